@@ -127,23 +127,34 @@ def block_range(self, start, end=None):
 
     return [self[height] for height in self.block_times[(self.block_times.index >= start_date) & (self.block_times.index < end)].height.tolist()]
 
+def warmup_tier_cached(warmup_path, tier):
+    # A marker only counts for the boot it was written in, since the page cache is empty after a reboot
+    try:
+        with open(os.path.join(warmup_path, tier)) as f:
+            marker_boot_id = f.read().strip()
+    except IOError:
+        return False
+    try:
+        with open("/proc/sys/kernel/random/boot_id") as f:
+            return marker_boot_id == f.read().strip()
+    except IOError:
+        return True
+
 old_init = Blockchain.__init__
 def new_init(self, loc):
     old_init(self, loc)
     self.block_times = None
     self.cpp = CPP(self)
-    ec2_instance_path = "/home/ubuntu/BlockSci/IS_EC2"
-    tx_heated_path = "/home/ubuntu/BlockSci/TX_DATA_HEATED"
-    scripts_heated_path = "/home/ubuntu/BlockSci/SCRIPT_DATA_HEATED"
-    index_heated_path = "/home/ubuntu/BlockSci/INDEX_DATA_HEATED"
-
-    if os.path.exists(ec2_instance_path):
-        if not os.path.exists(tx_heated_path):
-            print("Note: this appears to be a fresh instance. Transaction data has not yet been cached locally. Most queries might be slow. Caching is currently ongoing in the background, and usually takes 20 minutes.")
-        elif not os.path.exists(scripts_heated_path):
-            print("Note: this appears to be a fresh instance. Script data has not yet been cached locally. Some queries might be slow. Caching is currently ongoing in the background, and usually takes 1.5 hours.")
-        elif not os.path.exists(index_heated_path):
-            print("Note: this appears to be a fresh instance. Index data has not yet been cached locally. A few queries might be slow. Caching is currently ongoing in the background, and usually takes 3.5 hours.")
+    # blocksci_parser warmup marks each group of files once it has been read into the cache
+    warmup_path = os.path.join(loc, "warmup")
+
+    if os.path.isdir(warmup_path):
+        if not warmup_tier_cached(warmup_path, "tx"):
+            print("Note: transaction data has not yet been cached locally. Most queries might be slow until blocksci_parser warmup finishes.")
+        elif not warmup_tier_cached(warmup_path, "scripts"):
+            print("Note: script data has not yet been cached locally. Some queries might be slow until blocksci_parser warmup finishes.")
+        elif not warmup_tier_cached(warmup_path, "indexes"):
+            print("Note: index data has not yet been cached locally. A few queries might be slow until blocksci_parser warmup finishes.")
 Blockchain.__init__ = new_init
 Blockchain.range = block_range
 Blockchain.heights_to_dates = heights_to_dates
@@ -10,6 +10,7 @@
 #define blockchain_hpp
 
 #include "block.hpp"
+#include "chain_access.hpp"
 #include "transaction.hpp"
 #include <blocksci/scripts/script_access.hpp>
 #include <blocksci/scripts/script_variant.hpp>
@@ -182,6 +183,7 @@ namespace blocksci {
         std::enable_if_t<is_callable<MapFunc, std::vector<Block>>::value, ResultType>
         mapReduce(BlockHeight start, BlockHeight stop, MapFunc mapFunc, ReduceFunc reduceFunc) const {
             auto segments = segmentChain(*this, start, stop, std::thread::hardware_concurrency());
+            SequentialScanHint scanHint(*access.chain);
             return mapReduceBlocksImp<ResultType>(segments.begin(), segments.end(), mapFunc, reduceFunc);
         }
 
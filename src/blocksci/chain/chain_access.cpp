@@ -46,6 +46,11 @@ namespace blocksci {
     txHashesFile(config.txHashesFilePath()),
     blocksIgnored(config.blocksIgnored),
     errorOnReorg(config.errorOnReorg) {
+        txFile.setMappingPolicy(config.mapping.transactions);
+        sequenceFile.setMappingPolicy(config.mapping.transactions);
+        txHashesFile.setMappingPolicy(config.mapping.transactions);
+        blockFile.setMappingPolicy(config.mapping.blocks);
+        blockCoinbaseFile.setMappingPolicy(config.mapping.blocks);
         setup();
     }
     
@@ -57,6 +62,24 @@ namespace blocksci {
         setup();
     }
     
+    void ChainAccess::beginSequentialScan() {
+        std::lock_guard<std::mutex> lock(scanMutex);
+        if (activeScans++ == 0) {
+            txFile.setAccessPattern(AccessPattern::sequential);
+            sequenceFile.setAccessPattern(AccessPattern::sequential);
+            txHashesFile.setAccessPattern(AccessPattern::sequential);
+        }
+    }
+    
+    void ChainAccess::endSequentialScan() {
+        std::lock_guard<std::mutex> lock(scanMutex);
+        if (--activeScans == 0) {
+            txFile.setAccessPattern(AccessPattern::normal);
+            sequenceFile.setAccessPattern(AccessPattern::normal);
+            txHashesFile.setAccessPattern(AccessPattern::normal);
+        }
+    }
+    
     size_t ChainAccess::txCount() const {
         return _maxLoadedTx;
     }
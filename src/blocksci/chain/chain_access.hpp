@@ -17,6 +17,7 @@
 #include <blocksci/util/bitcoin_uint256.hpp>
 
 #include <memory>
+#include <mutex>
 
 namespace blocksci {
     
@@ -46,6 +47,9 @@ namespace blocksci {
         BlockHeight blocksIgnored;
         bool errorOnReorg;
         
+        std::mutex scanMutex;
+        int activeScans = 0;
+        
         void reorgCheck() const {
             if (errorOnReorg && lastBlockHash != *lastBlockHashDisk) {
                 throw ReorgException();
@@ -89,8 +93,28 @@ namespace blocksci {
         
         std::vector<unsigned char> getCoinbase(uint64_t offset) const;
         
+        // Switch the per transaction files to sequential readahead while at least one scan over the chain is
+        // running, and back to the default once the last one ends
+        void beginSequentialScan();
+        void endSequentialScan();
+        
         void reload();
     };
+    
+    class SequentialScanHint {
+        ChainAccess &access;
+    public:
+        explicit SequentialScanHint(ChainAccess &access_) : access(access_) {
+            access.beginSequentialScan();
+        }
+        
+        SequentialScanHint(const SequentialScanHint &) = delete;
+        SequentialScanHint &operator=(const SequentialScanHint &) = delete;
+        
+        ~SequentialScanHint() {
+            access.endSequentialScan();
+        }
+    };
 }
 
 #endif /* chain_access_hpp */
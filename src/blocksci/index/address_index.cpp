@@ -202,26 +202,34 @@ namespace blocksci {
         return std::vector<Address>{upAddresses.begin(), upAddresses.end()};
     }
     
-    void AddressIndex::addAddressNested(const Address &childAddress, const DedupAddress &parentAddress) {
+    std::string AddressIndex::nestedKey(const Address &childAddress, const DedupAddress &parentAddress) {
         std::array<rocksdb::Slice, 2> keyParts = {{
             rocksdb::Slice(reinterpret_cast<const char *>(&childAddress.scriptNum), sizeof(childAddress.scriptNum)),
             rocksdb::Slice(reinterpret_cast<const char *>(&parentAddress), sizeof(parentAddress))
         }};
         std::string sliceStr;
         rocksdb::Slice key{rocksdb::SliceParts{keyParts.data(), keyParts.size()}, &sliceStr};
-        auto nestedColumn = getNestedColumn(childAddress.type);
-        db->Put(rocksdb::WriteOptions{}, nestedColumn, key, rocksdb::Slice{});
+        return key.ToString();
     }
     
-    void AddressIndex::addAddressOutput(const Address &address, const blocksci::OutputPointer &pointer) {
+    std::string AddressIndex::outputKey(const Address &address, const blocksci::OutputPointer &pointer) {
         std::array<rocksdb::Slice, 2> keyParts = {{
             rocksdb::Slice(reinterpret_cast<const char *>(&address.scriptNum), sizeof(address.scriptNum)),
             rocksdb::Slice(reinterpret_cast<const char *>(&pointer), sizeof(pointer))
         }};
         std::string sliceStr;
         rocksdb::Slice key{rocksdb::SliceParts{keyParts.data(), keyParts.size()}, &sliceStr};
+        return key.ToString();
+    }
+    
+    void AddressIndex::addAddressNested(const Address &childAddress, const DedupAddress &parentAddress) {
+        auto nestedColumn = getNestedColumn(childAddress.type);
+        db->Put(rocksdb::WriteOptions{}, nestedColumn, nestedKey(childAddress, parentAddress), rocksdb::Slice{});
+    }
+    
+    void AddressIndex::addAddressOutput(const Address &address, const blocksci::OutputPointer &pointer) {
         auto outputColumn = getOutputColumn(address.type);
-        db->Put(rocksdb::WriteOptions{}, outputColumn, key, rocksdb::Slice{});
+        db->Put(rocksdb::WriteOptions{}, outputColumn, outputKey(address, pointer), rocksdb::Slice{});
     }
 }
 
@@ -28,17 +28,21 @@ namespace blocksci {
         
         std::unordered_set<Address> getPossibleNestedEquivalentUp(const Address &address) const;
         std::unordered_set<Address> getPossibleNestedEquivalentDown(const Address &address) const;
-        
+    
     public:
         
         AddressIndex(const std::string &path, bool readonly);
         ~AddressIndex();
-
+        
         bool checkIfExists(const Address &address) const;
         std::vector<OutputPointer> getOutputPointers(const Address &address) const;
         std::vector<Address> getPossibleNestedEquivalent(const Address &address) const;
         std::vector<Address> getIncludingMultisigs(const Address &searchAddress) const;
         
+        // Keys are the address's script number followed by the parent address or the output
+        static std::string nestedKey(const blocksci::Address &childAddress, const blocksci::DedupAddress &parentAddress);
+        static std::string outputKey(const blocksci::Address &address, const blocksci::OutputPointer &pointer);
+        
         void addAddressNested(const blocksci::Address &childAddress, const blocksci::DedupAddress &parentAddress);
         void addAddressOutput(const blocksci::Address &address, const blocksci::OutputPointer &pointer);
         
@@ -53,8 +57,20 @@ namespace blocksci {
             return db->NewIterator(rocksdb::ReadOptions(), getNestedColumn(type));
         }
         
-        void writeBatch(rocksdb::WriteBatch &batch) {
-            db->Write(rocksdb::WriteOptions(), &batch);
+        rocksdb::Status writeBatch(rocksdb::WriteBatch &batch) {
+            return db->Write(rocksdb::WriteOptions(), &batch);
+        }
+        
+        // Options the column family was opened with, for building SST files that match it
+        rocksdb::Options getOptions(rocksdb::ColumnFamilyHandle *column) {
+            return db->GetOptions(column);
+        }
+        
+        // Moves sorted SST files built for the column into the database
+        rocksdb::Status ingestFiles(rocksdb::ColumnFamilyHandle *column, const std::vector<std::string> &files) {
+            rocksdb::IngestExternalFileOptions options;
+            options.move_files = true;
+            return db->IngestExternalFile(column, files, options);
         }
     };
 }
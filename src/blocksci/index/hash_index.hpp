@@ -79,15 +79,32 @@ namespace blocksci {
             return columnHandles.back();
         }
         
-        void writeBatch(rocksdb::WriteBatch &batch) {
-            db->Write(rocksdb::WriteOptions(), &batch);
+        rocksdb::Status writeBatch(rocksdb::WriteBatch &batch) {
+            return db->Write(rocksdb::WriteOptions(), &batch);
         }
         
-        void deleteTx(const rocksdb::Slice &slice) {
-            db->Delete(rocksdb::WriteOptions(), getTxColumn(), slice);
+        // Flushes the write ahead log so every completed write survives a crash
+        rocksdb::Status syncWAL() {
+            return db->SyncWAL();
+        }
+        
+        // Options the column family was opened with, for building SST files that match it
+        rocksdb::Options getOptions(rocksdb::ColumnFamilyHandle *column) {
+            return db->GetOptions(column);
         }
         
+        // Moves sorted SST files built for the column into the database
+        rocksdb::Status ingestFiles(rocksdb::ColumnFamilyHandle *column, const std::vector<std::string> &files) {
+            rocksdb::IngestExternalFileOptions options;
+            options.move_files = true;
+            return db->IngestExternalFile(column, files, options);
+        }
         
+        void deleteTx(const rocksdb::Slice &slice) {
+            db->Delete(rocksdb::WriteOptions(), getTxColumn(), slice);
+        }
+    
+    
     private:
         rocksdb::DB *db;
         std::vector<rocksdb::ColumnFamilyHandle *> columnHandles;
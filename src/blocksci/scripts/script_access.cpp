@@ -14,7 +14,27 @@ namespace blocksci {
     ScriptAccess::ScriptAccess(const DataConfiguration &config_) :
     scriptFiles(blocksci::apply(DedupAddressInfoList(), [&] (auto tag) {
         return std::make_unique<ScriptFile<tag.value>>(config_.scriptsDirectory()/ std::string{dedupAddressName(tag)});
-    })), config(config_) {}
+    })), config(config_) {
+        // Queries look scripts up by address number in whatever order the chain references them
+        for_each(scriptFiles, [&](auto& file) -> decltype(auto) {
+            file->setAccessPattern(AccessPattern::random);
+            file->setMappingPolicy(config_.mapping.scripts);
+        });
+    }
+    
+    void ScriptAccess::beginSequentialScan() {
+        std::lock_guard<std::mutex> lock(scanMutex);
+        if (activeScans++ == 0) {
+            for_each(scriptFiles, [&](auto& file) -> decltype(auto) { file->setAccessPattern(AccessPattern::sequential); });
+        }
+    }
+    
+    void ScriptAccess::endSequentialScan() {
+        std::lock_guard<std::mutex> lock(scanMutex);
+        if (--activeScans == 0) {
+            for_each(scriptFiles, [&](auto& file) -> decltype(auto) { file->setAccessPattern(AccessPattern::random); });
+        }
+    }
     
     void ScriptAccess::reload() {
         for_each(scriptFiles, [&](auto& file) -> decltype(auto) { file->reload(); });
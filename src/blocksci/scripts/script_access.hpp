@@ -18,6 +18,8 @@
 
 #include <mpark/variant.hpp>
 
+#include <mutex>
+
 namespace blocksci {
     template<typename T>
     struct ScriptFileType;
@@ -47,6 +49,8 @@ namespace blocksci {
         using ScriptFilesTuple = to_dedup_address_tuple_t<ScriptFilePtr>;
         ScriptFilesTuple scriptFiles;
         
+        std::mutex scanMutex;
+        int activeScans = 0;
         
     public:
         ScriptAccess(const DataConfiguration &config);
@@ -83,8 +87,28 @@ namespace blocksci {
         
         size_t totalAddressCount() const;
         
+        // Switch the script files from random to sequential readahead while at least one pass reads the scripts
+        // in address order, such as an index update, and back once the last one ends
+        void beginSequentialScan();
+        void endSequentialScan();
+        
         void reload();
     };
+    
+    class ScriptScanHint {
+        ScriptAccess &access;
+    public:
+        explicit ScriptScanHint(ScriptAccess &access_) : access(access_) {
+            access.beginSequentialScan();
+        }
+        
+        ScriptScanHint(const ScriptScanHint &) = delete;
+        ScriptScanHint &operator=(const ScriptScanHint &) = delete;
+        
+        ~ScriptScanHint() {
+            access.endSequentialScan();
+        }
+    };
 
 }
 
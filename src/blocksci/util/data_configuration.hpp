@@ -10,6 +10,7 @@
 #define data_configuration_h
 
 #include <blocksci/blocksci_fwd.hpp>
+#include <blocksci/util/file_mapper_fwd.hpp>
 #include <boost/filesystem/path.hpp>
 
 #include <string>
@@ -19,6 +20,15 @@ namespace blocksci {
     
     static constexpr int dataVersion = 4;
     
+    // How each class of data file is mapped when the chain is opened
+    struct MappingPolicies {
+        // Transaction, sequence and hash files, which full scans of the chain walk through
+        MappingPolicy transactions = MappingPolicy::lazy;
+        // Block and coinbase files
+        MappingPolicy blocks = MappingPolicy::lazy;
+        MappingPolicy scripts = MappingPolicy::lazy;
+    };
+    
     struct DataConfiguration {
         DataConfiguration() {}
         explicit DataConfiguration(const boost::filesystem::path &dataDirectory, bool errorOnReorg, BlockHeight blocksIgnored);
@@ -32,6 +42,8 @@ namespace blocksci {
         
         boost::filesystem::path dataDirectory;
         
+        MappingPolicies mapping;
+        
         bool isNull() const {
             return dataDirectory.empty();
         }
@@ -76,6 +88,11 @@ namespace blocksci {
             return chainDirectory()/"scriptTypeCount.txt";
         }
         
+        // Holds a marker for each group of files blocksci_parser warmup has finished reading
+        boost::filesystem::path warmupDirectory() const {
+            return dataDirectory/"warmup";
+        }
+        
         bool operator==(const DataConfiguration &other) const {
             return dataDirectory == other.dataDirectory;
         }
@@ -11,6 +11,9 @@
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 using namespace blocksci;
 
 namespace {
@@ -24,9 +27,52 @@ namespace {
         assert(false);
         return boost::iostreams::mapped_file::mapmode::readonly;
     }
+    
+    int getAdvice(AccessPattern pattern) {
+        switch (pattern) {
+            case AccessPattern::normal:
+                return MADV_NORMAL;
+            case AccessPattern::sequential:
+                return MADV_SEQUENTIAL;
+            case AccessPattern::random:
+                return MADV_RANDOM;
+        }
+        assert(false);
+        return MADV_NORMAL;
+    }
+    
+    // madvise needs a page aligned start, so the range is widened down to the page holding offset. Failures are
+    // ignored since the advice is only a hint
+    void adviseRange(const char *data, size_t mappedSize, OffsetType offset, size_t length, int advice) {
+        if (data == nullptr || offset >= mappedSize || length == 0) {
+            return;
+        }
+        static const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        auto end = length < mappedSize - offset ? offset + length : mappedSize;
+        auto begin = reinterpret_cast<uintptr_t>(data + offset) & ~(pageSize - 1);
+        auto stop = reinterpret_cast<uintptr_t>(data + end);
+        madvise(reinterpret_cast<void *>(begin), stop - begin, advice);
+    }
+    
+    // Same effect as mapping with MAP_POPULATE, which boost's mapped_file has no way to pass
+    void populate(const char *data, size_t mappedSize) {
+#ifdef MADV_POPULATE_READ
+        if (madvise(const_cast<char *>(data), mappedSize, MADV_POPULATE_READ) == 0) {
+            return;
+        }
+#endif
+        // Kernels before 5.14 have no populate advice, so queue readahead for the file and fault every page in
+        adviseRange(data, mappedSize, 0, mappedSize, MADV_WILLNEED);
+        static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        volatile char sink = 0;
+        for (size_t offset = 0; offset < mappedSize; offset += pageSize) {
+            sink = data[offset];
+        }
+        (void)sink;
+    }
 }
 
-SimpleFileMapperBase::SimpleFileMapperBase(boost::filesystem::path path_, AccessMode mode) : fileEnd(0), path(path_), fileMode(mode) {
+SimpleFileMapperBase::SimpleFileMapperBase(boost::filesystem::path path_, AccessMode mode) : constData(nullptr), accessPattern(AccessPattern::normal), mappingPolicy(MappingPolicy::lazy), fileEnd(0), path(path_), fileMode(mode) {
     path += ".dat";
     
     if (boost::filesystem::exists(path)) {
@@ -39,6 +85,55 @@ void SimpleFileMapperBase::openFile(size_t size) {
     if (fileEnd != 0) {
         file.open(path, getMapMode(fileMode));
         constData = file.const_data();
+        applyAdvice();
+    }
+}
+
+void SimpleFileMapperBase::applyAdvice() {
+    if (file.is_open()) {
+        constData = file.const_data();
+        // A new mapping starts out with normal readahead
+        if (accessPattern != AccessPattern::normal) {
+            adviseRange(constData, fileEnd, 0, fileEnd, getAdvice(accessPattern));
+        }
+        switch (mappingPolicy) {
+            case MappingPolicy::lazy:
+                break;
+            case MappingPolicy::populate:
+                populate(constData, fileEnd);
+                break;
+            case MappingPolicy::hugePages:
+                adviseRange(constData, fileEnd, 0, fileEnd, MADV_HUGEPAGE);
+                break;
+        }
+    }
+}
+
+void SimpleFileMapperBase::setAccessPattern(AccessPattern pattern) {
+    accessPattern = pattern;
+    // Normal is advised as well since the mapping keeps the advice set before, which would otherwise leave a
+    // finished scan dropping pages behind it
+    if (file.is_open()) {
+        adviseRange(constData, fileEnd, 0, fileEnd, getAdvice(accessPattern));
+    }
+}
+
+void SimpleFileMapperBase::setMappingPolicy(MappingPolicy policy) {
+    if (policy != mappingPolicy) {
+        mappingPolicy = policy;
+        applyAdvice();
+    }
+}
+
+void SimpleFileMapperBase::willNeed(OffsetType offset, size_t length) const {
+    if (file.is_open()) {
+        adviseRange(constData, fileEnd, offset, length, MADV_WILLNEED);
+    }
+}
+
+void SimpleFileMapperBase::dontNeed(OffsetType offset, size_t length) const {
+    if (file.is_open()) {
+        adviseRange(constData, fileEnd, offset, length, MADV_DONTNEED);
     }
 }
 
@@ -139,6 +234,7 @@ void SimpleFileMapper<AccessMode::readwrite>::clearBuffer() {
         memcpy(file.data() + fileEnd, buffer.data(), buffer.size());
         fileEnd += buffer.size();
         buffer.clear();
+        applyAdvice();
     }
 }
 
@@ -18,6 +18,7 @@
 #include <range/v3/utility/optional.hpp>
 
 #include <array>
+#include <utility>
 #include <vector>
 
 namespace blocksci {
@@ -54,12 +55,17 @@ namespace blocksci {
         using FileType = boost::iostreams::mapped_file;
     private:
         const char *constData;
+        AccessPattern accessPattern;
+        MappingPolicy mappingPolicy;
         
         void openFile(size_t size);
         
     protected:
         FileType file;
         size_t fileEnd;
+        
+        // Mapping the file again discards the advice on the old mapping
+        void applyAdvice();
     public:
         boost::filesystem::path path;
         AccessMode fileMode;
@@ -81,6 +87,20 @@ namespace blocksci {
         }
         
         size_t fileSize() const;
+        
+        // Kept across reloads, so it only needs to be set once for the lifetime of the mapper. Setting normal
+        // replaces any earlier advice on the current mapping, so a sequential scan can be ended
+        void setAccessPattern(AccessPattern pattern);
+        
+        // Also kept across reloads. A populated file is read again in full every time it is remapped
+        void setMappingPolicy(MappingPolicy policy);
+        
+        // Starts reading the given byte range into the page cache in the background
+        void willNeed(OffsetType offset, size_t length) const;
+        
+        // Releases the given byte range from this mapping. The file data stays in the page cache until the kernel
+        // needs the memory, but it is no longer counted against this process
+        void dontNeed(OffsetType offset, size_t length) const;
     };
     
     template <>
@@ -305,6 +325,22 @@ namespace blocksci {
             dataFile.truncate(getPos(index));
         }
         
+        void setAccessPattern(AccessPattern pattern) {
+            dataFile.setAccessPattern(pattern);
+        }
+        
+        void setMappingPolicy(MappingPolicy policy) {
+            dataFile.setMappingPolicy(policy);
+        }
+        
+        void willNeed(size_t beginIndex, size_t endIndex) const {
+            dataFile.willNeed(getPos(beginIndex), getPos(endIndex) - getPos(beginIndex));
+        }
+        
+        void dontNeed(size_t beginIndex, size_t endIndex) const {
+            dataFile.dontNeed(getPos(beginIndex), getPos(endIndex) - getPos(beginIndex));
+        }
+        
         template<typename Test>
         std::vector<uint32_t> findAll(Test test) const {
             auto itemCount = size();
@@ -397,6 +433,19 @@ namespace blocksci {
             return offset;
         }
         
+        // Data offsets spanned by the first elements of the entries in [beginIndex, endIndex). Elements written
+        // later for an entry through an update can lie outside of it
+        std::pair<OffsetType, OffsetType> dataRange(uint32_t beginIndex, uint32_t endIndex) const {
+            auto entryCount = size();
+            endIndex = static_cast<uint32_t>(std::min<size_t>(endIndex, entryCount));
+            if (beginIndex >= endIndex) {
+                return {0, 0};
+            }
+            auto begin = getOffset(beginIndex);
+            auto end = endIndex < entryCount ? getOffset(endIndex) : dataFile.size();
+            return {begin, end};
+        }
+        
         friend ranges::range_access;
         
         struct cursor {
@@ -497,6 +546,28 @@ namespace blocksci {
             dataFile.truncate(dataFile.size() + dataSize);
         }
         
+        void setAccessPattern(AccessPattern pattern) {
+            indexFile.setAccessPattern(pattern);
+            dataFile.setAccessPattern(pattern);
+        }
+        
+        void setMappingPolicy(MappingPolicy policy) {
+            indexFile.setMappingPolicy(policy);
+            dataFile.setMappingPolicy(policy);
+        }
+        
+        void willNeed(uint32_t beginIndex, uint32_t endIndex) const {
+            indexFile.willNeed(beginIndex, endIndex);
+            auto range = dataRange(beginIndex, endIndex);
+            dataFile.willNeed(range.first, range.second - range.first);
+        }
+        
+        void dontNeed(uint32_t beginIndex, uint32_t endIndex) const {
+            auto range = dataRange(beginIndex, endIndex);
+            dataFile.dontNeed(range.first, range.second - range.first);
+            indexFile.dontNeed(beginIndex, endIndex);
+        }
+        
         void write(const nth_element<0> &t) {
             writeNewImp(&t, sizeof(t));
         }
@@ -13,6 +13,22 @@ namespace blocksci {
         readonly, readwrite
     };
     
+    // How a mapped file is about to be read, passed on to the kernel to size its readahead
+    enum class AccessPattern {
+        normal, sequential, random
+    };
+    
+    // How the pages of a mapped file are brought into memory
+    enum class MappingPolicy {
+        // Each page is faulted in on first access
+        lazy,
+        // The whole file is read and its page tables filled as soon as it is mapped
+        populate,
+        // Transparent huge pages where the kernel supports them for file mappings, so a scan takes one TLB
+        // entry per 2MB instead of per 4KB
+        hugePages
+    };
+    
     template<AccessMode mode = AccessMode::readonly>
     struct SimpleFileMapper;
     
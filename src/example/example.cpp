@@ -98,6 +98,11 @@ std::vector<R> mapParallel(const std::vector<T> &input, F fn) {
 int main(int argc, const char * argv[]) {
 //    assert(argc == 2);
     
+    if (argc == 3 && std::string(argv[2]) == "mapping") {
+        compareMappingPolicies(argv[1]);
+        return 0;
+    }
+    
     Blockchain chain(argv[1]);
     Address multi(509, AddressType::NONSTANDARD, *chain.access);
     auto outs = multi.getOutputs(true, true);
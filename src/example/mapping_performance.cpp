@@ -0,0 +1,113 @@
+//
+//  mapping_performance.cpp
+//  blocksci_devel
+//
+
+#include "performance.hpp"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+using namespace blocksci;
+
+namespace {
+    // Counts data TLB misses of this thread and every thread it starts while counting, where the kernel
+    // permits unprivileged perf events
+    class TLBMissCounter {
+        int fd;
+    
+    public:
+        TLBMissCounter() {
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.size = sizeof(attr);
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+        
+        TLBMissCounter(const TLBMissCounter &) = delete;
+        TLBMissCounter &operator=(const TLBMissCounter &) = delete;
+        
+        ~TLBMissCounter() {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        
+        bool available() const {
+            return fd >= 0;
+        }
+        
+        void start() {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        
+        // Counts of threads started while counting are only added once they exit, which mapReduce waits for
+        uint64_t stop() {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t count = 0;
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+                return 0;
+            }
+            return count;
+        }
+    };
+    
+    template <typename Func>
+    void timeScan(const char *policyName, const char *scanName, Func func) {
+        TLBMissCounter counter;
+        if (counter.available()) {
+            counter.start();
+        }
+        auto begin = std::chrono::steady_clock::now();
+        func();
+        auto endTime = std::chrono::steady_clock::now();
+        auto timeSecs = std::chrono::duration_cast<std::chrono::microseconds>(endTime - begin).count() / 1000000.0;
+        std::cout << std::left << std::setw(12) << policyName << std::setw(14) << scanName << std::setw(12) << timeSecs;
+        if (counter.available()) {
+            std::cout << counter.stop();
+        } else {
+            std::cout << "n/a";
+        }
+        std::cout << std::endl;
+    }
+}
+
+void compareMappingPolicies(const std::string &dataDirectory) {
+    std::pair<const char *, MappingPolicy> policies[] = {
+        {"lazy", MappingPolicy::lazy},
+        {"populate", MappingPolicy::populate},
+        {"huge pages", MappingPolicy::hugePages}
+    };
+    
+    // Read everything once first so every policy is measured against the same warm page cache
+    {
+        Blockchain chain(dataDirectory);
+        maxSizeTx2(chain, 0, static_cast<uint32_t>(static_cast<int>(chain.size())));
+    }
+    
+    std::cout << std::left << std::setw(12) << "policy" << std::setw(14) << "scan" << std::setw(12) << "seconds" << "dTLB misses" << std::endl;
+    for (auto &policy : policies) {
+        DataConfiguration config{dataDirectory, true, BlockHeight{0}};
+        config.mapping.transactions = policy.second;
+        
+        std::unique_ptr<Blockchain> chain;
+        timeScan(policy.first, "open", [&] { chain = std::make_unique<Blockchain>(config); });
+        auto stop = static_cast<uint32_t>(static_cast<int>(chain->size()));
+        timeScan(policy.first, "unspentSums2", [&] { unspentSums2(*chain, 0, stop); });
+        timeScan(policy.first, "maxSizeTx2", [&] { maxSizeTx2(*chain, 0, stop); });
+    }
+}
@@ -11,6 +11,7 @@
 
 #include <blocksci/blocksci.hpp>
 
+#include <string>
 #include <unordered_map>
 
 std::vector<uint64_t> unspentSums1(blocksci::Blockchain &chain, uint32_t start, uint32_t stop);
@@ -25,4 +26,7 @@ std::unordered_map<uint64_t, uint64_t> getOutputDistribution2(blocksci::Blockcha
 uint64_t maxValOutput1(blocksci::Blockchain &chain, uint32_t start, uint32_t stop);
 uint64_t maxValOutput2(blocksci::Blockchain &chain, uint32_t start, uint32_t stop);
 
+// Times unspentSums2 and maxSizeTx2 with the transaction files mapped under each mapping policy
+void compareMappingPolicies(const std::string &dataDirectory);
+
 #endif /* performance_hpp */
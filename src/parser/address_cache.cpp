@@ -0,0 +1,108 @@
+//
+//  address_cache.cpp
+//  blocksci_parser
+//
+
+#include "address_cache.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+namespace {
+    struct SerializedEntry {
+        blocksci::uint160 hash;
+        uint32_t addressNum;
+    };
+}
+
+constexpr uint64_t AddressCache::bytesPerEntry;
+
+AddressCache::AddressCache(size_t capacity) : positions(blocksci::uint160S("FFFFFFFFFFFFFFFFFFFF"), blocksci::uint160S("AAAAAAAAAAAAAAAAAA")), maxEntries(std::max(capacity, size_t{1})) {}
+
+bool AddressCache::find(const blocksci::uint160 &hash, uint32_t &addressNum) {
+    auto it = positions.find(hash);
+    if (it == positions.end()) {
+        cacheStats.misses++;
+        return false;
+    }
+    auto &entry = entries[it->second];
+    entry.referenced = true;
+    addressNum = entry.addressNum;
+    cacheStats.hits++;
+    return true;
+}
+
+void AddressCache::add(const blocksci::uint160 &hash, uint32_t addressNum) {
+    if (positions.find(hash) != positions.end()) {
+        return;
+    }
+    if (entries.size() < maxEntries) {
+        positions.add(hash, static_cast<uint32_t>(entries.size()));
+        entries.push_back({hash, addressNum, false});
+        return;
+    }
+    while (entries[hand].referenced) {
+        entries[hand].referenced = false;
+        hand = (hand + 1) % entries.size();
+    }
+    positions.erase(entries[hand].hash);
+    positions.add(hash, static_cast<uint32_t>(hand));
+    entries[hand] = {hash, addressNum, false};
+    hand = (hand + 1) % entries.size();
+    cacheStats.evictions++;
+}
+
+void AddressCache::rebuild(std::vector<Entry> newEntries) {
+    if (newEntries.size() > maxEntries) {
+        newEntries.resize(maxEntries);
+    }
+    entries = std::move(newEntries);
+    positions.clear_no_resize();
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        positions.add(entries[i].hash, i);
+    }
+    hand = 0;
+}
+
+void AddressCache::unserialize(const boost::filesystem::path &path, const boost::filesystem::path &legacyPath) {
+    std::vector<Entry> loaded;
+    std::ifstream file{path.native(), std::ios::binary};
+    if (file.is_open()) {
+        uint64_t count = 0;
+        file.read(reinterpret_cast<char *>(&count), sizeof(count));
+        loaded.reserve(std::min<uint64_t>(count, maxEntries));
+        SerializedEntry entry;
+        for (uint64_t i = 0; i < count && loaded.size() < maxEntries; i++) {
+            if (!file.read(reinterpret_cast<char *>(&entry), sizeof(entry))) {
+                throw std::runtime_error("Unexpected end of address cache file " + path.string());
+            }
+            loaded.push_back({entry.hash, entry.addressNum, false});
+        }
+    } else if (boost::filesystem::exists(legacyPath)) {
+        SerializableMap<blocksci::uint160, uint32_t> legacyMap{blocksci::uint160S("FFFFFFFFFFFFFFFFFFFF"), blocksci::uint160S("AAAAAAAAAAAAAAAAAA")};
+        legacyMap.unserialize(legacyPath.native());
+        loaded.reserve(std::min<size_t>(legacyMap.size(), maxEntries));
+        for (auto it = legacyMap.begin(); it != legacyMap.end() && loaded.size() < maxEntries; ++it) {
+            loaded.push_back({it->first, it->second, false});
+        }
+    }
+    rebuild(std::move(loaded));
+}
+
+void AddressCache::serialize(const boost::filesystem::path &path) const {
+    std::ofstream file{path.native(), std::ios::binary};
+    uint64_t count = entries.size();
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    for (auto &entry : entries) {
+        SerializedEntry serialized{entry.hash, entry.addressNum};
+        file.write(reinterpret_cast<const char *>(&serialized), sizeof(serialized));
+    }
+}
+
+std::ostream &operator<<(std::ostream &os, const AddressCache &cache) {
+    auto &stats = cache.stats();
+    os << cache.size() << "/" << cache.capacity() << " entries, " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions";
+    return os;
+}
@@ -0,0 +1,84 @@
+//
+//  address_cache.hpp
+//  blocksci_parser
+//
+
+#ifndef address_cache_hpp
+#define address_cache_hpp
+
+#include "serializable_map.hpp"
+
+#include <blocksci/util/bitcoin_uint256.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <ostream>
+#include <vector>
+
+// Fixed capacity map from address hashes to address numbers for addresses that were used more than once.
+// Once full, entries are evicted in CLOCK order: every hit marks an entry as referenced and the clock hand
+// skips referenced entries once, clearing the mark, before it evicts one. Evicted addresses are still found
+// in the hash index, so the capacity only bounds memory and never affects correctness.
+class AddressCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+    
+    // Approximate memory used per entry including the hash table overhead
+    static constexpr uint64_t bytesPerEntry = 80;
+    
+    explicit AddressCache(size_t capacity);
+    
+    bool find(const blocksci::uint160 &hash, uint32_t &addressNum);
+    void add(const blocksci::uint160 &hash, uint32_t addressNum);
+    
+    // Removes every entry for which pred(addressNum) is true
+    template <typename Pred>
+    void eraseIf(Pred pred) {
+        std::vector<Entry> kept;
+        for (auto &entry : entries) {
+            if (!pred(entry.addressNum)) {
+                kept.push_back(entry);
+            }
+        }
+        rebuild(std::move(kept));
+    }
+    
+    size_t size() const {
+        return entries.size();
+    }
+    
+    size_t capacity() const {
+        return maxEntries;
+    }
+    
+    const Stats &stats() const {
+        return cacheStats;
+    }
+    
+    // Loads a cache written by serialize, or the unbounded map used before the cache existed at legacyPath
+    void unserialize(const boost::filesystem::path &path, const boost::filesystem::path &legacyPath);
+    void serialize(const boost::filesystem::path &path) const;
+    
+private:
+    struct Entry {
+        blocksci::uint160 hash;
+        uint32_t addressNum;
+        bool referenced;
+    };
+    
+    SerializableMap<blocksci::uint160, uint32_t> positions;
+    std::vector<Entry> entries;
+    size_t maxEntries;
+    size_t hand = 0;
+    Stats cacheStats;
+    
+    void rebuild(std::vector<Entry> newEntries);
+};
+
+std::ostream &operator<<(std::ostream &os, const AddressCache &cache);
+
+#endif /* address_cache_hpp */
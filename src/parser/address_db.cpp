@@ -34,45 +34,80 @@ AddressDB::AddressDB(const ParserConfigurationBase &config_, const std::string &
 
 void AddressDB::tearDown() {}
 
-void AddressDB::processTx(const blocksci::Transaction &tx) {
-    std::unordered_set<Address> addresses;
-    std::function<bool(const blocksci::Address &)> visitFunc = [&](const blocksci::Address &a) {
-        if (dedupType(a.type) == DedupAddressType::SCRIPTHASH) {
-            script::ScriptHash scriptHash(a.scriptNum, tx.getAccess());
-            if (scriptHash.getTxRevealedIndex() == tx.txNum) {
-                auto wrapped = *scriptHash.getWrappedAddress();
-                db.addAddressNested(wrapped, DedupAddress{a.scriptNum, DedupAddressType::SCRIPTHASH});
-                return true;
-            } else {
-                return false;
+namespace {
+    template <typename Index>
+    void indexTx(const blocksci::Transaction &tx, Index &index) {
+        std::function<bool(const blocksci::Address &)> visitFunc = [&](const blocksci::Address &a) {
+            if (dedupType(a.type) == DedupAddressType::SCRIPTHASH) {
+                script::ScriptHash scriptHash(a.scriptNum, tx.getAccess());
+                if (scriptHash.getTxRevealedIndex() == tx.txNum) {
+                    auto wrapped = *scriptHash.getWrappedAddress();
+                    index.addAddressNested(wrapped, DedupAddress{a.scriptNum, DedupAddressType::SCRIPTHASH});
+                    return true;
+                } else {
+                    return false;
+                }
             }
+            return false;
+        };
+        for (auto input : tx.inputs()) {
+            visit(input.getAddress(), visitFunc);
+        }
+        
+        for (auto output : tx.outputs()) {
+            index.addAddressOutput(output.getAddress(), output.pointer);
         }
-        return false;
-    };
-    for (auto input : tx.inputs()) {
-        visit(input.getAddress(), visitFunc);
-    }
-    
-    for (auto output : tx.outputs()) {
-        db.addAddressOutput(output.getAddress(), output.pointer);
     }
 }
 
-void AddressDB::rollback(const blocksci::State &state) {
+void AddressDB::processTx(const blocksci::Transaction &tx) {
+    indexTx(tx, db);
+}
+
+void AddressDB::BulkWriter::addAddressNested(const blocksci::Address &childAddress, const blocksci::DedupAddress &parentAddress) {
+    auto key = AddressIndex::nestedKey(childAddress, parentAddress);
+    writer.add(AddressType::size + static_cast<size_t>(childAddress.type), key.data(), nullptr);
+}
+
+void AddressDB::BulkWriter::addAddressOutput(const blocksci::Address &address, const blocksci::OutputPointer &pointer) {
+    auto key = AddressIndex::outputKey(address, pointer);
+    writer.add(static_cast<size_t>(address.type), key.data(), nullptr);
+}
+
+std::vector<BulkIndexColumn> AddressDB::bulkColumns() {
+    std::vector<BulkIndexColumn> columns(AddressType::size * 2);
     for_each(AddressInfoList(), [&](auto type) {
-        auto column = db.getOutputColumn(type);
-        auto it = db.getOutputIterator(type);
-        rocksdb::WriteBatch batch;
-        for (it->SeekToFirst(); it->Valid(); it->Next()) {
-            auto key = it->key();
-            key.remove_prefix(sizeof(uint32_t));
-            OutputPointer outPoint;
-            memcpy(&outPoint, key.data(), sizeof(outPoint));
-            if (outPoint.txNum >= state.scriptCounts[static_cast<size_t>(blocksci::DedupAddressType::SCRIPTHASH)]) {
-                batch.Delete(column, it->key());
-            }
-        }
-        assert(it->status().ok()); // Check for any errors found during the scan
-        delete it;
+        auto outputColumn = db.getOutputColumn(type);
+        auto nestedColumn = db.getNestedColumn(type);
+        columns[static_cast<size_t>(type)] = {outputColumn, sizeof(uint32_t) + sizeof(OutputPointer), 0, db.getOptions(outputColumn)};
+        columns[AddressType::size + static_cast<size_t>(type)] = {nestedColumn, sizeof(uint32_t) + sizeof(DedupAddress), 0, db.getOptions(nestedColumn)};
+    });
+    return columns;
+}
+
+void AddressDB::bulkProcessTx(const blocksci::Transaction &tx, BulkRunWriter &writer) {
+    BulkWriter bulkWriter(writer);
+    indexTx(tx, bulkWriter);
+}
+
+void AddressDB::RollbackWriter::addAddressNested(const blocksci::Address &childAddress, const blocksci::DedupAddress &parentAddress) {
+    batch.Delete(db.getNestedColumn(childAddress.type), AddressIndex::nestedKey(childAddress, parentAddress));
+}
+
+void AddressDB::RollbackWriter::addAddressOutput(const blocksci::Address &address, const blocksci::OutputPointer &pointer) {
+    batch.Delete(db.getOutputColumn(address.type), AddressIndex::outputKey(address, pointer));
+}
+
+void AddressDB::rollback(const blocksci::State &state) {
+    rocksdb::WriteBatch batch;
+    RollbackWriter rollbackWriter(db, batch);
+    visitRolledBack(state, [&](const blocksci::Transaction &tx) {
+        indexTx(tx, rollbackWriter);
+    }, [&](uint32_t scriptNum, const blocksci::DataAccess &access) {
+        addMultisigAddresses(scriptNum, access, rollbackWriter);
     });
+    auto status = db.writeBatch(batch);
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to roll back address index: " + status.ToString());
+    }
 }
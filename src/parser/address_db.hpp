@@ -17,6 +17,8 @@
 #include <blocksci/address/address_fwd.hpp>
 #include <blocksci/scripts/multisig_script.hpp>
 
+#include <rocksdb/write_batch.h>
+
 #include <unordered_map>
 
 class AddressDB;
@@ -31,6 +33,36 @@ struct ParserIndexScriptInfo<AddressDB, blocksci::DedupAddressType::MULTISIG> :
 class AddressDB : public ParserIndex<AddressDB> {
     blocksci::AddressIndex db;
     
+    // Stands in for the AddressIndex when entries are built in bulk. Output columns come first, followed by
+    // the nested columns, both in AddressType order
+    class BulkWriter {
+        BulkRunWriter &writer;
+    public:
+        explicit BulkWriter(BulkRunWriter &writer_) : writer(writer_) {}
+        
+        void addAddressNested(const blocksci::Address &childAddress, const blocksci::DedupAddress &parentAddress);
+        void addAddressOutput(const blocksci::Address &address, const blocksci::OutputPointer &pointer);
+    };
+    
+    // Deletes the keys it is given instead of adding them
+    class RollbackWriter {
+        blocksci::AddressIndex &db;
+        rocksdb::WriteBatch &batch;
+    public:
+        RollbackWriter(blocksci::AddressIndex &db_, rocksdb::WriteBatch &batch_) : db(db_), batch(batch_) {}
+        
+        void addAddressNested(const blocksci::Address &childAddress, const blocksci::DedupAddress &parentAddress);
+        void addAddressOutput(const blocksci::Address &address, const blocksci::OutputPointer &pointer);
+    };
+    
+    template <typename Index>
+    static void addMultisigAddresses(uint32_t equivNum, const blocksci::DataAccess &access, Index &index) {
+        blocksci::script::Multisig multisig(equivNum, access);
+        for (const auto &address : multisig.getAddresses()) {
+            index.addAddressNested(address, blocksci::DedupAddress{equivNum, blocksci::DedupAddressType::MULTISIG});
+        }
+    }
+    
 public:
     
     
@@ -42,16 +74,29 @@ public:
     template<blocksci::DedupAddressType::Enum type>
     void processScript(uint32_t, const blocksci::DataAccess &);
     
+    std::vector<BulkIndexColumn> bulkColumns();
+    void bulkProcessTx(const blocksci::Transaction &tx, BulkRunWriter &writer);
+    
+    template<blocksci::DedupAddressType::Enum type>
+    void bulkProcessScript(uint32_t, const blocksci::DataAccess &, BulkRunWriter &);
+    
+    void ingest(BulkIndexBuilder &builder) {
+        builder.ingest(db);
+    }
+    
     void rollback(const blocksci::State &state);
     void tearDown() override;
 };
 
 template<>
 inline void AddressDB::processScript<blocksci::DedupAddressType::MULTISIG>(uint32_t equivNum, const blocksci::DataAccess &access) {
-    blocksci::script::Multisig multisig(equivNum, access);
-    for (const auto &address : multisig.getAddresses()) {
-        db.addAddressNested(address, blocksci::DedupAddress{equivNum, blocksci::DedupAddressType::MULTISIG});
-    }
+    addMultisigAddresses(equivNum, access, db);
+}
+
+template<>
+inline void AddressDB::bulkProcessScript<blocksci::DedupAddressType::MULTISIG>(uint32_t equivNum, const blocksci::DataAccess &access, BulkRunWriter &writer) {
+    BulkWriter bulkWriter(writer);
+    addMultisigAddresses(equivNum, access, bulkWriter);
 }
 
 #endif /* address_db_h */
@@ -15,6 +15,7 @@
 
 
 #include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
 
 #include <iostream>
 
@@ -22,17 +23,40 @@ using namespace blocksci;
 
 namespace {
     static constexpr auto multiAddressFileName = "multi";
+    static constexpr auto multiAddressCacheFileName = "multiCache";
     static constexpr auto bloomFileName = "bloom_";
     static constexpr auto scriptCountsFileName = "scriptCounts.txt";
+    
+    // Address types without an expected count still get a small cache
+    static constexpr size_t minimumCacheEntries = 1 << 16;
+    
+    boost::filesystem::path multiAddressPath(const boost::filesystem::path &path, const char *fileName, blocksci::DedupAddressType::Enum type) {
+        std::stringstream ss;
+        ss << fileName << "_" << dedupAddressName(type) << ".dat";
+        return path/ss.str();
+    }
+    
+    template <blocksci::DedupAddressType::Enum type>
+    size_t cacheCapacity(uint64_t cacheMemory) {
+        uint64_t totalCount = 0;
+        blocksci::for_each(blocksci::DedupAddressInfoList(), [&](auto tag) {
+            totalCount += startingCount<tag>;
+        });
+        auto share = static_cast<double>(startingCount<type>) / static_cast<double>(totalCount);
+        auto capacity = static_cast<size_t>(share * static_cast<double>(cacheMemory / AddressCache::bytesPerEntry));
+        return std::max(capacity, minimumCacheEntries);
+    }
 }
 
-AddressState::AddressState(const boost::filesystem::path &path_, const boost::filesystem::path &hashIndexPath) : path(path_), db(hashIndexPath.native(), false), addressBloomFilters(blocksci::apply(blocksci::DedupAddressInfoList(), [&] (auto tag) {
+constexpr uint64_t AddressState::defaultCacheMemory;
+
+AddressState::AddressState(const boost::filesystem::path &path_, const boost::filesystem::path &hashIndexPath, uint64_t cacheMemory) : path(path_), db(hashIndexPath.native(), false), multiAddressMaps(blocksci::apply(blocksci::DedupAddressInfoList(), [&] (auto tag) {
+    return AddressMap<tag>{cacheCapacity<tag>(cacheMemory)};
+})), addressBloomFilters(blocksci::apply(blocksci::DedupAddressInfoList(), [&] (auto tag) {
     return AddressBloomFilter<tag>{path/std::string(bloomFileName)};
 }))  {
     blocksci::for_each(multiAddressMaps, [&](auto &multiAddressMap) {
-        std::stringstream ss;
-        ss << multiAddressFileName << "_" << dedupAddressName(multiAddressMap.type) << ".dat";
-        multiAddressMap.unserialize((path/ss.str()).native());
+        multiAddressMap.unserialize(multiAddressPath(path, multiAddressCacheFileName, multiAddressMap.type), multiAddressPath(path, multiAddressFileName, multiAddressMap.type));
     });
     
     boost::filesystem::ifstream inputFile(path/std::string(scriptCountsFileName));
@@ -57,9 +81,9 @@ AddressState::~AddressState() {
     std::cout << "bloomFPCount: " << bloomFPCount << "\n";
     
     blocksci::for_each(multiAddressMaps, [&](auto &multiAddressMap) {
-        std::stringstream ss;
-        ss << multiAddressFileName << "_" << dedupAddressName(multiAddressMap.type) << ".dat";
-        multiAddressMap.serialize((path/ss.str()).native());
+        std::cout << "multiCache " << dedupAddressName(multiAddressMap.type) << ": " << multiAddressMap << "\n";
+        multiAddressMap.serialize(multiAddressPath(path, multiAddressCacheFileName, multiAddressMap.type));
+        boost::filesystem::remove(multiAddressPath(path, multiAddressFileName, multiAddressMap.type));
     });
     
     boost::filesystem::ofstream outputFile(path/std::string(scriptCountsFileName));
@@ -75,36 +99,61 @@ uint32_t AddressState::getNewAddressIndex(blocksci::DedupAddressType::Enum type)
     return scriptNum;
 }
 
-void AddressState::rollback(const blocksci::State &state) {
+void AddressState::rollback(const blocksci::State &state, const std::vector<BlockUndo> *undos) {
+    dbWriter.wait();
+    
     blocksci::for_each(multiAddressMaps, [&](auto &multiAddressMap) {
-        for (auto multiAddressIt = multiAddressMap.begin(); multiAddressIt != multiAddressMap.end(); ++multiAddressIt) {
-            auto count = state.scriptCounts[static_cast<size_t>(multiAddressMap.type)];
-            if (multiAddressIt->second >= count) {
-                multiAddressMap.erase(multiAddressIt);
-            }
-        }
+        auto count = state.scriptCounts[static_cast<size_t>(multiAddressMap.type)];
+        multiAddressMap.eraseIf([&](uint32_t addressNum) {
+            return addressNum >= count;
+        });
     });
     
-    blocksci::for_each(blocksci::DedupAddressInfoList(), [&](auto tag) {
-        auto column = db.getColumn(tag);
+    if (undos != nullptr) {
         rocksdb::WriteBatch batch;
-        auto it = db.getIterator(tag);
-        for (it->SeekToFirst(); it->Valid(); it->Next()) {
-            uint32_t destNum;
-            memcpy(&destNum, it->value().data(), sizeof(destNum));
-            auto count = state.scriptCounts[static_cast<size_t>(tag)];
-            if (destNum >= count) {
-                batch.Delete(column, it->key());
+        for (auto &undo : *undos) {
+            for (auto &key : undo.addressKeys) {
+                batch.Delete(db.getColumn(key.column), rocksdb::Slice(key.data.data(), key.size));
             }
         }
-        assert(it->status().ok());
-        delete it;
-        db.writeBatch(batch);
-    });
+        auto status = db.writeBatch(batch);
+        if (!status.ok()) {
+            throw std::runtime_error("Failed to roll back hash index: " + status.ToString());
+        }
+    } else {
+        blocksci::for_each(blocksci::DedupAddressInfoList(), [&](auto tag) {
+            auto column = db.getColumn(tag);
+            rocksdb::WriteBatch batch;
+            auto it = db.getIterator(tag);
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+                uint32_t destNum;
+                memcpy(&destNum, it->value().data(), sizeof(destNum));
+                auto count = state.scriptCounts[static_cast<size_t>(tag)];
+                if (destNum >= count) {
+                    batch.Delete(column, it->key());
+                }
+            }
+            assert(it->status().ok());
+            delete it;
+            auto status = db.writeBatch(batch);
+            if (!status.ok()) {
+                throw std::runtime_error("Failed to roll back hash index: " + status.ToString());
+            }
+        });
+        
+        reloadBloomFilters();
+    }
     
-    reloadBloomFilters();
     scriptIndexes.clear();
     for (auto size : state.scriptCounts) {
         scriptIndexes.push_back(size);
     }
 }
+
+void AddressState::syncHashIndex() {
+    dbWriter.wait();
+    auto status = db.syncWAL();
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to flush hash index: " + status.ToString());
+    }
+}
@@ -9,9 +9,12 @@
 #ifndef address_state_hpp
 #define address_state_hpp
 
+#include "address_cache.hpp"
 #include "bloom_filter.hpp"
+#include "hash_index_writer.hpp"
 #include "parser_fwd.hpp"
 #include "serializable_map.hpp"
+#include "undo_journal.hpp"
 
 #include <blocksci/index/hash_index.hpp>
 #include <blocksci/util/state.hpp>
@@ -54,24 +57,27 @@ constexpr int startingCount<blocksci::DedupAddressType::MULTISIG> = 100'000'000;
 
 class AddressState {
     static constexpr auto AddressFalsePositiveRate = .05;
+    static constexpr uint64_t defaultCacheMemory = uint64_t{4} << 30;
     
     template<blocksci::DedupAddressType::Enum scriptType>
-    class AddressMap : public SerializableMap<blocksci::uint160, uint32_t>  {
+    class AddressMap : public AddressCache  {
     public:
         static constexpr auto type = scriptType;
-        AddressMap() : SerializableMap(blocksci::uint160S("FFFFFFFFFFFFFFFFFFFF"), blocksci::uint160S("AAAAAAAAAAAAAAAAAA")) {}
+        AddressMap(size_t capacity) : AddressCache(capacity) {}
     };
     
     template<blocksci::DedupAddressType::Enum scriptType>
-    class AddressBloomFilter : public BloomFilter  {
+    class AddressBloomFilter : public ScalableBloomFilter  {
     public:
         static constexpr auto type = scriptType;
-        AddressBloomFilter(const boost::filesystem::path &path) : BloomFilter(boost::filesystem::path(path).concat(dedupAddressName(type)), startingCount<scriptType>, AddressFalsePositiveRate)  {}
+        AddressBloomFilter(const boost::filesystem::path &path) : ScalableBloomFilter(boost::filesystem::path(path).concat(dedupAddressName(type)), startingCount<scriptType>, AddressFalsePositiveRate)  {}
     };
     
     boost::filesystem::path path;
     
     blocksci::HashIndex db;
+    // New addresses are written in the background while the hash index is only read through the writer
+    HashIndexWriter dbWriter{db};
     
     using AddressMapTuple = blocksci::to_dedup_address_tuple_t<AddressMap>;
     using AddressBloomFilterTuple = blocksci::to_dedup_address_tuple_t<AddressBloomFilter>;
@@ -87,25 +93,16 @@ class AddressState {
     
     std::vector<uint32_t> scriptIndexes;
     
-    template<blocksci::DedupAddressType::Enum type>
-    void reloadBloomFilter() {
-        auto &addressBloomFilter = std::get<AddressBloomFilter<type>>(addressBloomFilters);
-        addressBloomFilter.reset(addressBloomFilter.getMaxItems(), addressBloomFilter.getFPRate());
-        rocksdb::Iterator* it = db.getIterator(type);
-        for (it->SeekToFirst(); it->Valid(); it->Next()) {
-            uint32_t scriptNum;
-            memcpy(&scriptNum, it->value().data(), sizeof(scriptNum));
-            blocksci::uint160 addressHash;
-            memcpy(&addressHash, it->key().data(), sizeof(addressHash));
-            addressBloomFilter.add(addressHash);
-        }
-    }
+    // Receives the hash index keys of new addresses while an undo journal is being written
+    std::vector<HashIndexKey> *addedKeys = nullptr;
     
-    // Duplicated to prevent triggering gcc
+    // Only needed after a rollback removed addresses since the filters grow on their own
     void reloadBloomFilters() {
         blocksci::for_each(blocksci::DedupAddressInfoList(), [&](auto tag) {
             auto &addressBloomFilter = std::get<AddressBloomFilter<tag>>(addressBloomFilters);
-            addressBloomFilter.reset(addressBloomFilter.getMaxItems(), addressBloomFilter.getFPRate());
+            // Every address that is left fits into a single layer again
+            uint64_t maxItems = std::max<uint64_t>(addressBloomFilter.getMaxItems(), addressBloomFilter.size());
+            addressBloomFilter.reset(maxItems, addressBloomFilter.getFPRate());
             rocksdb::Iterator* it = db.getIterator(tag);
             for (it->SeekToFirst(); it->Valid(); it->Next()) {
                 uint32_t scriptNum;
@@ -116,9 +113,10 @@ class AddressState {
             }
         });
     }
-    
+
 public:
-    AddressState(const boost::filesystem::path &path, const boost::filesystem::path &hashIndexPath);
+    // Reused addresses are cached within cacheMemory bytes, split between the address types by their expected counts
+    AddressState(const boost::filesystem::path &path, const boost::filesystem::path &hashIndexPath, uint64_t cacheMemory = defaultCacheMemory);
     AddressState(const AddressState &) = delete;
     AddressState &operator=(const AddressState &) = delete;
     AddressState(AddressState &&) = delete;
@@ -148,14 +146,14 @@ public:
         
         {
             auto &multiAddressMap = std::get<AddressMap<dedupType(type)>>(multiAddressMaps);
-            auto it = multiAddressMap.find(hash);
-            if (it != multiAddressMap.end()) {
+            uint32_t addressNum;
+            if (multiAddressMap.find(hash, addressNum)) {
                 multiCount++;
-                return {hash, AddressLocation::MultiUseMap, it->second};
+                return {hash, AddressLocation::MultiUseMap, addressNum};
             }
         }
         
-        uint32_t destNum = db.lookupAddress<blocksci::AddressInfo<type>::exampleType>(hash);
+        uint32_t destNum = dbWriter.lookupAddress<blocksci::AddressInfo<type>::exampleType>(hash);
         if (destNum != 0) {
             dbCount++;
             return {hash, AddressLocation::LevelDb, destNum};
@@ -192,9 +190,9 @@ public:
             addressNum = getNewAddressIndex(dedupType(type));
             auto &addressBloomFilter = std::get<AddressBloomFilter<dedupType(type)>>(addressBloomFilters);
             addressBloomFilter.add(addressInfo.hash);
-            db.addAddress<blocksci::AddressInfo<type>::exampleType>(addressInfo.hash, addressNum);
-            if (addressBloomFilter.isFull()) {
-                reloadBloomFilter<dedupType(type)>();
+            dbWriter.addAddress<blocksci::AddressInfo<type>::exampleType>(addressInfo.hash, addressNum);
+            if (addedKeys != nullptr) {
+                addedKeys->push_back(makeHashIndexKey<blocksci::AddressInfo<type>::exampleType>(addressInfo.hash));
             }
         }
         return std::make_pair(addressNum, !existingAddress);
@@ -202,7 +200,30 @@ public:
     
     uint32_t getNewAddressIndex(blocksci::DedupAddressType::Enum type);
     
-    void rollback(const blocksci::State &state);
+    const std::vector<uint32_t> &getScriptCounts() const {
+        return scriptIndexes;
+    }
+    
+    void recordHashIndexKeys(std::vector<HashIndexKey> *keys) {
+        addedKeys = keys;
+    }
+    
+    // Lets an index creator running alongside the parser share the open hash index
+    blocksci::HashIndex &getHashIndex() {
+        return db;
+    }
+    
+    // Makes every address added so far visible to readers of the hash index
+    void flushHashIndex() {
+        dbWriter.wait();
+    }
+    
+    // Also makes them durable so they survive a crash together with the parser checkpoint
+    void syncHashIndex();
+    
+    // With the undo records of the removed blocks only their keys are deleted from the hash index. The bloom
+    // filters then keep the removed addresses, which only costs a few extra lookups
+    void rollback(const blocksci::State &state, const std::vector<BlockUndo> *undos = nullptr);
 };
 
 
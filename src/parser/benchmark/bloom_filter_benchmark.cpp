@@ -0,0 +1,85 @@
+//
+//  bloom_filter_benchmark.cpp
+//  blocksci_parser
+//
+
+#include "parser_benchmark.hpp"
+
+#include "bloom_filter.hpp"
+
+#include <blocksci/util/bitcoin_uint256.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+namespace {
+    constexpr uint64_t insertSeed = 1;
+    constexpr uint64_t absentSeed = 2;
+    
+    blocksci::uint160 makeKey(uint64_t &state) {
+        blocksci::uint160 key;
+        uint64_t words[3] = {splitMix64(state), splitMix64(state), splitMix64(state)};
+        memcpy(key.begin(), words, key.size());
+        return key;
+    }
+    
+    double lookupRate(const BloomFilter &filter, uint64_t seed, uint64_t queryCount, uint64_t &positives) {
+        uint64_t state = seed;
+        positives = 0;
+        auto start = BenchmarkClock::now();
+        for (uint64_t i = 0; i < queryCount; i++) {
+            positives += filter.possiblyContains(makeKey(state));
+        }
+        return static_cast<double>(queryCount) / secondsSince(start);
+    }
+}
+
+void benchmarkBloomFilter(const boost::filesystem::path &directory, uint64_t itemCount, uint64_t queryCount, double fpRate) {
+    queryCount = std::min(queryCount, itemCount);
+    std::cout << "Bloom filter with " << itemCount << " items, target false positive rate " << fpRate << "\n";
+    std::cout << std::left << std::setw(10) << "layout" << std::setw(8) << "avx2" << std::setw(12) << "size (MB)" << std::setw(16) << "inserts/sec" << std::setw(16) << "hits/sec" << std::setw(16) << "misses/sec" << "false positive rate\n";
+    
+    for (auto layout : {BloomFilterLayout::classic, BloomFilterLayout::blocked}) {
+        auto name = layout == BloomFilterLayout::classic ? "classic" : "blocked";
+        auto path = directory/(std::string("benchmarkBloom_") + name);
+        
+        {
+            BloomFilter filter{path, itemCount, fpRate, layout};
+            filter.reset(itemCount, fpRate, layout);
+            
+            uint64_t state = insertSeed;
+            auto start = BenchmarkClock::now();
+            for (uint64_t i = 0; i < itemCount; i++) {
+                filter.add(makeKey(state));
+            }
+            auto insertRate = static_cast<double>(itemCount) / secondsSince(start);
+            auto sizeMB = static_cast<double>(boost::filesystem::file_size(filter.storePath().concat(".dat"))) / (1 << 20);
+            
+            std::vector<bool> vectorizedRuns{false};
+            if (layout == BloomFilterLayout::blocked) {
+                filter.setVectorized(true);
+                if (filter.isVectorized()) {
+                    vectorizedRuns.push_back(true);
+                }
+            }
+            
+            for (bool vectorized : vectorizedRuns) {
+                filter.setVectorized(vectorized);
+                uint64_t hits = 0;
+                uint64_t falsePositives = 0;
+                auto hitRate = lookupRate(filter, insertSeed, queryCount, hits);
+                auto missRate = lookupRate(filter, absentSeed, queryCount, falsePositives);
+                if (hits != queryCount) {
+                    std::cout << "Error: " << queryCount - hits << " inserted keys were not found\n";
+                }
+                std::cout << std::left << std::setw(10) << name << std::setw(8) << (vectorized ? "yes" : "no") << std::setw(12) << std::fixed << std::setprecision(1) << sizeMB << std::setw(16) << std::setprecision(0) << insertRate << std::setw(16) << hitRate << std::setw(16) << missRate << std::setprecision(5) << static_cast<double>(falsePositives) / static_cast<double>(queryCount) << "\n";
+            }
+        }
+        BloomFilter::removeFiles(path);
+    }
+}
@@ -0,0 +1,82 @@
+//
+//  hash_benchmark.cpp
+//  blocksci_parser
+//
+
+#include "parser_benchmark.hpp"
+
+#include "multi_sha256.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+namespace {
+    // Roughly the mix of the main chain: mostly one or two input transactions with the odd large one
+    size_t transactionSize(uint64_t &state) {
+        auto roll = splitMix64(state) % 100;
+        if (roll < 70) {
+            return 190 + splitMix64(state) % 200;
+        } else if (roll < 98) {
+            return 390 + splitMix64(state) % 1600;
+        } else {
+            return 2000 + splitMix64(state) % 30000;
+        }
+    }
+}
+
+void benchmarkTransactionHashing(uint64_t txCount, uint32_t batchSize) {
+    uint64_t state = 1;
+    std::vector<size_t> offsets;
+    std::vector<unsigned char> data;
+    for (uint64_t i = 0; i < txCount; i++) {
+        offsets.push_back(data.size());
+        auto size = transactionSize(state);
+        for (size_t j = 0; j < size; j++) {
+            data.push_back(static_cast<unsigned char>(splitMix64(state)));
+        }
+    }
+    offsets.push_back(data.size());
+    
+    // Hashed like a transaction, with the first and last four bytes standing in for the version and locktime
+    auto makeMessages = [&](std::vector<unsigned char> &digests) {
+        std::vector<SHA256Message> messages;
+        digests.resize(32 * txCount);
+        for (uint64_t i = 0; i < txCount; i++) {
+            auto begin = data.data() + offsets[i];
+            auto length = offsets[i + 1] - offsets[i];
+            messages.push_back(SHA256Message{{begin, begin + 4, begin + length - 4}, {4, length - 8, 4}, digests.data() + 32 * i});
+        }
+        return messages;
+    };
+    
+    std::cout << "Double SHA256 of " << txCount << " transactions (" << std::fixed << std::setprecision(1) << static_cast<double>(data.size()) / (1 << 20) << " MB) in batches of " << batchSize << " on one core\n";
+    std::cout << std::left << std::setw(10) << "backend" << std::setw(16) << "MB/s" << std::setw(16) << "txes/sec" << "speedup\n";
+    
+    std::vector<unsigned char> expected;
+    double scalarRate = 0;
+    for (auto backend : {SHA256Backend::scalar, SHA256Backend::avx2, SHA256Backend::avx512}) {
+        if (!sha256BackendSupported(backend)) {
+            std::cout << std::setw(10) << sha256BackendName(backend) << "unsupported\n";
+            continue;
+        }
+        std::vector<unsigned char> digests;
+        auto messages = makeMessages(digests);
+        auto start = BenchmarkClock::now();
+        for (uint64_t i = 0; i < txCount; i += batchSize) {
+            doubleSHA256Batch(messages.data() + i, std::min<uint64_t>(batchSize, txCount - i), backend);
+        }
+        auto seconds = secondsSince(start);
+        
+        if (backend == SHA256Backend::scalar) {
+            expected = digests;
+            scalarRate = static_cast<double>(data.size()) / seconds;
+        } else if (digests != expected) {
+            std::cout << "Error: " << sha256BackendName(backend) << " hashes differ from the scalar hashes\n";
+        }
+        auto rate = static_cast<double>(data.size()) / seconds;
+        std::cout << std::setw(10) << sha256BackendName(backend) << std::setw(16) << std::setprecision(1) << rate / (1 << 20) << std::setw(16) << std::setprecision(0) << static_cast<double>(txCount) / seconds << std::setprecision(2) << rate / scalarRate << "x\n";
+    }
+    std::cout << "The parser uses " << sha256BackendName(bestSHA256Backend()) << "\n";
+}
@@ -0,0 +1,149 @@
+//
+//  mapper_benchmark.cpp
+//  blocksci_parser
+//
+
+#include "parser_benchmark.hpp"
+
+#include <blocksci/util/file_mapper.hpp>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+    constexpr uint64_t valueSeed = 1;
+    constexpr uint64_t lookupSeed = 2;
+    
+    // Flushes the file and asks the kernel to evict it, which works without root as long as no mapping of the
+    // file is alive. File systems kept in memory such as tmpfs ignore the request
+    void dropFromPageCache(const boost::filesystem::path &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open " + path.native());
+        }
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    
+    // Bytes this process has caused to be fetched from storage, or 0 where the kernel doesn't account it
+    uint64_t storageBytesRead() {
+        std::ifstream io("/proc/self/io");
+        std::string key;
+        uint64_t value;
+        while (io >> key >> value) {
+            if (key == "read_bytes:") {
+                return value;
+            }
+        }
+        return 0;
+    }
+    
+    struct ColdRun {
+        double seconds;
+        double storageMB;
+        uint64_t checksum;
+    };
+    
+    template <typename Func>
+    ColdRun runCold(const boost::filesystem::path &filePath, const boost::filesystem::path &mapperPath, blocksci::AccessPattern pattern, bool prefetch, Func func) {
+        dropFromPageCache(filePath);
+        auto readBefore = storageBytesRead();
+        auto start = BenchmarkClock::now();
+        blocksci::FixedSizeFileMapper<uint64_t> file(mapperPath);
+        file.setAccessPattern(pattern);
+        if (prefetch) {
+            file.willNeed(0, file.size());
+        }
+        auto checksum = func(file);
+        auto seconds = secondsSince(start);
+        auto storageMB = static_cast<double>(storageBytesRead() - readBefore) / (1 << 20);
+        return {seconds, storageMB, checksum};
+    }
+    
+    const char *patternName(blocksci::AccessPattern pattern) {
+        switch (pattern) {
+            case blocksci::AccessPattern::normal:
+                return "normal";
+            case blocksci::AccessPattern::sequential:
+                return "sequential";
+            case blocksci::AccessPattern::random:
+                return "random";
+        }
+        return "";
+    }
+}
+
+void benchmarkMappedFileAccess(const boost::filesystem::path &directory, uint64_t sizeMB, uint64_t lookupCount) {
+    auto mapperPath = directory/"benchmarkMapper";
+    auto filePath = boost::filesystem::path{mapperPath}.concat(".dat");
+    uint64_t valueCount = (sizeMB << 20) / sizeof(uint64_t);
+    
+    {
+        boost::filesystem::ofstream out(filePath, std::ios::binary | std::ios::trunc);
+        std::vector<uint64_t> chunk(1 << 17);
+        uint64_t state = valueSeed;
+        for (uint64_t written = 0; written < valueCount; written += chunk.size()) {
+            auto chunkCount = std::min<uint64_t>(chunk.size(), valueCount - written);
+            for (uint64_t i = 0; i < chunkCount; i++) {
+                chunk[i] = splitMix64(state);
+            }
+            out.write(reinterpret_cast<const char *>(chunk.data()), static_cast<std::streamsize>(chunkCount * sizeof(uint64_t)));
+        }
+    }
+    
+    std::cout << "Cold cache access to a " << sizeMB << " MB mapped file in " << directory << "\n";
+    std::cout << std::left << std::setw(10) << "access" << std::setw(24) << "hint" << std::setw(12) << "seconds" << std::setw(16) << "rate" << "MB read\n";
+    
+    auto report = [](const char *access, const std::string &hint, const ColdRun &run, double rate, const char *unit) {
+        std::cout << std::left << std::setw(10) << access << std::setw(24) << hint << std::setw(12) << std::fixed << std::setprecision(2) << run.seconds << std::setw(16) << (std::to_string(static_cast<uint64_t>(rate)) + unit) << std::setprecision(0) << run.storageMB << "\n";
+    };
+    
+    auto scan = [](const blocksci::FixedSizeFileMapper<uint64_t> &file) {
+        uint64_t sum = 0;
+        auto count = file.size();
+        for (size_t i = 0; i < count; i++) {
+            sum += *file.getData(i);
+        }
+        return sum;
+    };
+    
+    auto lookups = [&](const blocksci::FixedSizeFileMapper<uint64_t> &file) {
+        uint64_t sum = 0;
+        uint64_t state = lookupSeed;
+        auto count = file.size();
+        for (uint64_t i = 0; i < lookupCount; i++) {
+            sum += *file.getData(splitMix64(state) % count);
+        }
+        return sum;
+    };
+    
+    uint64_t scanChecksum = 0;
+    for (auto pattern : {blocksci::AccessPattern::normal, blocksci::AccessPattern::sequential}) {
+        for (bool prefetch : {false, true}) {
+            auto run = runCold(filePath, mapperPath, pattern, prefetch, scan);
+            if (scanChecksum != 0 && run.checksum != scanChecksum) {
+                std::cout << "Error: scans disagree on the file contents\n";
+            }
+            scanChecksum = run.checksum;
+            auto hint = std::string{patternName(pattern)} + (prefetch ? " + willneed" : "");
+            report("scan", hint, run, static_cast<double>(sizeMB) / run.seconds, " MB/s");
+        }
+    }
+    
+    for (auto pattern : {blocksci::AccessPattern::normal, blocksci::AccessPattern::random}) {
+        auto run = runCold(filePath, mapperPath, pattern, false, lookups);
+        report("lookup", patternName(pattern), run, static_cast<double>(lookupCount) / run.seconds, "/s");
+    }
+    
+    boost::filesystem::remove(filePath);
+}
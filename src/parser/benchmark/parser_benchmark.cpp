@@ -0,0 +1,92 @@
+//
+//  parser_benchmark.cpp
+//  blocksci_parser
+//
+
+#include "parser_benchmark.hpp"
+
+#include <clipp.h>
+
+#include <iostream>
+
+int main(int argc, char * argv[]) {
+    enum class mode {bloom, hash, scripts, mapper, sort, help};
+    mode selected = mode::help;
+    
+    std::string directory = ".";
+    uint64_t itemCount = 600'000'000;
+    uint64_t queryCount = 50'000'000;
+    double fpRate = .05;
+    uint64_t txCount = 2'000'000;
+    uint32_t batchSize = 1000;
+    std::vector<std::string> blockFiles;
+    uint32_t rounds = 10;
+    uint64_t fileSizeMB = 4096;
+    uint64_t lookupCount = 200'000;
+    uint64_t recordCount = 5'000'000;
+    uint32_t sortTxCount = 300'000'000;
+    uint32_t sortRounds = 5;
+    
+    auto directoryOpt = (clipp::option("--directory", "-d") & clipp::value("directory", directory)) % "Directory for temporary benchmark files";
+    
+    auto bloomCommand = (clipp::command("bloom").set(selected, mode::bloom),
+        directoryOpt,
+        (clipp::option("--items") & clipp::value("item count", itemCount)) % "Number of keys added to each filter (defaults to the parser's pubkey filter size)",
+        (clipp::option("--queries") & clipp::value("query count", queryCount)) % "Number of present and absent keys looked up",
+        (clipp::option("--fp-rate") & clipp::value("rate", fpRate)) % "Target false positive rate (defaults to the parser's address filter rate)"
+    );
+    
+    auto hashCommand = (clipp::command("hash").set(selected, mode::hash),
+        (clipp::option("--txes") & clipp::value("tx count", txCount)) % "Number of transactions hashed",
+        (clipp::option("--batch-size") & clipp::value("batch size", batchSize)) % "Transactions hashed per call (defaults to the parser's batch size)"
+    );
+    
+    auto scriptsCommand = (clipp::command("scripts").set(selected, mode::scripts),
+        clipp::values("blk files", blockFiles) % "Bitcoin block files whose output scripts are classified",
+        (clipp::option("--rounds") & clipp::value("rounds", rounds)) % "Number of passes over the scripts"
+    );
+    
+    auto mapperCommand = (clipp::command("mapper").set(selected, mode::mapper),
+        directoryOpt,
+        (clipp::option("--size-mb") & clipp::value("megabytes", fileSizeMB)) % "Size of the mapped file, which should sit on the disk holding the parser output",
+        (clipp::option("--lookups") & clipp::value("lookup count", lookupCount)) % "Number of random records read"
+    );
+    
+    auto sortCommand = (clipp::command("sort").set(selected, mode::sort),
+        (clipp::option("--records") & clipp::value("record count", recordCount)) % "Number of output link records sorted",
+        (clipp::option("--txes") & clipp::value("tx count", sortTxCount)) % "Number of transactions the spent outputs are drawn from",
+        (clipp::option("--rounds") & clipp::value("rounds", sortRounds)) % "Number of times each sort is timed"
+    );
+    
+    auto cli = (bloomCommand | hashCommand | scriptsCommand | mapperCommand | sortCommand | clipp::command("help").set(selected, mode::help));
+    
+    auto res = clipp::parse(argc, argv, cli);
+    if (res.any_error() || selected == mode::help) {
+        std::cout << clipp::make_man_page(cli, "parser_benchmark");
+        return 0;
+    }
+    
+    switch (selected) {
+        case mode::bloom:
+            benchmarkBloomFilter(directory, itemCount, queryCount, fpRate);
+            break;
+        case mode::hash:
+            benchmarkTransactionHashing(txCount, batchSize);
+            break;
+        case mode::scripts: {
+            std::vector<boost::filesystem::path> paths(blockFiles.begin(), blockFiles.end());
+            benchmarkScriptClassification(paths, rounds);
+            break;
+        }
+        case mode::mapper:
+            benchmarkMappedFileAccess(directory, fileSizeMB, lookupCount);
+            break;
+        case mode::sort:
+            benchmarkBackLinkSort(recordCount, sortTxCount, sortRounds);
+            break;
+        case mode::help:
+            break;
+    }
+    
+    return 0;
+}
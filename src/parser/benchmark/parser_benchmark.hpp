@@ -0,0 +1,49 @@
+//
+//  parser_benchmark.hpp
+//  blocksci_parser
+//
+
+#ifndef parser_benchmark_hpp
+#define parser_benchmark_hpp
+
+#include <boost/filesystem/path.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+inline double secondsSince(BenchmarkClock::time_point start) {
+    return std::chrono::duration<double>(BenchmarkClock::now() - start).count();
+}
+
+// Deterministic stand in for uniformly distributed hash data such as transaction or address hashes
+inline uint64_t splitMix64(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+// Compares the classic and cache line blocked bloom filter layouts on random 20 byte keys. Filter files
+// are created in directory and removed afterwards
+void benchmarkBloomFilter(const boost::filesystem::path &directory, uint64_t itemCount, uint64_t queryCount, double fpRate);
+
+// Compares the transaction hashing backends on synthetic transactions of realistic sizes, hashed in batches
+// the way the parser's hashing stage receives them
+void benchmarkTransactionHashing(uint64_t txCount, uint32_t batchSize);
+
+// Measures the standard template matcher against a single opcode walk on the output scripts of the given
+// blk files, and reports how often each template matched
+void benchmarkScriptClassification(const std::vector<boost::filesystem::path> &blockFiles, uint32_t rounds);
+
+// Times full scans and random lookups through a FixedSizeFileMapper over a file evicted from the page cache
+// before every run, once with each access hint. The file is created in directory and removed afterwards
+void benchmarkMappedFileAccess(const boost::filesystem::path &directory, uint64_t sizeMB, uint64_t lookupCount);
+
+// Compares the parallel radix sort used for back linking with std::stable_sort on synthetic output link
+// records, on one thread and on every core
+void benchmarkBackLinkSort(uint64_t recordCount, uint32_t txCount, uint32_t rounds);
+
+#endif /* parser_benchmark_hpp */
@@ -0,0 +1,91 @@
+//
+//  radix_sort_benchmark.cpp
+//  blocksci_parser
+//
+
+#include "parser_benchmark.hpp"
+
+#include "radix_sort.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    // Same layout and sort key as the parser's OutputLinkData
+    struct LinkRecord {
+        uint32_t txNum;
+        uint16_t outputNum;
+        uint32_t spendingTxNum;
+    };
+    
+    uint64_t linkKey(const LinkRecord &record) {
+        return (static_cast<uint64_t>(record.txNum) << 16) | record.outputNum;
+    }
+    
+    bool sameOrder(const std::vector<LinkRecord> &a, const std::vector<LinkRecord> &b) {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const LinkRecord &x, const LinkRecord &y) {
+            return linkKey(x) == linkKey(y) && x.spendingTxNum == y.spendingTxNum;
+        });
+    }
+}
+
+void benchmarkBackLinkSort(uint64_t recordCount, uint32_t txCount, uint32_t rounds) {
+    uint64_t state = 1;
+    std::vector<LinkRecord> records;
+    records.reserve(recordCount);
+    uint64_t maxKey = 0;
+    for (uint64_t i = 0; i < recordCount; i++) {
+        // Spent outputs are spread over the whole chain, mostly low output numbers
+        LinkRecord record;
+        record.txNum = static_cast<uint32_t>(splitMix64(state) % txCount);
+        record.outputNum = static_cast<uint16_t>(splitMix64(state) % 4 == 0 ? splitMix64(state) % 64 : splitMix64(state) % 2);
+        record.spendingTxNum = static_cast<uint32_t>(i);
+        maxKey = std::max(maxKey, linkKey(record));
+        records.push_back(record);
+    }
+    
+    auto threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    std::cout << "Sorting " << recordCount << " back link records over " << txCount << " transactions, best of " << rounds << " rounds\n";
+    std::cout << std::left << std::setw(24) << "sort" << std::setw(12) << "seconds" << std::setw(16) << "records/sec" << "speedup\n";
+    
+    std::vector<LinkRecord> expected;
+    double baseSeconds = 0;
+    auto run = [&](const std::string &name, auto sortFunc) {
+        double best = 0;
+        std::vector<LinkRecord> sorted;
+        for (uint32_t round = 0; round < rounds; round++) {
+            sorted = records;
+            auto start = BenchmarkClock::now();
+            sortFunc(sorted);
+            auto seconds = secondsSince(start);
+            if (round == 0 || seconds < best) {
+                best = seconds;
+            }
+        }
+        if (expected.empty()) {
+            expected = sorted;
+            baseSeconds = best;
+        } else if (!sameOrder(sorted, expected)) {
+            std::cout << "Error: " << name << " order differs from std::stable_sort\n";
+        }
+        std::cout << std::setw(24) << name << std::setw(12) << std::fixed << std::setprecision(3) << best << std::setw(16) << std::setprecision(0) << static_cast<double>(recordCount) / best << std::setprecision(2) << baseSeconds / best << "x\n";
+    };
+    
+    run("std::stable_sort", [](std::vector<LinkRecord> &items) {
+        std::stable_sort(items.begin(), items.end(), [](const LinkRecord &a, const LinkRecord &b) {
+            return linkKey(a) < linkKey(b);
+        });
+    });
+    run("radix, 1 thread", [&](std::vector<LinkRecord> &items) {
+        parallelRadixSort(items, linkKey, maxKey, 1);
+    });
+    if (threadCount > 1) {
+        run("radix, " + std::to_string(threadCount) + " threads", [&](std::vector<LinkRecord> &items) {
+            parallelRadixSort(items, linkKey, maxKey, threadCount);
+        });
+    }
+}
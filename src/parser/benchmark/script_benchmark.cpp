@@ -0,0 +1,141 @@
+//
+//  script_benchmark.cpp
+//  blocksci_parser
+//
+
+#include "parser_benchmark.hpp"
+
+#include "safe_mem_reader.hpp"
+#include "script_template.hpp"
+
+#include <blocksci/address/address_info.hpp>
+#include <blocksci/scripts/script_view.hpp>
+
+#include <array>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+namespace {
+    struct ScriptSample {
+        std::vector<unsigned char> data;
+        std::vector<std::pair<size_t, uint32_t>> scripts;
+        
+        const unsigned char *script(size_t i) const {
+            return data.data() + scripts[i].first;
+        }
+    };
+    
+    // Collects every output script of the blocks in a blk file
+    void loadOutputScripts(const boost::filesystem::path &path, ScriptSample &sample) {
+        SafeMemReader reader{path.native()};
+        while (reader.has(8)) {
+            auto magic = reader.readNext<uint32_t>();
+            // The end of the preallocated file space
+            if (magic == 0) {
+                break;
+            }
+            auto blockSize = reader.readNext<uint32_t>();
+            auto blockStart = reader.offset();
+            reader.advance(80);
+            auto txCount = reader.readVariableLengthInteger();
+            for (uint32_t i = 0; i < txCount; i++) {
+                reader.advance(sizeof(int32_t));
+                auto inputCount = reader.readVariableLengthInteger();
+                bool isSegwit = false;
+                if (inputCount == 0) {
+                    reader.advance(1);
+                    inputCount = reader.readVariableLengthInteger();
+                    isSegwit = true;
+                }
+                for (uint32_t j = 0; j < inputCount; j++) {
+                    reader.advance(36);
+                    reader.advance(reader.readVariableLengthInteger());
+                    reader.advance(sizeof(uint32_t));
+                }
+                auto outputCount = reader.readVariableLengthInteger();
+                for (uint32_t j = 0; j < outputCount; j++) {
+                    reader.advance(sizeof(uint64_t));
+                    auto scriptLength = reader.readVariableLengthInteger();
+                    auto script = reinterpret_cast<const unsigned char *>(reader.unsafePos());
+                    reader.advance(scriptLength);
+                    sample.scripts.emplace_back(sample.data.size(), scriptLength);
+                    sample.data.insert(sample.data.end(), script, script + scriptLength);
+                }
+                if (isSegwit) {
+                    for (uint32_t j = 0; j < inputCount; j++) {
+                        auto itemCount = reader.readVariableLengthInteger();
+                        for (uint32_t k = 0; k < itemCount; k++) {
+                            reader.advance(reader.readVariableLengthInteger());
+                        }
+                    }
+                }
+                reader.advance(sizeof(uint32_t));
+            }
+            reader.reset(blockStart + blockSize);
+        }
+    }
+    
+    // The least work the opcode walker does for a script: the script hash and witness checks followed by a
+    // single pass over its opcodes, where the walker makes one pass per template it tries
+    bool walkOpcodes(const blocksci::CScriptView &script) {
+        if (script.IsPayToScriptHash() || script.IsWitnessProgram()) {
+            return true;
+        }
+        blocksci::opcodetype opcode = blocksci::OP_INVALIDOPCODE;
+        ranges::iterator_range<const unsigned char *> data;
+        auto pc = script.begin();
+        while (pc < script.end()) {
+            if (!script.GetOp(pc, opcode, data)) {
+                return false;
+            }
+        }
+        return opcode == blocksci::OP_CHECKSIG;
+    }
+}
+
+void benchmarkScriptClassification(const std::vector<boost::filesystem::path> &blockFiles, uint32_t rounds) {
+    ScriptSample sample;
+    for (auto &path : blockFiles) {
+        loadOutputScripts(path, sample);
+    }
+    auto scriptCount = sample.scripts.size();
+    if (scriptCount == 0) {
+        std::cout << "No output scripts found\n";
+        return;
+    }
+    
+    std::array<uint64_t, blocksci::AddressType::size> typeCounts{};
+    uint64_t checksum = 0;
+    auto start = BenchmarkClock::now();
+    for (uint32_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < scriptCount; i++) {
+            auto match = matchScriptTemplate(sample.script(i), sample.scripts[i].second, true);
+            typeCounts[static_cast<size_t>(match.type)]++;
+            checksum += match.data != nullptr ? match.data[0] : 0;
+        }
+    }
+    auto templateRate = static_cast<double>(scriptCount * rounds) / secondsSince(start);
+    
+    uint64_t walkMatches = 0;
+    start = BenchmarkClock::now();
+    for (uint32_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < scriptCount; i++) {
+            auto script = sample.script(i);
+            walkMatches += walkOpcodes(blocksci::CScriptView{script, script + sample.scripts[i].second});
+        }
+    }
+    auto walkRate = static_cast<double>(scriptCount * rounds) / secondsSince(start);
+    
+    std::cout << "Classified " << scriptCount << " output scripts " << rounds << " times (checksum " << checksum + walkMatches << ")\n";
+    std::cout << std::left << std::setw(24) << "template" << "share\n";
+    for (auto type : blocksci::AddressType::all) {
+        auto count = typeCounts[static_cast<size_t>(type)];
+        if (count > 0) {
+            auto name = type == blocksci::AddressType::Enum::NONSTANDARD ? std::string{"no match (opcode walk)"} : blocksci::addressName(type);
+            std::cout << std::setw(24) << name << std::fixed << std::setprecision(2) << 100.0 * static_cast<double>(count) / static_cast<double>(scriptCount * rounds) << "%\n";
+        }
+    }
+    std::cout << std::setw(24) << "template match" << std::setprecision(0) << templateRate << " scripts/sec\n";
+    std::cout << std::setw(24) << "opcode walk" << walkRate << " scripts/sec\n";
+}
@@ -22,6 +22,14 @@
 #include "output_spend_data.hpp"
 #include "serializable_map.hpp"
 #include "progress_bar.hpp"
+#include "pipeline_queue.hpp"
+#include "transaction_pool.hpp"
+#include "pipeline_telemetry.hpp"
+#include "radix_sort.hpp"
+#include "worker_group.hpp"
+#include "undo_journal.hpp"
+#include "rpc_block_fetcher.hpp"
+#include "parser_checkpoint.hpp"
 
 #include <blocksci/util/hash.hpp>
 #include <blocksci/util/bitcoin_uint256.hpp>
@@ -31,44 +39,19 @@
 #include <blocksci/chain/transaction.hpp>
 #include <blocksci/scripts/bitcoin_pubkey.hpp>
 
-#ifdef BLOCKSCI_RPC_PARSER
-#include <bitcoinapi/bitcoinapi.h>
-#endif
-
-#include <boost/lockfree/spsc_queue.hpp>
 #include <boost/filesystem/operations.hpp>
 
 #include <cmath>
 #include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
 #include <thread>
 #include <fstream>
 #include <iostream>
 
-std::vector<unsigned char> ParseHex(const char* psz);
-
 BlockProcessor::BlockProcessor(uint32_t startingTxCount_, uint32_t totalTxCount_, blocksci::BlockHeight maxBlockHeight_) : startingTxCount(startingTxCount_), currentTxNum(startingTxCount_), totalTxCount(totalTxCount_), maxBlockHeight(maxBlockHeight_) {
-    
-}
 
-std::vector<unsigned char> ParseHex(const char* psz)
-{
-    // convert hex dump to vector
-    std::vector<unsigned char> vch;
-    while (true)
-    {
-        while (isspace(*psz))
-            psz++;
-        signed char c = blocksci::HexDigit(*psz++);
-        if (c == static_cast<signed char>(-1))
-            break;
-        unsigned char n = static_cast<unsigned char>(c << 4);
-        c = blocksci::HexDigit(*psz++);
-        if (c == static_cast<signed char>(-1))
-            break;
-        n |= c;
-        vch.push_back(n);
-    }
-    return vch;
 }
 
 struct SegwitChecker {
@@ -99,6 +82,23 @@ BlockFileReaderBase::~BlockFileReaderBase() = default;
 template <typename ParseTag>
 class BlockFileReader;
 
+template<bool shouldAdvance>
+void loadFileTx(SafeMemReader &reader, RawTransaction *tx, uint32_t txNum, blocksci::BlockHeight height, bool isSegwit) {
+    try {
+        auto firstTxOffset = reader.offset();
+        tx->load(reader, txNum, height, isSegwit);
+        if (!shouldAdvance) {
+            reader.reset(firstTxOffset);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to load tx"
+        << " from block" << height
+        << " at offset " << reader.offset()
+        << ".\n" << e.what();
+        throw;
+    }
+}
+
 #ifdef BLOCKSCI_FILE_PARSER
 
 template <>
@@ -113,23 +113,12 @@ class BlockFileReader<FileTag> : public BlockFileReaderBase {
     
     template<bool shouldAdvance>
     void nextTxImp(RawTransaction *tx, bool isSegwit) {
-        try {
-            auto firstTxOffset = reader->offset();
-            tx->load(*reader, currentTxNum, currentHeight, isSegwit);
-            if (shouldAdvance) {
-                currentTxNum++;
-            } else {
-                reader->reset(firstTxOffset);
-            }
-        } catch (const std::exception &e) {
-            std::cerr << "Failed to load tx"
-            << " from block" << currentHeight
-            << " at offset " << reader->offset()
-            << ".\n" << e.what();
-            throw;
+        loadFileTx<shouldAdvance>(*reader, tx, currentTxNum, currentHeight, isSegwit);
+        if (shouldAdvance) {
+            currentTxNum++;
         }
     }
-    
+
 public:
     BlockFileReader(const ParserConfiguration<FileTag> &config_, std::vector<BlockInfo<FileTag>> &blocksToAdd, uint32_t firstTxNum) : config(config_) {
         for (auto &block : blocksToAdd) {
@@ -166,10 +155,19 @@ public:
         nextTxImp<false>(tx, isSegwit);
     }
     
+    // Positioned at the first transaction of the current block. Copies share the file mapping
+    const SafeMemReader &currentReader() const {
+        return *reader;
+    }
+    
     void receivedFinishedTx(RawTransaction *tx) override {
+        releaseFinishedFiles(tx->txNum);
+    }
+    
+    void releaseFinishedFiles(uint32_t finishedTxNum) {
         auto it = files.begin();
         while (it != files.end()) {
-            if (it->second.second < tx->txNum) {
+            if (it->second.second < finishedTxNum) {
                 it = files.erase(it);
             } else {
                 ++it;
@@ -184,44 +182,40 @@ public:
 
 template <>
 class BlockFileReader<RPCTag> : public BlockFileReaderBase {
-    BitcoinAPI bapi;
+    std::shared_ptr<RPCBlockFetcher> fetcher;
+    // Loaded transactions point into the raw blocks, so each block is kept with the txNum following its last
+    // transaction until that transaction has left the pipeline
+    std::deque<std::pair<std::shared_ptr<const RawBlockData>, uint32_t>> liveBlocks;
+    SafeMemReader reader{nullptr, 0};
     
-    uint32_t firstTxNum;
-    uint32_t currentTxOffset;
     blocksci::BlockHeight currentHeight;
-    BlockInfo<RPCTag> block;
+    uint32_t currentTxNum;
     
     template<bool shouldAdvance>
     void nextTxImp(RawTransaction *tx, bool isSegwit) {
-        if (currentHeight == 0) {
-            tx->outputs.clear();
-            tx->outputs.reserve(1);
-            
-            auto scriptPubKey = blocksci::CScript() << ParseHex("040184a11fa689ad5123690c81a3a49c8f13f8d45bac857fbcbc8bc4a8ead3eb4b1ff4d4614fa18dce611aaf1f471216fe1b51851b4acf21b17fc45171ac7b13af") << blocksci::OP_CHECKSIG;
-            std::vector<unsigned char> scriptBytes(scriptPubKey.begin(), scriptPubKey.end());
-            //Set the desired initial block reward
-            tx->outputs.emplace_back(scriptBytes, 50 * 100000000.0);
-            tx->hash = blocksci::uint256S("0100000000000000000000000000000000000000000000000000000000000000");
-            tx->blockHeight = blocksci::BlockHeight{0};
-            tx->txNum = 0;
-            tx->isSegwit = false;
-        } else {
-            auto txinfo = bapi.getrawtransaction(block.tx[currentTxOffset], 1);
-            tx->load(txinfo, firstTxNum + currentTxOffset, currentHeight, isSegwit);
-        }
+        loadFileTx<shouldAdvance>(reader, tx, currentTxNum, currentHeight, isSegwit);
         if (shouldAdvance) {
-            currentTxOffset++;
+            currentTxNum++;
         }
     }
-    
+
 public:
-    BlockFileReader(const ParserConfiguration<RPCTag> &config, std::vector<BlockInfo<RPCTag>> &, uint32_t) : bapi(config.createBitcoinAPI()) {}
-    
-    void nextBlock(BlockInfo<RPCTag> &block_, uint32_t txNum) {
-        block = block_;
+    BlockFileReader(const ParserConfiguration<RPCTag> &config, std::vector<BlockInfo<RPCTag>> &blocksToAdd, uint32_t) : fetcher(std::make_shared<RPCBlockFetcher>(config, blocksToAdd, config.pipeline.rpcConnections)) {}
+    
+    // Must be called for every block passed to the constructor in the same order
+    void nextBlock(BlockInfo<RPCTag> &block, uint32_t firstTxNum) {
+        auto data = fetcher->next();
+        liveBlocks.emplace_back(data, firstTxNum + block.nTx);
+        reader = SafeMemReader{data->data(), data->size()};
+        reader.advance(sizeof(CBlockHeader));
+        auto txCount = reader.readVariableLengthInteger();
+        if (txCount != block.nTx) {
+            std::stringstream ss;
+            ss << "Error: Block " << block.height << " returned over RPC has " << txCount << " transactions instead of " << block.nTx << "\n";
+            throw std::runtime_error(ss.str());
+        }
         currentHeight = block.height;
-        firstTxNum = txNum;
-        currentTxOffset = 0;
+        currentTxNum = firstTxNum;
     }
     
     void nextTx(RawTransaction *tx, bool isSegwit) override {
@@ -232,34 +226,32 @@ public:
         nextTxImp<false>(tx, isSegwit);
     }
     
-    void receivedFinishedTx(RawTransaction *) override {}
+    void receivedFinishedTx(RawTransaction *tx) override {
+        while (!liveBlocks.empty() && liveBlocks.front().second < tx->txNum) {
+            liveBlocks.pop_front();
+        }
+    }
 };
 
 #endif
 
-std::vector<unsigned char> readNewBlock(uint32_t firstTxNum, const BlockInfoBase &block, BlockFileReaderBase &fileReader, NewBlocksFiles &files, const std::function<bool(RawTransaction *&tx)> &loadFunc, const std::function<void(RawTransaction *tx)> &outFunc) {
-    std::vector<unsigned char> coinbase;
-    bool isSegwit = false;
-    blocksci::uint256 nullHash;
-    nullHash.SetNull();
-    uint32_t headerSize = 80 + variableLengthIntSize(block.nTx);
-    uint32_t baseSize = headerSize;
-    uint32_t realSize = headerSize;
-    for (uint32_t j = 0; j < block.nTx; j++) {
-        RawTransaction *tx = nullptr;
-        if (!loadFunc(tx)) {
-            tx = new RawTransaction();
-        } else {
-            assert(tx);
-            fileReader.receivedFinishedTx(tx);
-        }
+namespace {
+    struct BlockTotals {
+        std::vector<unsigned char> coinbase;
+        uint32_t baseSize;
+        uint32_t realSize;
         
-        if (j == 0) {
-            fileReader.nextTxNoAdvance(tx, false);
-            isSegwit = checkSegwit(tx);
+        explicit BlockTotals(const BlockInfoBase &block) {
+            uint32_t headerSize = 80 + variableLengthIntSize(block.nTx);
+            baseSize = headerSize;
+            realSize = headerSize;
         }
-        
-        fileReader.nextTx(tx, isSegwit);
+    };
+    
+    // Writes the block level data of a loaded transaction and strips the coinbase input
+    void recordBlockTx(RawTransaction *tx, NewBlocksFiles &files, BlockTotals &totals) {
+        blocksci::uint256 nullHash;
+        nullHash.SetNull();
         
         files.sequenceFile.writeIndexGroup();
         for (auto &input : tx->inputs) {
@@ -268,21 +260,44 @@ std::vector<unsigned char> readNewBlock(uint32_t firstTxNum, const BlockInfoBase
         
         if (tx->inputs.size() == 1 && tx->inputs[0].rawOutputPointer.hash == nullHash) {
             auto scriptView = tx->inputs[0].getScriptView();
-            coinbase.assign(scriptView.begin(), scriptView.end());
+            totals.coinbase.assign(scriptView.begin(), scriptView.end());
             tx->inputs.clear();
         }
         
-        baseSize += tx->baseSize;
-        realSize += tx->realSize;
+        totals.baseSize += tx->baseSize;
+        totals.realSize += tx->realSize;
+    }
+    
+    void recordBlock(uint32_t firstTxNum, const BlockInfoBase &block, NewBlocksFiles &files, const BlockTotals &totals) {
+        blocksci::RawBlock blocksciBlock{firstTxNum, block.nTx, static_cast<uint32_t>(static_cast<int>(block.height)), block.hash, block.header.nVersion, block.header.nTime, block.header.nBits, block.header.nNonce, totals.realSize, totals.baseSize, files.blockCoinbaseFile.size()};
+        files.blockFile.write(blocksciBlock);
+        files.blockCoinbaseFile.write(totals.coinbase.begin(), totals.coinbase.end());
+    }
+}
+
+std::vector<unsigned char> readNewBlock(uint32_t firstTxNum, const BlockInfoBase &block, BlockFileReaderBase &fileReader, NewBlocksFiles &files, const std::function<bool(RawTransaction *&tx)> &loadFunc, const std::function<void(RawTransaction *tx)> &outFunc) {
+    BlockTotals totals(block);
+    bool isSegwit = false;
+    for (uint32_t j = 0; j < block.nTx; j++) {
+        // loadFunc always hands out a transaction, either a finished one to reuse or a new one owned by its pool
+        RawTransaction *tx = nullptr;
+        bool reused = loadFunc(tx);
+        assert(tx);
+        if (reused) {
+            fileReader.receivedFinishedTx(tx);
+        }
+        
+        if (j == 0) {
+            fileReader.nextTxNoAdvance(tx, false);
+            isSegwit = checkSegwit(tx);
+        }
         
+        fileReader.nextTx(tx, isSegwit);
+        recordBlockTx(tx, files, totals);
         outFunc(tx);
     }
-    blocksci::RawBlock blocksciBlock{firstTxNum, block.nTx, static_cast<uint32_t>(static_cast<int>(block.height)), block.hash, block.header.nVersion, block.header.nTime, block.header.nBits, block.header.nNonce, realSize, baseSize, files.blockCoinbaseFile.size()};
-    firstTxNum += block.nTx;
-    files.blockFile.write(blocksciBlock);
-    files.blockCoinbaseFile.write(coinbase.begin(), coinbase.end());
-    
-    return coinbase;
+    recordBlock(firstTxNum, block, files, totals);
+    return totals.coinbase;
 }
 
 void calculateHash(RawTransaction *tx, FixedSizeFileWriter<blocksci::uint256> &hashFile) {
@@ -299,7 +314,7 @@ void generateScriptOutputs(RawTransaction *tx) {
 
 void connectUTXOs(RawTransaction *tx, UTXOState &utxoState) {
     for (auto &input : tx->inputs) {
-        input.utxo = utxoState.erase(input.rawOutputPointer);
+        input.utxoSlot = utxoState.spend(input.rawOutputPointer, input.utxo);
     }
     
     for (uint16_t i = 0; i < tx->outputs.size(); i++) {
@@ -309,11 +324,75 @@ void connectUTXOs(RawTransaction *tx, UTXOState &utxoState) {
         if (isSpendable(type)) {
             UTXO utxo{output.value, tx->txNum, type};
             RawOutputPointer pointer{tx->hash, i};
-            utxoState.add(pointer, utxo);
+            output.utxoSlot = utxoState.add(pointer, utxo);
         }
     }
 }
 
+// Connects whole batches of transactions with the UTXO index shards divided between a group of threads.
+// Record slots for new outputs are allocated up front on the calling thread and every index operation of
+// the batch is queued on the shard of its outpoint in transaction order. Each worker then replays the
+// queues of its own shards. An outpoint always maps to the same shard, so an output which is created and
+// spent within one batch is inserted before it is removed exactly as in the sequential connectUTXOs.
+class ShardedUTXOConnector {
+    struct IndexOperation {
+        RawOutputPointer pointer;
+        // Input spending the outpoint, or nullptr to insert the output
+        RawInput *input;
+        RawOutput *output;
+    };
+    
+    UTXOState &utxoState;
+    WorkerGroup workers;
+    std::array<std::vector<IndexOperation>, UTXOState::shardCount> operations;
+
+public:
+    ShardedUTXOConnector(UTXOState &utxoState_, size_t threadCount) : utxoState(utxoState_), workers(std::min<size_t>(threadCount, UTXOState::shardCount)) {}
+    
+    void operator()(const std::vector<RawTransaction *> &batch) {
+        if (workers.size() == 1) {
+            for (auto tx : batch) {
+                connectUTXOs(tx, utxoState);
+            }
+            return;
+        }
+        
+        for (auto &shardOperations : operations) {
+            shardOperations.clear();
+        }
+        for (auto tx : batch) {
+            for (auto &input : tx->inputs) {
+                operations[UTXOState::shardOf(input.rawOutputPointer)].push_back({input.rawOutputPointer, &input, nullptr});
+            }
+            for (uint16_t i = 0; i < tx->outputs.size(); i++) {
+                auto &output = tx->outputs[i];
+                auto type = tx->scriptOutputs[i].type();
+                if (isSpendable(type)) {
+                    UTXO utxo{output.value, tx->txNum, type};
+                    RawOutputPointer pointer{tx->hash, i};
+                    output.utxoSlot = utxoState.allocate(pointer, utxo);
+                    operations[UTXOState::shardOf(pointer)].push_back({pointer, nullptr, &output});
+                }
+            }
+        }
+        
+        workers.run([&](size_t worker) {
+            for (size_t shard = worker; shard < UTXOState::shardCount; shard += workers.size()) {
+                auto shardNum = static_cast<uint32_t>(shard);
+                for (auto &operation : operations[shard]) {
+                    if (operation.input) {
+                        auto slot = utxoState.remove(shardNum, operation.pointer);
+                        operation.input->utxoSlot = slot;
+                        operation.input->utxo = utxoState.getUTXO(slot);
+                    } else if (!utxoState.insert(shardNum, operation.pointer, operation.output->utxoSlot)) {
+                        operation.output->utxoSlot = UTXOState::duplicateSlot;
+                    }
+                }
+            }
+        });
+    }
+};
+
 void generateScriptInput(RawTransaction *tx, UTXOAddressState &utxoAddressState) {
     tx->scriptInputs.clear();
     uint16_t i = 0;
@@ -341,21 +420,23 @@ void processAddresses(RawTransaction *tx, AddressState &addressState) {
     }
 }
 
-void recordAddresses(RawTransaction *tx, UTXOScriptState &state) {
+void recordAddresses(RawTransaction *tx, UTXOState &utxoState) {
     for (size_t i = 0; i < tx->inputs.size(); i++) {
         auto &input = tx->inputs[i];
         auto &scriptInput = tx->scriptInputs[i];
-        auto scriptNum = state.erase(input.getOutputPointer());
+        auto scriptNum = utxoState.release(input.utxoSlot);
         assert(scriptNum > 0);
         scriptInput.setScriptNum(scriptNum);
     }
     
-    uint16_t i = 0;
-    for (auto &scriptOutput : tx->scriptOutputs) {
+    for (size_t i = 0; i < tx->outputs.size(); i++) {
+        auto &scriptOutput = tx->scriptOutputs[i];
         auto scriptNum = scriptOutput.address().scriptNum;
         assert(scriptNum > 0);
-        state.add({tx->txNum, i}, scriptNum);
-        i++;
+        auto slot = tx->outputs[i].utxoSlot;
+        if (isSpendable(scriptOutput.type()) && slot != UTXOState::duplicateSlot) {
+            utxoState.setScriptNum(slot, scriptNum);
+        }
     }
 }
 
@@ -391,132 +472,528 @@ void serializeAddressess(RawTransaction *tx, AddressWriter &addressWriter) {
     }
 }
 
-void backUpdateTxes(const ParserConfigurationBase &config) {
-    {
-        blocksci::IndexedFileMapper<blocksci::AccessMode::readwrite, blocksci::RawTransaction> txFile(config.txFilePath());
-        
-        blocksci::FixedSizeFileMapper<OutputLinkData> linkDataFile_(config.txUpdatesFilePath());
-        const auto &linkDataFile = linkDataFile_;
-        
-        std::cout << "Back linking transactions" << std::endl;
-        
-        std::vector<OutputLinkData> updates;
-        updates.reserve(linkDataFile.size());
-        
-        for (uint32_t i = 0; i < linkDataFile.size(); i++) {
-            updates.push_back(*linkDataFile.getData(i));
+namespace {
+    uint64_t outputLinkKey(const OutputLinkData &update) {
+        return (static_cast<uint64_t>(update.pointer.txNum) << 16) | update.pointer.inoutNum;
+    }
+    
+    void backLinkTxes(const ParserConfigurationBase &config, boost::filesystem::path updatesPath) {
+        size_t threadCount = config.pipeline.backLinkThreads;
+        if (threadCount == 0) {
+            threadCount = std::max(std::thread::hardware_concurrency(), 1u);
         }
         
-        std::sort(updates.begin(), updates.end(), [](const auto& a, const auto& b) {
-            return a.pointer < b.pointer;
-        });
-        
-        auto progressBar = makeProgressBar(updates.size(), [=]() {});
+        {
+            blocksci::IndexedFileMapper<blocksci::AccessMode::readwrite, blocksci::RawTransaction> txFile(config.txFilePath());
+            
+            blocksci::FixedSizeFileMapper<OutputLinkData> linkDataFile_(updatesPath);
+            linkDataFile_.setAccessPattern(blocksci::AccessPattern::sequential);
+            const auto &linkDataFile = linkDataFile_;
+            
+            std::vector<OutputLinkData> updates;
+            updates.reserve(linkDataFile.size());
+            
+            uint64_t maxKey = 0;
+            for (uint32_t i = 0; i < linkDataFile.size(); i++) {
+                auto update = *linkDataFile.getData(i);
+                maxKey = std::max(maxKey, outputLinkKey(update));
+                updates.push_back(update);
+            }
+            
+            parallelRadixSort(updates, outputLinkKey, maxKey, threadCount);
+            
+            // Transactions are laid out in txNum order, so every thread patches its own region of the file
+            // from front to back
+            threadCount = std::max<size_t>(1, std::min(threadCount, updates.size() / 100000));
+            runOnThreads(threadCount, [&](size_t thread) {
+                auto begin = updates.begin() + static_cast<ptrdiff_t>(updates.size() * thread / threadCount);
+                auto end = updates.begin() + static_cast<ptrdiff_t>(updates.size() * (thread + 1) / threadCount);
+                for (auto it = begin; it != end; ++it) {
+                    auto tx = txFile.getData(it->pointer.txNum);
+                    auto &output = tx->getOutput(it->pointer.inoutNum);
+                    output.linkedTxNum = it->txNum;
+                }
+            });
+        }
         
-        uint32_t count = 0;
-        for (auto &update : updates) {
-            auto tx = txFile.getData(update.pointer.txNum);
-            auto &output = tx->getOutput(update.pointer.inoutNum);
-            output.linkedTxNum = update.txNum;
-            count++;
-            progressBar.update(count);
+        // The links are only saved in the transaction file once the updates file is gone
+        syncFiles(config.chainDirectory());
+        boost::filesystem::remove(updatesPath.concat(".dat"));
+    }
+    
+    // A pending file is only left behind if a previous run stopped while back linking in the background
+    void backLinkInterruptedTxes(const ParserConfigurationBase &config) {
+        auto pendingPath = config.txUpdatesPendingFilePath();
+        if (boost::filesystem::exists(boost::filesystem::path{pendingPath}.concat(".dat"))) {
+            backLinkTxes(config, pendingPath);
+        }
+    }
+}
+
+void backUpdateTxes(const ParserConfigurationBase &config) {
+    std::cout << "Back linking transactions" << std::endl;
+    backLinkInterruptedTxes(config);
+    backLinkTxes(config, config.txUpdatesFilePath());
+}
+
+std::future<void> backUpdateTxesAsync(const ParserConfigurationBase &config) {
+    backLinkInterruptedTxes(config);
+    auto updatesFile = config.txUpdatesFilePath().concat(".dat");
+    if (!boost::filesystem::exists(updatesFile)) {
+        return std::async(std::launch::deferred, []() {});
+    }
+    // The next chunk writes a fresh updates file while this one is processed
+    auto pendingPath = config.txUpdatesPendingFilePath();
+    boost::filesystem::rename(updatesFile, boost::filesystem::path{pendingPath}.concat(".dat"));
+    return std::async(std::launch::async, [&config, pendingPath]() {
+        backLinkTxes(config, pendingPath);
+    });
+}
+
+void repairBackLinks(const ParserConfigurationBase &config, uint32_t txCount) {
+    std::vector<boost::filesystem::path> updatesFiles;
+    for (auto &updatesPath : {config.txUpdatesPendingFilePath(), config.txUpdatesFilePath()}) {
+        if (boost::filesystem::exists(boost::filesystem::path{updatesPath}.concat(".dat"))) {
+            updatesFiles.push_back(updatesPath);
+        }
+    }
+    if (updatesFiles.empty()) {
+        return;
+    }
+    
+    {
+        blocksci::IndexedFileMapper<blocksci::AccessMode::readwrite, blocksci::RawTransaction> txFile(config.txFilePath());
+        for (auto &updatesPath : updatesFiles) {
+            const blocksci::FixedSizeFileMapper<OutputLinkData> linkDataFile(updatesPath);
+            for (uint32_t i = 0; i < linkDataFile.size(); i++) {
+                auto update = *linkDataFile.getData(i);
+                if (update.pointer.txNum >= txCount) {
+                    continue;
+                }
+                auto &output = txFile.getData(update.pointer.txNum)->getOutput(update.pointer.inoutNum);
+                if (update.txNum < txCount) {
+                    output.linkedTxNum = update.txNum;
+                } else if (output.linkedTxNum == update.txNum) {
+                    output.linkedTxNum = 0;
+                }
+            }
         }
     }
     
-    boost::filesystem::remove(config.txUpdatesFilePath().concat(".dat"));
+    syncFiles(config.chainDirectory());
+    for (auto &updatesPath : updatesFiles) {
+        boost::filesystem::remove(boost::filesystem::path{updatesPath}.concat(".dat"));
+    }
 }
 
-struct CompletionGuard {
-    CompletionGuard(std::atomic<bool> &isDone_) : isDone(isDone_) {}
+template <typename InputQueue, typename NextQueue = InputQueue>
+struct StepGuard {
+    StepGuard(InputQueue *inputQueue_, NextQueue *nextQueue_) : inputQueue(inputQueue_), nextQueue(nextQueue_) {}
     
-    ~CompletionGuard() {
-        isDone = true;
+    ~StepGuard() {
+        if (inputQueue) {
+            inputQueue->stopConsuming();
+        }
+        if (nextQueue) {
+            nextQueue->close();
+        }
     }
 private:
-    std::atomic<bool> &isDone;
-};
-
-struct NextQueueFinishedEarlyException : public std::runtime_error {
-    NextQueueFinishedEarlyException() : std::runtime_error("Next queue finished early") {}
-    NextQueueFinishedEarlyException(const NextQueueFinishedEarlyException &) = default;
-    virtual ~NextQueueFinishedEarlyException() = default;
+    InputQueue *inputQueue;
+    NextQueue *nextQueue;
 };
 
-template <typename ProcessFunc, typename AdvanceFunc>
+template <typename Queue, typename ProcessFunc, typename AdvanceFunc>
 class ProcessStep {
 public:
-    std::atomic<bool> &prevDone;
-    
-    std::atomic<bool> isDone{false};
-    boost::lockfree::spsc_queue<RawTransaction *, boost::lockfree::capacity<10000>> inputQueue;
-    
-    boost::lockfree::spsc_queue<RawTransaction *, boost::lockfree::capacity<10000>> *nextQueue;
-    std::atomic<bool> *nextDone;
+    Queue inputQueue;
+    Queue *nextQueue = nullptr;
     
     ProcessFunc func;
     AdvanceFunc advanceFunc;
     
-    long prevWaitCount = 0;
-    long nextWaitCount = 0;
+    TelemetryClock::duration runTime{0};
     
-    // AdvanceFunc
-    ProcessStep(std::atomic<bool> &prevDone_, ProcessFunc func_, AdvanceFunc advanceFunc_) : prevDone(prevDone_), func(func_), advanceFunc(advanceFunc_) {}
+    ProcessStep(size_t batchSize, ProcessFunc func_, AdvanceFunc advanceFunc_) : inputQueue(batchSize), func(func_), advanceFunc(advanceFunc_) {}
     
     template <typename PrevStep>
-    ProcessStep(PrevStep &prevStep, ProcessFunc func_, AdvanceFunc advanceFunc_) : ProcessStep(prevStep.isDone, func_, advanceFunc_) {
+    ProcessStep(PrevStep &prevStep, size_t batchSize, ProcessFunc func_, AdvanceFunc advanceFunc_) : ProcessStep(batchSize, func_, advanceFunc_) {
         prevStep.nextQueue = &inputQueue;
-        prevStep.nextDone = &isDone;
     }
     
     void operator()() {
-        using namespace std::chrono_literals;
-        CompletionGuard guard(isDone);
-        auto consumeAll = [&]() {
-            RawTransaction *rawTx = nullptr;
-            while (inputQueue.pop(rawTx)) {
+        StageTimer timer{runTime};
+        StepGuard<Queue> guard(&inputQueue, nextQueue);
+        std::vector<RawTransaction *> batch;
+        while (inputQueue.popBatch(batch)) {
+            for (auto rawTx : batch) {
                 func(rawTx);
                 if (advanceFunc(rawTx)) {
                     assert(rawTx);
-                    while (!nextQueue->push(rawTx)) {
-                        if (nextDone && *nextDone) {
-                            throw NextQueueFinishedEarlyException();
+                    assert(nextQueue);
+                    nextQueue->push(rawTx);
+                }
+            }
+            if (nextQueue) {
+                nextQueue->flush();
+            }
+        }
+    }
+};
+
+// Like ProcessStep, but hands each input batch to the function as a whole
+template <typename Queue, typename BatchFunc, typename AdvanceFunc>
+class BatchProcessStep {
+public:
+    Queue inputQueue;
+    Queue *nextQueue = nullptr;
+    
+    BatchFunc func;
+    AdvanceFunc advanceFunc;
+    
+    TelemetryClock::duration runTime{0};
+    
+    BatchProcessStep(size_t batchSize, BatchFunc func_, AdvanceFunc advanceFunc_) : inputQueue(batchSize), func(func_), advanceFunc(advanceFunc_) {}
+    
+    template <typename PrevStep>
+    BatchProcessStep(PrevStep &prevStep, size_t batchSize, BatchFunc func_, AdvanceFunc advanceFunc_) : BatchProcessStep(batchSize, func_, advanceFunc_) {
+        prevStep.nextQueue = &inputQueue;
+    }
+    
+    void operator()() {
+        StageTimer timer{runTime};
+        StepGuard<Queue> guard(&inputQueue, nextQueue);
+        std::vector<RawTransaction *> batch;
+        while (inputQueue.popBatch(batch)) {
+            func(batch);
+            for (auto rawTx : batch) {
+                if (advanceFunc(rawTx)) {
+                    assert(rawTx);
+                    assert(nextQueue);
+                    nextQueue->push(rawTx);
+                }
+            }
+            if (nextQueue) {
+                nextQueue->flush();
+            }
+        }
+    }
+};
+
+// Runs a stateless function over each input batch on several replica threads. Whole input batches are
+// handed to the replicas in round robin order and collected again in the same order, so transactions
+// leave the step in exactly the order they arrived. OrderedFunc is then applied sequentially on the
+// merging thread and returns whether the transaction should be forwarded.
+template <typename Queue, typename ProcessFunc, typename OrderedFunc>
+class ReplicatedProcessStep {
+    using Batch = std::vector<RawTransaction *>;
+    using BatchSlots = BatchQueue<Batch>;
+    
+    struct SlotsGuard {
+        std::vector<std::unique_ptr<BatchSlots>> &slots;
+        void (BatchSlots::*finish)();
+        ~SlotsGuard() {
+            for (auto &slot : slots) {
+                (slot.get()->*finish)();
+            }
+        }
+    };
+    
+    size_t replicaCount;
+    
+    void runSingle() {
+        StepGuard<Queue> guard(&inputQueue, nextQueue);
+        Batch batch;
+        while (inputQueue.popBatch(batch)) {
+            func(batch);
+            for (auto rawTx : batch) {
+                if (orderedFunc(rawTx)) {
+                    nextQueue->push(rawTx);
+                }
+            }
+            nextQueue->flush();
+        }
+    }
+    
+    void runReplicated() {
+        StepGuard<Queue> guard(&inputQueue, nextQueue);
+        std::vector<std::unique_ptr<BatchSlots>> workSlots;
+        std::vector<std::unique_ptr<BatchSlots>> doneSlots;
+        for (size_t i = 0; i < replicaCount; i++) {
+            workSlots.push_back(std::make_unique<BatchSlots>(1, 2));
+            doneSlots.push_back(std::make_unique<BatchSlots>(1, 2));
+        }
+        
+        replicaTimes.assign(replicaCount, ReplicaTimes{});
+        std::vector<std::future<void>> replicas;
+        for (size_t i = 0; i < replicaCount; i++) {
+            replicas.push_back(std::async(std::launch::async, [&, i] {
+                StepGuard<BatchSlots> replicaGuard(workSlots[i].get(), doneSlots[i].get());
+                auto &times = replicaTimes[i];
+                std::vector<Batch> work;
+                while (workSlots[i]->popBatch(work)) {
+                    for (auto &batch : work) {
+                        {
+                            StageTimer funcTimer{times.busy};
+                            func(batch);
                         }
-                        nextWaitCount++;
-                        std::this_thread::sleep_for(5ms);
+                        times.batchCount++;
+                        doneSlots[i]->push(std::move(batch));
                     }
                 }
+            }));
+        }
+        
+        auto merger = std::async(std::launch::async, [&] {
+            // Once the merger stops, no replica may stay blocked on a full slot
+            SlotsGuard mergeGuard{doneSlots, &BatchSlots::stopConsuming};
+            std::vector<Batch> done;
+            size_t replica = 0;
+            while (doneSlots[replica]->popBatch(done)) {
+                for (auto &batch : done) {
+                    for (auto rawTx : batch) {
+                        if (orderedFunc(rawTx)) {
+                            nextQueue->push(rawTx);
+                        }
+                    }
+                }
+                nextQueue->flush();
+                replica = (replica + 1) % replicaCount;
             }
-        };
+        });
+        
+        {
+            SlotsGuard dispatchGuard{workSlots, &BatchSlots::close};
+            
+            Batch batch;
+            size_t replica = 0;
+            while (inputQueue.popBatch(batch)) {
+                workSlots[replica]->push(std::move(batch));
+                batch = Batch{};
+                replica = (replica + 1) % replicaCount;
+            }
+        }
         
-        while (!prevDone) {
-            consumeAll();
-            prevWaitCount++;
-            std::this_thread::sleep_for(5ms);
+        for (auto &replica : replicas) {
+            replica.get();
         }
+        merger.get();
         
-        consumeAll();
+        for (size_t i = 0; i < replicaCount; i++) {
+            replicaTimes[i].idle = workSlots[i]->stats.popWaitTime;
+            replicaTimes[i].blocked = doneSlots[i]->stats.pushWaitTime;
+            replicaTimes[i].dispatchBlocked = workSlots[i]->stats.pushWaitTime;
+        }
+    }
+
+public:
+    Queue inputQueue;
+    Queue *nextQueue = nullptr;
+    
+    ProcessFunc func;
+    OrderedFunc orderedFunc;
+    
+    TelemetryClock::duration runTime{0};
+    // Only filled in when the step ran on more than one replica
+    std::vector<ReplicaTimes> replicaTimes;
+    
+    ReplicatedProcessStep(size_t batchSize, size_t replicaCount_, ProcessFunc func_, OrderedFunc orderedFunc_) : replicaCount(std::max(replicaCount_, size_t{1})), inputQueue(batchSize), func(func_), orderedFunc(orderedFunc_) {}
+    
+    template <typename PrevStep>
+    ReplicatedProcessStep(PrevStep &prevStep, size_t batchSize, size_t replicaCount_, ProcessFunc func_, OrderedFunc orderedFunc_) : ReplicatedProcessStep(batchSize, replicaCount_, func_, orderedFunc_) {
+        prevStep.nextQueue = &inputQueue;
+    }
+    
+    void operator()() {
+        assert(nextQueue);
+        StageTimer timer{runTime};
+        if (replicaCount == 1) {
+            runSingle();
+        } else {
+            runReplicated();
+        }
     }
 };
 
-template<typename ProcessFunc, typename AdvanceFunc, typename PrevStep>
-ProcessStep<ProcessFunc, AdvanceFunc> makeProcessStep(PrevStep &prevStep, ProcessFunc func, AdvanceFunc advanceFunc) {
-    return ProcessStep<ProcessFunc, AdvanceFunc>(prevStep, func, advanceFunc);
+using ImportOutFunc = std::function<void(RawTransaction *tx)>;
+using ImportBlockFunc = std::function<void()>;
+
+template <typename ParseTag>
+void importBlocksSequential(std::vector<BlockInfo<ParseTag>> &blocks, uint32_t &txNum, BlockFileReader<ParseTag> &fileReader, NewBlocksFiles &files, TransactionPool &pool, const ImportOutFunc &outFunc, const ImportBlockFunc &blockFinishedFunc) {
+    auto loadFinishedTx = [&](RawTransaction *&tx) {
+        return pool.acquire(tx);
+    };
+    
+    for (auto &block : blocks) {
+        fileReader.nextBlock(block, txNum);
+        readNewBlock(txNum, block, fileReader, files, loadFinishedTx, outFunc);
+        blockFinishedFunc();
+        txNum += block.nTx;
+    }
+}
+
+// Blocks can only be loaded in parallel when they are read from disk
+template <typename ParseTag>
+void importBlocksParallel(const ParserConfiguration<ParseTag> &, std::vector<BlockInfo<ParseTag>> &blocks, uint32_t &txNum, BlockFileReader<ParseTag> &fileReader, NewBlocksFiles &files, TransactionPool &pool, const ImportOutFunc &outFunc, const ImportBlockFunc &blockFinishedFunc) {
+    importBlocksSequential(blocks, txNum, fileReader, files, pool, outFunc, blockFinishedFunc);
+}
+
+#ifdef BLOCKSCI_FILE_PARSER
+
+// Loads whole blocks on a pool of worker threads. Block i goes to worker i % workerCount and the loaded
+// blocks are collected from the workers in the same order, so transactions are released in txNum order.
+// Block file mappings are shared with the workers and released by the calling thread as before.
+void importBlocksParallel(const ParserConfiguration<FileTag> &config, std::vector<BlockInfo<FileTag>> &blocks, uint32_t &txNum, BlockFileReader<FileTag> &fileReader, NewBlocksFiles &files, TransactionPool &pool, const ImportOutFunc &outFunc, const ImportBlockFunc &blockFinishedFunc) {
+    struct BlockJob {
+        SafeMemReader reader;
+        const BlockInfo<FileTag> *block;
+        uint32_t firstTxNum;
+    };
+    
+    struct LoadedBlock {
+        std::vector<RawTransaction *> txes;
+        // Highest txNum of a recycled transaction, all earlier transactions have left the pipeline
+        uint32_t finishedTxNum = 0;
+    };
+    
+    using JobQueue = BatchQueue<BlockJob>;
+    using LoadedQueue = BatchQueue<LoadedBlock>;
+    
+    size_t workerCount = config.pipeline.importThreads;
+    // Number of blocks that may be loaded ahead of the block being handed to the pipeline
+    size_t window = workerCount * 2;
+    
+    std::vector<std::unique_ptr<JobQueue>> jobQueues;
+    std::vector<std::unique_ptr<LoadedQueue>> loadedQueues;
+    for (size_t i = 0; i < workerCount; i++) {
+        jobQueues.push_back(std::make_unique<JobQueue>(1, window));
+        loadedQueues.push_back(std::make_unique<LoadedQueue>(1, window));
+    }
+    
+    auto loadBlock = [&](BlockJob &job) {
+        LoadedBlock loaded;
+        loaded.txes.reserve(job.block->nTx);
+        bool isSegwit = false;
+        for (uint32_t j = 0; j < job.block->nTx; j++) {
+            RawTransaction *tx = nullptr;
+            if (pool.acquire(tx)) {
+                loaded.finishedTxNum = std::max(loaded.finishedTxNum, tx->txNum);
+            }
+            
+            if (j == 0) {
+                loadFileTx<false>(job.reader, tx, job.firstTxNum, job.block->height, false);
+                isSegwit = checkSegwit(tx);
+            }
+            
+            loadFileTx<true>(job.reader, tx, job.firstTxNum + j, job.block->height, isSegwit);
+            loaded.txes.push_back(tx);
+        }
+        return loaded;
+    };
+    
+    std::vector<std::future<void>> workers;
+    for (size_t i = 0; i < workerCount; i++) {
+        workers.push_back(std::async(std::launch::async, [&, i] {
+            StepGuard<JobQueue, LoadedQueue> guard(jobQueues[i].get(), loadedQueues[i].get());
+            std::vector<BlockJob> jobs;
+            while (jobQueues[i]->popBatch(jobs)) {
+                for (auto &job : jobs) {
+                    loadedQueues[i]->push(loadBlock(job));
+                }
+            }
+        }));
+    }
+    
+    auto stopWorkers = [&]() {
+        for (size_t i = 0; i < workerCount; i++) {
+            jobQueues[i]->close();
+            loadedQueues[i]->stopConsuming();
+        }
+    };
+    
+    try {
+        size_t dispatched = 0;
+        uint32_t dispatchTxNum = txNum;
+        std::vector<LoadedBlock> loadedBatch;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            while (dispatched < blocks.size() && dispatched < i + window) {
+                auto &block = blocks[dispatched];
+                fileReader.nextBlock(block, dispatchTxNum);
+                jobQueues[dispatched % workerCount]->push(BlockJob{fileReader.currentReader(), &block, dispatchTxNum});
+                dispatchTxNum += block.nTx;
+                dispatched++;
+                if (dispatched == blocks.size()) {
+                    for (auto &jobQueue : jobQueues) {
+                        jobQueue->close();
+                    }
+                }
+            }
+            
+            if (!loadedQueues[i % workerCount]->popBatch(loadedBatch)) {
+                // The worker failed, its exception is rethrown below
+                break;
+            }
+            assert(loadedBatch.size() == 1);
+            auto &loaded = loadedBatch.front();
+            if (loaded.finishedTxNum > 0) {
+                fileReader.releaseFinishedFiles(loaded.finishedTxNum);
+            }
+            
+            auto &block = blocks[i];
+            BlockTotals totals(block);
+            for (auto tx : loaded.txes) {
+                recordBlockTx(tx, files, totals);
+                outFunc(tx);
+            }
+            recordBlock(txNum, block, files, totals);
+            blockFinishedFunc();
+            txNum += block.nTx;
+        }
+    } catch (...) {
+        stopWorkers();
+        for (auto &worker : workers) {
+            worker.get();
+        }
+        throw;
+    }
+    
+    stopWorkers();
+    for (auto &worker : workers) {
+        worker.get();
+    }
 }
 
-template<typename ProcessFunc, typename AdvanceFunc>
-ProcessStep<ProcessFunc, AdvanceFunc> makeProcessStep(std::atomic<bool> &prevDone, ProcessFunc func, AdvanceFunc advanceFunc) {
-    return ProcessStep<ProcessFunc, AdvanceFunc>(prevDone, func, advanceFunc);
+#endif
+
+namespace {
+    FileWriterOptions fileWriterOptions(const ParserConfigurationBase &config) {
+        FileWriterOptions options;
+        options.maxBufferedBytes = config.pipeline.writeBufferMB << 20;
+        return options;
+    }
 }
 
-NewBlocksFiles::NewBlocksFiles(const ParserConfigurationBase &config) : blockCoinbaseFile(config.blockCoinbaseFilePath()), blockFile(config.blockFilePath()), sequenceFile(config.sequenceFilePath()) {}
+NewBlocksFiles::NewBlocksFiles(const ParserConfigurationBase &config) : blockCoinbaseFile(config.blockCoinbaseFilePath(), fileWriterOptions(config)), blockFile(config.blockFilePath(), fileWriterOptions(config)), sequenceFile(config.sequenceFilePath(), fileWriterOptions(config)) {}
 
 template <typename ParseTag>
-void BlockProcessor::addNewBlocks(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> blocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState, UTXOScriptState &utxoScriptState) {
+void BlockProcessor::addNewBlocks(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> blocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState) {
+    switch (config.pipeline.mode) {
+        case PipelineMode::polling:
+            addNewBlocksImp<PollingQueue<RawTransaction *>>(config, std::move(blocks), utxoState, utxoAddressState, addressState);
+            break;
+        case PipelineMode::batched:
+            addNewBlocksImp<BatchQueue<RawTransaction *>>(config, std::move(blocks), utxoState, utxoAddressState, addressState);
+            break;
+    }
+}
+
+template <typename Queue, typename ParseTag>
+void BlockProcessor::addNewBlocksImp(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> blocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState) {
     
-    std::atomic<bool> rawDone{false};
-    boost::lockfree::spsc_queue<RawTransaction *, boost::lockfree::capacity<10000>> finished_transaction_queue;
+    TransactionPool transactionPool;
+    PipelineTelemetry telemetry;
     
-    FixedSizeFileWriter<blocksci::uint256> hashFile{config.txHashesFilePath()};
+    FixedSizeFileWriter<blocksci::uint256> hashFile{config.txHashesFilePath(), fileWriterOptions(config)};
     AddressWriter addressWriter{config};
     
     auto progressBar = makeProgressBar(totalTxCount, [=](RawTransaction *tx) {
@@ -526,32 +1003,44 @@ void BlockProcessor::addNewBlocks(const ParserConfiguration<ParseTag> &config, s
     
     auto advanceFunc = [](RawTransaction *) { return true; };
     
-    auto calculateHashesFunc = [&](RawTransaction *tx) {
-        calculateHash(tx, hashFile);
+    // Hashes are computed by the replicas a whole batch at a time and written out in order by the merging thread
+    auto hashBackend = bestSHA256Backend();
+    auto calculateHashesFunc = [hashBackend](const std::vector<RawTransaction *> &batch) {
+        calculateHashes(batch, hashBackend);
     };
     
-    auto generateScriptOutputsFunc = [](RawTransaction *tx) {
-        generateScriptOutputs(tx);
+    auto writeHashesFunc = [&](RawTransaction *tx) {
+        hashFile.write(tx->hash);
+        return true;
     };
     
-    auto connectUTXOsFunc = [&](RawTransaction *tx) {
-        connectUTXOs(tx, utxoState);
+    auto generateScriptOutputsFunc = [](const std::vector<RawTransaction *> &batch) {
+        for (auto tx : batch) {
+            generateScriptOutputs(tx);
+        }
+    };
+    
+    ShardedUTXOConnector utxoConnector{utxoState, config.pipeline.utxoThreads};
+    auto connectUTXOsFunc = [&](const std::vector<RawTransaction *> &batch) {
+        utxoConnector(batch);
     };
     
     auto generateScriptInputFunc = [&](RawTransaction *tx) {
         generateScriptInput(tx, utxoAddressState);
     };
     
+    UndoJournalWriter undoJournal{config, addressState};
     auto processAddressFunc = [&](RawTransaction *tx) {
+        undoJournal.addTx(*tx);
         processAddresses(tx, addressState);
     };
     
     auto recordAddressesFunc = [&](RawTransaction *tx) {
-        recordAddresses(tx, utxoScriptState);
+        recordAddresses(tx, utxoState);
     };
     
-    IndexedFileWriter<1> txFile(config.txFilePath());
-    FixedSizeFileWriter<OutputLinkData> linkDataFile(config.txUpdatesFilePath());
+    IndexedFileWriter<1> txFile(config.txFilePath(), fileWriterOptions(config));
+    FixedSizeFileWriter<OutputLinkData> linkDataFile(config.txUpdatesFilePath(), fileWriterOptions(config));
     
     auto serializeTransactionFunc = [&](RawTransaction *tx) {
         serializeTransaction(tx, txFile, linkDataFile);
@@ -559,51 +1048,47 @@ void BlockProcessor::addNewBlocks(const ParserConfiguration<ParseTag> &config, s
     
     auto serializeAddressFunc = [&](RawTransaction *tx) {
         serializeAddressess(tx, addressWriter);
+        telemetry.recordTransaction(tx->realSize);
         progressBar.update(tx->txNum - startingTxCount, tx);
     };
     
+    // The last step hands transactions straight back to the importer for reuse
     auto serializeAddressAdvanceFunc = [&](RawTransaction *tx) {
-        bool shouldSend = tx->realSize < 800 && finished_transaction_queue.write_available() >= 1;
-        if (!shouldSend) delete tx;
-        return shouldSend;
+        transactionPool.release(tx);
+        return false;
     };
     
-    ProcessStep<decltype(calculateHashesFunc), decltype(advanceFunc)> calculateHashesStep(rawDone, calculateHashesFunc, advanceFunc);
-    ProcessStep<decltype(generateScriptOutputsFunc), decltype(advanceFunc)> generateScriptOutputsStep(calculateHashesStep, generateScriptOutputsFunc, advanceFunc);
-    ProcessStep<decltype(connectUTXOsFunc), decltype(advanceFunc)> connectUTXOsStep(generateScriptOutputsStep, connectUTXOsFunc, advanceFunc);
-    ProcessStep<decltype(generateScriptInputFunc), decltype(advanceFunc)> generateScriptInputStep(connectUTXOsStep, generateScriptInputFunc, advanceFunc);
-    ProcessStep<decltype(processAddressFunc), decltype(advanceFunc)> processAddressStep(generateScriptInputStep, processAddressFunc, advanceFunc);
-    ProcessStep<decltype(recordAddressesFunc), decltype(advanceFunc)> recordAddressesStep(processAddressStep, recordAddressesFunc, advanceFunc);
-    ProcessStep<decltype(serializeTransactionFunc), decltype(advanceFunc)> serializeTransactionStep(recordAddressesStep, serializeTransactionFunc, advanceFunc);
-    ProcessStep<decltype(serializeAddressFunc), decltype(serializeAddressAdvanceFunc)> serializeAddressStep(serializeTransactionStep, serializeAddressFunc, serializeAddressAdvanceFunc);
-    serializeAddressStep.nextQueue = &finished_transaction_queue;
-    
-    long nextWaitCount = 0;
-    
+    size_t batchSize = config.pipeline.batchSize;
+    ReplicatedProcessStep<Queue, decltype(calculateHashesFunc), decltype(writeHashesFunc)> calculateHashesStep(batchSize, config.pipeline.hashReplicas, calculateHashesFunc, writeHashesFunc);
+    ReplicatedProcessStep<Queue, decltype(generateScriptOutputsFunc), decltype(advanceFunc)> generateScriptOutputsStep(calculateHashesStep, batchSize, config.pipeline.scriptOutputReplicas, generateScriptOutputsFunc, advanceFunc);
+    BatchProcessStep<Queue, decltype(connectUTXOsFunc), decltype(advanceFunc)> connectUTXOsStep(generateScriptOutputsStep, batchSize, connectUTXOsFunc, advanceFunc);
+    ProcessStep<Queue, decltype(generateScriptInputFunc), decltype(advanceFunc)> generateScriptInputStep(connectUTXOsStep, batchSize, generateScriptInputFunc, advanceFunc);
+    ProcessStep<Queue, decltype(processAddressFunc), decltype(advanceFunc)> processAddressStep(generateScriptInputStep, batchSize, processAddressFunc, advanceFunc);
+    ProcessStep<Queue, decltype(recordAddressesFunc), decltype(advanceFunc)> recordAddressesStep(processAddressStep, batchSize, recordAddressesFunc, advanceFunc);
+    ProcessStep<Queue, decltype(serializeTransactionFunc), decltype(advanceFunc)> serializeTransactionStep(recordAddressesStep, batchSize, serializeTransactionFunc, advanceFunc);
+    ProcessStep<Queue, decltype(serializeAddressFunc), decltype(serializeAddressAdvanceFunc)> serializeAddressStep(serializeTransactionStep, batchSize, serializeAddressFunc, serializeAddressAdvanceFunc);
+    
+    TelemetryClock::duration importerRunTime{0};
     auto importer = std::async(std::launch::async, [&] {
-        CompletionGuard guard(rawDone);
-        auto loadFinishedTx = [&](RawTransaction *&tx) {
-            return finished_transaction_queue.pop(tx);
-        };
+        StageTimer timer{importerRunTime};
+        auto &outQueue = calculateHashesStep.inputQueue;
+        StepGuard<Queue> guard(nullptr, &outQueue);
         
         auto outFunc = [&](RawTransaction *tx) {
-            using namespace std::chrono_literals;
-            while (!calculateHashesStep.inputQueue.push(tx)) {
-                if (calculateHashesStep.isDone) {
-                    throw NextQueueFinishedEarlyException();
-                }
-                nextWaitCount++;
-                std::this_thread::sleep_for(5ms);
-            }
+            outQueue.push(tx);
+        };
+        
+        auto blockFinishedFunc = [&]() {
+            outQueue.flush();
         };
         
         BlockFileReader<ParseTag> fileReader(config, blocks, currentTxNum);
         NewBlocksFiles files(config);
         
-        for (auto &block : blocks) {
-            fileReader.nextBlock(block, currentTxNum);
-            readNewBlock(currentTxNum, block, fileReader, files, loadFinishedTx, outFunc);
-            currentTxNum += block.nTx;
+        if (config.pipeline.importThreads > 1) {
+            importBlocksParallel(config, blocks, currentTxNum, fileReader, files, transactionPool, outFunc, blockFinishedFunc);
+        } else {
+            importBlocksSequential(blocks, currentTxNum, fileReader, files, transactionPool, outFunc, blockFinishedFunc);
         }
         
         return fileReader;
@@ -651,33 +1136,33 @@ void BlockProcessor::addNewBlocks(const ParserConfiguration<ParseTag> &config, s
     recordAddressesStepFuture.get();
     serializeTransactionStepFuture.get();
     serializeAddressStepFuture.get();
-    
-//    std::cout << "generateTxesStep:" << nextWaitCount << "\n";
-//    std::cout << "calculateHashesStep: " << calculateHashesStep.prevWaitCount << " " << calculateHashesStep.nextWaitCount << "\n";
-//    std::cout << "generateScriptOutputsStep: " << generateScriptOutputsStep.prevWaitCount << " " << generateScriptOutputsStep.nextWaitCount << "\n";
-//    std::cout << "connectUTXOsStep: " << connectUTXOsStep.prevWaitCount << " " << connectUTXOsStep.nextWaitCount << "\n";
-//    std::cout << "generateScriptInputStep: " << generateScriptInputStep.prevWaitCount << " " << generateScriptInputStep.nextWaitCount << "\n";
-//    std::cout << "processAddressStep: " << processAddressStep.prevWaitCount << " " << processAddressStep.nextWaitCount << "\n";
-//    std::cout << "recordAddressesStep: " << recordAddressesStep.prevWaitCount << " " << recordAddressesStep.nextWaitCount << "\n";
-//    std::cout << "serializeTransactionStep: " << serializeTransactionStep.prevWaitCount << " " << serializeTransactionStep.nextWaitCount << "\n";
-//    std::cout << "serializeAddressStep: " << serializeAddressStep.prevWaitCount << " " << serializeAddressStep.nextWaitCount << "\n";
-    
-    finished_transaction_queue.consume_all([](RawTransaction *tx) {
-        delete tx;
-    });
+    undoJournal.close();
+    
+    telemetry.finish();
+    telemetry.addStage("importer", importerRunTime, nullptr, &calculateHashesStep.inputQueue.stats);
+    telemetry.addReplicatedStage("calculateHashes", calculateHashesStep.runTime, calculateHashesStep.replicaTimes, &calculateHashesStep.inputQueue.stats, &generateScriptOutputsStep.inputQueue.stats);
+    telemetry.addReplicatedStage("generateScriptOutputs", generateScriptOutputsStep.runTime, generateScriptOutputsStep.replicaTimes, &generateScriptOutputsStep.inputQueue.stats, &connectUTXOsStep.inputQueue.stats);
+    telemetry.addStage("connectUTXOs", connectUTXOsStep.runTime, &connectUTXOsStep.inputQueue.stats, &generateScriptInputStep.inputQueue.stats);
+    telemetry.addStage("generateScriptInput", generateScriptInputStep.runTime, &generateScriptInputStep.inputQueue.stats, &processAddressStep.inputQueue.stats);
+    telemetry.addStage("processAddresses", processAddressStep.runTime, &processAddressStep.inputQueue.stats, &recordAddressesStep.inputQueue.stats);
+    telemetry.addStage("recordAddresses", recordAddressesStep.runTime, &recordAddressesStep.inputQueue.stats, &serializeTransactionStep.inputQueue.stats);
+    telemetry.addStage("serializeTransaction", serializeTransactionStep.runTime, &serializeTransactionStep.inputQueue.stats, &serializeAddressStep.inputQueue.stats);
+    telemetry.addStage("serializeAddresses", serializeAddressStep.runTime, &serializeAddressStep.inputQueue.stats, nullptr);
+    telemetry.setTransactionPoolStats(transactionPool.stats());
+    telemetry.write(config);
 }
 
 
 template <typename ParseTag>
-void BlockProcessor::addNewBlocksSingle(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> blocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState, UTXOScriptState &utxoScriptState) {
+void BlockProcessor::addNewBlocksSingle(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> blocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState) {
     
     RawTransaction realTx;
     auto loadFinishedTx = [&](RawTransaction *&tx) {
         tx = &realTx;
         return true;
     };
-        
-    FixedSizeFileWriter<blocksci::uint256> hashFile{config.txHashesFilePath()};
+    
+    FixedSizeFileWriter<blocksci::uint256> hashFile{config.txHashesFilePath(), fileWriterOptions(config)};
     AddressWriter addressWriter{config};
     blocksci::ECCVerifyHandle handle;
     
@@ -686,20 +1171,22 @@ void BlockProcessor::addNewBlocksSingle(const ParserConfiguration<ParseTag> &con
         std::cout << ", Block " << blockHeight << "/" << maxBlockHeight;
     });
     
-    FixedSizeFileWriter<OutputLinkData> linkDataFile(config.txUpdatesFilePath());
-    IndexedFileWriter<1> txFile(config.txFilePath());
-
+    FixedSizeFileWriter<OutputLinkData> linkDataFile(config.txUpdatesFilePath(), fileWriterOptions(config));
+    IndexedFileWriter<1> txFile(config.txFilePath(), fileWriterOptions(config));
+    UndoJournalWriter undoJournal{config, addressState};
+    
     auto outFunc = [&](RawTransaction *tx) {
         calculateHash(tx, hashFile);
         connectUTXOs(tx, utxoState);
         generateScriptInput(tx, utxoAddressState);
+        undoJournal.addTx(*tx);
         processAddresses(tx, addressState);
-        recordAddresses(tx, utxoScriptState);
+        recordAddresses(tx, utxoState);
         serializeTransaction(tx, txFile, linkDataFile);
         serializeAddressess(tx, addressWriter);
         progressBar.update(tx->txNum - startingTxCount, tx);
     };
-        
+    
     BlockFileReader<ParseTag> fileReader(config, blocks, currentTxNum);
     NewBlocksFiles files(config);
     
@@ -708,13 +1195,14 @@ void BlockProcessor::addNewBlocksSingle(const ParserConfiguration<ParseTag> &con
         readNewBlock(currentTxNum, block, fileReader, files, loadFinishedTx, outFunc);
         currentTxNum += block.nTx;
     }
+    undoJournal.close();
 }
 
 #ifdef BLOCKSCI_FILE_PARSER
-template void BlockProcessor::addNewBlocks(const ParserConfiguration<FileTag> &config, std::vector<BlockInfo<FileTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState, UTXOScriptState &utxoScriptState);
-template void BlockProcessor::addNewBlocksSingle(const ParserConfiguration<FileTag> &config, std::vector<BlockInfo<FileTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState, UTXOScriptState &utxoScriptState);
+template void BlockProcessor::addNewBlocks(const ParserConfiguration<FileTag> &config, std::vector<BlockInfo<FileTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState);
+template void BlockProcessor::addNewBlocksSingle(const ParserConfiguration<FileTag> &config, std::vector<BlockInfo<FileTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState);
 #endif
 #ifdef BLOCKSCI_RPC_PARSER
-template void BlockProcessor::addNewBlocks(const ParserConfiguration<RPCTag> &config, std::vector<BlockInfo<RPCTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState, UTXOScriptState &utxoScriptState);
-template void BlockProcessor::addNewBlocksSingle(const ParserConfiguration<RPCTag> &config, std::vector<BlockInfo<RPCTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState, UTXOScriptState &utxoScriptState);
+template void BlockProcessor::addNewBlocks(const ParserConfiguration<RPCTag> &config, std::vector<BlockInfo<RPCTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState);
+template void BlockProcessor::addNewBlocksSingle(const ParserConfiguration<RPCTag> &config, std::vector<BlockInfo<RPCTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState);
 #endif
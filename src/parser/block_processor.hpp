@@ -22,12 +22,14 @@
 #include <blocksci/scripts/scripts_fwd.hpp>
 #include <blocksci/util/bitcoin_uint256.hpp>
 
+#include <future>
+
 class BlockFileReaderBase {
 public:
     BlockFileReaderBase() = default;
     BlockFileReaderBase(const BlockFileReaderBase &) = default;
     virtual ~BlockFileReaderBase();
-
+    
     virtual void nextTx(RawTransaction *tx, bool isSegwit) = 0;
     virtual void nextTxNoAdvance(RawTransaction *tx, bool isSegwit) = 0;
     virtual void receivedFinishedTx(RawTransaction *) = 0;
@@ -53,9 +55,15 @@ void connectUTXOs(RawTransaction *tx, UTXOState &utxoState);
 void serializeTransaction(RawTransaction *tx, IndexedFileWriter<1> &txFile, FixedSizeFileWriter<OutputLinkData> &linkDataFile);
 void generateScriptInput(RawTransaction *tx, UTXOAddressState &utxoAddressState);
 void processAddresses(RawTransaction *tx, AddressState &addressState);
-void recordAddresses(RawTransaction *tx, UTXOScriptState &state);
+void recordAddresses(RawTransaction *tx, UTXOState &utxoState);
 void serializeAddressess(RawTransaction *tx, AddressWriter &addressWriter);
 void backUpdateTxes(const ParserConfigurationBase &config);
+// Back links the current chunk on a background thread so the next chunk can be parsed in the meantime.
+// config must outlive the returned future
+std::future<void> backUpdateTxesAsync(const ParserConfigurationBase &config);
+// Finishes the back links an interrupted run left in its updates files for spenders before txCount and removes
+// any link it already made to a later one
+void repairBackLinks(const ParserConfigurationBase &config, uint32_t txCount);
 
 
 class BlockProcessor {
@@ -64,16 +72,19 @@ class BlockProcessor {
     uint32_t currentTxNum;
     uint32_t totalTxCount;
     blocksci::BlockHeight maxBlockHeight;
+    
+    template <typename Queue, typename ParseTag>
+    void addNewBlocksImp(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState);
 
 public:
     
     BlockProcessor(uint32_t startingTxCount, uint32_t totalTxCount, blocksci::BlockHeight maxBlockHeight);
     
     template <typename ParseTag>
-    void addNewBlocks(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState, UTXOScriptState &utxoScriptState);
-
+    void addNewBlocks(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState);
+    
     template <typename ParseTag>
-    void addNewBlocksSingle(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState, UTXOScriptState &utxoScriptState);
+    void addNewBlocksSingle(const ParserConfiguration<ParseTag> &config, std::vector<BlockInfo<ParseTag>> nextBlocks, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState);
 };
 
 
@@ -13,11 +13,17 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
 
 #include <fstream>
 #include <array>
 #include <cmath>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BLOCKSCI_BLOOM_AVX2
+#include <immintrin.h>
+#endif
+
 
 constexpr double Log2 = 0.69314718056;
 constexpr double Log2Squared = Log2 * Log2;
@@ -35,6 +41,9 @@ BloomStore::BloomStore(const boost::filesystem::path &path, uint64_t length_) :
     if (backingFile.size() != blockCount()) {
         throw std::runtime_error("Trying to open bloom filter of wrong size");
     }
+    
+    // Every probe lands on an unrelated line, so readahead would only pull in lines nobody asked for
+    backingFile.setAccessPattern(blocksci::AccessPattern::random);
 }
 
 uint64_t BloomStore::blockCount() const {
@@ -49,6 +58,14 @@ bool BloomStore::isSet(uint64_t bitPos) const {
     return !(((*backingFile.getData(bitPos / BlockSize)) & bitMasks[bitPos % BlockSize]) == 0);
 }
 
+BloomStore::BlockType *BloomStore::line(uint64_t lineNum) {
+    return backingFile.getData(lineNum * LineBlocks);
+}
+
+const BloomStore::BlockType *BloomStore::line(uint64_t lineNum) const {
+    return backingFile.getData(lineNum * LineBlocks);
+}
+
 void BloomStore::reset(uint64_t newLength) {
     backingFile.truncate(0);
     backingFile.truncate((newLength + BlockSize - 1) / BlockSize);
@@ -62,12 +79,21 @@ uint8_t calculateHashes(double fpRate) {
     return static_cast<uint8_t>(std::round(-std::log(fpRate) / Log2));
 }
 
-BloomFilterData::BloomFilterData() : maxItems(0), fpRate(1), m_numHashes(0), length(0), addedCount(0) {}
-BloomFilterData::BloomFilterData(uint64_t maxItems_, double fpRate_) : maxItems(maxItems_), fpRate(fpRate_), m_numHashes(calculateHashes(fpRate_)), length(calculateLength(maxItems_, fpRate_)), addedCount(0) {}
+// Blocked filters are rounded up to whole cache lines
+uint64_t calculateLength(uint64_t maxItems, double fpRate, BloomFilterLayout layout) {
+    auto length = calculateLength(maxItems, fpRate);
+    if (layout == BloomFilterLayout::blocked) {
+        length = (length + BloomStore::LineSize - 1) / BloomStore::LineSize * BloomStore::LineSize;
+    }
+    return length;
+}
+
+BloomFilterData::BloomFilterData() : maxItems(0), fpRate(1), m_numHashes(0), length(0), addedCount(0), layout(BloomFilterLayout::classic) {}
+BloomFilterData::BloomFilterData(uint64_t maxItems_, double fpRate_, BloomFilterLayout layout_) : maxItems(maxItems_), fpRate(fpRate_), m_numHashes(calculateHashes(fpRate_)), length(calculateLength(maxItems_, fpRate_, layout_)), addedCount(0), layout(layout_) {}
 
 
-BloomFilterData loadData(const boost::filesystem::path &path, uint64_t maxItems, double fpRate) {
-    BloomFilterData data{maxItems, fpRate};
+BloomFilterData loadData(const boost::filesystem::path &path, uint64_t maxItems, double fpRate, BloomFilterLayout layout) {
+    BloomFilterData data{maxItems, fpRate, layout};
     boost::filesystem::ifstream file(path, std::ios::binary);
     if (file.good()) {
         boost::archive::binary_iarchive ia(file);
@@ -76,7 +102,18 @@ BloomFilterData loadData(const boost::filesystem::path &path, uint64_t maxItems,
     return data;
 }
 
-BloomFilter::BloomFilter(const boost::filesystem::path &path_, uint64_t maxItems, double fpRate) : path(path_), impData(loadData(metaPath(), maxItems, fpRate)), store(storePath(), impData.length) {}
+namespace {
+    bool cpuSupportsAVX2() {
+        #ifdef BLOCKSCI_BLOOM_AVX2
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+        #else
+        return false;
+        #endif
+    }
+}
+
+BloomFilter::BloomFilter(const boost::filesystem::path &path_, uint64_t maxItems, double fpRate, BloomFilterLayout layout) : path(path_), impData(loadData(metaPath(), maxItems, fpRate, layout)), store(storePath(), impData.length), vectorized(cpuSupportsAVX2()) {}
 
 BloomFilter::~BloomFilter() {
     boost::filesystem::ofstream file(metaPath(), std::ios::binary);
@@ -84,11 +121,21 @@ BloomFilter::~BloomFilter() {
     oa << impData;
 }
 
-void BloomFilter::reset(uint64_t maxItems, double fpRate) {
-    impData = BloomFilterData(maxItems, fpRate);
+void BloomFilter::removeFiles(const boost::filesystem::path &path) {
+    boost::filesystem::remove(metaPath(path));
+    // The store's file mapper adds its own extension
+    boost::filesystem::remove(storePath(path).concat(".dat"));
+}
+
+void BloomFilter::reset(uint64_t maxItems, double fpRate, BloomFilterLayout layout) {
+    impData = BloomFilterData(maxItems, fpRate, layout);
     store.reset(impData.length);
 }
 
+void BloomFilter::setVectorized(bool enabled) {
+    vectorized = enabled && cpuSupportsAVX2();
+}
+
 inline std::array<uint64_t, 2> hash(const uint8_t *data, int len) {
     uint64_t hashA, hashB;
     memcpy(&hashA, data + len - sizeof(uint64_t), sizeof(uint64_t));
@@ -100,9 +147,63 @@ inline uint64_t nthHash(uint8_t n, uint64_t hashA, uint64_t hashB, uint64_t filt
     return (hashA + n * hashB) % filterSize;
 }
 
+using LineMask = std::array<BloomStore::BlockType, BloomStore::LineBlocks>;
+
+constexpr int lineBitsPerProbe = 9;
+static_assert(BloomStore::LineSize == 1 << lineBitsPerProbe, "Each probe picks one bit of a cache line");
+
+// Bits probed within the key's cache line. Each probe takes 9 bits of hashB, which is remixed once all
+// of its bits have been used
+inline LineMask lineMask(uint8_t numHashes, uint64_t hashA, uint64_t hashB) {
+    LineMask mask{};
+    auto bits = hashB;
+    int bitsLeft = 64;
+    for (uint8_t n = 0; n < numHashes; n++) {
+        if (bitsLeft < lineBitsPerProbe) {
+            bits = bits * 0x9E3779B97F4A7C15 + hashA;
+            bitsLeft = 64;
+        }
+        auto bitPos = bits & (BloomStore::LineSize - 1);
+        mask[bitPos / BloomStore::BlockSize] |= BloomStore::BlockType{1} << (bitPos % BloomStore::BlockSize);
+        bits >>= lineBitsPerProbe;
+        bitsLeft -= lineBitsPerProbe;
+    }
+    return mask;
+}
+
+inline bool lineContains(const BloomStore::BlockType *line, const LineMask &mask) {
+    BloomStore::BlockType missing = 0;
+    for (size_t i = 0; i < BloomStore::LineBlocks; i++) {
+        missing |= mask[i] & ~line[i];
+    }
+    return missing == 0;
+}
+
+#ifdef BLOCKSCI_BLOOM_AVX2
+__attribute__((target("avx2")))
+bool lineContainsAVX2(const BloomStore::BlockType *line, const LineMask &mask) {
+    auto lineLow = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(line));
+    auto lineHigh = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(line) + 1);
+    auto maskLow = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask.data()));
+    auto maskHigh = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask.data()) + 1);
+    // testc is set when every bit of the mask is also set in the line
+    return _mm256_testc_si256(lineLow, maskLow) && _mm256_testc_si256(lineHigh, maskHigh);
+}
+#endif
+
 void BloomFilter::add(const uint8_t *item, int length) {
     auto hashValues = hash(item, length);
     
+    if (impData.layout == BloomFilterLayout::blocked) {
+        auto mask = lineMask(impData.m_numHashes, hashValues[0], hashValues[1]);
+        auto line = store.line(hashValues[0] % (impData.length / BloomStore::LineSize));
+        for (size_t i = 0; i < BloomStore::LineBlocks; i++) {
+            line[i] |= mask[i];
+        }
+        impData.addedCount++;
+        return;
+    }
+    
     for (uint8_t n = 0; n < impData.m_numHashes; n++) {
         auto bitPos = nthHash(n, hashValues[0], hashValues[1], impData.length);
         store.setBit(bitPos);
@@ -114,6 +215,17 @@ void BloomFilter::add(const uint8_t *item, int length) {
 bool BloomFilter::possiblyContains(const uint8_t *item, int length) const {
     auto hashValues = hash(item, length);
     
+    if (impData.layout == BloomFilterLayout::blocked) {
+        auto mask = lineMask(impData.m_numHashes, hashValues[0], hashValues[1]);
+        auto line = store.line(hashValues[0] % (impData.length / BloomStore::LineSize));
+        #ifdef BLOCKSCI_BLOOM_AVX2
+        if (vectorized) {
+            return lineContainsAVX2(line, mask);
+        }
+        #endif
+        return lineContains(line, mask);
+    }
+    
     for (uint8_t n = 0; n < impData.m_numHashes; n++) {
         auto bitPos = nthHash(n, hashValues[0], hashValues[1], impData.length);
         if (!store.isSet(bitPos)) {
@@ -123,3 +235,50 @@ bool BloomFilter::possiblyContains(const uint8_t *item, int length) const {
     
     return true;
 }
+
+constexpr uint64_t ScalableBloomFilter::growthFactor;
+constexpr double ScalableBloomFilter::fpRateRatio;
+
+ScalableBloomFilter::ScalableBloomFilter(const boost::filesystem::path &path_, uint64_t maxItems, double fpRate) : path(path_) {
+    layers.push_back(std::make_unique<BloomFilter>(path, maxItems, fpRate));
+    for (size_t layer = 1; boost::filesystem::exists(BloomFilter::metaPath(layerPath(layer))); layer++) {
+        auto &top = *layers.back();
+        layers.push_back(std::make_unique<BloomFilter>(layerPath(layer), top.getMaxItems() * growthFactor, top.getFPRate() * fpRateRatio));
+    }
+}
+
+boost::filesystem::path ScalableBloomFilter::layerPath(size_t layer) const {
+    if (layer == 0) {
+        return path;
+    }
+    return boost::filesystem::path(path).concat("_layer" + std::to_string(layer));
+}
+
+size_t ScalableBloomFilter::size() const {
+    size_t count = 0;
+    for (auto &layer : layers) {
+        count += layer->size();
+    }
+    return count;
+}
+
+void ScalableBloomFilter::addLayer() {
+    auto &top = *layers.back();
+    auto maxItems = top.getMaxItems() * growthFactor;
+    auto fpRate = top.getFPRate() * fpRateRatio;
+    layers.push_back(std::make_unique<BloomFilter>(layerPath(layers.size()), maxItems, fpRate));
+    // Clears anything left behind by a layer whose metadata was never written
+    layers.back()->reset(maxItems, fpRate);
+}
+
+void ScalableBloomFilter::reset(uint64_t maxItems, double fpRate) {
+    std::vector<boost::filesystem::path> removedPaths;
+    while (layers.size() > 1) {
+        removedPaths.push_back(layerPath(layers.size() - 1));
+        layers.pop_back();
+    }
+    for (auto &removedPath : removedPaths) {
+        BloomFilter::removeFiles(removedPath);
+    }
+    layers.front()->reset(maxItems, fpRate);
+}
@@ -12,19 +12,28 @@
 #include <blocksci/util/file_mapper.hpp>
 
 #include <boost/serialization/access.hpp>
+#include <boost/serialization/version.hpp>
 
 #include <fstream>
+#include <memory>
 #include <vector>
 
 struct BloomStore {
     using BlockType = size_t;
     static constexpr size_t BlockSize = sizeof(BlockType) * 8;
 
+    // Blocks making up one 64 byte cache line
+    static constexpr size_t LineBlocks = 64 / sizeof(BlockType);
+    static constexpr size_t LineSize = BlockSize * LineBlocks;
+
     BloomStore(const boost::filesystem::path &path, uint64_t length);
     
     void setBit(uint64_t bitPos);
     bool isSet(uint64_t bitPos) const;
     
+    BlockType *line(uint64_t lineNum);
+    const BlockType *line(uint64_t lineNum) const;
+    
     void reset(uint64_t length);
     
 private:
@@ -37,33 +46,50 @@ private:
     uint64_t blockCount() const;
 };
 
+enum class BloomFilterLayout : uint8_t {
+    // Every probe tests an independent bit anywhere in the filter
+    classic,
+    // All probes for a key fall in a single cache line picked by the key, so a lookup costs at most one
+    // cache miss for a slightly higher false positive rate at the same size
+    blocked
+};
+
 struct BloomFilterData {
     uint64_t maxItems;
     double fpRate;
     uint8_t m_numHashes;
     uint64_t length;
     uint64_t addedCount;
+    BloomFilterLayout layout;
     
     BloomFilterData();
-    BloomFilterData(uint64_t maxItems_, double fpRate_);
+    BloomFilterData(uint64_t maxItems_, double fpRate_, BloomFilterLayout layout_);
     
     friend class boost::serialization::access;
-    template<class Archive> void serialize(Archive & ar, const unsigned int) {
+    template<class Archive> void serialize(Archive & ar, const unsigned int version) {
         ar & maxItems;
         ar & fpRate;
         ar & m_numHashes;
         ar & length;
         ar & addedCount;
+        // Filters written before the layout was stored are classic ones
+        auto layoutValue = static_cast<uint8_t>(version > 0 ? layout : BloomFilterLayout::classic);
+        if (version > 0) {
+            ar & layoutValue;
+        }
+        layout = static_cast<BloomFilterLayout>(layoutValue);
     }
 };
 
+BOOST_CLASS_VERSION(BloomFilterData, 1)
+
 class BloomFilter {
 public:
-    // Load or create
-    BloomFilter(const boost::filesystem::path &path, uint64_t maxItems, double fpRate);
+    // Load or create. Existing filters keep the layout they were created with until they are reset
+    BloomFilter(const boost::filesystem::path &path, uint64_t maxItems, double fpRate, BloomFilterLayout layout = BloomFilterLayout::blocked);
     ~BloomFilter();
     
-    void reset(uint64_t maxItems, double fpRate);
+    void reset(uint64_t maxItems, double fpRate, BloomFilterLayout layout = BloomFilterLayout::blocked);
     
     template<class Key>
     void add(const Key &key) {
@@ -93,21 +119,99 @@ public:
         return impData.fpRate;
     }
     
+    BloomFilterLayout getLayout() const {
+        return impData.layout;
+    }
+    
+    // Blocked lookups use AVX2 whenever the processor supports it
+    bool isVectorized() const {
+        return vectorized;
+    }
+    
+    void setVectorized(bool enabled);
+    
     boost::filesystem::path metaPath() const {
-        return boost::filesystem::path(path).concat("Meta.dat");
+        return metaPath(path);
     }
     
     boost::filesystem::path storePath() const {
+        return storePath(path);
+    }
+    
+    static boost::filesystem::path metaPath(const boost::filesystem::path &path) {
+        return boost::filesystem::path(path).concat("Meta.dat");
+    }
+    
+    static boost::filesystem::path storePath(const boost::filesystem::path &path) {
         return boost::filesystem::path(path).concat("Store");
     }
     
+    // Deletes the files of a filter which is not open
+    static void removeFiles(const boost::filesystem::path &path);
+    
 private:
     boost::filesystem::path path;
     BloomFilterData impData;
     BloomStore store;
+    bool vectorized;
     
     void add(const uint8_t *item, int length);
     bool possiblyContains(const uint8_t *item, int length) const;
 };
 
+// Stack of bloom filters which grows instead of filling up. Keys go into the newest layer and once it is
+// full a new layer with twice the capacity and half the false positive rate is stacked on top of it, so
+// growth never requires rebuilding the filter from its keys and the combined false positive rate stays
+// below twice the rate of the base layer. The base layer uses the plain BloomFilter files at path, which
+// keeps filters written before layers existed readable.
+class ScalableBloomFilter {
+public:
+    ScalableBloomFilter(const boost::filesystem::path &path, uint64_t maxItems, double fpRate);
+    
+    // Drops every layer above the base and clears the base, sized for maxItems keys
+    void reset(uint64_t maxItems, double fpRate);
+    
+    template<class Key>
+    void add(const Key &key) {
+        if (layers.back()->isFull()) {
+            addLayer();
+        }
+        layers.back()->add(key);
+    }
+    
+    template<class Key>
+    bool possiblyContains(const Key &key) const {
+        for (auto &layer : layers) {
+            if (layer->possiblyContains(key)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    size_t size() const;
+    
+    size_t layerCount() const {
+        return layers.size();
+    }
+    
+    uint64_t getMaxItems() const {
+        return layers.front()->getMaxItems();
+    }
+    
+    double getFPRate() const {
+        return layers.front()->getFPRate();
+    }
+    
+private:
+    static constexpr uint64_t growthFactor = 2;
+    static constexpr double fpRateRatio = .5;
+    
+    boost::filesystem::path path;
+    std::vector<std::unique_ptr<BloomFilter>> layers;
+    
+    boost::filesystem::path layerPath(size_t layer) const;
+    void addLayer();
+};
+
 #endif /* bloom_filter_hpp */
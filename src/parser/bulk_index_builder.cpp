@@ -0,0 +1,211 @@
+//
+//  bulk_index_builder.cpp
+//  blocksci_parser
+//
+
+#include "bulk_index_builder.hpp"
+
+#include <rocksdb/sst_file_writer.h>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <memory>
+#include <numeric>
+#include <queue>
+#include <thread>
+
+namespace {
+    // Merged entries are split into tables of about this size so a column is never ingested as one huge file
+    constexpr uint64_t tableTargetBytes = uint64_t{256} << 20;
+    constexpr size_t recordsPerRead = 1 << 16;
+    
+    void checkStatus(const rocksdb::Status &status, const char *action) {
+        if (!status.ok()) {
+            throw std::runtime_error(std::string(action) + ": " + status.ToString());
+        }
+    }
+    
+    // Records in buffers and runs are the key, the value and the sequence number of the entry
+    size_t runRecordSize(const BulkIndexColumn &info) {
+        return info.keySize + info.valueSize + sizeof(uint64_t);
+    }
+    
+    uint64_t recordSequence(const BulkIndexColumn &info, const char *record) {
+        uint64_t sequence;
+        memcpy(&sequence, record + info.keySize + info.valueSize, sizeof(sequence));
+        return sequence;
+    }
+    
+    // Reads the sorted fixed size records of a run file a block at a time
+    class RunReader {
+        boost::filesystem::ifstream file;
+        std::vector<char> buffer;
+        size_t recordSize;
+        size_t position = 0;
+        size_t available = 0;
+    
+    public:
+        RunReader(const boost::filesystem::path &path, size_t recordSize_) : file(path, std::ios::binary), buffer(recordSize_ * recordsPerRead), recordSize(recordSize_) {
+            if (!file) {
+                throw std::runtime_error("Could not open index run " + path.native());
+            }
+        }
+        
+        const char *current() const {
+            return buffer.data() + position;
+        }
+        
+        // Moves to the next record and returns false once the run is exhausted
+        bool advance() {
+            position += recordSize;
+            if (position >= available) {
+                file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                available = static_cast<size_t>(file.gcount());
+                position = 0;
+            }
+            return position + recordSize <= available;
+        }
+    };
+}
+
+BulkRunWriter::BulkRunWriter(BulkIndexBuilder &builder_, size_t memoryLimit_) : builder(builder_), buffers(builder_.columns.size()), memoryLimit(std::max(memoryLimit_, size_t{1} << 20)) {}
+
+void BulkRunWriter::spill() {
+    for (size_t column = 0; column < buffers.size(); column++) {
+        auto &buffer = buffers[column];
+        if (buffer.empty()) {
+            continue;
+        }
+        const auto &info = builder.columns[column];
+        auto recordSize = runRecordSize(info);
+        auto recordCount = buffer.size() / recordSize;
+        auto record = [&](size_t i) {
+            return buffer.data() + i * recordSize;
+        };
+        
+        // Entries were buffered in sequence order, which the stable sort keeps for equal keys
+        std::vector<uint32_t> order(recordCount);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return memcmp(record(a), record(b), info.keySize) < 0;
+        });
+        
+        boost::filesystem::ofstream file(builder.nextRunPath(column), std::ios::binary);
+        std::vector<char> staged;
+        staged.reserve(recordSize * recordsPerRead);
+        uint64_t writtenCount = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            auto current = record(order[i]);
+            // A key added twice only needs to be ingested once, with the value it was given last
+            if (i + 1 < order.size() && memcmp(current, record(order[i + 1]), info.keySize) == 0) {
+                continue;
+            }
+            staged.insert(staged.end(), current, current + recordSize);
+            if (staged.size() >= recordSize * recordsPerRead) {
+                file.write(staged.data(), static_cast<std::streamsize>(staged.size()));
+                staged.clear();
+            }
+            writtenCount++;
+        }
+        file.write(staged.data(), static_cast<std::streamsize>(staged.size()));
+        if (!file) {
+            throw std::runtime_error("Failed writing index run");
+        }
+        builder.entryCount += writtenCount;
+        buffer.clear();
+    }
+    bufferedBytes = 0;
+}
+
+BulkIndexBuilder::BulkIndexBuilder(std::vector<BulkIndexColumn> columns_, const boost::filesystem::path &directory_, size_t threadCount, uint64_t memoryBytes_) : columns(std::move(columns_)), directory(directory_), memoryBytes(memoryBytes_), workers(threadCount == 0 ? std::thread::hardware_concurrency() : threadCount), runs(columns.size()) {
+    // Left over runs from an interrupted build are useless
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directories(directory);
+}
+
+BulkIndexBuilder::~BulkIndexBuilder() {
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(directory, ec);
+}
+
+boost::filesystem::path BulkIndexBuilder::nextRunPath(size_t column) {
+    std::lock_guard<std::mutex> lock(runsMutex);
+    auto &columnRuns = runs[column];
+    columnRuns.push_back(directory/(std::to_string(column) + "_" + std::to_string(columnRuns.size()) + ".run"));
+    return columnRuns.back();
+}
+
+std::vector<std::string> BulkIndexBuilder::mergeRuns(size_t column) {
+    const auto &info = columns[column];
+    auto recordSize = runRecordSize(info);
+    
+    std::vector<std::unique_ptr<RunReader>> readers;
+    auto laterKey = [&](RunReader *a, RunReader *b) {
+        auto comparison = memcmp(a->current(), b->current(), info.keySize);
+        if (comparison != 0) {
+            return comparison > 0;
+        }
+        return recordSequence(info, a->current()) > recordSequence(info, b->current());
+    };
+    std::priority_queue<RunReader *, std::vector<RunReader *>, decltype(laterKey)> heap(laterKey);
+    for (auto &runPath : runs[column]) {
+        readers.push_back(std::make_unique<RunReader>(runPath, recordSize));
+        if (readers.back()->advance()) {
+            heap.push(readers.back().get());
+        }
+    }
+    
+    std::vector<std::string> tables;
+    rocksdb::SstFileWriter tableWriter(rocksdb::EnvOptions{info.options}, info.options, info.handle);
+    bool tableOpen = false;
+    uint64_t tableBytes = 0;
+    
+    auto writeEntry = [&](const char *entry) {
+        if (!tableOpen) {
+            tables.push_back((directory/(std::to_string(column) + "_" + std::to_string(tables.size()) + ".sst")).native());
+            checkStatus(tableWriter.Open(tables.back()), "Failed to create index table");
+            tableOpen = true;
+        }
+        rocksdb::Slice key(entry, info.keySize);
+        rocksdb::Slice value(entry + info.keySize, info.valueSize);
+        checkStatus(tableWriter.Put(key, value), "Failed to write index table");
+        tableBytes += info.keySize + info.valueSize;
+        if (tableBytes >= tableTargetBytes) {
+            checkStatus(tableWriter.Finish(), "Failed to finish index table");
+            tableOpen = false;
+            tableBytes = 0;
+        }
+    };
+    
+    // Different workers may have generated the same key. Equal keys come out in sequence order, so the entry
+    // is only written once the next key differs
+    std::vector<char> pending(recordSize);
+    bool hasPending = false;
+    while (!heap.empty()) {
+        auto reader = heap.top();
+        heap.pop();
+        auto current = reader->current();
+        if (hasPending && memcmp(pending.data(), current, info.keySize) != 0) {
+            writeEntry(pending.data());
+        }
+        memcpy(pending.data(), current, recordSize);
+        hasPending = true;
+        if (reader->advance()) {
+            heap.push(reader);
+        }
+    }
+    if (hasPending) {
+        writeEntry(pending.data());
+    }
+    if (tableOpen) {
+        checkStatus(tableWriter.Finish(), "Failed to finish index table");
+    }
+    
+    readers.clear();
+    for (auto &runPath : runs[column]) {
+        boost::filesystem::remove(runPath);
+    }
+    runs[column].clear();
+    return tables;
+}
@@ -0,0 +1,152 @@
+//
+//  bulk_index_builder.hpp
+//  blocksci_parser
+//
+
+#ifndef bulk_index_builder_hpp
+#define bulk_index_builder_hpp
+
+#include "worker_group.hpp"
+
+#include <rocksdb/db.h>
+
+#include <boost/filesystem/path.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Every entry of a column has the same key and value size. Tables are built with the options the column family
+// was opened with so they match what RocksDB would have written itself
+struct BulkIndexColumn {
+    rocksdb::ColumnFamilyHandle *handle;
+    size_t keySize;
+    size_t valueSize;
+    rocksdb::Options options;
+};
+
+class BulkIndexBuilder;
+
+// Collects the entries generated by one worker. Once its share of the sort memory is used up the entries of
+// every column are sorted and spilled to a run file. Each entry carries a sequence number in the order the
+// incremental update would have written it, so a key added twice keeps its last value like a Put would.
+class BulkRunWriter {
+    BulkIndexBuilder &builder;
+    std::vector<std::vector<char>> buffers;
+    size_t bufferedBytes = 0;
+    size_t memoryLimit;
+    uint64_t sequence = 0;
+    
+    void spill();
+
+public:
+    BulkRunWriter(BulkIndexBuilder &builder, size_t memoryLimit);
+    BulkRunWriter(const BulkRunWriter &) = delete;
+    BulkRunWriter &operator=(const BulkRunWriter &) = delete;
+    
+    // Memory use is approximate since the buffers grow by doubling
+    void add(size_t column, const void *key, const void *value);
+    
+    // Chunks are taken in increasing order, so numbering entries from the chunk start orders them across workers
+    void startChunk(uint32_t chunkBegin) {
+        sequence = static_cast<uint64_t>(chunkBegin) << 32;
+    }
+    
+    void finish() {
+        spill();
+    }
+};
+
+// Builds index entries in bulk instead of putting them into RocksDB one at a time. Entries are generated from
+// disjoint ranges on every worker and sorted into runs on disk. Each column's runs are then merged into
+// non-overlapping SST files which are ingested directly into the column family.
+class BulkIndexBuilder {
+    friend class BulkRunWriter;
+    
+    std::vector<BulkIndexColumn> columns;
+    boost::filesystem::path directory;
+    uint64_t memoryBytes;
+    WorkerGroup workers;
+    
+    std::mutex runsMutex;
+    std::vector<std::vector<boost::filesystem::path>> runs;
+    std::atomic<uint64_t> entryCount{0};
+    
+    boost::filesystem::path nextRunPath(size_t column);
+    std::vector<std::string> mergeRuns(size_t column);
+
+public:
+    // Threads defaults to every core
+    BulkIndexBuilder(std::vector<BulkIndexColumn> columns, const boost::filesystem::path &directory, size_t threadCount, uint64_t memoryBytes);
+    BulkIndexBuilder(const BulkIndexBuilder &) = delete;
+    BulkIndexBuilder &operator=(const BulkIndexBuilder &) = delete;
+    ~BulkIndexBuilder();
+    
+    // Splits [begin, end) into chunks which the workers take in turn, calling func(writer, chunkBegin, chunkEnd)
+    template <typename Func>
+    void generate(uint32_t begin, uint32_t end, Func func) {
+        if (begin >= end) {
+            return;
+        }
+        // Small enough chunks that the workers finish close together
+        uint32_t chunkSize = std::max<uint32_t>(1, (end - begin) / static_cast<uint32_t>(workers.size() * 64));
+        std::atomic<uint64_t> nextChunk{begin};
+        workers.run([&](size_t) {
+            BulkRunWriter writer(*this, memoryBytes / workers.size());
+            uint64_t chunkBegin;
+            while ((chunkBegin = nextChunk.fetch_add(chunkSize)) < end) {
+                auto chunkEnd = std::min<uint64_t>(chunkBegin + chunkSize, end);
+                writer.startChunk(static_cast<uint32_t>(chunkBegin));
+                func(writer, static_cast<uint32_t>(chunkBegin), static_cast<uint32_t>(chunkEnd));
+            }
+            writer.finish();
+        });
+    }
+    
+    // Merges the runs of every column into SST files and hands them to index.ingestFiles(handle, files)
+    template <typename Index>
+    void ingest(Index &index) {
+        std::vector<std::vector<std::string>> tables(columns.size());
+        workers.run([&](size_t worker) {
+            for (size_t column = worker; column < columns.size(); column += workers.size()) {
+                tables[column] = mergeRuns(column);
+            }
+        });
+        for (size_t column = 0; column < columns.size(); column++) {
+            if (!tables[column].empty()) {
+                auto status = index.ingestFiles(columns[column].handle, tables[column]);
+                if (!status.ok()) {
+                    throw std::runtime_error("Failed to ingest index tables: " + status.ToString());
+                }
+            }
+        }
+    }
+    
+    uint64_t getEntryCount() const {
+        return entryCount;
+    }
+};
+
+inline void BulkRunWriter::add(size_t column, const void *key, const void *value) {
+    const auto &info = builder.columns[column];
+    auto &buffer = buffers[column];
+    auto keyData = static_cast<const char *>(key);
+    buffer.insert(buffer.end(), keyData, keyData + info.keySize);
+    if (info.valueSize > 0) {
+        auto valueData = static_cast<const char *>(value);
+        buffer.insert(buffer.end(), valueData, valueData + info.valueSize);
+    }
+    auto sequenceData = reinterpret_cast<const char *>(&sequence);
+    buffer.insert(buffer.end(), sequenceData, sequenceData + sizeof(sequence));
+    sequence++;
+    bufferedBytes += info.keySize + info.valueSize + sizeof(sequence);
+    if (bufferedBytes >= memoryLimit) {
+        spill();
+    }
+}
+
+#endif /* bulk_index_builder_hpp */
@@ -12,10 +12,13 @@
 #include "parser_configuration.hpp"
 #include "safe_mem_reader.hpp"
 #include "preproccessed_block.hpp"
+#include "worker_group.hpp"
+#include "rpc_block_fetcher.hpp"
 
 #include <blocksci/chain/chain_access.hpp>
 #include <blocksci/chain/block.hpp>
 #include <blocksci/util/hash.hpp>
+#include <blocksci/util/file_mapper.hpp>
 
 #ifdef BLOCKSCI_RPC_PARSER
 #include <bitcoinapi/bitcoinapi.h>
@@ -25,10 +28,13 @@
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/unordered_map.hpp>
 #include <boost/serialization/vector.hpp>
+#include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
 
+#include <atomic>
 #include <cmath>
-#include <future>
+#include <mutex>
+#include <thread>
 #include <sstream>
 #include <fstream>
 #include <iostream>
@@ -40,23 +46,18 @@ BlockInfoBase::BlockInfoBase(const blocksci::uint256 &hash_, const CBlockHeader
 
 BlockInfo<FileTag>::BlockInfo(const CBlockHeader &h, uint32_t size_, unsigned int numTxes, uint32_t inputCount_, uint32_t outputCount_, const ParserConfiguration<FileTag> &config, int fileNum, unsigned int dataPos) : BlockInfoBase(config.workHashFunction(reinterpret_cast<const char *>(&h), sizeof(CBlockHeader)), h, size_, numTxes, inputCount_, outputCount_), nFile(fileNum), nDataPos(dataPos) {}
 
-// The 0 should be replaced with info.bits converted to string
-BlockInfo<RPCTag>::BlockInfo(const blockinfo_t &info, blocksci::BlockHeight height_) : 
+// getblockheader doesn't report the size of the block, which only the file parser uses
+BlockInfo<RPCTag>::BlockInfo(const Json::Value &header) : 
 BlockInfoBase(
-    blocksci::uint256S(info.hash), 
-    {info.version, blocksci::uint256S(info.previousblockhash), blocksci::uint256S(info.merkleroot), info.time, 0, info.nonce}, 
-    static_cast<uint32_t>(info.size), 
-    static_cast<uint32_t>(info.tx.size()), 0, 0
-    ), tx(info.tx) {
-    height = height_;
-}
-
-int maxBlockFileNum(int startFile, const ParserConfiguration<FileTag> &config) {
-    int fileNum = startFile;
-    while (boost::filesystem::exists(config.pathForBlockFile(fileNum))) {
-        fileNum++;
+    blocksci::uint256S(header["hash"].asString()), 
+    {header["version"].asInt(), blocksci::uint256S(header["previousblockhash"].asString()), blocksci::uint256S(header["merkleroot"].asString()), header["time"].asUInt(), static_cast<uint32_t>(std::stoul(header["bits"].asString(), nullptr, 16)), header["nonce"].asUInt()}, 
+    0, 
+    header["nTx"].asUInt(), 0, 0
+    ) {
+    if (!header.isMember("nTx")) {
+        throw std::runtime_error("getblockheader did not return the transaction count of block " + header["hash"].asString() + ", the node is too old");
     }
-    return fileNum - 1;
+    height = static_cast<blocksci::BlockHeight>(header["height"].asInt());
 }
 
 template<typename ParseTag>
@@ -71,98 +72,115 @@ template void ChainIndex<FileTag>::serialize(boost::archive::binary_oarchive& ar
 template void ChainIndex<RPCTag>::serialize(boost::archive::binary_iarchive& archive, const unsigned int version);
 template void ChainIndex<RPCTag>::serialize(boost::archive::binary_oarchive& archive, const unsigned int version);
 
-template <>
-void ChainIndex<FileTag>::update(const ConfigType &config) {
-    int fileNum = 0;
-    unsigned int filePos = 0;
-
-    if (!blockList.empty()) {
-        fileNum = newestBlock.nFile;
-        filePos = newestBlock.nDataPos + newestBlock.size;
+namespace {
+    struct BlockFileScanHeader {
+        uint64_t recordCount;
+        blocksci::uint256 bestBlockHash;
+        uint64_t fileCount;
+    };
+    
+    // Reads the headers of the blocks stored from offset on and returns the offset just past the last complete one
+    uint64_t scanBlockFile(const ParserConfiguration<FileTag> &config, int fileNum, uint64_t offset, std::vector<BlockInfo<FileTag>> &blocks) {
+        auto blockFilePath = config.pathForBlockFile(fileNum);
+        SafeMemReader reader{blockFilePath.native()};
+        try {
+            reader.reset(static_cast<SafeMemReader::difference_type>(offset));
+            
+            // read blocks in loop while we can...
+            while (reader.has(sizeof(uint32_t))) {
+                auto magic = reader.readNext<uint32_t>();
+                if (magic != config.blockMagic) {
+                    break;
+                }
+                auto length = reader.readNext<uint32_t>();
+                auto blockStartOffset = reader.offset();
+                auto header = reader.readNext<CBlockHeader>();
+                auto numTxes = reader.readVariableLengthInteger();
+                uint32_t inputCount = 0;
+                uint32_t outputCount = 0;
+                for (size_t i = 0; i < numTxes; i++) {
+                    TransactionHeader h(reader);
+                    inputCount += h.inputCount;
+                    outputCount += h.outputCount;
+                }
+                // The next two lines bring the reader to the end of this block
+                reader.reset(blockStartOffset);
+                reader.advance(length);
+                inputCount--;
+                blocks.emplace_back(header, length, numTxes, inputCount, outputCount, config, fileNum, static_cast<unsigned int>(blockStartOffset));
+                offset = static_cast<uint64_t>(reader.offset());
+            }
+        } catch (const std::out_of_range &e) {
+            std::cerr << "Failed to read block header information"
+            << " from " << blockFilePath
+            << " at offset " << reader.offset()
+            << ": " << e.what() << "\n";
+            throw;
+        }
+        return offset;
     }
-
-    auto firstFile = fileNum;
     
-    auto maxFileNum = maxBlockFileNum(fileNum, config);
+    // Bitcoin Core preallocates blk files so a file with unscanned space at its end may or may not have new blocks
+    bool hasBlockAt(const ParserConfiguration<FileTag> &config, int fileNum, uint64_t offset) {
+        boost::filesystem::ifstream file(config.pathForBlockFile(fileNum), std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(offset));
+        uint32_t magic = 0;
+        file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+        return file && magic == config.blockMagic;
+    }
     
-    auto localConfig = config;
+    // The first block of a file starts right after its magic and length
+    constexpr uint64_t firstBlockPos = 2 * sizeof(uint32_t);
     
-    std::mutex m;
+    bool hasBlockHashAt(const ParserConfiguration<FileTag> &config, int fileNum, uint64_t blockPos, const blocksci::uint256 &hash) {
+        boost::filesystem::ifstream file(config.pathForBlockFile(fileNum), std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(blockPos));
+        CBlockHeader header;
+        file.read(reinterpret_cast<char *>(&header), sizeof(header));
+        return file && config.workHashFunction(reinterpret_cast<const char *>(&header), sizeof(header)) == hash;
+    }
     
-    std::cout.setf(std::ios::fixed,std::ios::floatfield);
-    std::cout.precision(1);
-    auto fileCount = maxFileNum - fileNum + 1;
-    int filesDone = 0;
-    using namespace std::chrono_literals;
-    std::atomic<int> activeThreads{0};
+    bool blockFileUnchanged(const ParserConfiguration<FileTag> &config, int fileNum, const BlockFileScan &scan) {
+        return hasBlockHashAt(config, fileNum, firstBlockPos, scan.firstBlockHash) && hasBlockHashAt(config, fileNum, scan.lastBlockPos, scan.lastBlockHash);
+    }
+}
+
+void BlockFileScanState::write(const boost::filesystem::path &path) const {
+    BlockFileScanHeader header{recordCount, bestBlockHash, files.size()};
+    auto tempPath = boost::filesystem::path(path).concat(".tmp");
     {
-        std::vector<std::future<void>> blockFutures;
-        for (; fileNum <= maxFileNum; fileNum++) {
-            while (activeThreads > 20) {
-                std::this_thread::sleep_for(500ms);
-            }
-            blockFutures.emplace_back(std::async(std::launch::async, [&](int fileNum) {
-                activeThreads++;
-                // determine block file path
-                auto blockFilePath = localConfig.pathForBlockFile(fileNum);
-                SafeMemReader reader{blockFilePath.native()};
-                std::vector<BlockInfo<FileTag>> blocks;
-                try {
-                    // logic for resume from last processed block, note blockStartOffset and length below
-                    if (fileNum == firstFile) {
-                        reader.reset(filePos);
-                    }
-                    
-                    // read blocks in loop while we can...
-                    while (reader.has(sizeof(uint32_t))) {
-                        auto magic = reader.readNext<uint32_t>();
-                        if (magic != localConfig.blockMagic) {
-                            break;
-                        }
-                        auto length = reader.readNext<uint32_t>();
-                        auto blockStartOffset = reader.offset();
-                        auto header = reader.readNext<CBlockHeader>();
-                        auto numTxes = reader.readVariableLengthInteger();
-                        uint32_t inputCount = 0;
-                        uint32_t outputCount = 0;
-                        for (size_t i = 0; i < numTxes; i++) {
-                            TransactionHeader h(reader);
-                            inputCount += h.inputCount;
-                            outputCount += h.outputCount;
-                        }
-                        // The next two lines bring the reader to the end of this block
-                        reader.reset(blockStartOffset);
-                        reader.advance(length);
-                        inputCount--;
-                        blocks.emplace_back(header, length, numTxes, inputCount, outputCount, localConfig, fileNum, blockStartOffset);
-                    }
-                } catch (const std::out_of_range &e) {
-                    std::cerr << "Failed to read block header information"
-                    << " from " << blockFilePath
-                    << " at offset " << reader.offset()
-                    << ": " << e.what() << "\n";
-                    throw;
-                }
-                
-                if (fileNum == maxFileNum && blocks.size() > 0) {
-                    newestBlock = blocks.back();
-                }
-                activeThreads--;
-                std::lock_guard<std::mutex> lock(m);
-                
-                for (auto &block : blocks) {
-                    blockList[block.hash] = block;
-                }
-                
-                filesDone++;
-                std::cout << "\r" << (static_cast<double>(filesDone) / static_cast<double>(fileCount)) * 100 << "% done fetching block headers" << std::flush;
-                
-            }, fileNum));
+        boost::filesystem::ofstream file(tempPath, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(files.data()), static_cast<std::streamsize>(files.size() * sizeof(BlockFileScan)));
+        if (!file) {
+            throw std::runtime_error("Failed to write block file scan state " + path.native());
         }
     }
-    
-    std::cout << std::endl;
-    
+    boost::filesystem::rename(tempPath, path);
+}
+
+bool BlockFileScanState::read(const boost::filesystem::path &path) {
+    boost::filesystem::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    BlockFileScanHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        return false;
+    }
+    if (boost::filesystem::file_size(path) != sizeof(header) + header.fileCount * sizeof(BlockFileScan)) {
+        return false;
+    }
+    recordCount = header.recordCount;
+    bestBlockHash = header.bestBlockHash;
+    files.clear();
+    files.resize(header.fileCount);
+    file.read(reinterpret_cast<char *>(files.data()), static_cast<std::streamsize>(files.size() * sizeof(BlockFileScan)));
+    return static_cast<bool>(file);
+}
+
+template <typename ParseTag>
+void ChainIndex<ParseTag>::updateHeights() {
     std::unordered_multimap<blocksci::uint256, blocksci::uint256> forwardHashes;
     
     for (auto &pair : blockList) {
@@ -172,6 +190,11 @@ void ChainIndex<FileTag>::update(const ConfigType &config) {
     blocksci::uint256 nullHash;
     nullHash.SetNull();
     
+    // Blocks whose ancestors were dropped are no longer part of any chain
+    for (auto &pair : blockList) {
+        pair.second.height = -1;
+    }
+    
     std::vector<std::pair<blocksci::uint256, blocksci::BlockHeight>> queue;
     
     queue.emplace_back(nullHash, 0);
@@ -186,46 +209,294 @@ void ChainIndex<FileTag>::update(const ConfigType &config) {
             queue.emplace_back(block.hash, block.height);
         }
     }
+}
+
+template <>
+void ChainIndex<FileTag>::load(const ConfigType &config) {
+    static_assert(std::is_trivially_copyable<BlockType>::value, "Block headers are stored as raw records");
+    if (scanState.read(config.blockFileScanStatePath())) {
+        blocksci::FixedSizeFileMapper<BlockType> headerFile(config.blockHeadersFilePath());
+        // Records past recordCount were written by an update which didn't finish
+        auto recordCount = std::min<uint64_t>(scanState.recordCount, headerFile.size());
+        scanState.recordCount = recordCount;
+        headerFile.setAccessPattern(blocksci::AccessPattern::sequential);
+        for (uint64_t i = 0; i < recordCount; i++) {
+            auto block = headerFile.getData(i);
+            blockList[block->hash] = *block;
+        }
+        if (recordCount > 0) {
+            newestBlock = *headerFile.getData(recordCount - 1);
+        }
+    } else {
+        // Migrate the index saved as a single archive by older versions, which save replaces
+        boost::filesystem::ifstream inFile(config.blockListPath(), std::ios::binary);
+        if (inFile.good()) {
+            boost::archive::binary_iarchive ia(inFile);
+            ia >> *this;
+            for (auto &pair : blockList) {
+                auto &block = pair.second;
+                auto fileNum = static_cast<size_t>(block.nFile);
+                if (fileNum >= scanState.files.size()) {
+                    scanState.files.resize(fileNum + 1);
+                }
+                auto &offset = scanState.files[fileNum].offset;
+                offset = std::max<uint64_t>(offset, block.nDataPos + block.size);
+                unsavedBlocks.push_back(block);
+            }
+            identifyBlockFiles();
+        }
+    }
+    updateHeights();
+}
+
+// Fills in the first and last block of every file for an index migrated from the archive of older versions
+template <>
+void ChainIndex<FileTag>::identifyBlockFiles() {
+    auto &files = scanState.files;
+    std::vector<const BlockType *> firstBlocks(files.size(), nullptr);
+    std::vector<const BlockType *> lastBlocks(files.size(), nullptr);
+    for (auto &pair : blockList) {
+        auto &block = pair.second;
+        auto fileNum = static_cast<size_t>(block.nFile);
+        if (fileNum >= files.size()) {
+            continue;
+        }
+        if (!firstBlocks[fileNum] || block.nDataPos < firstBlocks[fileNum]->nDataPos) {
+            firstBlocks[fileNum] = &block;
+        }
+        if (!lastBlocks[fileNum] || block.nDataPos > lastBlocks[fileNum]->nDataPos) {
+            lastBlocks[fileNum] = &block;
+        }
+    }
+    for (size_t fileNum = 0; fileNum < files.size(); fileNum++) {
+        auto &scan = files[fileNum];
+        if (lastBlocks[fileNum] && scan.lastBlockHash.IsNull()) {
+            scan.firstBlockHash = firstBlocks[fileNum]->hash;
+            scan.lastBlockPos = lastBlocks[fileNum]->nDataPos;
+            scan.lastBlockHash = lastBlocks[fileNum]->hash;
+        }
+    }
+}
+
+template <>
+void ChainIndex<FileTag>::dropBlockFile(int fileNum) {
+    for (auto it = blockList.begin(); it != blockList.end();) {
+        if (it->second.nFile == fileNum) {
+            it = blockList.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    unsavedBlocks.erase(std::remove_if(unsavedBlocks.begin(), unsavedBlocks.end(), [&](const BlockType &block) {
+        return block.nFile == fileNum;
+    }), unsavedBlocks.end());
+    rewriteHeaders = true;
+}
+
+template <>
+void ChainIndex<FileTag>::save(const ConfigType &config) {
+    if (rewriteHeaders) {
+        // An empty scan state makes an interrupted rewrite read every blk file again
+        BlockFileScanState{}.write(config.blockFileScanStatePath());
+        auto headersPath = boost::filesystem::path{config.blockHeadersFilePath()}.concat(".dat");
+        auto rewritePath = boost::filesystem::path{config.blockHeadersFilePath()}.concat("_rewrite");
+        auto rewriteFile = boost::filesystem::path{rewritePath}.concat(".dat");
+        boost::filesystem::remove(rewriteFile);
+        {
+            blocksci::FixedSizeFileMapper<BlockType, blocksci::AccessMode::readwrite> headerFile(rewritePath);
+            // load takes the last record as the newest block
+            for (auto &pair : blockList) {
+                if (!(pair.first == newestBlock.hash)) {
+                    headerFile.write(pair.second);
+                }
+            }
+            auto newest = blockList.find(newestBlock.hash);
+            if (newest != blockList.end()) {
+                headerFile.write(newest->second);
+            }
+        }
+        boost::filesystem::rename(rewriteFile, headersPath);
+        scanState.recordCount = blockList.size();
+        rewriteHeaders = false;
+    } else {
+        {
+            blocksci::FixedSizeFileMapper<BlockType, blocksci::AccessMode::readwrite> headerFile(config.blockHeadersFilePath());
+            headerFile.truncate(scanState.recordCount);
+            for (auto &block : unsavedBlocks) {
+                headerFile.write(block);
+            }
+        }
+        // The header file is only trusted up to the count in the scan state so records are appended first
+        scanState.recordCount += unsavedBlocks.size();
+    }
+    unsavedBlocks.clear();
+    auto best = bestBlock();
+    if (best) {
+        scanState.bestBlockHash = best->hash;
+    } else {
+        scanState.bestBlockHash.SetNull();
+    }
+    scanState.write(config.blockFileScanStatePath());
+    boost::filesystem::remove(config.blockListPath());
+}
+
+template <>
+bool ChainIndex<FileTag>::isUpToDate(const ConfigType &config, const blocksci::uint256 &parsedTipHash) {
+    BlockFileScanState state;
+    if (!state.read(config.blockFileScanStatePath()) || state.bestBlockHash.IsNull() || !(state.bestBlockHash == parsedTipHash)) {
+        return false;
+    }
+    for (int fileNum = 0; ; fileNum++) {
+        auto blockFilePath = config.pathForBlockFile(fileNum);
+        boost::system::error_code ec;
+        auto fileSize = boost::filesystem::file_size(blockFilePath, ec);
+        if (ec) {
+            return true;
+        }
+        if (static_cast<size_t>(fileNum) >= state.files.size()) {
+            return !hasBlockAt(config, fileNum, 0);
+        }
+        // Any other change is checked by update, which can tell appended blocks from a rewritten file
+        auto &scan = state.files[static_cast<size_t>(fileNum)];
+        auto modifiedTime = static_cast<int64_t>(boost::filesystem::last_write_time(blockFilePath, ec));
+        if (ec || fileSize != scan.fileSize || modifiedTime != scan.modifiedTime) {
+            return false;
+        }
+    }
+}
+
+template <>
+bool ChainIndex<FileTag>::update(const ConfigType &config) {
+    auto &files = scanState.files;
     
+    // Only new files and files with another block after the scanned part can hold new blocks
+    std::vector<int> filesToScan;
+    bool droppedBlocks = false;
+    for (int fileNum = 0; ; fileNum++) {
+        auto blockFilePath = config.pathForBlockFile(fileNum);
+        boost::system::error_code ec;
+        auto fileSize = boost::filesystem::file_size(blockFilePath, ec);
+        if (ec) {
+            break;
+        }
+        auto modifiedTime = static_cast<int64_t>(boost::filesystem::last_write_time(blockFilePath));
+        if (static_cast<size_t>(fileNum) == files.size()) {
+            files.emplace_back();
+        }
+        auto &scan = files[static_cast<size_t>(fileNum)];
+        if (scan.offset > 0 && (fileSize != scan.fileSize || modifiedTime != scan.modifiedTime)) {
+            if (fileSize < scan.offset || !blockFileUnchanged(config, fileNum, scan)) {
+                // The file was rewritten, for example by a reindex, so the blocks read from it before are dropped
+                // and every block in it is read again
+                std::cout << "Block file " << blockFilePath.filename().native() << " was rewritten, reading it again" << std::endl;
+                dropBlockFile(fileNum);
+                scan = BlockFileScan{};
+                droppedBlocks = true;
+            }
+        }
+        scan.fileSize = fileSize;
+        scan.modifiedTime = modifiedTime;
+        if (fileSize > scan.offset && hasBlockAt(config, fileNum, scan.offset)) {
+            filesToScan.push_back(fileNum);
+        }
+    }
+    
+    std::vector<std::vector<BlockType>> fileBlocks(filesToScan.size());
+    if (!filesToScan.empty()) {
+        std::cout.setf(std::ios::fixed,std::ios::floatfield);
+        std::cout.precision(1);
+        std::mutex m;
+        size_t filesDone = 0;
+        std::atomic<size_t> nextFile{0};
+        WorkerGroup workers{std::min<size_t>(filesToScan.size(), std::max(std::thread::hardware_concurrency(), 1u))};
+        workers.run([&](size_t) {
+            size_t i;
+            while ((i = nextFile++) < filesToScan.size()) {
+                auto &scan = files[static_cast<size_t>(filesToScan[i])];
+                auto &blocks = fileBlocks[i];
+                auto startOffset = scan.offset;
+                scan.offset = scanBlockFile(config, filesToScan[i], startOffset, blocks);
+                if (!blocks.empty()) {
+                    if (startOffset == 0) {
+                        scan.firstBlockHash = blocks.front().hash;
+                    }
+                    scan.lastBlockPos = blocks.back().nDataPos;
+                    scan.lastBlockHash = blocks.back().hash;
+                }
+                std::lock_guard<std::mutex> lock(m);
+                filesDone++;
+                std::cout << "\r" << (static_cast<double>(filesDone) / static_cast<double>(filesToScan.size())) * 100 << "% done fetching block headers" << std::flush;
+            }
+        });
+        std::cout << std::endl;
+    }
+    
+    bool foundBlocks = false;
+    for (auto &blocks : fileBlocks) {
+        for (auto &block : blocks) {
+            blockList[block.hash] = block;
+            unsavedBlocks.push_back(block);
+        }
+        if (!blocks.empty()) {
+            newestBlock = blocks.back();
+            foundBlocks = true;
+        }
+    }
+    
+    if (foundBlocks || droppedBlocks) {
+        updateHeights();
+    }
+    return foundBlocks || droppedBlocks;
+}
+
+template <>
+void ChainIndex<RPCTag>::load(const ConfigType &config) {
+    boost::filesystem::ifstream inFile(config.blockListPath(), std::ios::binary);
+    if (inFile.good()) {
+        boost::archive::binary_iarchive ia(inFile);
+        ia >> *this;
+    }
+}
+
+template <>
+void ChainIndex<RPCTag>::save(const ConfigType &config) {
+    boost::filesystem::ofstream of(config.blockListPath(), std::ios::binary);
+    boost::archive::binary_oarchive oa(of);
+    oa << *this;
+}
+
+template <>
+bool ChainIndex<RPCTag>::isUpToDate(const ConfigType &, const blocksci::uint256 &) {
+    // Asking the node is not much cheaper than an update which finds no new blocks
+    return false;
 }
 
 template<>
-void ChainIndex<RPCTag>::update(const ConfigType &config) {
+bool ChainIndex<RPCTag>::update(const ConfigType &config) {
+    blocksci::BlockHeight numBlocks = 0;
     try {
         BitcoinAPI bapi{config.createBitcoinAPI()};
-        auto blockHeight = static_cast<blocksci::BlockHeight>(bapi.getblockcount());
-
+        // getblockcount returns the height of the tip rather than the number of blocks
+        auto blockCount = static_cast<blocksci::BlockHeight>(bapi.getblockcount() + 1);
         
-        auto splitPoint = findSplitPointIndex(blockHeight, [&](blocksci::BlockHeight h) {
+        auto splitPoint = findSplitPointIndex(blockCount, [&](blocksci::BlockHeight h) {
             return blocksci::uint256S(bapi.getblockhash(static_cast<int>(h)));
         });
         
-        std::cout.setf(std::ios::fixed,std::ios::floatfield);
-        std::cout.precision(1);
-        blocksci::BlockHeight numBlocks = blockHeight - splitPoint;
-        auto percentage = static_cast<double>(static_cast<int>(numBlocks)) / 1000.0;
-        auto percentageMarker = static_cast<blocksci::BlockHeight>(std::ceil(percentage));
-        
-        for (blocksci::BlockHeight i = splitPoint; i < blockHeight; i++) {
-            std::string blockhash = bapi.getblockhash(static_cast<int>(i));
-            BlockType block{bapi.getblock(blockhash), i};
+        numBlocks = blockCount - splitPoint;
+        auto blocks = fetchBlockHeaders(config, splitPoint, blockCount, config.pipeline.rpcConnections);
+        for (auto &block : blocks) {
             blockList.emplace(block.hash, block);
-            auto count = i - splitPoint;
-            if (count % percentageMarker == 0) {
-                std::cout << "\r" << (static_cast<double>(static_cast<int>(count)) / static_cast<double>(static_cast<int>(numBlocks))) * 100 << "% done fetching block headers" << std::flush;
-            }
-            if (i == blockHeight - 1) {
-                newestBlock = block;
-            }
         }
-        
-        std::cout << std::endl;
+        if (!blocks.empty()) {
+            newestBlock = blocks.back();
+        }
     } catch (const BitcoinException &e) {
         std::cout << std::endl;
         std::cerr << "Error while interacting with RPC: " << e.what() << std::endl;
         throw;
     }
-    std::cout << std::endl;
+    return numBlocks > 0;
 }
 
 #endif
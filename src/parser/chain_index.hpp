@@ -15,7 +15,9 @@
 #include <blocksci/util/bitcoin_uint256.hpp>
 #include <blocksci/chain/chain_fwd.hpp>
 
+#include <boost/filesystem/path.hpp>
 #include <boost/serialization/base_object.hpp>
+#include <boost/serialization/version.hpp>
 
 #include <unordered_map>
 #include <algorithm>
@@ -24,7 +26,10 @@
 #include <limits>
 
 class CBlockIndex;
-struct blockinfo_t;
+
+namespace Json {
+    class Value;
+}
 
 struct CBlockHeader {
     friend class boost::serialization::access;
@@ -106,18 +111,48 @@ struct BlockInfo<FileTag> : BlockInfoBase {
 
 template<>
 struct BlockInfo<RPCTag> : BlockInfoBase {
-    std::vector<std::string> tx;
-    
     BlockInfo() : BlockInfoBase() {}
-    BlockInfo(const blockinfo_t &info, blocksci::BlockHeight height);
+    // From the verbose output of getblockheader
+    explicit BlockInfo(const Json::Value &header);
     
     friend class boost::serialization::access;
-    template<class Archive> void serialize(Archive & ar, const unsigned int) {
+    template<class Archive> void serialize(Archive & ar, const unsigned int version) {
         ar & boost::serialization::base_object<BlockInfoBase>(*this);
-        ar & tx;
+        if (version == 0) {
+            // Version 0 also stored the txids of the block
+            std::vector<std::string> tx;
+            ar & tx;
+        }
     }
 };
 
+BOOST_CLASS_VERSION(BlockInfo<RPCTag>, 1)
+
+// How far a blk file has been scanned. A file whose size or modification time changed is only appended to if
+// the first and last block found in it are still in place, otherwise it was rewritten and is read again.
+struct BlockFileScan {
+    // Offset just past the last complete block
+    uint64_t offset = 0;
+    uint64_t fileSize = 0;
+    int64_t modifiedTime = 0;
+    uint64_t lastBlockPos = 0;
+    blocksci::uint256 firstBlockHash;
+    blocksci::uint256 lastBlockHash;
+};
+
+// Saved next to the append-only block header file of the file parser. Records how far every blk file has been
+// scanned so an update only has to look at the parts of the files written since.
+struct BlockFileScanState {
+    // Number of records in the header file which were completely written
+    uint64_t recordCount = 0;
+    // Newest block of the best chain when the header file was last saved
+    blocksci::uint256 bestBlockHash;
+    std::vector<BlockFileScan> files;
+    
+    void write(const boost::filesystem::path &path) const;
+    bool read(const boost::filesystem::path &path);
+};
+
 template <typename ParseTag>
 struct ChainIndex {
     using BlockType = BlockInfo<ParseTag>;
@@ -125,10 +160,18 @@ struct ChainIndex {
     std::unordered_map<blocksci::uint256, BlockType> blockList;
     BlockType newestBlock;
     
-    void update(const ConfigType &config);
-
-    std::vector<BlockType> generateChain(blocksci::BlockHeight maxBlockHeight) const {
-        std::vector<BlockType> chain;
+    // Loads the index saved by the last update
+    void load(const ConfigType &config);
+    void save(const ConfigType &config);
+    
+    // Adds the blocks which appeared since the last update and returns whether there were any
+    bool update(const ConfigType &config);
+    
+    // Whether no blocks appeared since the last update and the parsed chain already ends at the best block.
+    // Doesn't load the index so it is cheap enough to check before every update.
+    static bool isUpToDate(const ConfigType &config, const blocksci::uint256 &parsedTipHash);
+    
+    const BlockType *bestBlock() const {
         const BlockType *maxHeightBlock = nullptr;
         blocksci::BlockHeight maxHeight = std::numeric_limits<blocksci::BlockHeight>::min();
         for (auto &pair : blockList) {
@@ -137,6 +180,12 @@ struct ChainIndex {
                 maxHeight = pair.second.height;
             }
         }
+        return maxHeightBlock;
+    }
+
+    std::vector<BlockType> generateChain(blocksci::BlockHeight maxBlockHeight) const {
+        std::vector<BlockType> chain;
+        auto maxHeightBlock = bestBlock();
         
         if (!maxHeightBlock) {
             return chain;
@@ -163,6 +212,37 @@ struct ChainIndex {
         }
     }
     
+    // Moves chain, which came from generateChain, onto the current best block. Only walks back as far as the fork
+    // point instead of regenerating the whole chain. Returns the number of blocks of the old chain which were kept.
+    blocksci::BlockHeight extendChain(std::vector<BlockType> &chain) const {
+        auto maxHeightBlock = bestBlock();
+        if (!maxHeightBlock) {
+            return static_cast<blocksci::BlockHeight>(chain.size());
+        }
+        
+        blocksci::uint256 nullHash;
+        nullHash.SetNull();
+        
+        auto firstHeight = chain.empty() ? blocksci::BlockHeight{0} : chain.front().height;
+        std::vector<BlockType> newBlocks;
+        size_t keepCount = 0;
+        auto hash = maxHeightBlock->hash;
+        while (hash != nullHash) {
+            auto &block = blockList.find(hash)->second;
+            auto position = block.height - firstHeight;
+            if (position >= 0 && static_cast<size_t>(position) < chain.size() && chain[static_cast<size_t>(position)].hash == hash) {
+                keepCount = static_cast<size_t>(position) + 1;
+                break;
+            }
+            newBlocks.push_back(block);
+            hash = block.header.hashPrevBlock;
+        }
+        
+        chain.resize(keepCount);
+        chain.insert(chain.end(), newBlocks.rbegin(), newBlocks.rend());
+        return static_cast<blocksci::BlockHeight>(keepCount);
+    }
+    
     template <typename GetBlockHash>
     blocksci::BlockHeight findSplitPointIndex(blocksci::BlockHeight blockHeight, GetBlockHash getBlockHash) {
         auto oldBlocks = generateChain(blockHeight);
@@ -181,9 +261,20 @@ struct ChainIndex {
     }
     
 private:
+    // Only used by the file parser
+    BlockFileScanState scanState;
+    std::vector<BlockType> unsavedBlocks;
+    // Set once blocks were dropped, which the append-only header file can't record
+    bool rewriteHeaders = false;
+    
+    void identifyBlockFiles();
+    void dropBlockFile(int fileNum);
+    
     friend class boost::serialization::access;
     template<class Archive> void serialize(Archive & ar, const unsigned int);
     
+    void updateHeights();
+    
     int updateHeight(size_t blockNum, const std::unordered_map<blocksci::uint256, size_t> &indexMap);
 };
 
@@ -7,3 +7,207 @@
 //
 
 #include "file_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    [[noreturn]] void throwFileError(const char *action, const boost::filesystem::path &path) {
+        std::stringstream ss;
+        ss << "Failed to " << action << " " << path << ": " << strerror(errno);
+        throw std::runtime_error(ss.str());
+    }
+    
+    void pwriteAll(int fd, const char *data, size_t length, uint64_t offset, const boost::filesystem::path &path) {
+        while (length > 0) {
+            auto written = pwrite(fd, data, length, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throwFileError("write", path);
+            }
+            data += written;
+            length -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+    }
+}
+
+SimpleFileWriter::SimpleFileWriter(boost::filesystem::path path_, FileWriterOptions options_) : path(path_.concat(".dat")), options(options_) {
+    options.bufferSize = std::max<size_t>(options.bufferSize, 4096);
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throwFileError("open", path);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        throwFileError("stat", path);
+    }
+    lastDataPos = static_cast<uint64_t>(fileStat.st_size);
+    current.data = std::make_unique<char[]>(options.bufferSize);
+    current.offset = lastDataPos;
+    ioThread = std::thread([this]() {
+        ioLoop();
+    });
+}
+
+SimpleFileWriter::~SimpleFileWriter() {
+    try {
+        flush();
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+    }
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stopping = true;
+    }
+    bufferQueued.notify_one();
+    ioThread.join();
+    close(fd);
+}
+
+void SimpleFileWriter::ioLoop() {
+    std::unique_lock<std::mutex> lock(m);
+    while (true) {
+        bufferQueued.wait(lock, [&]() {
+            return stopping || !queued.empty();
+        });
+        if (queued.empty()) {
+            return;
+        }
+        auto buffer = std::move(queued.front());
+        queued.pop_front();
+        writing = true;
+        lock.unlock();
+        
+        std::exception_ptr failure;
+        try {
+            pwriteAll(fd, buffer.data.get(), buffer.used, buffer.offset, path);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        
+        lock.lock();
+        writing = false;
+        if (failure && !error) {
+            error = failure;
+        }
+        buffer.used = 0;
+        freeBuffers.push_back(std::move(buffer));
+        bufferWritten.notify_all();
+    }
+}
+
+void SimpleFileWriter::throwIfFailed() {
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Queues the current buffer and replaces it, allocating a new buffer while the memory limit allows and
+// waiting for the I/O thread to return one otherwise
+void SimpleFileWriter::submit() {
+    std::unique_lock<std::mutex> lock(m);
+    throwIfFailed();
+    auto nextOffset = current.offset + current.used;
+    queued.push_back(std::move(current));
+    bufferQueued.notify_one();
+    
+    auto maxBuffers = std::max<size_t>(2, options.maxBufferedBytes / options.bufferSize);
+    if (freeBuffers.empty() && allocatedBuffers < maxBuffers) {
+        current = Buffer{};
+        current.data = std::make_unique<char[]>(options.bufferSize);
+        allocatedBuffers++;
+    } else {
+        bufferWritten.wait(lock, [&]() {
+            return !freeBuffers.empty() || error;
+        });
+        throwIfFailed();
+        current = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+    }
+    current.offset = nextOffset;
+}
+
+void SimpleFileWriter::waitForWrites() {
+    std::unique_lock<std::mutex> lock(m);
+    bufferWritten.wait(lock, [&]() {
+        return (queued.empty() && !writing) || error;
+    });
+    throwIfFailed();
+}
+
+void SimpleFileWriter::writeBytes(const char *data, size_t length) {
+    while (length > 0) {
+        auto count = std::min(length, options.bufferSize - current.used);
+        memcpy(current.data.get() + current.used, data, count);
+        current.used += count;
+        data += count;
+        length -= count;
+        if (current.used == options.bufferSize) {
+            submit();
+        }
+    }
+}
+
+// Data still in the current buffer is patched there. Anything older, or beyond the end of the file, is written
+// directly once the queued buffers have reached the file, so later appends still overwrite it in order
+void SimpleFileWriter::updateBytes(uint64_t offset, const char *data, size_t length) {
+    auto end = offset + length;
+    auto bufferEnd = current.offset + current.used;
+    auto from = std::max(offset, current.offset);
+    auto to = std::min(end, bufferEnd);
+    if (from < to) {
+        memcpy(current.data.get() + (from - current.offset), data + (from - offset), to - from);
+    }
+    
+    bool waited = false;
+    auto writeDirect = [&](uint64_t begin, uint64_t stop) {
+        if (begin < stop) {
+            if (!waited) {
+                waitForWrites();
+                waited = true;
+            }
+            pwriteAll(fd, data + (begin - offset), stop - begin, begin, path);
+        }
+    };
+    writeDirect(offset, std::min(end, current.offset));
+    writeDirect(std::max(offset, bufferEnd), end);
+}
+
+void SimpleFileWriter::readBytes(uint64_t offset, char *data, size_t length) {
+    flush();
+    while (length > 0) {
+        auto count = pread(fd, data, length, static_cast<off_t>(offset));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            throwFileError("read", path);
+        }
+        data += count;
+        length -= static_cast<size_t>(count);
+        offset += static_cast<uint64_t>(count);
+    }
+}
+
+void SimpleFileWriter::expandToFit(uint64_t size) {
+    flush();
+    pwriteAll(fd, "", 1, size - 1, path);
+}
+
+void SimpleFileWriter::flush() {
+    if (current.used > 0) {
+        submit();
+    }
+    waitForWrites();
+}
@@ -9,71 +9,104 @@
 #ifndef file_writer_hpp
 #define file_writer_hpp
 
-#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/path.hpp>
 
+#include <array>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct FileWriterOptions {
+    // Size of each buffer handed to the I/O thread
+    size_t bufferSize = 1 << 20;
+    // Memory a writer may hold in buffers before writes wait for the disk, at least two buffers
+    size_t maxBufferedBytes = 64 << 20;
+};
+
+// Appends to a file from a dedicated I/O thread. Writes are copied into large buffers and every full buffer
+// is queued for the thread, so callers only block on the disk once maxBufferedBytes are waiting to be written.
+// Reads and updates of data that already left the current buffer first wait for the queue to drain.
+// Write errors are rethrown by the next call that submits a buffer or waits for the queue
 struct SimpleFileWriter {
+private:
+    struct Buffer {
+        std::unique_ptr<char[]> data;
+        size_t used = 0;
+        uint64_t offset = 0;
+    };
+    
+    boost::filesystem::path path;
+    FileWriterOptions options;
+    int fd;
+    Buffer current;
+    size_t allocatedBuffers = 1;
+    
+    std::mutex m;
+    std::condition_variable bufferQueued;
+    std::condition_variable bufferWritten;
+    std::deque<Buffer> queued;
+    std::vector<Buffer> freeBuffers;
+    bool writing = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::thread ioThread;
+    
+    void ioLoop();
+    void throwIfFailed();
+    void submit();
+    void waitForWrites();
+    void writeBytes(const char *data, size_t length);
+    void updateBytes(uint64_t offset, const char *data, size_t length);
+    void readBytes(uint64_t offset, char *data, size_t length);
+    
 protected:
     uint64_t lastDataPos;
-    boost::filesystem::fstream file;
+    
 public:
     
     uint64_t getLastPos() const { return lastDataPos; }
     
-    SimpleFileWriter(boost::filesystem::path path) {
-        auto mainParams = std::fstream::out | std::fstream::binary;
-        auto extraParams = std::fstream::ate | std::fstream::in;
-        path = path.concat(".dat");
-        
-        file.open(path, mainParams | extraParams);
-        if (!file.is_open())
-        {
-            // create
-            file.open(path, mainParams);
-            
-            // close
-            if (file.is_open())
-                file.close();
-            
-            // re-open
-            file.open(path, mainParams | extraParams);
-        }
-        lastDataPos = static_cast<size_t>(file.tellp());
-    }
+    SimpleFileWriter(boost::filesystem::path path, FileWriterOptions options = {});
+    SimpleFileWriter(const SimpleFileWriter &) = delete;
+    SimpleFileWriter &operator=(const SimpleFileWriter &) = delete;
+    ~SimpleFileWriter();
     
     template<typename T, typename = std::enable_if_t<std::is_trivially_copyable<T>::value>>
     void writeImp(const T &t) {
-        file.write(reinterpret_cast<const char *>(&t), sizeof(T));
+        if (current.used + sizeof(T) <= options.bufferSize) {
+            memcpy(current.data.get() + current.used, &t, sizeof(T));
+            current.used += sizeof(T);
+        } else {
+            writeBytes(reinterpret_cast<const char *>(&t), sizeof(T));
+        }
         lastDataPos += sizeof(T);
     }
     
     template <typename T>
     T read(size_t offset) {
         T ret;
-        file.seekg(static_cast<std::streamoff>(offset));
-        file.read(reinterpret_cast<char *>(&ret), sizeof(T));
-        file.seekg(static_cast<std::streamoff>(lastDataPos));
+        readBytes(offset, reinterpret_cast<char *>(&ret), sizeof(T));
         return ret;
     }
     
     template<typename K>
     void update(size_t offset, const K &t) {
-        file.seekp(static_cast<std::streamoff>(offset));
-        file.write(reinterpret_cast<const char *>(&t), sizeof(t));
-        file.seekp(static_cast<std::streamoff>(lastDataPos));
+        updateBytes(offset, reinterpret_cast<const char *>(&t), sizeof(t));
     }
     
-    void expandToFit(std::streamoff size) {
-        file.seekp(size - 1);
-        file.write("", 1);
-    }
+    void expandToFit(uint64_t size);
     
     size_t size() const {
         return lastDataPos;
     }
     
-    void flush() {
-        file.flush();
-    }
+    // Waits until everything written so far has reached the file
+    void flush();
 };
 
 struct ArbitraryFileWriter : SimpleFileWriter {
@@ -100,7 +133,7 @@ class FixedSizeFileWriter {
     
 public:
     
-    FixedSizeFileWriter(const boost::filesystem::path &path) : dataFile(path) {}
+    FixedSizeFileWriter(const boost::filesystem::path &path, FileWriterOptions options = {}) : dataFile(path, options) {}
     
     void expandToFit(uint32_t size) {
         dataFile.expandToFit(sizeof(T) * size);
@@ -122,6 +155,10 @@ public:
     size_t size() const {
         return dataFile.size() / sizeof(T);
     }
+    
+    void flush() {
+        dataFile.flush();
+    }
 };
 
 template <size_t indexCount>
@@ -135,7 +172,7 @@ private:
     FixedSizeFileWriter<FileIndex<indexCount>> indexFile;
 public:
     
-    IndexedFileWriter(boost::filesystem::path pathPrefix) : dataFile(boost::filesystem::path{pathPrefix}.concat("_data")), indexFile(boost::filesystem::path{pathPrefix}.concat("_index")) {}
+    IndexedFileWriter(boost::filesystem::path pathPrefix, FileWriterOptions options = {}) : dataFile(boost::filesystem::path{pathPrefix}.concat("_data"), options), indexFile(boost::filesystem::path{pathPrefix}.concat("_index"), options) {}
     
     void writeIndexGroup() {
         FileIndex<indexCount> fileIndex;
@@ -21,67 +21,71 @@
 
 #include <sstream>
 
-HashIndexCreator::HashIndexCreator(const ParserConfigurationBase &config_, const std::string &path) : ParserIndex(config_, "hashIndex"), db(path, false) {}
+HashIndexCreator::HashIndexCreator(const ParserConfigurationBase &config_, const std::string &path) : ParserIndex(config_, "hashIndex"), ownedDb(std::make_unique<blocksci::HashIndex>(path, false)), db(*ownedDb) {}
 
-void HashIndexCreator::processTx(const blocksci::Transaction &tx) {
-    auto hash = tx.getHash();
-    db.addTx(hash, tx.txNum);
-    
-    bool insideP2SH;
-    std::function<bool(const blocksci::Address &)> inputVisitFunc = [&](const blocksci::Address &a) {
-        if (a.type == blocksci::AddressType::SCRIPTHASH) {
-            insideP2SH = true;
-            return true;
-        } else if (a.type == blocksci::AddressType::WITNESS_SCRIPTHASH && insideP2SH) {
-            auto script = blocksci::script::WitnessScriptHash(a.scriptNum, a.getAccess());
-            db.addAddress<blocksci::AddressType::WITNESS_SCRIPTHASH>(script.getAddressHash(), a.scriptNum);
-            return false;
-        } else {
-            return false;
+HashIndexCreator::HashIndexCreator(const ParserConfigurationBase &config_, blocksci::HashIndex &db_) : ParserIndex(config_, "hashIndex"), db(db_) {}
+
+namespace {
+    template <typename Writer>
+    void indexTx(const blocksci::Transaction &tx, Writer &writer) {
+        auto hash = tx.getHash();
+        writer.addTx(hash, tx.txNum);
+        
+        bool insideP2SH;
+        std::function<bool(const blocksci::Address &)> inputVisitFunc = [&](const blocksci::Address &a) {
+            if (a.type == blocksci::AddressType::SCRIPTHASH) {
+                insideP2SH = true;
+                return true;
+            } else if (a.type == blocksci::AddressType::WITNESS_SCRIPTHASH && insideP2SH) {
+                auto script = blocksci::script::WitnessScriptHash(a.scriptNum, a.getAccess());
+                writer.template addAddress<blocksci::AddressType::WITNESS_SCRIPTHASH>(script.getAddressHash(), a.scriptNum);
+                return false;
+            } else {
+                return false;
+            }
+        };
+        for (auto input : tx.inputs()) {
+            insideP2SH = false;
+            visit(input.getAddress(), inputVisitFunc);
         }
-    };
-    for (auto input : tx.inputs()) {
-        insideP2SH = false;
-        visit(input.getAddress(), inputVisitFunc);
-    }
-    
-    for (auto txout : tx.outputs()) {
-        if (txout.getType() == blocksci::AddressType::WITNESS_SCRIPTHASH) {
-            auto scriptNum = txout.getAddress().scriptNum;
-            auto script = blocksci::script::WitnessScriptHash(scriptNum, tx.getAccess());
-            db.addAddress<blocksci::AddressType::WITNESS_SCRIPTHASH>(script.getAddressHash(), scriptNum);
+        
+        for (auto txout : tx.outputs()) {
+            if (txout.getType() == blocksci::AddressType::WITNESS_SCRIPTHASH) {
+                auto scriptNum = txout.getAddress().scriptNum;
+                auto script = blocksci::script::WitnessScriptHash(scriptNum, tx.getAccess());
+                writer.template addAddress<blocksci::AddressType::WITNESS_SCRIPTHASH>(script.getAddressHash(), scriptNum);
+            }
         }
     }
 }
 
+void HashIndexCreator::processTx(const blocksci::Transaction &tx) {
+    indexTx(tx, writer);
+}
+
+std::vector<BulkIndexColumn> HashIndexCreator::bulkColumns() {
+    std::vector<BulkIndexColumn> columns(2);
+    auto witnessScriptHashColumn = db.getColumn(blocksci::AddressType::WITNESS_SCRIPTHASH);
+    columns[BulkWriter::WitnessScriptHashColumn] = {witnessScriptHashColumn, sizeof(blocksci::AddressInfo<blocksci::AddressType::WITNESS_SCRIPTHASH>::IDType), sizeof(uint32_t), db.getOptions(witnessScriptHashColumn)};
+    columns[BulkWriter::TxColumn] = {db.getTxColumn(), sizeof(blocksci::uint256), sizeof(uint32_t), db.getOptions(db.getTxColumn())};
+    return columns;
+}
+
+void HashIndexCreator::bulkProcessTx(const blocksci::Transaction &tx, BulkRunWriter &writer) {
+    BulkWriter bulkWriter(writer);
+    indexTx(tx, bulkWriter);
+}
+
 void HashIndexCreator::rollback(const blocksci::State &state) {
-    {
-        auto column = db.getColumn(blocksci::AddressType::WITNESS_SCRIPTHASH);
-        rocksdb::WriteBatch batch;
-        auto it = db.getIterator(blocksci::AddressType::WITNESS_SCRIPTHASH);
-        for (it->SeekToFirst(); it->Valid(); it->Next()) {
-            uint32_t destNum;
-            memcpy(&destNum, it->value().data(), sizeof(destNum));
-            auto count = state.scriptCounts[static_cast<size_t>(blocksci::DedupAddressType::SCRIPTHASH)];
-            if (destNum >= count) {
-                batch.Delete(column, it->key());
-            }
-        }
-        assert(it->status().ok());
-        delete it;
-        db.writeBatch(batch);
-    }
+    writer.wait();
     
-    {
-        auto it = db.getTxIterator();
-        for (it->SeekToFirst(); it->Valid(); it->Next()) {
-            uint32_t value;
-            memcpy(&value, it->value().data(), sizeof(value));
-            if (value >= state.txCount) {
-                db.deleteTx(it->key());
-            }
-        }
-        assert(it->status().ok()); // Check for any errors found during the scan
-        delete it;
+    rocksdb::WriteBatch batch;
+    RollbackWriter rollbackWriter(db, batch, state.scriptCounts[static_cast<size_t>(blocksci::DedupAddressType::SCRIPTHASH)]);
+    visitRolledBack(state, [&](const blocksci::Transaction &tx) {
+        indexTx(tx, rollbackWriter);
+    }, [](uint32_t, const blocksci::DataAccess &) {});
+    auto status = db.writeBatch(batch);
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to roll back hash index: " + status.ToString());
     }
 }
@@ -11,10 +11,12 @@
 
 #include "parser_index.hpp"
 #include "parser_fwd.hpp"
+#include "hash_index_writer.hpp"
 
 #include <blocksci/chain/chain_fwd.hpp>
 #include <blocksci/index/hash_index.hpp>
 
+#include <memory>
 #include <tuple>
 
 namespace blocksci {
@@ -27,17 +29,77 @@ template<blocksci::DedupAddressType::Enum type>
 struct ParserIndexScriptInfo<HashIndexCreator, type> : std::false_type {};
 
 class HashIndexCreator : public ParserIndex<HashIndexCreator> {
-    blocksci::HashIndex db;
+    std::unique_ptr<blocksci::HashIndex> ownedDb;
+    blocksci::HashIndex &db;
+    HashIndexWriter writer{db};
+    
+    // Deletes the keys it is given which were added after the rollback point
+    class RollbackWriter {
+        blocksci::HashIndex &db;
+        rocksdb::WriteBatch &batch;
+        uint32_t scriptHashCount;
+    public:
+        RollbackWriter(blocksci::HashIndex &db_, rocksdb::WriteBatch &batch_, uint32_t scriptHashCount_) : db(db_), batch(batch_), scriptHashCount(scriptHashCount_) {}
+        
+        template<blocksci::AddressType::Enum type>
+        void addAddress(const typename blocksci::AddressInfo<type>::IDType &hash, uint32_t scriptNum) {
+            // Kept transactions may have added the same script first
+            if (scriptNum >= scriptHashCount) {
+                batch.Delete(db.getColumn(type), rocksdb::Slice(reinterpret_cast<const char *>(&hash), sizeof(hash)));
+            }
+        }
+        
+        void addTx(const blocksci::uint256 &hash, uint32_t) {
+            batch.Delete(db.getTxColumn(), rocksdb::Slice(reinterpret_cast<const char *>(&hash), sizeof(hash)));
+        }
+    };
+    
+    // Stands in for the HashIndexWriter when entries are built in bulk
+    class BulkWriter {
+        BulkRunWriter &writer;
+    public:
+        enum Column : size_t {
+            WitnessScriptHashColumn, TxColumn
+        };
+        
+        explicit BulkWriter(BulkRunWriter &writer_) : writer(writer_) {}
+        
+        template<blocksci::AddressType::Enum type>
+        void addAddress(const typename blocksci::AddressInfo<type>::IDType &hash, uint32_t scriptNum) {
+            static_assert(type == blocksci::AddressType::WITNESS_SCRIPTHASH, "Only witness script hashes are added by the hash index creator");
+            writer.add(WitnessScriptHashColumn, &hash, &scriptNum);
+        }
+        
+        void addTx(const blocksci::uint256 &hash, uint32_t txNum) {
+            writer.add(TxColumn, &hash, &txNum);
+        }
+    };
+    
 public:
     
     HashIndexCreator(const ParserConfigurationBase &config, const std::string &path);
+    // Writes into a hash index that is already open, such as the one of the address state
+    HashIndexCreator(const ParserConfigurationBase &config, blocksci::HashIndex &db);
     void processTx(const blocksci::Transaction &tx);
     
     template<blocksci::DedupAddressType::Enum type>
     void processScript(uint32_t equivNum, const blocksci::DataAccess &);
     
+    std::vector<BulkIndexColumn> bulkColumns();
+    void bulkProcessTx(const blocksci::Transaction &tx, BulkRunWriter &writer);
+    
+    template<blocksci::DedupAddressType::Enum type>
+    void bulkProcessScript(uint32_t equivNum, const blocksci::DataAccess &, BulkRunWriter &);
+    
+    void ingest(BulkIndexBuilder &builder) {
+        writer.wait();
+        builder.ingest(db);
+    }
+    
     void rollback(const blocksci::State &state);
-    void tearDown() override {}
+    void tearDown() override {
+        writer.wait();
+    }
 };
 
 #endif /* hash_index_creator_hpp */
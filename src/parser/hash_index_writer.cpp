@@ -0,0 +1,61 @@
+//
+//  hash_index_writer.cpp
+//  blocksci_parser
+//
+
+#include "hash_index_writer.hpp"
+
+HashIndexWriter::HashIndexWriter(blocksci::HashIndex &index_, size_t batchSize_) : index(index_), batchSize(batchSize_), current(std::make_unique<PendingBatch>()) {}
+
+HashIndexWriter::~HashIndexWriter() {
+    try {
+        wait();
+    } catch (const std::exception &e) {
+        std::cerr << "Failed writing hash index: " << e.what() << std::endl;
+    }
+}
+
+bool HashIndexWriter::findPending(const PendingKey &key, uint32_t &value) const {
+    auto it = current->values.find(key);
+    if (it != current->values.end()) {
+        value = it->second;
+        return true;
+    }
+    if (writing) {
+        it = writing->values.find(key);
+        if (it != writing->values.end()) {
+            value = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+void HashIndexWriter::finishWrite() {
+    if (writeFuture.valid()) {
+        // Only dropped once written so lookups keep finding its entries until then
+        auto finished = std::move(writing);
+        writeFuture.get();
+    }
+}
+
+void HashIndexWriter::flush() {
+    if (current->values.empty()) {
+        return;
+    }
+    finishWrite();
+    writing = std::move(current);
+    current = std::make_unique<PendingBatch>();
+    auto batch = &writing->batch;
+    writeFuture = std::async(std::launch::async, [this, batch]() {
+        auto status = index.writeBatch(*batch);
+        if (!status.ok()) {
+            throw std::runtime_error("Hash index write failed: " + status.ToString());
+        }
+    });
+}
+
+void HashIndexWriter::wait() {
+    flush();
+    finishWrite();
+}
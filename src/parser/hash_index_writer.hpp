@@ -0,0 +1,110 @@
+//
+//  hash_index_writer.hpp
+//  blocksci_parser
+//
+
+#ifndef hash_index_writer_hpp
+#define hash_index_writer_hpp
+
+#include <blocksci/index/hash_index.hpp>
+#include <blocksci/util/bitcoin_uint256.hpp>
+
+#include <rocksdb/write_batch.h>
+
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+
+// Buffers HashIndex inserts in a WriteBatch and hands each full batch to a background thread, so adding
+// an entry never waits on RocksDB. Entries that have been added but not yet written are kept in a side
+// map which lookupAddress checks first, so lookups always see earlier adds. At most one batch is being
+// written at a time and a write error is rethrown by the next flush or wait.
+class HashIndexWriter {
+    struct PendingKey {
+        uint32_t columnId;
+        uint32_t size;
+        std::array<char, 32> data;
+        
+        bool operator==(const PendingKey &other) const {
+            return columnId == other.columnId && size == other.size && memcmp(data.data(), other.data.data(), size) == 0;
+        }
+    };
+    
+    // Keys are hashes already, so part of them is a good enough hash
+    struct PendingKeyHash {
+        size_t operator()(const PendingKey &key) const {
+            size_t value;
+            memcpy(&value, key.data.data(), sizeof(value));
+            return value ^ key.columnId;
+        }
+    };
+    
+    struct PendingBatch {
+        rocksdb::WriteBatch batch;
+        std::unordered_map<PendingKey, uint32_t, PendingKeyHash> values;
+    };
+    
+    blocksci::HashIndex &index;
+    size_t batchSize;
+    std::unique_ptr<PendingBatch> current;
+    std::unique_ptr<PendingBatch> writing;
+    std::future<void> writeFuture;
+    
+    template <typename T>
+    static PendingKey makeKey(rocksdb::ColumnFamilyHandle *column, const T &key) {
+        static_assert(sizeof(T) <= sizeof(PendingKey::data), "Hash index keys are at most 32 bytes");
+        PendingKey pendingKey{column->GetID(), sizeof(T), {}};
+        memcpy(pendingKey.data.data(), &key, sizeof(T));
+        return pendingKey;
+    }
+    
+    template <typename T>
+    void put(rocksdb::ColumnFamilyHandle *column, const T &key, uint32_t value) {
+        rocksdb::Slice keySlice(reinterpret_cast<const char *>(&key), sizeof(key));
+        rocksdb::Slice valueSlice(reinterpret_cast<const char *>(&value), sizeof(value));
+        current->batch.Put(column, keySlice, valueSlice);
+        current->values[makeKey(column, key)] = value;
+        if (current->values.size() >= batchSize) {
+            flush();
+        }
+    }
+    
+    bool findPending(const PendingKey &key, uint32_t &value) const;
+    void finishWrite();
+    
+public:
+    explicit HashIndexWriter(blocksci::HashIndex &index, size_t batchSize = 100000);
+    HashIndexWriter(const HashIndexWriter &) = delete;
+    HashIndexWriter &operator=(const HashIndexWriter &) = delete;
+    ~HashIndexWriter();
+    
+    template<blocksci::AddressType::Enum type>
+    uint32_t lookupAddress(const typename blocksci::AddressInfo<type>::IDType &hash) {
+        uint32_t value;
+        if (findPending(makeKey(index.getColumn(type), hash), value)) {
+            return value;
+        }
+        return index.lookupAddress<type>(hash);
+    }
+    
+    template<blocksci::AddressType::Enum type>
+    void addAddress(const typename blocksci::AddressInfo<type>::IDType &hash, uint32_t scriptNum) {
+        put(index.getColumn(type), hash, scriptNum);
+    }
+    
+    void addTx(const blocksci::uint256 &hash, uint32_t txNum) {
+        put(index.getTxColumn(), hash, txNum);
+    }
+    
+    // Starts writing everything added so far in the background
+    void flush();
+    
+    // Returns once everything added so far is in the database
+    void wait();
+};
+
+#endif /* hash_index_writer_hpp */
@@ -21,6 +21,9 @@
 #include "block_replayer.hpp"
 #include "address_writer.hpp"
 #include "utxo_address_state.hpp"
+#include "undo_journal.hpp"
+#include "parser_checkpoint.hpp"
+#include "warmup.hpp"
 
 #include <blocksci/util/state.hpp>
 #include <blocksci/address/address_types.hpp>
@@ -43,11 +46,12 @@
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
-
 #include <unordered_set>
+#include <chrono>
+#include <csignal>
 #include <future>
+#include <memory>
+#include <thread>
 #include <iostream>
 #include <iomanip>
 #include <cassert>
@@ -56,22 +60,121 @@ std::vector<char> HexToBytes(const std::string& hex);
 uint32_t getStartingTxCount(const blocksci::DataConfiguration &config);
 
 
-blocksci::State rollbackState(const ParserConfigurationBase &config, blocksci::BlockHeight firstDeletedBlock, uint32_t firstDeletedTxNum) {
-    blocksci::State state{blocksci::ChainAccess{config}, blocksci::ScriptAccess{config}};
+void loadUTXOAddressState(const ParserConfigurationBase &config, UTXOAddressState &utxoAddressState) {
+    ParserCheckpoint checkpoint;
+    if (ParserCheckpoint::load(config, checkpoint) && checkpoint.utxoCheckpoint != 0) {
+        utxoAddressState.unserialize(config.utxoAddressStatePath(checkpoint.utxoCheckpoint));
+    } else {
+        utxoAddressState.unserialize(config.utxoAddressStatePath());
+    }
+}
+
+// Flushes the chain and script files and the UTXO state, saves the spend data next to the UTXO checkpoint and
+// then records the checkpoint. The spend data of older checkpoints is only removed once the new one is recorded.
+void commitCheckpoint(const ParserConfigurationBase &config, ParserCheckpoint &checkpoint, UTXOState &utxoState, UTXOAddressState &utxoAddressState) {
+    syncFiles(config.chainDirectory());
+    syncFiles(config.scriptsDirectory());
+    syncFiles(config.undoJournalDirectory());
+    for (auto &updatesPath : {config.txUpdatesFilePath(), config.txUpdatesPendingFilePath()}) {
+        auto updatesFile = boost::filesystem::path{updatesPath}.concat(".dat");
+        if (boost::filesystem::exists(updatesFile)) {
+            syncFile(updatesFile);
+        }
+    }
+    
+    auto utxoCheckpoint = utxoState.prepareCheckpoint();
+    auto statePath = config.utxoAddressStatePath(utxoCheckpoint);
+    boost::filesystem::create_directories(statePath);
+    utxoAddressState.serialize(statePath);
+    syncFiles(statePath);
+    
+    checkpoint.utxoCheckpoint = utxoCheckpoint;
+    checkpoint.save(config);
+    utxoState.checkpointRecorded();
+    
+    for (auto &entry : boost::filesystem::directory_iterator(config.utxoAddressStatePath())) {
+        if (entry.path() != statePath) {
+            boost::filesystem::remove_all(entry.path());
+        }
+    }
+}
+
+// Position of everything the parser has written so far
+void readParserPosition(const ParserConfigurationBase &config, ParserCheckpoint &checkpoint, const AddressState &addressState) {
+    checkpoint.state = blocksci::State{blocksci::ChainAccess{config}, blocksci::ScriptAccess{config}};
+    auto &scriptCounts = addressState.getScriptCounts();
+    std::copy(scriptCounts.begin(), scriptCounts.end(), checkpoint.state.scriptCounts.begin());
+    auto coinbaseFile = boost::filesystem::path{config.blockCoinbaseFilePath()}.concat(".dat");
+    checkpoint.coinbaseSize = boost::filesystem::exists(coinbaseFile) ? boost::filesystem::file_size(coinbaseFile) : 0;
+    checkpoint.linkedTxCount = checkpoint.state.txCount;
+}
+
+// Records that the parser is about to write past the current checkpoint
+void markUnclean(const ParserConfigurationBase &config, ParserCheckpoint &checkpoint, const AddressState &addressState) {
+    readParserPosition(config, checkpoint, addressState);
+    checkpoint.clean = false;
+    checkpoint.save(config);
+}
+
+// Moves the checkpoint to the blocks added so far. Back links of the last chunk may still be pending and are
+// finished from the updates files if the run stops before they are
+void saveCheckpoint(const ParserConfigurationBase &config, ParserCheckpoint &checkpoint, UTXOState &utxoState, UTXOAddressState &utxoAddressState, AddressState &addressState) {
+    addressState.syncHashIndex();
+    readParserPosition(config, checkpoint, addressState);
+    checkpoint.clean = false;
+    commitCheckpoint(config, checkpoint, utxoState, utxoAddressState);
+}
+
+// Only called once nothing past the checkpoint is left and every back link up to it is on disk
+void markClean(const ParserConfigurationBase &config, ParserCheckpoint &checkpoint) {
+    syncFiles(config.chainDirectory());
+    syncFiles(config.scriptsDirectory());
+    checkpoint.linkedTxCount = checkpoint.state.txCount;
+    checkpoint.clean = true;
+    checkpoint.save(config);
+}
+
+// Without undo records the spent outputs and the earliest removed scripts have to be found by scanning the outputs
+// of every removed transaction and of every transaction they spend from. The restored UTXO state is recorded as
+// a checkpoint that discardBlocks then removes the blocks down to.
+ParserCheckpoint rollbackState(const ParserConfigurationBase &config, blocksci::BlockHeight firstDeletedBlock, uint32_t firstDeletedTxNum, uint64_t firstDeletedCoinbaseOffset, const std::vector<BlockUndo> *undos) {
+    ParserCheckpoint checkpoint;
+    ParserCheckpoint::load(config, checkpoint);
+    auto &state = checkpoint.state;
+    state = blocksci::State{blocksci::ChainAccess{config}, blocksci::ScriptAccess{config}};
     state.blockCount = static_cast<uint32_t>(static_cast<int>(firstDeletedBlock));
     state.txCount = firstDeletedTxNum;
     
-    blocksci::IndexedFileMapper<blocksci::AccessMode::readwrite, blocksci::RawTransaction> txFile{config.txFilePath()};
-    blocksci::FixedSizeFileMapper<blocksci::uint256, blocksci::AccessMode::readwrite> txHashesFile{config.txHashesFilePath()};
+    const blocksci::IndexedFileMapper<blocksci::AccessMode::readonly, blocksci::RawTransaction> txFile{config.txFilePath()};
+    const blocksci::FixedSizeFileMapper<blocksci::uint256> txHashesFile{config.txHashesFilePath()};
     blocksci::DataAccess access(config);
     
     UTXOState utxoState;
     UTXOAddressState utxoAddressState;
-    UTXOScriptState utxoScriptState;
     
-    utxoAddressState.unserialize(config.utxoAddressStatePath());
-    utxoState.unserialize(config.utxoCacheFile().native());
-    utxoScriptState.unserialize(config.utxoScriptStatePath().native());
+    loadUTXOAddressState(config, utxoAddressState);
+    utxoState.open(config);
+    
+    std::vector<blocksci::OutputPointer> spentOutputs;
+    if (undos != nullptr) {
+        auto &firstUndo = undos->front();
+        std::copy(firstUndo.scriptCounts.begin(), firstUndo.scriptCounts.end(), state.scriptCounts.begin());
+        for (auto &undo : *undos) {
+            spentOutputs.insert(spentOutputs.end(), undo.spentOutputs.begin(), undo.spentOutputs.end());
+        }
+    }
+    
+    // The back links to the removed transactions stay until discardBlocks clears them so an interrupted rollback
+    // can still find the outputs they spent
+    auto restoreOutput = [&](uint32_t spentTxNum, uint16_t outputNum) {
+        auto spentTx = txFile.getData(spentTxNum);
+        auto spentHash = txHashesFile.getData(spentTxNum);
+        auto &output = spentTx->getOutput(outputNum);
+        UTXO utxo(output.getValue(), spentTxNum, output.getType());
+        utxoState.add({*spentHash, outputNum}, utxo, output.toAddressNum);
+        blocksci::AnyScript script(output.toAddressNum, output.getType(), access);
+        utxoAddressState.addOutput(script, {spentTxNum, outputNum});
+    };
     
     uint32_t totalTxCount = static_cast<uint32_t>(txFile.size());
     for (uint32_t txNum = totalTxCount - 1; txNum >= firstDeletedTxNum; txNum--) {
@@ -79,74 +182,150 @@ blocksci::State rollbackState(const ParserConfigurationBase &config, blocksci::B
         auto hash = txHashesFile.getData(txNum);
         for (uint16_t i = 0; i < tx->outputCount; i++) {
             auto &output = tx->getOutput(i);
-            blocksci::AnyScript script(output.toAddressNum, output.getType(), access);
-            if (script.firstTxIndex() == txNum) {
-                auto &prevValue = state.scriptCounts[static_cast<size_t>(dedupType(output.getType()))];
-                if (output.toAddressNum < prevValue) {
-                    prevValue = output.toAddressNum;
+            if (undos == nullptr) {
+                blocksci::AnyScript script(output.toAddressNum, output.getType(), access);
+                if (script.firstTxIndex() == txNum) {
+                    auto &prevValue = state.scriptCounts[static_cast<size_t>(dedupType(output.getType()))];
+                    if (output.toAddressNum < prevValue) {
+                        prevValue = output.toAddressNum;
+                    }
                 }
             }
             if (isSpendable(output.getType())) {
                 utxoState.erase({*hash, i});
                 utxoAddressState.spendOutput({txNum, i}, output.getType());
-                utxoScriptState.erase({txNum, i});
             }
         }
         
-        uint32_t inputsAdded = 0;
+        if (undos != nullptr) {
+            for (uint16_t i = 0; i < tx->inputCount; i++) {
+                if (spentOutputs.empty()) {
+                    throw std::runtime_error("Undo journal is missing spent outputs");
+                }
+                auto pointer = spentOutputs.back();
+                spentOutputs.pop_back();
+                if (txFile.getData(pointer.txNum)->getOutput(pointer.inoutNum).linkedTxNum != txNum) {
+                    throw std::runtime_error("Undo journal does not match the chain");
+                }
+                restoreOutput(pointer.txNum, pointer.inoutNum);
+            }
+        } else {
+            uint32_t inputsAdded = 0;
+            for (uint16_t i = 0; i < tx->inputCount; i++) {
+                auto &input = tx->getInput(i);
+                auto spentTxNum = input.linkedTxNum;
+                auto spentTx = txFile.getData(spentTxNum);
+                for (uint16_t j = 0; j < spentTx->outputCount; j++) {
+                    if (spentTx->getOutput(j).linkedTxNum == txNum) {
+                        restoreOutput(spentTxNum, j);
+                        inputsAdded++;
+                    }
+                }
+            }
+            assert(inputsAdded == tx->inputCount);
+        }
+    }
+    
+    checkpoint.coinbaseSize = firstDeletedCoinbaseOffset;
+    checkpoint.linkedTxCount = totalTxCount;
+    checkpoint.clean = false;
+    commitCheckpoint(config, checkpoint, utxoState, utxoAddressState);
+    utxoState.close();
+    
+    return checkpoint;
+}
+
+// Outputs kept by a rollback may still be linked to the transactions in [txCount, linkedTxCount) that spent them
+void clearBackLinks(const ParserConfigurationBase &config, uint32_t txCount, uint32_t linkedTxCount) {
+    blocksci::IndexedFileMapper<blocksci::AccessMode::readwrite, blocksci::RawTransaction> txFile{config.txFilePath()};
+    linkedTxCount = std::min(linkedTxCount, static_cast<uint32_t>(txFile.size()));
+    for (uint32_t txNum = txCount; txNum < linkedTxCount; txNum++) {
+        auto tx = txFile.getData(txNum);
         for (uint16_t i = 0; i < tx->inputCount; i++) {
-            auto &input = tx->getInput(i);
-            auto spentTxNum = input.linkedTxNum;
-            auto spentTx = txFile.getData(spentTxNum);
-            auto spentHash = txHashesFile.getData(spentTxNum);
-            for (uint16_t j = 0; j < spentTx->outputCount; j++) {
-                auto &output = spentTx->getOutput(j);
-                if (output.linkedTxNum == txNum) {
-                    output.linkedTxNum = 0;
-                    UTXO utxo(output.getValue(), spentTxNum, output.getType());
-                    utxoState.add({*spentHash, j}, utxo);
-                    blocksci::AnyScript script(output.toAddressNum, output.getType(), access);
-                    utxoAddressState.addOutput(script, {spentTxNum, j});
-                    utxoScriptState.add({spentTxNum, j}, output.toAddressNum);
-                    inputsAdded++;
+            auto spentTxNum = tx->getInput(i).linkedTxNum;
+            if (spentTxNum < txCount) {
+                auto spentTx = txFile.getData(spentTxNum);
+                for (uint16_t j = 0; j < spentTx->outputCount; j++) {
+                    auto &output = spentTx->getOutput(j);
+                    if (output.linkedTxNum == txNum) {
+                        output.linkedTxNum = 0;
+                    }
                 }
             }
         }
-        assert(inputsAdded == tx->inputCount);
     }
+}
+
+// Removes everything past the checkpoint from the chain and script files, the indexes and the address state.
+// Every step only removes what is still past the checkpoint, so an interrupted call is simply repeated.
+void discardBlocks(const ParserConfigurationBase &config, const ParserCheckpoint &checkpoint, const std::vector<BlockUndo> *undos) {
+    constexpr auto readwrite = blocksci::AccessMode::readwrite;
+    auto &state = checkpoint.state;
+    
+    clearBackLinks(config, state.txCount, checkpoint.linkedTxCount);
+    syncFiles(config.chainDirectory());
+    
+    // Index keys are regenerated from the removed transactions so this must happen before they are truncated
+    AddressDB(config, config.addressDBFilePath().native()).rollback(state);
+    HashIndexCreator(config, config.hashIndexFilePath().native()).rollback(state);
     
-    utxoAddressState.serialize(config.utxoAddressStatePath());
-    utxoState.serialize(config.utxoCacheFile().native());
-    utxoScriptState.serialize(config.utxoScriptStatePath().native());
+    blocksci::IndexedFileMapper<readwrite, blocksci::RawTransaction>(config.txFilePath()).truncate(state.txCount);
+    blocksci::FixedSizeFileMapper<blocksci::uint256, readwrite>(config.txHashesFilePath()).truncate(state.txCount);
+    blocksci::IndexedFileMapper<readwrite, uint32_t>(config.sequenceFilePath()).truncate(state.txCount);
+    blocksci::SimpleFileMapper<readwrite>(config.blockCoinbaseFilePath()).truncate(checkpoint.coinbaseSize);
+    blocksci::FixedSizeFileMapper<blocksci::RawBlock, readwrite>(config.blockFilePath()).truncate(state.blockCount);
     
-    return state;
+    {
+        AddressState addressState{config.addressPath(), config.hashIndexFilePath(), config.pipeline.addressCacheMB << 20};
+        addressState.rollback(state, undos);
+        addressState.syncHashIndex();
+    }
+    AddressWriter(config).rollback(state);
+    truncateUndoJournal(config, static_cast<blocksci::BlockHeight>(state.blockCount));
 }
 
 void rollbackTransactions(blocksci::BlockHeight blockKeepCount, const ParserConfigurationBase &config) {
     using namespace blocksci;
     
-    constexpr auto readwrite = blocksci::AccessMode::readwrite;
-    blocksci::FixedSizeFileMapper<blocksci::RawBlock, readwrite> blockFile(config.blockFilePath());
-    
-    auto blockKeepSize = static_cast<size_t>(static_cast<int>(blockKeepCount));
-    if (blockFile.size() > blockKeepSize) {
+    std::vector<BlockUndo> undos;
+    const std::vector<BlockUndo> *undoRecords = nullptr;
+    ParserCheckpoint checkpoint;
+    {
+        blocksci::FixedSizeFileMapper<blocksci::RawBlock> blockFile(config.blockFilePath());
+        
+        auto blockKeepSize = static_cast<size_t>(static_cast<int>(blockKeepCount));
+        if (blockFile.size() <= blockKeepSize) {
+            return;
+        }
         
         auto firstDeletedBlock = blockFile.getData(blockKeepSize);
         auto firstDeletedTxNum = firstDeletedBlock->firstTxIndex;
         
-        auto blocksciState = rollbackState(config, blockKeepCount, firstDeletedTxNum);
-        
-        blocksci::IndexedFileMapper<readwrite, blocksci::RawTransaction>(config.txFilePath()).truncate(firstDeletedTxNum);
-        blocksci::FixedSizeFileMapper<blocksci::uint256, readwrite>(config.txHashesFilePath()).truncate(firstDeletedTxNum);
-        blocksci::IndexedFileMapper<readwrite, uint32_t>(config.sequenceFilePath()).truncate(firstDeletedTxNum);
-        blocksci::SimpleFileMapper<readwrite>(config.blockCoinbaseFilePath()).truncate(firstDeletedBlock->coinbaseOffset);
-        blockFile.truncate(blockKeepSize);
+        bool journaled = loadUndoJournal(config, blockKeepCount, static_cast<BlockHeight>(blockFile.size()), undos) && undos.front().firstTxNum == firstDeletedTxNum;
+        if (!journaled) {
+            std::cout << "No undo records for the removed blocks, scanning the parser state instead" << std::endl;
+        }
+        undoRecords = journaled ? &undos : nullptr;
         
-        AddressState{config.addressPath(), config.hashIndexFilePath()}.rollback(blocksciState);
-        AddressWriter(config).rollback(blocksciState);
-        AddressDB(config, config.addressDBFilePath().native()).rollback(blocksciState);
-        HashIndexCreator(config, config.hashIndexFilePath().native()).rollback(blocksciState);
+        checkpoint = rollbackState(config, blockKeepCount, firstDeletedTxNum, firstDeletedBlock->coinbaseOffset, undoRecords);
+    }
+    
+    discardBlocks(config, checkpoint, undoRecords);
+    markClean(config, checkpoint);
+}
+
+// A run that stopped after its last checkpoint left the chain and script files, the indexes and possibly some back
+// links ahead of the recorded state. They are rolled back to the checkpoint, and the UTXO state restores itself
+// to it the next time it is opened.
+void recoverParserState(const ParserConfigurationBase &config) {
+    ParserCheckpoint checkpoint;
+    if (!ParserCheckpoint::load(config, checkpoint) || checkpoint.clean) {
+        return;
     }
+    std::cout << "Previous run did not finish, rolling back to its checkpoint at " << checkpoint.state.blockCount << " blocks" << std::endl;
+    repairBackLinks(config, checkpoint.state.txCount);
+    discardBlocks(config, checkpoint, nullptr);
+    markClean(config, checkpoint);
 }
 
 std::vector<char> HexToBytes(const std::string& hex) {
@@ -181,21 +360,25 @@ template <typename ParserTag>
 void updateChain(const ParserConfiguration<ParserTag> &config, blocksci::BlockHeight maxBlockNum) {
     using namespace std::chrono_literals;
     
+    recoverParserState(config);
+    
+    if (maxBlockNum == 0) {
+        blocksci::ChainAccess oldChain(config);
+        if (oldChain.blockCount() > 0 && ChainIndex<ParserTag>::isUpToDate(config, oldChain.getBlock(oldChain.blockCount() - 1)->hash)) {
+            std::cout << "Chain of " << oldChain.blockCount() << " blocks is up to date" << std::endl;
+            return;
+        }
+    }
+    
     auto chainBlocks = [&]() {
         ChainIndex<ParserTag> index;
-        boost::filesystem::ifstream inFile(config.blockListPath(), std::ios::binary);
-        if (inFile.good()) {
-            boost::archive::binary_iarchive ia(inFile);
-            ia >> index;
-        }
+        index.load(config);
         index.update(config);
         auto blocks = index.generateChain(maxBlockNum);
-        boost::filesystem::ofstream of(config.blockListPath(), std::ios::binary);
-        boost::archive::binary_oarchive oa(of);
-        oa << index;
+        index.save(config);
         return blocks;
     }();
-
+    
     blocksci::BlockHeight splitPoint = [&]() {
         blocksci::ChainAccess oldChain(config);
         blocksci::BlockHeight maxSize = std::min(oldChain.blockCount(), static_cast<blocksci::BlockHeight>(chainBlocks.size()));
@@ -215,7 +398,7 @@ void updateChain(const ParserConfiguration<ParserTag> &config, blocksci::BlockHe
         
         return splitPoint;
     }();
-
+    
     std::vector<BlockInfo<ParserTag>> blocksToAdd{chainBlocks.begin() + static_cast<int>(splitPoint), chainBlocks.end()};
     
     std::ios::sync_with_stdio(false);
@@ -238,17 +421,19 @@ void updateChain(const ParserConfiguration<ParserTag> &config, blocksci::BlockHe
         totalOutputCount += block.outputCount;
     }
     
+    ParserCheckpoint checkpoint;
+    ParserCheckpoint::load(config, checkpoint);
     {
         BlockProcessor processor{startingTxCount, totalTxCount, maxBlockHeight};
         UTXOState utxoState;
         UTXOAddressState utxoAddressState;
-        AddressState addressState{config.addressPath(), config.hashIndexFilePath()};
-        UTXOScriptState utxoScriptState;
+        AddressState addressState{config.addressPath(), config.hashIndexFilePath(), config.pipeline.addressCacheMB << 20};
         
-        utxoAddressState.unserialize(config.utxoAddressStatePath());
-        utxoState.unserialize(config.utxoCacheFile().native());
-        utxoScriptState.unserialize(config.utxoScriptStatePath().native());
+        loadUTXOAddressState(config, utxoAddressState);
+        utxoState.open(config);
+        markUnclean(config, checkpoint, addressState);
         
+        std::future<void> backLinking;
         auto it = blocksToAdd.begin();
         auto end = blocksToAdd.end();
         while (it != end) {
@@ -261,18 +446,48 @@ void updateChain(const ParserConfiguration<ParserTag> &config, blocksci::BlockHe
             
             decltype(blocksToAdd) nextBlocks{prev, it};
             
-            processor.addNewBlocks(config, nextBlocks, utxoState, utxoAddressState, addressState, utxoScriptState);
+            processor.addNewBlocks(config, nextBlocks, utxoState, utxoAddressState, addressState);
             
-            backUpdateTxes(config);
+            if (config.pipeline.overlapBackLinking) {
+                if (backLinking.valid()) {
+                    backLinking.get();
+                }
+                saveCheckpoint(config, checkpoint, utxoState, utxoAddressState, addressState);
+                backLinking = backUpdateTxesAsync(config);
+            } else {
+                saveCheckpoint(config, checkpoint, utxoState, utxoAddressState, addressState);
+                backUpdateTxes(config);
+            }
         }
         
-        utxoAddressState.serialize(config.utxoAddressStatePath());
-        utxoState.serialize(config.utxoCacheFile().native());
-        utxoScriptState.serialize(config.utxoScriptStatePath().native());
+        if (backLinking.valid()) {
+            backLinking.get();
+        }
+        
+        utxoState.close();
+    }
+    // The address state only saves its script counts when it is destroyed
+    markClean(config, checkpoint);
+}
+
+template <typename Index>
+void runIndexUpdate(Index &db, const ParserConfigurationBase &config, const blocksci::State &updateState) {
+    auto start = std::chrono::steady_clock::now();
+    db.prepareUpdate();
+    if (config.indexUpdate.bulk) {
+        db.runBulkUpdate(updateState);
+    } else {
+        db.runUpdate(updateState);
     }
+    db.tearDown();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Index update took " << elapsed.count() << "s\n";
 }
 
 void updateHashDB(const ParserConfigurationBase &config) {
+    // Indexing blocks past the checkpoint of an interrupted run would index data it is about to discard
+    recoverParserState(config);
+    
     blocksci::ChainAccess chain{config};
     blocksci::ScriptAccess scripts{config};
     
@@ -281,12 +496,13 @@ void updateHashDB(const ParserConfigurationBase &config) {
     
     std::cout << "Updating hash index\n";
     
-    db.prepareUpdate();
-    db.runUpdate(updateState);
-    db.tearDown();
+    runIndexUpdate(db, config, updateState);
 }
 
 void updateAddressDB(const ParserConfigurationBase &config) {
+    // Indexing blocks past the checkpoint of an interrupted run would index data it is about to discard
+    recoverParserState(config);
+    
     blocksci::ChainAccess chain{config};
     blocksci::ScriptAccess scripts{config};
     
@@ -295,9 +511,161 @@ void updateAddressDB(const ParserConfigurationBase &config) {
     
     std::cout << "Updating address index\n";
     
-    db.prepareUpdate();
-    db.runUpdate(updateState);
-    db.tearDown();
+    runIndexUpdate(db, config, updateState);
+}
+
+namespace {
+    volatile std::sig_atomic_t tailStopRequested = 0;
+    
+    void requestTailStop(int) {
+        tailStopRequested = 1;
+    }
+}
+
+// Parser state kept open between the blocks added by tail. Blocks are added and indexed a batch at a time while
+// commit records them as a checkpoint, and close saves everything to disk the same way the end of an update does.
+// A session dropped without close is rolled back to its last checkpoint by the next run, indexes included.
+struct TailSession {
+    ParserCheckpoint checkpoint;
+    UTXOState utxoState;
+    UTXOAddressState utxoAddressState;
+    AddressState addressState;
+    AddressDB addressDB;
+    // Shares the hash index of the address state since RocksDB only lets one writer open it
+    HashIndexCreator hashIndex;
+    
+    explicit TailSession(const ParserConfigurationBase &config) : addressState{config.addressPath(), config.hashIndexFilePath(), config.pipeline.addressCacheMB << 20}, addressDB(config, config.addressDBFilePath().native()), hashIndex(config, addressState.getHashIndex()) {
+        ParserCheckpoint::load(config, checkpoint);
+        loadUTXOAddressState(config, utxoAddressState);
+        utxoState.open(config);
+        markUnclean(config, checkpoint, addressState);
+    }
+    
+    // Back links into earlier transactions are only cleared by a rollback up to the recorded linked count, so it
+    // is moved past the new blocks before they are back linked
+    void prepareBackLinks(const ParserConfigurationBase &config) {
+        syncFiles(config.chainDirectory());
+        checkpoint.linkedTxCount = getStartingTxCount(config);
+        checkpoint.save(config);
+    }
+    
+    // Only once the blocks added since the last commit are back linked
+    void commit(const ParserConfigurationBase &config) {
+        saveCheckpoint(config, checkpoint, utxoState, utxoAddressState, addressState);
+    }
+    
+    void close(const ParserConfigurationBase &config) {
+        commit(config);
+        utxoState.close();
+    }
+    
+    // The indexes run ahead of the checkpoint, so each records the update before it starts and a rollback to the
+    // checkpoint removes whatever part of it was written
+    void updateIndexes(const ParserConfigurationBase &config) {
+        addressState.flushHashIndex();
+        blocksci::State state{blocksci::ChainAccess{config}, blocksci::ScriptAccess{config}};
+        addressDB.saveState(state);
+        addressDB.runUpdate(state);
+        addressDB.saveState();
+        hashIndex.saveState(state);
+        hashIndex.runUpdate(state);
+        hashIndex.tearDown();
+        hashIndex.saveState();
+    }
+};
+
+// Catches up like update and then keeps following the chain. The chain index, parser state and indexes stay in
+// memory so each new block only costs parsing and indexing it. Reorgs close the state and roll back on disk like
+// update does. A checkpoint serializes the whole UTXO address state and the RPC chain index is saved as a single
+// archive, so both only happen once checkpointInterval passed since the last one. A process killed at any point
+// is rolled back by the next run to its last checkpoint. The time spent parsing, indexing and committing each
+// batch is printed so the latency can be followed.
+template <typename ParserTag>
+void tailChain(const ParserConfiguration<ParserTag> &config, std::chrono::milliseconds pollInterval, std::chrono::seconds checkpointInterval) {
+    using clock = std::chrono::steady_clock;
+    using milliseconds = std::chrono::duration<double, std::milli>;
+    
+    updateChain(config, 0);
+    updateHashDB(config);
+    updateAddressDB(config);
+    
+    ChainIndex<ParserTag> index;
+    index.load(config);
+    auto chain = index.generateChain(0);
+    
+    std::signal(SIGINT, requestTailStop);
+    std::signal(SIGTERM, requestTailStop);
+    
+    auto session = std::make_unique<TailSession>(config);
+    auto closeSession = [&]() {
+        session->close(config);
+        index.save(config);
+        auto checkpoint = session->checkpoint;
+        session.reset();
+        markClean(config, checkpoint);
+    };
+    auto lastCheckpoint = clock::now();
+    bool uncommitted = false;
+    std::cout << "Following the chain from " << chain.size() << " blocks" << std::endl;
+    
+    while (!tailStopRequested) {
+        std::this_thread::sleep_for(pollInterval);
+        
+        auto start = clock::now();
+        bool updated = index.update(config);
+        size_t addedCount = 0;
+        milliseconds parseTime{0}, commitTime{0}, indexTime{0};
+        if (updated) {
+            auto keepCount = index.extendChain(chain);
+            auto parsedCount = blocksci::ChainAccess{config}.blockCount();
+            keepCount = std::min(keepCount, parsedCount);
+            if (keepCount < parsedCount) {
+                std::cout << "Removing " << parsedCount - keepCount << " blocks" << std::endl;
+                closeSession();
+                rollbackTransactions(keepCount, config);
+                session = std::make_unique<TailSession>(config);
+            }
+            
+            std::vector<BlockInfo<ParserTag>> blocksToAdd{chain.begin() + static_cast<int>(keepCount), chain.end()};
+            if (!blocksToAdd.empty()) {
+                uint32_t totalTxCount = 0;
+                for (auto &block : blocksToAdd) {
+                    totalTxCount += block.nTx;
+                }
+                auto parseStart = clock::now();
+                BlockProcessor processor{getStartingTxCount(config), totalTxCount, blocksToAdd.back().height};
+                processor.addNewBlocks(config, blocksToAdd, session->utxoState, session->utxoAddressState, session->addressState);
+                session->prepareBackLinks(config);
+                backUpdateTxes(config);
+                auto indexStart = clock::now();
+                session->updateIndexes(config);
+                parseTime = indexStart - parseStart;
+                indexTime = clock::now() - indexStart;
+            }
+            addedCount = blocksToAdd.size();
+            uncommitted = true;
+        }
+        
+        // Checked on every poll so the last batch before a quiet period is committed without waiting for the next
+        if (uncommitted && clock::now() - lastCheckpoint >= checkpointInterval) {
+            auto commitStart = clock::now();
+            session->commit(config);
+            index.save(config);
+            lastCheckpoint = clock::now();
+            commitTime = lastCheckpoint - commitStart;
+            uncommitted = false;
+        }
+        
+        milliseconds elapsed = clock::now() - start;
+        if (updated) {
+            std::cout << "Added " << addedCount << " blocks in " << elapsed.count() << "ms (parse " << parseTime.count() << "ms, commit " << commitTime.count() << "ms, index " << indexTime.count() << "ms), chain has " << chain.size() << " blocks" << std::endl;
+        } else if (commitTime.count() > 0) {
+            std::cout << "Saved checkpoint in " << commitTime.count() << "ms" << std::endl;
+        }
+    }
+    
+    std::cout << "Saving parser state" << std::endl;
+    closeSession();
 }
 
 void updateConfig(boost::filesystem::path &dataDirectory) {
@@ -312,22 +680,22 @@ void updateConfig(boost::filesystem::path &dataDirectory) {
 
 int main(int argc, char * argv[]) {
     
-    enum class mode {update, updateCore, updateIndexes, updateHashIndex, updateAddressIndex, help};
+    enum class mode {update, updateCore, tail, updateIndexes, updateHashIndex, updateAddressIndex, warmup, help};
     mode selected = mode::help;
-
-
+    
+    
     enum class updateMode {
         disk, rpc
     };
     updateMode selectedUpdateMode = updateMode::disk;
-
-
+    
+    
     std::string dataDirectoryString;
     
-
-
+    
+    
     auto outputDirOpt = (clipp::required("--output-directory", "-o") & clipp::value("output directory", dataDirectoryString)) % "Path to output parsed data";
-
+    
     std::string username;
     std::string password;
     std::string address = "127.0.0.1";
@@ -339,25 +707,64 @@ int main(int argc, char * argv[]) {
         (clipp::option("--address") & clipp::value("address", address)) % "RPC address",
         (clipp::option("--port") & clipp::value("port", port)) % "RPC port"
     ).doc("RPC options");
-
+    
     std::string bitcoinDirectoryString;
     auto fileOptions = (
         clipp::command("disk").set(selectedUpdateMode, updateMode::disk),
         (clipp::required("--coin-directory", "-c") & clipp::value("coin directory", bitcoinDirectoryString)) % "Path to cryptocurrency directory"
     ).doc("File parser options");
-
+    
     auto updateCommand = clipp::command("update").set(selected,mode::update) % "Update all BlockSci data";
     auto updateCoreCommand = clipp::command("core-update").set(selected,mode::updateCore) % "Update just the core BlockSci data (excluding indexes)";
+    auto tailCommand = clipp::command("tail").set(selected,mode::tail) % "Update all BlockSci data and keep adding new blocks as they appear";
     auto indexUpdateCommand = clipp::command("index-update").set(selected,mode::updateIndexes) % "Update indexes to latest chain state";
     auto addressIndexUpdateCommand = clipp::command("address-index-update").set(selected,mode::updateAddressIndex) % "Update address index to latest state";
     auto hashIndexUpdateCommand = clipp::command("hash-index-update").set(selected,mode::updateHashIndex) % "Update hash index to latest state";
+    auto warmupCommand = clipp::command("warmup").set(selected,mode::warmup) % "Read all BlockSci data from disk so queries on a fresh machine run at full speed";
     
     int maxBlockNum = 0;
     auto maxBlockOpt = (clipp::option("--max-block", "-m") & clipp::value("max block", maxBlockNum)) % "Max block height to scan up to";
     
-    auto coreUpdateOptions = (maxBlockOpt, (fileOptions | rpcOptions));
-    
-    auto commands = ((updateCommand | updateCoreCommand), coreUpdateOptions) | indexUpdateCommand | addressIndexUpdateCommand | hashIndexUpdateCommand;
+    PipelineSettings pipelineSettings;
+    auto pipelineOptions = (
+        clipp::option("--polling-pipeline").set(pipelineSettings.mode, PipelineMode::polling) % "Hand transactions between parser stages one at a time with sleep polling",
+        (clipp::option("--batch-size") & clipp::value("batch size", pipelineSettings.batchSize)) % "Maximum number of transactions handed between parser stages at once",
+        (clipp::option("--hash-threads") & clipp::value("thread count", pipelineSettings.hashReplicas)) % "Number of threads calculating transaction hashes",
+        (clipp::option("--script-output-threads") & clipp::value("thread count", pipelineSettings.scriptOutputReplicas)) % "Number of threads generating script outputs",
+        (clipp::option("--import-threads") & clipp::value("thread count", pipelineSettings.importThreads)) % "Number of threads loading blocks from disk",
+        (clipp::option("--rpc-connections") & clipp::value("connection count", pipelineSettings.rpcConnections)) % "Number of concurrent RPC connections fetching block headers and blocks (default 4)",
+        (clipp::option("--utxo-threads") & clipp::value("thread count", pipelineSettings.utxoThreads)) % "Number of threads looking up spent outputs, up to one per UTXO index shard",
+        (clipp::option("--address-cache-mb") & clipp::value("megabytes", pipelineSettings.addressCacheMB)) % "Memory used to cache reused addresses (default 4096)",
+        clipp::option("--overlap-backlinking").set(pipelineSettings.overlapBackLinking) % "Back link transactions in the background while the next chunk is parsed",
+        (clipp::option("--backlink-threads") & clipp::value("thread count", pipelineSettings.backLinkThreads)) % "Number of threads used for back linking transactions (default all cores)",
+        (clipp::option("--write-buffer-mb") & clipp::value("megabytes", pipelineSettings.writeBufferMB)) % "Memory each output file may queue for its background writer (default 64)"
+    ).doc("Pipeline options");
+    
+    IndexUpdateSettings indexSettings;
+    auto indexOptions = (
+        clipp::option("--bulk-index").set(indexSettings.bulk) % "Experimental: build new index entries on every core and ingest them as sorted tables, meant for rebuilding an index from scratch. Check it against the regular update with util/compare_index_rebuild.py before relying on it",
+        (clipp::option("--index-threads") & clipp::value("thread count", indexSettings.threads)) % "Number of threads building index entries in bulk (default all cores)",
+        (clipp::option("--index-sort-mb") & clipp::value("megabytes", indexSettings.sortMemoryMB)) % "Memory used to sort index entries in bulk before spilling them to disk (default 4096)"
+    ).doc("Index options");
+    
+    int pollIntervalMs = 200;
+    int checkpointSeconds = 60;
+    auto tailOptions = (
+        (clipp::option("--poll-ms") & clipp::value("milliseconds", pollIntervalMs)) % "Time between checks for new blocks (default 200)",
+        (clipp::option("--checkpoint-seconds") & clipp::value("seconds", checkpointSeconds)) % "Minimum time between parser checkpoints, 0 to record one after every batch (default 60)"
+    ).doc("Tail options");
+    
+    WarmupSettings warmupSettings;
+    auto warmupOptions = (
+        (clipp::option("--io-depth") & clipp::value("read count", warmupSettings.ioDepth)) % "Number of reads kept in flight at once (default 32)",
+        (clipp::option("--block-kb") & clipp::value("kilobytes", warmupSettings.blockSizeKB)) % "Size of each read (default 128)",
+        clipp::option("--direct").set(warmupSettings.direct) % "Bypass the page cache, only initializing a volume restored from a snapshot",
+        clipp::option("--lock-hot").set(warmupSettings.lockHotSet) % "Keep the transaction and block files locked in memory until interrupted"
+    ).doc("Warmup options");
+    
+    auto coreUpdateOptions = (maxBlockOpt, pipelineOptions, indexOptions, (fileOptions | rpcOptions));
+    
+    auto commands = ((updateCommand | updateCoreCommand), coreUpdateOptions) | (tailCommand, tailOptions, pipelineOptions, indexOptions, (fileOptions | rpcOptions)) | ((indexUpdateCommand | addressIndexUpdateCommand | hashIndexUpdateCommand), indexOptions) | (warmupCommand, warmupOptions);
     
     auto cli = (outputDirOpt, commands);
     
@@ -373,14 +780,14 @@ int main(int argc, char * argv[]) {
         std::cout << "\n" << clipp::make_man_page(cli, argv[0]);
         return 0;
     }
-
+    
     boost::filesystem::path dataDirectory = {dataDirectoryString};
     dataDirectory = boost::filesystem::absolute(dataDirectory);
-
+    
     if(!(boost::filesystem::exists(dataDirectory))){
         boost::filesystem::create_directory(dataDirectory);
     }
-
+    
     switch (selected) {
         case mode::update:
         case mode::updateCore: {
@@ -389,12 +796,14 @@ int main(int argc, char * argv[]) {
                     boost::filesystem::path bitcoinDirectory = {bitcoinDirectoryString};
                     bitcoinDirectory = boost::filesystem::absolute(bitcoinDirectory);
                     ParserConfiguration<FileTag> config{bitcoinDirectory, dataDirectory};
+                    config.pipeline = pipelineSettings;
                     updateChain(config, blocksci::BlockHeight{maxBlockNum});
                     break;
                 }
-
+                
                 case updateMode::rpc: {
                     ParserConfiguration<RPCTag> config(username, password, address, port, dataDirectory);
+                    config.pipeline = pipelineSettings;
                     updateChain(config, blocksci::BlockHeight{maxBlockNum});
                     
                     break;
@@ -404,32 +813,68 @@ int main(int argc, char * argv[]) {
             
             if (selected == mode::update) {
                 ParserConfigurationBase config{dataDirectory};
+                config.indexUpdate = indexSettings;
                 updateHashDB(config);
                 updateAddressDB(config);
             }
             
             break;
         }
-
+        
+        case mode::tail: {
+            updateConfig(dataDirectory);
+            std::chrono::milliseconds pollInterval{pollIntervalMs};
+            std::chrono::seconds checkpointInterval{checkpointSeconds};
+            switch (selectedUpdateMode) {
+                case updateMode::disk: {
+                    boost::filesystem::path bitcoinDirectory = {bitcoinDirectoryString};
+                    bitcoinDirectory = boost::filesystem::absolute(bitcoinDirectory);
+                    ParserConfiguration<FileTag> config{bitcoinDirectory, dataDirectory};
+                    config.pipeline = pipelineSettings;
+                    config.indexUpdate = indexSettings;
+                    tailChain(config, pollInterval, checkpointInterval);
+                    break;
+                }
+                
+                case updateMode::rpc: {
+                    ParserConfiguration<RPCTag> config(username, password, address, port, dataDirectory);
+                    config.pipeline = pipelineSettings;
+                    config.indexUpdate = indexSettings;
+                    tailChain(config, pollInterval, checkpointInterval);
+                    break;
+                }
+            }
+            break;
+        }
+        
         case mode::updateIndexes: {
             ParserConfigurationBase config{dataDirectory};
+            config.indexUpdate = indexSettings;
             updateAddressDB(config);
             updateHashDB(config);
             break;
         }
-
+        
         case mode::updateHashIndex: {
             ParserConfigurationBase config{dataDirectory};
+            config.indexUpdate = indexSettings;
             updateHashDB(config);
             break;
         }
-
+        
         case mode::updateAddressIndex: {
             ParserConfigurationBase config{dataDirectory};
+            config.indexUpdate = indexSettings;
             updateAddressDB(config);
             break;
         }
-
+        
+        case mode::warmup: {
+            blocksci::DataConfiguration config{dataDirectory, false, blocksci::BlockHeight{0}};
+            warmupData(config, warmupSettings);
+            break;
+        }
+        
         case mode::help: {
             std::cout << clipp::make_man_page(cli, "blocksci_parser");
             break;
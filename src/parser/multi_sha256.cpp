@@ -0,0 +1,345 @@
+//
+//  multi_sha256.cpp
+//  blocksci_parser
+//
+
+#include "multi_sha256.hpp"
+
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BLOCKSCI_MULTI_SHA256
+#include <cpuid.h>
+#endif
+
+namespace {
+    constexpr size_t digestSize = 32;
+    constexpr size_t sha256BlockSize = 64;
+    
+    // Longer messages are hashed one at a time, see doubleSHA256Batch
+    constexpr size_t maxLaneMessageLength = 4096;
+    
+    size_t messageLength(const SHA256Message &message) {
+        return message.lengths[0] + message.lengths[1] + message.lengths[2];
+    }
+    
+    void doubleSHA256(const SHA256Message &message) {
+        unsigned char firstDigest[digestSize];
+        SHA256_CTX sha256CTX;
+        SHA256_Init(&sha256CTX);
+        for (size_t i = 0; i < 3; i++) {
+            if (message.lengths[i] > 0) {
+                SHA256_Update(&sha256CTX, message.parts[i], message.lengths[i]);
+            }
+        }
+        SHA256_Final(firstDigest, &sha256CTX);
+        SHA256(firstDigest, digestSize, message.digest);
+    }
+    
+    #ifdef BLOCKSCI_MULTI_SHA256
+    
+    constexpr uint32_t initialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    
+    constexpr uint32_t roundConstants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    
+    // Generic vectors compile to AVX2 or AVX-512 instructions inside the functions targeting them below
+    typedef uint32_t LaneVector8 __attribute__((vector_size(32)));
+    typedef uint32_t LaneVector16 __attribute__((vector_size(64)));
+    
+    // Returns block blockNum of the padded message. Blocks lying entirely within one piece of the message are
+    // read in place, the rest are assembled in out
+    const unsigned char *fillBlock(const SHA256Message &message, size_t length, size_t blockNum, size_t blockCount, unsigned char *out) {
+        size_t blockStart = blockNum * sha256BlockSize;
+        size_t blockEnd = blockStart + sha256BlockSize;
+        size_t partStart = 0;
+        for (size_t i = 0; i < 3; i++) {
+            size_t partEnd = partStart + message.lengths[i];
+            if (partStart <= blockStart && blockEnd <= partEnd) {
+                return message.parts[i] + (blockStart - partStart);
+            }
+            partStart = partEnd;
+        }
+        
+        memset(out, 0, sha256BlockSize);
+        partStart = 0;
+        for (size_t i = 0; i < 3; i++) {
+            size_t partEnd = partStart + message.lengths[i];
+            if (message.lengths[i] > 0 && partEnd > blockStart && partStart < blockEnd) {
+                auto from = std::max(blockStart, partStart);
+                auto to = std::min(blockEnd, partEnd);
+                memcpy(out + (from - blockStart), message.parts[i] + (from - partStart), to - from);
+            }
+            partStart = partEnd;
+        }
+        if (length >= blockStart && length < blockEnd) {
+            out[length - blockStart] = 0x80;
+        }
+        if (blockNum + 1 == blockCount) {
+            uint64_t bitLength = static_cast<uint64_t>(length) * 8;
+            for (size_t i = 0; i < 8; i++) {
+                out[sha256BlockSize - 1 - i] = static_cast<unsigned char>(bitLength >> (8 * i));
+            }
+        }
+        return out;
+    }
+    
+    struct LaneJob {
+        SHA256Message *message = nullptr;
+        SHA256Message current;
+        size_t length;
+        size_t blockCount;
+        size_t nextBlock;
+        bool secondPass;
+        unsigned char firstDigest[digestSize];
+        
+        void start(SHA256Message *message_) {
+            message = message_;
+            current = *message;
+            begin(messageLength(current), false);
+        }
+        
+        void startSecondPass() {
+            current = SHA256Message{{firstDigest, nullptr, nullptr}, {digestSize, 0, 0}, nullptr};
+            begin(digestSize, true);
+        }
+    
+    private:
+        void begin(size_t length_, bool secondPass_) {
+            length = length_;
+            // The padding needs one byte for the terminator and eight for the length
+            blockCount = (length + 8) / sha256BlockSize + 1;
+            nextBlock = 0;
+            secondPass = secondPass_;
+        }
+    };
+    
+    // A macro rather than a function, since passing vectors by value outside the targeted functions changes the ABI
+    #define BLOCKSCI_ROTATE_RIGHT(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+    
+    template <typename Vec>
+    inline __attribute__((always_inline)) void compressLanes(Vec *state, Vec *w) {
+        Vec a = state[0], b = state[1], c = state[2], d = state[3];
+        Vec e = state[4], f = state[5], g = state[6], h = state[7];
+        auto round = [&](int i, const Vec &word) {
+            auto t1 = h + (BLOCKSCI_ROTATE_RIGHT(e, 6) ^ BLOCKSCI_ROTATE_RIGHT(e, 11) ^ BLOCKSCI_ROTATE_RIGHT(e, 25)) + ((e & f) ^ (~e & g)) + roundConstants[i] + word;
+            auto t2 = (BLOCKSCI_ROTATE_RIGHT(a, 2) ^ BLOCKSCI_ROTATE_RIGHT(a, 13) ^ BLOCKSCI_ROTATE_RIGHT(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        };
+        for (int i = 0; i < 16; i++) {
+            round(i, w[i]);
+        }
+        for (int i = 16; i < 64; i++) {
+            auto w15 = w[(i - 15) & 15];
+            auto w2 = w[(i - 2) & 15];
+            auto s0 = BLOCKSCI_ROTATE_RIGHT(w15, 7) ^ BLOCKSCI_ROTATE_RIGHT(w15, 18) ^ (w15 >> 3);
+            auto s1 = BLOCKSCI_ROTATE_RIGHT(w2, 17) ^ BLOCKSCI_ROTATE_RIGHT(w2, 19) ^ (w2 >> 10);
+            w[i & 15] += s0 + w[(i - 7) & 15] + s1;
+            round(i, w[i & 15]);
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+    
+    #undef BLOCKSCI_ROTATE_RIGHT
+    
+    // Keeps every lane busy by starting the next message in a lane as soon as the previous one finishes.
+    // Messages should be sorted longest first so the lanes finish at about the same time
+    template <typename Vec>
+    inline __attribute__((always_inline)) void hashLanes(SHA256Message **messages, size_t count) {
+        constexpr size_t laneCount = sizeof(Vec) / sizeof(uint32_t);
+        Vec state[8] = {};
+        Vec w[16];
+        uint32_t words[16][laneCount] = {};
+        unsigned char block[sha256BlockSize];
+        LaneJob jobs[laneCount];
+        
+        size_t nextMessage = 0;
+        size_t activeLanes = 0;
+        auto resetLane = [&](size_t lane) {
+            for (size_t i = 0; i < 8; i++) {
+                state[i][lane] = initialState[i];
+            }
+        };
+        for (size_t lane = 0; lane < laneCount && nextMessage < count; lane++) {
+            jobs[lane].start(messages[nextMessage++]);
+            resetLane(lane);
+            activeLanes++;
+        }
+        
+        while (activeLanes > 0) {
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                auto &job = jobs[lane];
+                if (job.message) {
+                    auto data = fillBlock(job.current, job.length, job.nextBlock, job.blockCount, block);
+                    for (size_t i = 0; i < 16; i++) {
+                        uint32_t word;
+                        memcpy(&word, data + 4 * i, sizeof(word));
+                        words[i][lane] = __builtin_bswap32(word);
+                    }
+                }
+            }
+            for (size_t i = 0; i < 16; i++) {
+                memcpy(&w[i], words[i], sizeof(Vec));
+            }
+            
+            compressLanes(state, w);
+            
+            for (size_t lane = 0; lane < laneCount; lane++) {
+                auto &job = jobs[lane];
+                if (!job.message || ++job.nextBlock < job.blockCount) {
+                    continue;
+                }
+                auto digest = job.secondPass ? job.message->digest : job.firstDigest;
+                for (size_t i = 0; i < 8; i++) {
+                    auto word = __builtin_bswap32(state[i][lane]);
+                    memcpy(digest + 4 * i, &word, sizeof(word));
+                }
+                if (!job.secondPass) {
+                    job.startSecondPass();
+                } else if (nextMessage < count) {
+                    job.start(messages[nextMessage++]);
+                } else {
+                    job.message = nullptr;
+                    activeLanes--;
+                    continue;
+                }
+                resetLane(lane);
+            }
+        }
+    }
+    
+    __attribute__((target("avx2")))
+    void hashLanesAVX2(SHA256Message **messages, size_t count) {
+        hashLanes<LaneVector8>(messages, count);
+    }
+    
+    __attribute__((target("avx512f")))
+    void hashLanesAVX512(SHA256Message **messages, size_t count) {
+        hashLanes<LaneVector16>(messages, count);
+    }
+    
+    bool cpuHasSHAExtensions() {
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        return (ebx >> 29) & 1;
+    }
+    
+    #endif
+}
+
+bool sha256BackendSupported(SHA256Backend backend) {
+    switch (backend) {
+        case SHA256Backend::scalar:
+            return true;
+        #ifdef BLOCKSCI_MULTI_SHA256
+        case SHA256Backend::avx2: {
+            static const bool supported = __builtin_cpu_supports("avx2");
+            return supported;
+        }
+        case SHA256Backend::avx512: {
+            static const bool supported = __builtin_cpu_supports("avx512f");
+            return supported;
+        }
+        #else
+        case SHA256Backend::avx2:
+        case SHA256Backend::avx512:
+            return false;
+        #endif
+    }
+    return false;
+}
+
+SHA256Backend bestSHA256Backend() {
+    if (sha256BackendSupported(SHA256Backend::avx512)) {
+        return SHA256Backend::avx512;
+    }
+    #ifdef BLOCKSCI_MULTI_SHA256
+    static const bool hasSHAExtensions = cpuHasSHAExtensions();
+    if (hasSHAExtensions) {
+        return SHA256Backend::scalar;
+    }
+    #endif
+    if (sha256BackendSupported(SHA256Backend::avx2)) {
+        return SHA256Backend::avx2;
+    }
+    return SHA256Backend::scalar;
+}
+
+const char *sha256BackendName(SHA256Backend backend) {
+    switch (backend) {
+        case SHA256Backend::scalar:
+            return "scalar";
+        case SHA256Backend::avx2:
+            return "avx2";
+        case SHA256Backend::avx512:
+            return "avx512";
+    }
+    return "unknown";
+}
+
+void doubleSHA256Batch(SHA256Message *messages, size_t count, SHA256Backend backend) {
+    if (backend == SHA256Backend::scalar || !sha256BackendSupported(backend)) {
+        for (size_t i = 0; i < count; i++) {
+            doubleSHA256(messages[i]);
+        }
+        return;
+    }
+    
+    #ifdef BLOCKSCI_MULTI_SHA256
+    std::vector<std::pair<size_t, SHA256Message *>> laneMessages;
+    laneMessages.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        auto length = messageLength(messages[i]);
+        if (length > maxLaneMessageLength) {
+            doubleSHA256(messages[i]);
+        } else {
+            laneMessages.emplace_back(length, &messages[i]);
+        }
+    }
+    std::sort(laneMessages.begin(), laneMessages.end(), [](const auto &a, const auto &b) {
+        return a.first > b.first;
+    });
+    std::vector<SHA256Message *> sorted;
+    sorted.reserve(laneMessages.size());
+    for (auto &item : laneMessages) {
+        sorted.push_back(item.second);
+    }
+    
+    if (backend == SHA256Backend::avx512) {
+        hashLanesAVX512(sorted.data(), sorted.size());
+    } else {
+        hashLanesAVX2(sorted.data(), sorted.size());
+    }
+    #endif
+}
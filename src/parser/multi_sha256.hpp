@@ -0,0 +1,42 @@
+//
+//  multi_sha256.hpp
+//  blocksci_parser
+//
+
+#ifndef multi_sha256_hpp
+#define multi_sha256_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+enum class SHA256Backend {
+    // One message at a time through OpenSSL, which uses the SHA extensions when the processor has them
+    scalar,
+    // Eight messages at once in the 32 bit lanes of AVX2 registers
+    avx2,
+    // Sixteen messages at once in the 32 bit lanes of AVX-512 registers
+    avx512
+};
+
+// A message hashed as the concatenation of up to three pieces, so transactions can be hashed in place
+// without copying their version, body and locktime together first
+struct SHA256Message {
+    const unsigned char *parts[3];
+    size_t lengths[3];
+    unsigned char *digest;
+};
+
+bool sha256BackendSupported(SHA256Backend backend);
+
+// The fastest backend on this processor. Sixteen AVX-512 lanes beat single buffer hashing with the SHA
+// extensions, while eight AVX2 lanes only win on processors without them
+SHA256Backend bestSHA256Backend();
+
+const char *sha256BackendName(SHA256Backend backend);
+
+// Writes SHA256(SHA256(message)) of every message to its digest. The multi buffer backends hash messages
+// longer than a few kilobytes one at a time, since a single long message would otherwise keep every other
+// lane idle until it finished
+void doubleSHA256Batch(SHA256Message *messages, size_t count, SHA256Backend backend);
+
+#endif /* multi_sha256_hpp */
@@ -0,0 +1,67 @@
+//
+//  parser_checkpoint.cpp
+//  blocksci_parser
+//
+
+#include "parser_checkpoint.hpp"
+#include "parser_configuration.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+bool ParserCheckpoint::load(const ParserConfigurationBase &config, ParserCheckpoint &checkpoint) {
+    auto path = config.parserCheckpointFilePath();
+    if (!boost::filesystem::exists(path)) {
+        return false;
+    }
+    boost::filesystem::ifstream file(path);
+    file >> checkpoint.utxoCheckpoint >> checkpoint.clean >> checkpoint.coinbaseSize >> checkpoint.linkedTxCount >> checkpoint.state;
+    if (!file) {
+        throw std::runtime_error("Parser checkpoint " + path.string() + " is corrupted");
+    }
+    return true;
+}
+
+void ParserCheckpoint::save(const ParserConfigurationBase &config) const {
+    auto path = config.parserCheckpointFilePath();
+    auto tmpPath = boost::filesystem::path{path}.concat(".tmp");
+    {
+        boost::filesystem::ofstream file(tmpPath);
+        file << utxoCheckpoint << " " << clean << " " << coinbaseSize << " " << linkedTxCount << " " << state;
+        if (!file.flush()) {
+            throw std::runtime_error("Failed to write parser checkpoint " + tmpPath.string());
+        }
+    }
+    syncFile(tmpPath);
+    boost::filesystem::rename(tmpPath, path);
+    syncFile(path.parent_path());
+}
+
+void syncFile(const boost::filesystem::path &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Could not open " + path.string() + " to flush it");
+    }
+    auto result = ::fsync(fd);
+    ::close(fd);
+    if (result != 0) {
+        throw std::runtime_error("Failed to flush " + path.string() + " to disk");
+    }
+}
+
+void syncFiles(const boost::filesystem::path &directory) {
+    if (!boost::filesystem::exists(directory)) {
+        return;
+    }
+    for (auto &entry : boost::filesystem::recursive_directory_iterator(directory)) {
+        if (boost::filesystem::is_regular_file(entry.status()) || boost::filesystem::is_directory(entry.status())) {
+            syncFile(entry.path());
+        }
+    }
+    syncFile(directory);
+}
@@ -0,0 +1,46 @@
+//
+//  parser_checkpoint.hpp
+//  blocksci_parser
+//
+
+#ifndef parser_checkpoint_hpp
+#define parser_checkpoint_hpp
+
+#include "parser_fwd.hpp"
+
+#include <blocksci/util/state.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <cstdint>
+
+// Last point at which the chain files, the script files, the hash index and the UTXO state were all on disk
+// and agreed with each other. A parser run marks it unclean before it changes any of them and moves it forward
+// after every chunk of blocks it adds, so a run that stopped in between is rolled back to the last checkpoint
+// instead of leaving the data unusable.
+struct ParserCheckpoint {
+    // Checkpoint number of the UTXO state and of the spend data saved with it
+    uint32_t utxoCheckpoint = 0;
+    // Chain and script counts, the script counts being the next script numbers of AddressState
+    blocksci::State state;
+    uint64_t coinbaseSize = 0;
+    // Transactions in [state.txCount, linkedTxCount) are still complete on disk and outputs of the kept
+    // transactions may be back linked to them
+    uint32_t linkedTxCount = 0;
+    // Nothing past the checkpoint has been written
+    bool clean = true;
+    
+    // Returns false if the parser has never saved a checkpoint
+    static bool load(const ParserConfigurationBase &config, ParserCheckpoint &checkpoint);
+    
+    // Replaces the saved checkpoint atomically
+    void save(const ParserConfigurationBase &config) const;
+};
+
+// Flushes a file or directory to disk
+void syncFile(const boost::filesystem::path &path);
+
+// Flushes every file below a directory and the directory entries themselves
+void syncFiles(const boost::filesystem::path &directory);
+
+#endif /* parser_checkpoint_hpp */
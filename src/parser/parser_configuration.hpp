@@ -18,15 +18,83 @@
 #include <boost/filesystem/path.hpp>
 
 #include <functional>
+#include <string>
+
+enum class PipelineMode {
+    // Stages poll single item lock-free queues and sleep when they are empty or full
+    polling,
+    // Stages exchange batches of transactions and block until woken by their neighbors
+    batched
+};
+
+struct PipelineSettings {
+    PipelineMode mode = PipelineMode::batched;
+
+    // Maximum number of transactions handed between stages at once. Blocks are never merged into one batch
+    uint32_t batchSize = 1000;
+
+    // Number of worker threads sharing the stateless hashing and script output stages
+    uint32_t hashReplicas = 1;
+    uint32_t scriptOutputReplicas = 1;
+
+    // Number of threads loading blocks from disk ahead of the pipeline
+    uint32_t importThreads = 1;
+
+    // Number of concurrent RPC connections fetching block headers and raw blocks ahead of the pipeline
+    uint32_t rpcConnections = 4;
+
+    // Threads resolving the inputs of each batch against the sharded UTXO index
+    uint32_t utxoThreads = 1;
+    
+    // Memory budget in MiB for reused addresses kept out of the hash index
+    uint64_t addressCacheMB = 4096;
+    
+    // Back link each chunk on a background thread while the next chunk is parsed
+    bool overlapBackLinking = false;
+    // Threads used to sort and apply back links, 0 uses every core
+    uint32_t backLinkThreads = 0;
+
+    // Memory in MiB each output file may buffer for its background writer before serialization waits on the disk
+    uint64_t writeBufferMB = 64;
+};
+
+struct IndexUpdateSettings {
+    // Generate the new entries on every core and ingest them as sorted tables instead of inserting them one at a time
+    bool bulk = false;
+    // Threads generating and merging entries in bulk mode, 0 uses every core
+    uint32_t threads = 0;
+    // Memory in MiB for sorting entries in bulk mode before they are spilled to disk
+    uint64_t sortMemoryMB = 4096;
+};
 
 struct ParserConfigurationBase : public blocksci::DataConfiguration {
     ParserConfigurationBase();
     ParserConfigurationBase(const boost::filesystem::path &dataDirectory_);
-    
+
+    PipelineSettings pipeline;
+    IndexUpdateSettings indexUpdate;
+
     boost::filesystem::path parserDirectory() const {
         return dataDirectory/"parser";
     }
     
+    boost::filesystem::path utxoIndexDirectory() const {
+        return parserDirectory()/"utxoIndex";
+    }
+    
+    boost::filesystem::path utxoRecordsFilePath() const {
+        return parserDirectory()/"utxoRecords.dat";
+    }
+    
+    boost::filesystem::path utxoSlotsFilePath() const {
+        return parserDirectory()/"utxoSlots.dat";
+    }
+    
+    // Files replaced by the mapped UTXO table, only read to migrate older parser state
+    boost::filesystem::path utxoSetFilePath() const {
+        return parserDirectory()/"utxoSet.dat";
+    }
+    
     boost::filesystem::path utxoCacheFile() const {
         return parserDirectory()/"utxoCache.dat";
     }
@@ -39,7 +107,20 @@ struct ParserConfigurationBase : public blocksci::DataConfiguration {
         return parserDirectory()/"utxoScriptState";
     }
     
+    // Spend data saved together with a checkpoint of the UTXO state
+    boost::filesystem::path utxoAddressStatePath(uint32_t utxoCheckpoint) const {
+        return utxoAddressStatePath()/std::to_string(utxoCheckpoint);
+    }
+    
+    boost::filesystem::path parserCheckpointFilePath() const {
+        return parserDirectory()/"checkpoint.txt";
+    }
+    
+    
     
+    boost::filesystem::path undoJournalDirectory() const {
+        return parserDirectory()/"undo";
+    }
     
     boost::filesystem::path addressPath() const {
         return parserDirectory()/"address";
@@ -49,10 +130,42 @@ struct ParserConfigurationBase : public blocksci::DataConfiguration {
         return parserDirectory()/"blockList.dat";
     }
     
+    boost::filesystem::path blockHeadersFilePath() const {
+        return parserDirectory()/"blockHeaders";
+    }
+    
+    boost::filesystem::path blockFileScanStatePath() const {
+        return parserDirectory()/"blockFileScan.dat";
+    }
+    
     boost::filesystem::path txUpdatesFilePath() const {
         return parserDirectory()/"txUpdates";
     }
     
+    boost::filesystem::path txUpdatesPendingFilePath() const {
+        return parserDirectory()/"txUpdatesPending";
+    }
+    
+    boost::filesystem::path bulkIndexDirectory() const {
+        return parserDirectory()/"bulkIndex";
+    }
+    
+    boost::filesystem::path pipelineStagesFilePath() const {
+        return parserDirectory()/"pipelineStages.csv";
+    }
+    
+    boost::filesystem::path pipelineReplicasFilePath() const {
+        return parserDirectory()/"pipelineReplicas.csv";
+    }
+    
+    boost::filesystem::path pipelineThroughputFilePath() const {
+        return parserDirectory()/"pipelineThroughput.csv";
+    }
+    
+    boost::filesystem::path transactionPoolFilePath() const {
+        return parserDirectory()/"transactionPool.csv";
+    }
+    
     bool witnessActivatedAtHeight(uint32_t blockHeight) const;
 };
 
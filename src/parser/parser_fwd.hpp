@@ -24,13 +24,14 @@ template<typename Key, typename Value>
 class SerializableMap;
 
 class UTXOState;
-class UTXOScriptState;
 
 struct RawTransaction;
 struct BlockInfoBase;
 class UTXOAddressState;
 class AddressState;
 class AddressWriter;
+struct BlockUndo;
+class UndoJournalWriter;
 
 struct RawTransaction;
 struct RawInput;
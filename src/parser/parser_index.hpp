@@ -10,6 +10,7 @@
 #define parser_index_hpp
 
 #include "parser_configuration.hpp"
+#include "bulk_index_builder.hpp"
 #include "block_processor.hpp"
 #include "progress_bar.hpp"
 
@@ -26,6 +27,8 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/operations.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <future>
 
@@ -50,8 +53,19 @@ public:
     ParserIndex(ParserIndex &&) = delete;
     ParserIndex &operator=(ParserIndex &&) = delete;
     ~ParserIndex() {
+        saveState();
+    }
+    
+    // Records how far the index is updated, which otherwise only happens when it is destroyed
+    void saveState() const {
+        saveState(latestState);
+    }
+    
+    // Records an update to state before it starts. Only for updates past the parser checkpoint, whose rollback then
+    // removes every entry the update wrote even if it was interrupted.
+    void saveState(const blocksci::State &state) const {
         boost::filesystem::ofstream outputFile(cachePath);
-        outputFile << latestState;
+        outputFile << state;
     }
     
     template<typename EquivType>
@@ -70,6 +84,52 @@ public:
     template<typename EquivType>
     void updateScript(std::false_type, EquivType, const blocksci::State &, const blocksci::DataAccess &) {}
     
+    template<typename EquivType, typename ScriptFunc>
+    void rollbackScript(std::true_type, EquivType type, const blocksci::State &state, const blocksci::DataAccess &access, ScriptFunc &scriptFunc) {
+        auto typeIndex = static_cast<size_t>(type);
+        for (uint32_t i = state.scriptCounts[typeIndex]; i < latestState.scriptCounts[typeIndex]; i++) {
+            scriptFunc(i + 1, access);
+        }
+    }
+    
+    template<typename EquivType, typename ScriptFunc>
+    void rollbackScript(std::false_type, EquivType, const blocksci::State &, const blocksci::DataAccess &, ScriptFunc &) {}
+    
+    // Calls txFunc(tx) on every indexed transaction and scriptFunc(scriptNum, access) on every indexed script that
+    // rolling back to state removes, so rollbacks regenerate the keys to delete instead of scanning the database.
+    // The removed data is read from disk so this must run before the chain is truncated.
+    template <typename TxFunc, typename ScriptFunc>
+    void visitRolledBack(const blocksci::State &state, TxFunc txFunc, ScriptFunc scriptFunc) {
+        blocksci::DataAccess access(config);
+        if (state.txCount < latestState.txCount) {
+            RANGES_FOR(auto tx, blocksci::TransactionRange(access, state.txCount, latestState.txCount)) {
+                txFunc(tx);
+            }
+        }
+        blocksci::for_each(blocksci::DedupAddressInfoList(), [&](auto type) {
+            rollbackScript(ParserIndexScriptInfo<T, type>{}, type, state, access, scriptFunc);
+        });
+        latestState.blockCount = std::min(latestState.blockCount, state.blockCount);
+        latestState.txCount = std::min(latestState.txCount, state.txCount);
+        for (size_t i = 0; i < state.scriptCounts.size(); i++) {
+            latestState.scriptCounts[i] = std::min(latestState.scriptCounts[i], state.scriptCounts[i]);
+        }
+    }
+    
+    template<typename EquivType>
+    void bulkUpdateScript(std::true_type, EquivType type, const blocksci::State &state, const blocksci::DataAccess &access, BulkIndexBuilder &builder) {
+        auto typeIndex = static_cast<size_t>(type);
+        std::cout << "Generating index entries for scripts of type " << dedupAddressName(type) << "\n";
+        builder.generate(latestState.scriptCounts[typeIndex], state.scriptCounts[typeIndex], [&](BulkRunWriter &writer, uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++) {
+                static_cast<T*>(this)->template bulkProcessScript<type>(i + 1, access, writer);
+            }
+        });
+    }
+    
+    template<typename EquivType>
+    void bulkUpdateScript(std::false_type, EquivType, const blocksci::State &, const blocksci::DataAccess &, BulkIndexBuilder &) {}
+    
     virtual void prepareUpdate() {}
     void runUpdate(const blocksci::State &state) {
         blocksci::DataAccess access(config);
@@ -87,12 +147,52 @@ public:
             }
         }
         
-        blocksci::for_each(blocksci::DedupAddressInfoList(), [&](auto type) {
-            updateScript(ParserIndexScriptInfo<T, type>{}, type, state, access);
-        });
+        {
+            // Scripts are read in address order here, unlike the random lookups of queries
+            blocksci::ScriptScanHint scanHint(*access.scripts);
+            blocksci::for_each(blocksci::DedupAddressInfoList(), [&](auto type) {
+                updateScript(ParserIndexScriptInfo<T, type>{}, type, state, access);
+            });
+        }
         latestState = state;
     };
     
+    // Same result as runUpdate, but the new entries are generated from disjoint ranges on every core, sorted on
+    // disk and ingested as SST files. Much faster when most of the index is new such as when rebuilding it.
+    void runBulkUpdate(const blocksci::State &state) {
+        using clock = std::chrono::steady_clock;
+        auto seconds = [](clock::time_point start) {
+            return std::chrono::duration<double>(clock::now() - start).count();
+        };
+        auto &settings = config.indexUpdate;
+        blocksci::DataAccess access(config);
+        BulkIndexBuilder builder(static_cast<T*>(this)->bulkColumns(), config.bulkIndexDirectory()/cachePath.stem(), settings.threads, settings.sortMemoryMB << 20);
+        
+        auto generateStart = clock::now();
+        if (latestState.txCount < state.txCount) {
+            std::cout << "Generating index entries for " << state.txCount - latestState.txCount << " txes\n";
+            builder.generate(latestState.txCount, state.txCount, [&](BulkRunWriter &writer, uint32_t begin, uint32_t end) {
+                RANGES_FOR(auto tx, blocksci::TransactionRange(access, begin, end)) {
+                    static_cast<T*>(this)->bulkProcessTx(tx, writer);
+                }
+            });
+        }
+        
+        {
+            // Every worker reads its own range of scripts in address order
+            blocksci::ScriptScanHint scanHint(*access.scripts);
+            blocksci::for_each(blocksci::DedupAddressInfoList(), [&](auto type) {
+                bulkUpdateScript(ParserIndexScriptInfo<T, type>{}, type, state, access, builder);
+            });
+        }
+        std::cout << "Generated " << builder.getEntryCount() << " index entries in " << seconds(generateStart) << "s\n";
+        
+        auto ingestStart = clock::now();
+        static_cast<T*>(this)->ingest(builder);
+        std::cout << "Merged and ingested index entries in " << seconds(ingestStart) << "s\n";
+        latestState = state;
+    }
+    
     virtual void tearDown() {}
 };
 
@@ -0,0 +1,214 @@
+//
+//  pipeline_queue.hpp
+//  blocksci_parser
+//
+
+#ifndef pipeline_queue_hpp
+#define pipeline_queue_hpp
+
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+struct NextQueueFinishedEarlyException : public std::runtime_error {
+    NextQueueFinishedEarlyException() : std::runtime_error("Next queue finished early") {}
+    NextQueueFinishedEarlyException(const NextQueueFinishedEarlyException &) = default;
+    virtual ~NextQueueFinishedEarlyException() = default;
+};
+
+// Wait times are written by the side that waits and should only be read once both sides are finished
+struct QueueStats {
+    // Time the producer spent waiting for space and the consumer spent waiting for items
+    std::chrono::nanoseconds pushWaitTime{0};
+    std::chrono::nanoseconds popWaitTime{0};
+    long pushWaitCount = 0;
+    long popWaitCount = 0;
+    size_t poppedCount = 0;
+    // Largest number of items seen queued at once
+    size_t highWater = 0;
+};
+
+// Both queues share the same interface:
+//   producer: push(item), flush() at a batch boundary, close() when finished
+//   consumer: popBatch(batch) until it returns false, stopConsuming() when finished
+
+// Original hand-off: lock-free single item queue where both sides sleep for 5ms whenever
+// the queue is empty or full
+template <typename T>
+class PollingQueue {
+    static constexpr size_t queueCapacity = 10000;
+    boost::lockfree::spsc_queue<T, boost::lockfree::capacity<queueCapacity>> queue;
+    std::atomic<bool> producerDone{false};
+    std::atomic<bool> consumerDone{false};
+
+public:
+    QueueStats stats;
+
+    // Items are always handed off individually so the batch size is unused
+    explicit PollingQueue(size_t) {}
+
+    void push(const T &item) {
+        using namespace std::chrono_literals;
+        while (!queue.push(item)) {
+            if (consumerDone) {
+                throw NextQueueFinishedEarlyException();
+            }
+            stats.pushWaitCount++;
+            auto waitStart = std::chrono::steady_clock::now();
+            std::this_thread::sleep_for(5ms);
+            stats.pushWaitTime += std::chrono::steady_clock::now() - waitStart;
+        }
+        stats.highWater = std::max(stats.highWater, queueCapacity - queue.write_available());
+    }
+
+    void flush() {}
+
+    void close() {
+        producerDone = true;
+    }
+
+    void stopConsuming() {
+        consumerDone = true;
+    }
+
+    bool popBatch(std::vector<T> &batch) {
+        using namespace std::chrono_literals;
+        batch.clear();
+        while (true) {
+            bool wasDone = producerDone;
+            queue.consume_all([&](const T &item) {
+                batch.push_back(item);
+            });
+            if (!batch.empty()) {
+                stats.poppedCount += batch.size();
+                return true;
+            }
+            if (wasDone) {
+                return false;
+            }
+            stats.popWaitCount++;
+            auto waitStart = std::chrono::steady_clock::now();
+            std::this_thread::sleep_for(5ms);
+            stats.popWaitTime += std::chrono::steady_clock::now() - waitStart;
+        }
+    }
+};
+
+// Items are accumulated by the producer and handed over a batch at a time. Waiting threads
+// block on a condition variable and are woken as soon as the other side makes progress.
+template <typename T>
+class BatchQueue {
+    std::mutex m;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<std::vector<T>> batches;
+    std::vector<std::vector<T>> spareBatches;
+    size_t queuedCount = 0;
+    bool producerDone = false;
+    bool consumerDone = false;
+
+    // Only touched by the producer thread
+    std::vector<T> pending;
+
+    size_t batchSize;
+    size_t capacity;
+
+public:
+    QueueStats stats;
+
+    explicit BatchQueue(size_t batchSize_, size_t capacity_ = 10000) : batchSize(std::max(batchSize_, size_t{1})), capacity(std::max(capacity_, batchSize)) {
+        pending.reserve(batchSize);
+    }
+
+    void push(T item) {
+        pending.push_back(std::move(item));
+        if (pending.size() >= batchSize) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (pending.empty()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m);
+        auto hasSpace = [&]() {
+            return consumerDone || queuedCount == 0 || queuedCount + pending.size() <= capacity;
+        };
+        if (!hasSpace()) {
+            stats.pushWaitCount++;
+            auto waitStart = std::chrono::steady_clock::now();
+            notFull.wait(lock, hasSpace);
+            stats.pushWaitTime += std::chrono::steady_clock::now() - waitStart;
+        }
+        if (consumerDone) {
+            throw NextQueueFinishedEarlyException();
+        }
+        queuedCount += pending.size();
+        stats.highWater = std::max(stats.highWater, queuedCount);
+        batches.push_back(std::move(pending));
+        if (spareBatches.empty()) {
+            pending = std::vector<T>{};
+            pending.reserve(batchSize);
+        } else {
+            pending = std::move(spareBatches.back());
+            spareBatches.pop_back();
+        }
+        lock.unlock();
+        notEmpty.notify_one();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            producerDone = true;
+        }
+        notEmpty.notify_all();
+    }
+
+    void stopConsuming() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            consumerDone = true;
+        }
+        notFull.notify_all();
+    }
+
+    bool popBatch(std::vector<T> &batch) {
+        std::unique_lock<std::mutex> lock(m);
+        if (batch.capacity() > 0) {
+            batch.clear();
+            spareBatches.push_back(std::move(batch));
+        }
+        auto hasItems = [&]() {
+            return producerDone || !batches.empty();
+        };
+        if (!hasItems()) {
+            stats.popWaitCount++;
+            auto waitStart = std::chrono::steady_clock::now();
+            notEmpty.wait(lock, hasItems);
+            stats.popWaitTime += std::chrono::steady_clock::now() - waitStart;
+        }
+        if (batches.empty()) {
+            batch = std::vector<T>{};
+            return false;
+        }
+        batch = std::move(batches.front());
+        batches.pop_front();
+        queuedCount -= batch.size();
+        stats.poppedCount += batch.size();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+};
+
+#endif /* pipeline_queue_hpp */
@@ -0,0 +1,109 @@
+//
+//  pipeline_telemetry.cpp
+//  blocksci_parser
+//
+
+#include "pipeline_telemetry.hpp"
+#include "parser_configuration.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+namespace {
+    double toSeconds(TelemetryClock::duration duration) {
+        return std::chrono::duration<double>(duration).count();
+    }
+    
+    std::ofstream openCSV(const boost::filesystem::path &path, const char *header) {
+        bool isNew = !boost::filesystem::exists(path);
+        std::ofstream file(path.native(), std::ios::app);
+        if (isNew) {
+            file << header << "\n";
+        }
+        return file;
+    }
+}
+
+constexpr std::chrono::seconds PipelineTelemetry::sampleInterval;
+
+PipelineTelemetry::PipelineTelemetry() : updateTime(std::time(nullptr)), start(TelemetryClock::now()), lastSample(start) {}
+
+void PipelineTelemetry::sample(TelemetryClock::time_point now) {
+    samples.push_back({toSeconds(now - start), txCount, byteCount});
+    lastSample = now;
+}
+
+void PipelineTelemetry::addStage(std::string name, TelemetryClock::duration runTime, const QueueStats *input, const QueueStats *output) {
+    TelemetryClock::duration idle{0};
+    TelemetryClock::duration blocked{0};
+    size_t stageTxCount = 0;
+    size_t highWater = 0;
+    if (input) {
+        idle = input->popWaitTime;
+        stageTxCount = input->poppedCount;
+        highWater = input->highWater;
+    }
+    if (output) {
+        blocked = output->pushWaitTime;
+        if (!input) {
+            stageTxCount = output->poppedCount;
+        }
+    }
+    auto busy = std::max(runTime - idle - blocked, TelemetryClock::duration{0});
+    stages.push_back({std::move(name), stageTxCount, highWater, toSeconds(busy), toSeconds(idle), toSeconds(blocked)});
+}
+
+void PipelineTelemetry::addReplicatedStage(const std::string &name, TelemetryClock::duration runTime, const std::vector<ReplicaTimes> &replicaTimes, const QueueStats *input, const QueueStats *output) {
+    addStage(name, runTime, input, output);
+    if (replicaTimes.empty()) {
+        return;
+    }
+    TelemetryClock::duration totalBusy{0};
+    for (size_t i = 0; i < replicaTimes.size(); i++) {
+        auto &times = replicaTimes[i];
+        totalBusy += times.busy;
+        replicas.push_back({name, i, times.batchCount, toSeconds(times.busy), toSeconds(times.idle), toSeconds(times.blocked), toSeconds(times.dispatchBlocked)});
+    }
+    stages.back().busySeconds = toSeconds(totalBusy) / static_cast<double>(replicaTimes.size());
+}
+
+void PipelineTelemetry::finish() {
+    sample(TelemetryClock::now());
+}
+
+void PipelineTelemetry::write(const ParserConfigurationBase &config) const {
+    auto stageFile = openCSV(config.pipelineStagesFilePath(), "update,stage,txs,queue_high_water,busy_seconds,idle_seconds,blocked_seconds");
+    for (auto &stage : stages) {
+        stageFile << updateTime << "," << stage.name << "," << stage.txCount << "," << stage.queueHighWater << ",";
+        stageFile << stage.busySeconds << "," << stage.idleSeconds << "," << stage.blockedSeconds << "\n";
+    }
+    
+    if (!replicas.empty()) {
+        auto replicaFile = openCSV(config.pipelineReplicasFilePath(), "update,stage,replica,batches,busy_seconds,idle_seconds,blocked_seconds,dispatch_blocked_seconds");
+        for (auto &replica : replicas) {
+            replicaFile << updateTime << "," << replica.stage << "," << replica.replica << "," << replica.batchCount << ",";
+            replicaFile << replica.busySeconds << "," << replica.idleSeconds << "," << replica.blockedSeconds << "," << replica.dispatchBlockedSeconds << "\n";
+        }
+    }
+    
+    auto throughputFile = openCSV(config.pipelineThroughputFilePath(), "update,elapsed_seconds,txs,bytes,txs_per_second,bytes_per_second");
+    ThroughputSample previous{0, 0, 0};
+    for (auto &sample : samples) {
+        auto interval = sample.elapsedSeconds - previous.elapsedSeconds;
+        double txRate = 0;
+        double byteRate = 0;
+        if (interval > 0) {
+            txRate = static_cast<double>(sample.txCount - previous.txCount) / interval;
+            byteRate = static_cast<double>(sample.byteCount - previous.byteCount) / interval;
+        }
+        throughputFile << updateTime << "," << sample.elapsedSeconds << "," << sample.txCount << "," << sample.byteCount << ",";
+        throughputFile << txRate << "," << byteRate << "\n";
+        previous = sample;
+    }
+    
+    auto poolFile = openCSV(config.transactionPoolFilePath(), "update,allocations,reuses,buffer_growths,buffer_trims,discards");
+    poolFile << updateTime << "," << poolStats.allocations << "," << poolStats.reuses << "," << poolStats.bufferGrowths << ",";
+    poolFile << poolStats.bufferTrims << "," << poolStats.discards << "\n";
+}
@@ -0,0 +1,121 @@
+//
+//  pipeline_telemetry.hpp
+//  blocksci_parser
+//
+
+#ifndef pipeline_telemetry_hpp
+#define pipeline_telemetry_hpp
+
+#include "pipeline_queue.hpp"
+#include "transaction_pool.hpp"
+
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
+
+struct ParserConfigurationBase;
+
+using TelemetryClock = std::chrono::steady_clock;
+
+// Adds the lifetime of the enclosing scope to a running total
+struct StageTimer {
+    TelemetryClock::duration &total;
+    TelemetryClock::time_point start = TelemetryClock::now();
+    
+    ~StageTimer() {
+        total += TelemetryClock::now() - start;
+    }
+};
+
+struct StageTelemetry {
+    std::string name;
+    size_t txCount;
+    // Largest number of transactions waiting in the stage's input queue
+    size_t queueHighWater;
+    // Running time split into processing, waiting for input and waiting for the next stage
+    double busySeconds;
+    double idleSeconds;
+    double blockedSeconds;
+};
+
+// Timings of one replica thread of a replicated stage, measured directly since the threads of such a stage
+// overlap and its running time can't be split up
+struct ReplicaTimes {
+    size_t batchCount = 0;
+    // Time spent in the stage function
+    TelemetryClock::duration busy{0};
+    // Waiting for the dispatcher to hand over a batch and for the merger to take a finished one
+    TelemetryClock::duration idle{0};
+    TelemetryClock::duration blocked{0};
+    // Time the dispatcher was blocked because this replica's work slot was full
+    TelemetryClock::duration dispatchBlocked{0};
+};
+
+struct ReplicaTelemetry {
+    std::string stage;
+    size_t replica;
+    size_t batchCount;
+    double busySeconds;
+    double idleSeconds;
+    double blockedSeconds;
+    double dispatchBlockedSeconds;
+};
+
+struct ThroughputSample {
+    double elapsedSeconds;
+    size_t txCount;
+    size_t byteCount;
+};
+
+// Collects per stage timings and the throughput of a single parser update. The results are appended to
+// CSV files in the parser directory so that updates can be compared over time.
+class PipelineTelemetry {
+    std::time_t updateTime;
+    TelemetryClock::time_point start;
+    TelemetryClock::time_point lastSample;
+    size_t txCount = 0;
+    size_t byteCount = 0;
+    std::vector<ThroughputSample> samples;
+    std::vector<StageTelemetry> stages;
+    std::vector<ReplicaTelemetry> replicas;
+    TransactionPool::Stats poolStats;
+    
+    void sample(TelemetryClock::time_point now);
+    
+public:
+    // Interval between throughput samples
+    static constexpr std::chrono::seconds sampleInterval{1};
+    
+    PipelineTelemetry();
+    
+    // Must only be called from the final pipeline stage
+    void recordTransaction(uint32_t txSize) {
+        txCount++;
+        byteCount += txSize;
+        if (txCount % 1024 == 0) {
+            auto now = TelemetryClock::now();
+            if (now - lastSample >= sampleInterval) {
+                sample(now);
+            }
+        }
+    }
+    
+    // The input queue is null for the importer and the output queue is null for the final stage
+    void addStage(std::string name, TelemetryClock::duration runTime, const QueueStats *input, const QueueStats *output);
+    
+    // The busy time of a stage run by replicas is their average time in the stage function, while idle and
+    // blocked are still the waits on the stage's own queues. Each replica is also recorded on its own. Without
+    // replica timings the stage ran on a single thread and is added like any other.
+    void addReplicatedStage(const std::string &name, TelemetryClock::duration runTime, const std::vector<ReplicaTimes> &replicaTimes, const QueueStats *input, const QueueStats *output);
+    
+    void setTransactionPoolStats(const TransactionPool::Stats &stats) {
+        poolStats = stats;
+    }
+    
+    void finish();
+    
+    void write(const ParserConfigurationBase &config) const;
+};
+
+#endif /* pipeline_telemetry_hpp */
@@ -16,10 +16,6 @@
 #include <blocksci/util/hash.hpp>
 #include <blocksci/chain/transaction.hpp>
 
-#ifdef BLOCKSCI_RPC_PARSER
-#include <bitcoinapi/types.h>
-#endif
-
 #include <openssl/sha.h>
 
 #include <iostream>
@@ -28,26 +24,18 @@ using SequenceNum = uint32_t;
 using Value = uint64_t;
 using Locktime = uint32_t;
 
-std::vector<unsigned char> hexStringToVec(const std::string scripthex);
-
-std::vector<unsigned char> hexStringToVec(const std::string scripthex) {
-    std::vector<unsigned char> scriptBytes;
-    for (unsigned int i = 0; i < scripthex.size(); i += 2) {
-        std::string byteString = scripthex.substr(i, 2);
-        unsigned char byte = static_cast<unsigned char>(strtol(byteString.c_str(), NULL, 16));
-        scriptBytes.push_back(byte);
-    }
-    return scriptBytes;
+RawInput::RawInput(SafeMemReader &reader) {
+    load(reader);
 }
 
-#ifdef BLOCKSCI_FILE_PARSER
-RawInput::RawInput(SafeMemReader &reader) {
+void RawInput::load(SafeMemReader &reader) {
     rawOutputPointer.hash = reader.readNext<blocksci::uint256>();
     rawOutputPointer.outputNum = static_cast<uint16_t>(reader.readNext<uint32_t>());
     scriptLength = reader.readVariableLengthInteger();
     scriptBegin = reinterpret_cast<const unsigned char*>(reader.unsafePos());
     reader.advance(scriptLength);
     sequenceNum = reader.readNext<SequenceNum>();
+    witnessStack.clear();
 }
 
 RawOutput::RawOutput(SafeMemReader &reader) {
@@ -83,10 +71,10 @@ void RawTransaction::load(SafeMemReader &reader, uint32_t txNum_, blocksci::Bloc
         curOffset = reader.offset();
         inputCount = reader.readVariableLengthInteger();
     }
-    inputs.clear();
-    inputs.reserve(inputCount);
+    // Inputs left over from a recycled transaction are reloaded in place to reuse their witness stacks
+    inputs.resize(inputCount);
     for (decltype(inputCount) i = 0; i < inputCount; i++) {
-        inputs.emplace_back(reader);
+        inputs[i].load(reader);
     }
     
     auto outputCount = reader.readVariableLengthInteger();
@@ -171,46 +159,22 @@ void RawTransaction::calculateHash() {
     }
 }
 
-#endif
-
-#ifdef BLOCKSCI_RPC_PARSER
-RawInput::RawInput(const vin_t &vin) {
-    rawOutputPointer = {blocksci::uint256S(vin.txid), static_cast<uint16_t>(vin.n)};
-    sequenceNum = vin.sequence;
-    scriptBytes = hexStringToVec(vin.scriptSig.hex);
-    scriptLength = 0;
-}
-
-RawOutput::RawOutput(std::vector<unsigned char> scriptBytes_, uint64_t value_) : scriptLength(0), scriptBytes(std::move(scriptBytes_)), value(value_)  {
-}
-
-RawOutput::RawOutput(const vout_t &vout) : RawOutput(hexStringToVec(vout.scriptPubKey.hex), static_cast<uint64_t>(vout.value * 100000000)) {}
-
-void RawTransaction::load(const getrawtransaction_t &txinfo, uint32_t txNum_, blocksci::BlockHeight blockHeight_, bool witnessActivated) {
-    txNum = txNum_;
-    isSegwit = witnessActivated;
-    blockHeight = blockHeight_;
-    version = txinfo.version;
-    locktime = static_cast<uint32_t>(txinfo.locktime);
-    realSize = static_cast<uint32_t>(txinfo.hex.size() / 2);
-    auto inputCount = txinfo.vin.size();
-    inputs.clear();
-    inputs.reserve(inputCount);
-    for (size_t i = 0; i < inputCount; i++) {
-        inputs.emplace_back(txinfo.vin[i]);
-    }
-    auto outputCount = txinfo.vout.size();
-    
-    outputs.clear();
-    outputs.reserve(outputCount);
-    for (unsigned int i = 0; i < outputCount; i++) {
-        outputs.emplace_back(txinfo.vout[i]);
+void calculateHashes(const std::vector<RawTransaction *> &txes, SHA256Backend backend) {
+    std::vector<SHA256Message> messages;
+    messages.reserve(txes.size());
+    for (auto tx : txes) {
+        if (tx->hash.IsNull()) {
+            auto txBody = reinterpret_cast<const unsigned char *>(tx->txHashStart);
+            messages.push_back(SHA256Message{
+                {reinterpret_cast<const unsigned char *>(&tx->version), txBody, reinterpret_cast<const unsigned char *>(&tx->locktime)},
+                {sizeof(tx->version), tx->txHashLength, sizeof(tx->locktime)},
+                tx->hash.begin()
+            });
+        }
     }
-    hash = blocksci::uint256S(txinfo.txid);;
+    doubleSHA256Batch(messages.data(), messages.size(), backend);
 }
 
-#endif
-
 blocksci::RawTransaction RawTransaction::getRawTransaction() const {
     return {realSize, baseSize, locktime, static_cast<uint16_t>(inputs.size()), static_cast<uint16_t>(outputs.size())};
 }
@@ -10,15 +10,13 @@
 #define preproccessed_block_hpp
 
 #include "config.hpp"
+#include "multi_sha256.hpp"
 #include "script_output.hpp"
 #include "script_input.hpp"
 #include "utxo.hpp"
 
 #include <blocksci/util/bitcoin_uint256.hpp>
 
-struct getrawtransaction_t;
-struct vout_t;
-struct vin_t;
 struct InputView;
 
 namespace blocksci {
@@ -28,13 +26,14 @@ namespace blocksci {
 
 class SafeMemReader;
 
+// Scripts and witness items are views into the serialized block a transaction was loaded from. The block
+// reader keeps that data mapped until the transaction is handed back through receivedFinishedTx
+
 struct WitnessStackItem {
     uint32_t length;
     const char *itemBegin;
     
-    #ifdef BLOCKSCI_FILE_PARSER
     WitnessStackItem(SafeMemReader &reader);
-    #endif
 };
 
 struct RawInput {
@@ -42,60 +41,42 @@ private:
     const unsigned char *scriptBegin;
     uint32_t scriptLength;
     
-    std::vector<unsigned char> scriptBytes;
-    
 public:
     
     RawOutputPointer rawOutputPointer;
     uint32_t sequenceNum;
     std::vector<WitnessStackItem> witnessStack;
     UTXO utxo;
+    // Slot of the spent output in UTXOState, held until recordAddresses releases it
+    uint32_t utxoSlot;
     
     blocksci::OutputPointer getOutputPointer() const;
     
     blocksci::CScriptView getScriptView() const {
-        if (scriptLength == 0) {
-            return blocksci::CScriptView(scriptBytes.data(), scriptBytes.data() + scriptBytes.size());
-        } else {
-            return blocksci::CScriptView(scriptBegin, scriptBegin + scriptLength);
-        }
+        return blocksci::CScriptView(scriptBegin, scriptBegin + scriptLength);
     }
     
-    RawInput(){}
+    RawInput() : scriptBegin(nullptr), scriptLength(0) {}
     
-    #ifdef BLOCKSCI_FILE_PARSER
     RawInput(SafeMemReader &reader);
-    #endif
     
-    #ifdef BLOCKSCI_RPC_PARSER
-    RawInput(const vin_t &vin);
-    #endif
+    // Reloads an existing input in place, keeping the capacity of its witness stack
+    void load(SafeMemReader &reader);
 };
 
 struct RawOutput {
 private:
     const unsigned char *scriptBegin;
     uint32_t scriptLength;
-    
-    std::vector<unsigned char> scriptBytes;
 public:
     uint64_t value;
+    // Slot of a spendable output in UTXOState, assigned by connectUTXOs, or UTXOState::duplicateSlot for a BIP 30 duplicate
+    uint32_t utxoSlot;
 
-    #ifdef BLOCKSCI_FILE_PARSER
     RawOutput(SafeMemReader &reader);
-    #endif
-    
-    #ifdef BLOCKSCI_RPC_PARSER
-    RawOutput(const vout_t &vout);
-    RawOutput(std::vector<unsigned char> scriptBytes_, uint64_t value_);
-    #endif
     
     blocksci::CScriptView getScriptView() const {
-        if (scriptLength == 0) {
-            return blocksci::CScriptView(scriptBytes.data(), scriptBytes.data() + scriptBytes.size());
-        } else {
-            return blocksci::CScriptView(scriptBegin, scriptBegin + scriptLength);
-        }
+        return blocksci::CScriptView(scriptBegin, scriptBegin + scriptLength);
     }
 };
 
@@ -136,13 +117,8 @@ struct RawTransaction {
       version(0),
       blockHeight(0) {}
     
-    #ifdef BLOCKSCI_FILE_PARSER
+    // Parses a serialized transaction in place, shared by blocks read from disk and over RPC
     void load(SafeMemReader &reader, uint32_t txNum, blocksci::BlockHeight blockHeight, bool witnessActivated);
-    #endif
-    
-    #ifdef BLOCKSCI_RPC_PARSER
-    void load(const getrawtransaction_t &txinfo, uint32_t txNum, blocksci::BlockHeight blockHeight, bool witnessActivated);
-    #endif
     
     void calculateHash();
     
@@ -152,5 +128,9 @@ struct RawTransaction {
     std::vector<char> getSer(const InputView &info, const blocksci::CScriptView &scriptView, int hashType) const;
 };
 
+// Equivalent to calling calculateHash on every transaction, but hashes several transactions at once with
+// the given backend
+void calculateHashes(const std::vector<RawTransaction *> &txes, SHA256Backend backend);
+
 
 #endif /* preproccessed_block_hpp */
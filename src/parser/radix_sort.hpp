@@ -0,0 +1,87 @@
+//
+//  radix_sort.hpp
+//  blocksci_parser
+//
+
+#ifndef radix_sort_hpp
+#define radix_sort_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+template <typename Func>
+void runOnThreads(size_t threadCount, Func func) {
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(func, i);
+    }
+    func(size_t{0});
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+// Stable least significant digit radix sort on an unsigned integer key. Each pass splits the items into
+// one contiguous range per thread, counts digits per range and then scatters every range into its own
+// precomputed slots. Only as many passes are made as are needed to cover maxKey.
+template <typename T, typename KeyFunc>
+void parallelRadixSort(std::vector<T> &items, KeyFunc keyFunc, uint64_t maxKey, size_t threadCount) {
+    constexpr int digitBits = 16;
+    constexpr size_t bucketCount = size_t{1} << digitBits;
+    constexpr uint64_t digitMask = bucketCount - 1;
+    // Below this many items per thread the extra threads cost more than they save
+    constexpr size_t minItemsPerThread = 1 << 16;
+    
+    int keyBits = 0;
+    while (keyBits < 64 && (maxKey >> keyBits) != 0) {
+        keyBits++;
+    }
+    if (keyBits == 0 || items.size() < 2) {
+        return;
+    }
+    if (items.size() < minItemsPerThread) {
+        std::stable_sort(items.begin(), items.end(), [&](const T &a, const T &b) {
+            return keyFunc(a) < keyFunc(b);
+        });
+        return;
+    }
+    
+    threadCount = std::max<size_t>(1, std::min(threadCount, items.size() / minItemsPerThread));
+    auto rangeStart = [&](size_t thread) {
+        return items.size() * thread / threadCount;
+    };
+    
+    std::vector<T> scratch(items.size());
+    std::vector<std::vector<size_t>> offsets(threadCount, std::vector<size_t>(bucketCount));
+    for (int shift = 0; shift < keyBits; shift += digitBits) {
+        runOnThreads(threadCount, [&](size_t thread) {
+            auto &counts = offsets[thread];
+            std::fill(counts.begin(), counts.end(), 0);
+            for (size_t i = rangeStart(thread); i < rangeStart(thread + 1); i++) {
+                counts[(keyFunc(items[i]) >> shift) & digitMask]++;
+            }
+        });
+        
+        size_t total = 0;
+        for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+            for (size_t thread = 0; thread < threadCount; thread++) {
+                auto count = offsets[thread][bucket];
+                offsets[thread][bucket] = total;
+                total += count;
+            }
+        }
+        
+        runOnThreads(threadCount, [&](size_t thread) {
+            auto &slots = offsets[thread];
+            for (size_t i = rangeStart(thread); i < rangeStart(thread + 1); i++) {
+                scratch[slots[(keyFunc(items[i]) >> shift) & digitMask]++] = items[i];
+            }
+        });
+        items.swap(scratch);
+    }
+}
+
+#endif /* radix_sort_hpp */
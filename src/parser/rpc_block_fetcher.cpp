@@ -0,0 +1,183 @@
+//
+//  rpc_block_fetcher.cpp
+//  blocksci_parser
+//
+
+#include "rpc_block_fetcher.hpp"
+
+#ifdef BLOCKSCI_RPC_PARSER
+
+#include "chain_index.hpp"
+#include "parser_configuration.hpp"
+
+#include <blocksci/util/bitcoin_uint256.hpp>
+
+#include <bitcoinapi/bitcoinapi.h>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+RawBlockData decodeHexBlock(const std::string &hex) {
+    if (hex.size() % 2 != 0) {
+        throw std::runtime_error("Block hex has an odd number of digits");
+    }
+    RawBlockData data(hex.size() / 2);
+    for (size_t i = 0; i < data.size(); i++) {
+        auto high = blocksci::HexDigit(hex[2 * i]);
+        auto low = blocksci::HexDigit(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            throw std::runtime_error("Block hex has an invalid digit");
+        }
+        data[i] = static_cast<char>((high << 4) | low);
+    }
+    return data;
+}
+
+std::vector<BlockInfo<RPCTag>> fetchBlockHeaders(const ParserConfiguration<RPCTag> &config, blocksci::BlockHeight beginHeight, blocksci::BlockHeight endHeight, size_t connectionCount) {
+    auto blockCount = static_cast<size_t>(std::max(0, endHeight - beginHeight));
+    std::vector<BlockInfo<RPCTag>> blocks(blockCount);
+    if (blockCount == 0) {
+        return blocks;
+    }
+    
+    std::cout.setf(std::ios::fixed,std::ios::floatfield);
+    std::cout.precision(1);
+    auto percentageMarker = std::max<size_t>(1, blockCount / 1000);
+    
+    std::mutex m;
+    size_t nextToFetch = 0;
+    size_t fetchedCount = 0;
+    std::exception_ptr error;
+    auto fetchLoop = [&]() {
+        try {
+            BitcoinAPI bapi{config.createBitcoinAPI()};
+            while (true) {
+                size_t index;
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    if (error || nextToFetch >= blockCount) {
+                        return;
+                    }
+                    index = nextToFetch++;
+                }
+                
+                auto height = beginHeight + static_cast<blocksci::BlockHeight>(index);
+                Json::Value params;
+                params.append(bapi.getblockhash(height));
+                params.append(true);
+                blocks[index] = BlockInfo<RPCTag>{bapi.sendcommand("getblockheader", params)};
+                
+                std::lock_guard<std::mutex> lock(m);
+                fetchedCount++;
+                if (fetchedCount % percentageMarker == 0) {
+                    std::cout << "\r" << static_cast<double>(fetchedCount) / static_cast<double>(blockCount) * 100 << "% done fetching block headers" << std::flush;
+                }
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+    
+    std::vector<std::thread> threads;
+    connectionCount = std::max<size_t>(1, std::min(connectionCount, blockCount));
+    for (size_t i = 0; i < connectionCount; i++) {
+        threads.emplace_back(fetchLoop);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    std::cout << std::endl;
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return blocks;
+}
+
+RPCBlockFetcher::RPCBlockFetcher(const ParserConfiguration<RPCTag> &config, const std::vector<BlockInfo<RPCTag>> &blocks, size_t connectionCount) {
+    blockHashes.reserve(blocks.size());
+    for (auto &block : blocks) {
+        blockHashes.push_back(block.hash.GetHex());
+    }
+    connectionCount = std::max<size_t>(1, std::min(connectionCount, blockHashes.size()));
+    window = connectionCount * 4;
+    for (size_t i = 0; i < connectionCount; i++) {
+        threads.emplace_back([this, &config]() {
+            fetchLoop(config);
+        });
+    }
+}
+
+RPCBlockFetcher::~RPCBlockFetcher() {
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stopping = true;
+    }
+    slotFree.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void RPCBlockFetcher::fetchLoop(const ParserConfiguration<RPCTag> &config) {
+    try {
+        BitcoinAPI bapi{config.createBitcoinAPI()};
+        while (true) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                slotFree.wait(lock, [&]() {
+                    return stopping || nextToFetch >= blockHashes.size() || nextToFetch < nextToTake + window;
+                });
+                if (stopping || nextToFetch >= blockHashes.size()) {
+                    return;
+                }
+                index = nextToFetch++;
+            }
+            
+            Json::Value params;
+            params.append(blockHashes[index]);
+            // Older nodes only accept a boolean here
+            params.append(false);
+            auto block = std::make_shared<const RawBlockData>(decodeHexBlock(bapi.sendcommand("getblock", params).asString()));
+            
+            {
+                std::lock_guard<std::mutex> lock(m);
+                fetched.emplace(index, std::move(block));
+            }
+            blockReady.notify_all();
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            if (!error) {
+                error = std::current_exception();
+            }
+            stopping = true;
+        }
+        blockReady.notify_all();
+        slotFree.notify_all();
+    }
+}
+
+std::shared_ptr<const RawBlockData> RPCBlockFetcher::next() {
+    std::unique_lock<std::mutex> lock(m);
+    blockReady.wait(lock, [&]() {
+        return error || fetched.count(nextToTake) > 0;
+    });
+    auto it = fetched.find(nextToTake);
+    if (it == fetched.end()) {
+        std::rethrow_exception(error);
+    }
+    auto block = std::move(it->second);
+    fetched.erase(it);
+    nextToTake++;
+    lock.unlock();
+    slotFree.notify_all();
+    return block;
+}
+
+#endif
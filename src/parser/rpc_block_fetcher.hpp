@@ -0,0 +1,68 @@
+//
+//  rpc_block_fetcher.hpp
+//  blocksci_parser
+//
+
+#ifndef rpc_block_fetcher_hpp
+#define rpc_block_fetcher_hpp
+
+#include "config.hpp"
+
+#ifdef BLOCKSCI_RPC_PARSER
+
+#include "parser_fwd.hpp"
+
+#include <blocksci/chain/chain_fwd.hpp>
+
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Serialized block in the same format as the blk files
+using RawBlockData = std::vector<char>;
+
+// Decodes the hex serialization returned by getblock with verbose set to false
+RawBlockData decodeHexBlock(const std::string &hex);
+
+// Fetches the headers of the blocks at heights [beginHeight, endHeight) over several RPC connections at once and
+// returns them in chain order
+std::vector<BlockInfo<RPCTag>> fetchBlockHeaders(const ParserConfiguration<RPCTag> &config, blocksci::BlockHeight beginHeight, blocksci::BlockHeight endHeight, size_t connectionCount);
+
+// Fetches the raw blocks of a chain segment ahead of the parser over several RPC connections at once. Each
+// request returns a whole block, so the parser reads it exactly like a block loaded from disk. Blocks are
+// handed out in chain order and at most a small window of them is held ahead of the one being read.
+class RPCBlockFetcher {
+    std::vector<std::string> blockHashes;
+    size_t window;
+    
+    std::mutex m;
+    std::condition_variable blockReady;
+    std::condition_variable slotFree;
+    std::map<size_t, std::shared_ptr<const RawBlockData>> fetched;
+    size_t nextToFetch = 0;
+    size_t nextToTake = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::vector<std::thread> threads;
+    
+    void fetchLoop(const ParserConfiguration<RPCTag> &config);
+
+public:
+    // config must outlive the fetcher
+    RPCBlockFetcher(const ParserConfiguration<RPCTag> &config, const std::vector<BlockInfo<RPCTag>> &blocks, size_t connectionCount);
+    RPCBlockFetcher(const RPCBlockFetcher &) = delete;
+    RPCBlockFetcher &operator=(const RPCBlockFetcher &) = delete;
+    ~RPCBlockFetcher();
+    
+    // Waits for the next block in chain order. Rethrows the error of a failed request
+    std::shared_ptr<const RawBlockData> next();
+};
+
+#endif
+
+#endif /* rpc_block_fetcher_hpp */
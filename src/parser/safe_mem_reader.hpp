@@ -29,6 +29,9 @@ public:
         end = fileMap.end();
         pos = begin;
     }
+    
+    // Reads a buffer owned by the caller, which must outlive the reader and anything loaded from it
+    SafeMemReader(const char *data, size_type size) : pos(data), begin(data), end(data + size) {}
 
     bool has(difference_type n) {
         return n <= std::distance(pos, end);
@@ -9,6 +9,7 @@
 #define BLOCKSCI_WITHOUT_SINGLETON
 
 #include "script_output.hpp"
+#include "script_template.hpp"
 #include "address_writer.hpp"
 
 #include <blocksci/util/hash.hpp>
@@ -35,29 +36,44 @@ ScriptOutputDataType extractScriptData(const blocksci::CScriptView &scriptPubKey
     // Templates
     using namespace blocksci;
     
-    static std::vector<std::pair<AddressType::Enum, CScript>> mTemplates;
-    if (mTemplates.empty())
-    {
+    // Shortcut for the standard templates, including every pay-to-script-hash output, which are recognized
+    // from their fixed bytes without walking the opcodes
+    if (scriptPubKey.size() > 0) {
+        auto match = matchScriptTemplate(&*scriptPubKey.begin(), scriptPubKey.size(), witnessActivated);
+        switch (match.type) {
+            case AddressType::Enum::PUBKEYHASH: {
+                uint160 hash{match.data, match.data + 20};
+                return ScriptOutputData<AddressType::Enum::PUBKEYHASH>{hash};
+            }
+            case AddressType::Enum::SCRIPTHASH:
+                return ScriptOutputData<AddressType::Enum::SCRIPTHASH>{uint160{match.data, match.data + 20}};
+            case AddressType::Enum::WITNESS_PUBKEYHASH:
+                return ScriptOutputData<AddressType::Enum::WITNESS_PUBKEYHASH>{uint160{match.data, match.data + 20}};
+            case AddressType::Enum::WITNESS_SCRIPTHASH:
+                return ScriptOutputData<AddressType::Enum::WITNESS_SCRIPTHASH>{uint256{match.data, match.data + 32}};
+            case AddressType::Enum::PUBKEY:
+                return ScriptOutputData<AddressType::Enum::PUBKEY>{CPubKey{match.data, match.data + scriptPubKey.size() - 2}};
+            default:
+                break;
+        }
+    }
+    
+    // Initialized once in a thread safe manner since outputs are generated from multiple threads
+    static const std::vector<std::pair<AddressType::Enum, CScript>> mTemplates = [] {
+        std::vector<std::pair<AddressType::Enum, CScript>> templates;
         // Standard tx, sender provides pubkey, receiver adds signature
         auto pubkey = std::make_pair(AddressType::Enum::PUBKEY, CScript() << OP_PUBKEY << OP_CHECKSIG);
-        mTemplates.push_back(pubkey);
+        templates.push_back(pubkey);
         
         // Bitcoin address tx, sender provides hash of pubkey, receiver provides signature and pubkey
         auto pubkeyHash = std::make_pair(AddressType::Enum::PUBKEYHASH, CScript() << OP_DUP << OP_HASH160 << OP_PUBKEYHASH << OP_EQUALVERIFY << OP_CHECKSIG);
-        mTemplates.push_back(pubkeyHash);
+        templates.push_back(pubkeyHash);
         
         // Sender provides N pubkeys, receivers provides M signatures
         auto multisig = std::make_pair(AddressType::Enum::MULTISIG, CScript() << OP_SMALLINTEGER << OP_PUBKEYS << OP_SMALLINTEGER << OP_CHECKMULTISIG);
-        mTemplates.push_back(multisig);
-    }
-    
-    // Shortcut for pay-to-script-hash, which are more constrained than the other types:
-    // it is always OP_HASH160 20 [20 byte hash] OP_EQUAL
-    if (scriptPubKey.IsPayToScriptHash()) {
-        blocksci::uint160 hash;
-        memcpy(&hash, &(*(scriptPubKey.begin()+2)), 20);
-        return ScriptOutputData<AddressType::Enum::SCRIPTHASH>{{hash}};
-    }
+        templates.push_back(multisig);
+        return templates;
+    }();
     
     if (witnessActivated && scriptPubKey.IsWitnessProgram()) {
         auto pc = scriptPubKey.begin();
@@ -0,0 +1,67 @@
+//
+//  script_template.hpp
+//  blocksci_parser
+//
+
+#ifndef script_template_hpp
+#define script_template_hpp
+
+#include <blocksci/address/address_types.hpp>
+#include <blocksci/scripts/bitcoin_script.hpp>
+
+#include <cstddef>
+
+struct ScriptTemplateMatch {
+    blocksci::AddressType::Enum type;
+    // Start of the hash or public key within the script
+    const unsigned char *data;
+};
+
+// Recognizes the standard output scripts that are fully determined by their length and a handful of fixed
+// bytes: pay to pubkey hash, script hash, witness pubkey hash, witness script hash and pay to pubkey. These
+// make up almost every output on the chain. Returns NONSTANDARD for any other script, which must then be
+// classified by walking its opcodes. Every script matched here is classified identically by the walk
+inline ScriptTemplateMatch matchScriptTemplate(const unsigned char *script, size_t length, bool witnessActivated) {
+    using namespace blocksci;
+    switch (length) {
+        case 22:
+            // OP_0 [20 byte hash]
+            if (witnessActivated && script[0] == OP_0 && script[1] == 20) {
+                return {AddressType::Enum::WITNESS_PUBKEYHASH, script + 2};
+            }
+            break;
+        case 23:
+            // OP_HASH160 [20 byte hash] OP_EQUAL
+            if (script[0] == OP_HASH160 && script[1] == 20 && script[22] == OP_EQUAL) {
+                return {AddressType::Enum::SCRIPTHASH, script + 2};
+            }
+            break;
+        case 25:
+            // OP_DUP OP_HASH160 [20 byte hash] OP_EQUALVERIFY OP_CHECKSIG
+            if (script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 && script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+                return {AddressType::Enum::PUBKEYHASH, script + 3};
+            }
+            break;
+        case 34:
+            // OP_0 [32 byte hash]
+            if (witnessActivated && script[0] == OP_0 && script[1] == 32) {
+                return {AddressType::Enum::WITNESS_SCRIPTHASH, script + 2};
+            }
+            break;
+        case 35:
+            // [33 byte compressed pubkey] OP_CHECKSIG
+            if (script[0] == 33 && (script[1] == 2 || script[1] == 3) && script[34] == OP_CHECKSIG) {
+                return {AddressType::Enum::PUBKEY, script + 1};
+            }
+            break;
+        case 67:
+            // [65 byte uncompressed or hybrid pubkey] OP_CHECKSIG
+            if (script[0] == 65 && (script[1] == 4 || script[1] == 6 || script[1] == 7) && script[66] == OP_CHECKSIG) {
+                return {AddressType::Enum::PUBKEY, script + 1};
+            }
+            break;
+    }
+    return {AddressType::Enum::NONSTANDARD, nullptr};
+}
+
+#endif /* script_template_hpp */
@@ -0,0 +1,97 @@
+//
+//  transaction_pool.cpp
+//  blocksci_parser
+//
+
+#include "transaction_pool.hpp"
+#include "preproccessed_block.hpp"
+
+struct TransactionPool::Entry : public RawTransaction {
+    // Total buffer capacity when last released, used to detect reallocations
+    size_t bufferCapacity = 0;
+};
+
+namespace {
+    template <typename T>
+    bool trimBuffer(std::vector<T> &buffer, size_t maxRetained) {
+        if (buffer.capacity() > maxRetained) {
+            std::vector<T>{}.swap(buffer);
+            return true;
+        }
+        buffer.clear();
+        return false;
+    }
+    
+    size_t bufferCapacity(const RawTransaction &tx) {
+        size_t capacity = tx.inputs.capacity() + tx.outputs.capacity() + tx.scriptInputs.capacity() + tx.scriptOutputs.capacity();
+        for (auto &input : tx.inputs) {
+            capacity += input.witnessStack.capacity();
+        }
+        return capacity;
+    }
+}
+
+TransactionPool::TransactionPool(size_t maxPooled_) : maxPooled(maxPooled_) {
+    pooled.reserve(maxPooled);
+}
+
+TransactionPool::~TransactionPool() {
+    for (auto entry : pooled) {
+        delete entry;
+    }
+}
+
+bool TransactionPool::acquire(RawTransaction *&tx) {
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (!pooled.empty()) {
+            tx = pooled.back();
+            pooled.pop_back();
+            counts.reuses++;
+            return true;
+        }
+        counts.allocations++;
+    }
+    tx = new Entry();
+    return false;
+}
+
+void TransactionPool::release(RawTransaction *tx) {
+    auto entry = static_cast<Entry *>(tx);
+    size_t trims = 0;
+    // Witness stacks live inside the inputs, so they are trimmed before the inputs may be released
+    for (auto &input : entry->inputs) {
+        if (input.witnessStack.capacity() > maxRetainedWitnessItems) {
+            std::vector<WitnessStackItem>{}.swap(input.witnessStack);
+            trims++;
+        }
+    }
+    auto capacity = bufferCapacity(*entry);
+    bool grew = entry->bufferCapacity != 0 && capacity > entry->bufferCapacity;
+    
+    // Inputs are kept in place so their witness stacks can be refilled without allocating
+    if (entry->inputs.capacity() > maxRetainedInputs) {
+        std::vector<RawInput>{}.swap(entry->inputs);
+        trims++;
+    }
+    trims += trimBuffer(entry->outputs, maxRetainedOutputs);
+    trims += trimBuffer(entry->scriptInputs, maxRetainedInputs);
+    trims += trimBuffer(entry->scriptOutputs, maxRetainedOutputs);
+    entry->bufferCapacity = bufferCapacity(*entry);
+    
+    std::unique_lock<std::mutex> lock(m);
+    counts.bufferGrowths += grew;
+    counts.bufferTrims += trims;
+    if (pooled.size() < maxPooled) {
+        pooled.push_back(entry);
+    } else {
+        counts.discards++;
+        lock.unlock();
+        delete entry;
+    }
+}
+
+TransactionPool::Stats TransactionPool::stats() const {
+    std::lock_guard<std::mutex> lock(m);
+    return counts;
+}
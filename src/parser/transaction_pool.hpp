@@ -0,0 +1,60 @@
+//
+//  transaction_pool.hpp
+//  blocksci_parser
+//
+
+#ifndef transaction_pool_hpp
+#define transaction_pool_hpp
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+struct RawTransaction;
+
+// Recycles RawTransaction objects between the end of the parser pipeline and the importer. Transactions
+// keep the capacity of their input, output and script buffers while pooled so that in the steady state
+// loading a transaction does not need to allocate. Memory use is bounded by the number of pooled
+// transactions and by trimming any buffer that grew beyond the retained limits.
+class TransactionPool {
+public:
+    struct Stats {
+        // Transactions allocated because the pool was empty
+        size_t allocations = 0;
+        // Transactions handed out again from the pool
+        size_t reuses = 0;
+        // Recycled transactions whose buffers had to grow since they were last released
+        size_t bufferGrowths = 0;
+        // Buffers released because they exceeded the retained limits
+        size_t bufferTrims = 0;
+        // Transactions deleted because the pool was full
+        size_t discards = 0;
+    };
+    
+    static constexpr size_t maxRetainedInputs = 32;
+    static constexpr size_t maxRetainedOutputs = 32;
+    static constexpr size_t maxRetainedWitnessItems = 16;
+    
+    explicit TransactionPool(size_t maxPooled = 10000);
+    TransactionPool(const TransactionPool &) = delete;
+    TransactionPool &operator=(const TransactionPool &) = delete;
+    ~TransactionPool();
+    
+    // Sets tx to a pooled transaction and returns true, or allocates a new one and returns false
+    bool acquire(RawTransaction *&tx);
+    
+    // Only transactions handed out by acquire may be released
+    void release(RawTransaction *tx);
+    
+    Stats stats() const;
+    
+private:
+    struct Entry;
+    
+    mutable std::mutex m;
+    std::vector<Entry *> pooled;
+    size_t maxPooled;
+    Stats counts;
+};
+
+#endif /* transaction_pool_hpp */
@@ -0,0 +1,149 @@
+//
+//  undo_journal.cpp
+//  blocksci_parser
+//
+
+#include "undo_journal.hpp"
+#include "address_state.hpp"
+#include "parser_configuration.hpp"
+#include "preproccessed_block.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <iostream>
+#include <string>
+
+namespace {
+    struct BlockUndoHeader {
+        uint32_t firstTxNum;
+        uint32_t spentOutputCount;
+        uint32_t addressKeyCount;
+        std::array<uint32_t, blocksci::DedupAddressType::size> scriptCounts;
+    };
+    
+    boost::filesystem::path undoFilePath(const boost::filesystem::path &directory, blocksci::BlockHeight height) {
+        return directory/(std::to_string(height) + ".dat");
+    }
+}
+
+void BlockUndo::write(const boost::filesystem::path &path) const {
+    BlockUndoHeader header{firstTxNum, static_cast<uint32_t>(spentOutputs.size()), static_cast<uint32_t>(addressKeys.size()), scriptCounts};
+    // Written under a temporary name so a crash never leaves a partial record behind
+    auto tempPath = boost::filesystem::path(path).concat(".tmp");
+    {
+        boost::filesystem::ofstream file(tempPath, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(spentOutputs.data()), static_cast<std::streamsize>(spentOutputs.size() * sizeof(blocksci::OutputPointer)));
+        file.write(reinterpret_cast<const char *>(addressKeys.data()), static_cast<std::streamsize>(addressKeys.size() * sizeof(HashIndexKey)));
+        if (!file) {
+            throw std::runtime_error("Failed to write undo record " + path.native());
+        }
+    }
+    boost::filesystem::rename(tempPath, path);
+}
+
+bool BlockUndo::read(const boost::filesystem::path &path) {
+    boost::filesystem::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    BlockUndoHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        return false;
+    }
+    auto expectedSize = sizeof(header) + header.spentOutputCount * sizeof(blocksci::OutputPointer) + header.addressKeyCount * sizeof(HashIndexKey);
+    if (boost::filesystem::file_size(path) != expectedSize) {
+        return false;
+    }
+    firstTxNum = header.firstTxNum;
+    scriptCounts = header.scriptCounts;
+    spentOutputs.resize(header.spentOutputCount);
+    addressKeys.resize(header.addressKeyCount);
+    file.read(reinterpret_cast<char *>(spentOutputs.data()), static_cast<std::streamsize>(spentOutputs.size() * sizeof(blocksci::OutputPointer)));
+    file.read(reinterpret_cast<char *>(addressKeys.data()), static_cast<std::streamsize>(addressKeys.size() * sizeof(HashIndexKey)));
+    return static_cast<bool>(file);
+}
+
+constexpr blocksci::BlockHeight UndoJournalWriter::journalDepth;
+
+UndoJournalWriter::UndoJournalWriter(const ParserConfigurationBase &config, AddressState &addressState_) : directory(config.undoJournalDirectory()), addressState(addressState_) {
+    boost::filesystem::create_directories(directory);
+    // Records a previous run was still writing when it stopped
+    std::vector<boost::filesystem::path> partialRecords;
+    for (auto &entry : boost::filesystem::directory_iterator(directory)) {
+        if (entry.path().extension() == ".tmp") {
+            partialRecords.push_back(entry.path());
+        }
+    }
+    for (auto &path : partialRecords) {
+        boost::filesystem::remove(path);
+    }
+    addressState.recordHashIndexKeys(&current.addressKeys);
+}
+
+UndoJournalWriter::~UndoJournalWriter() {
+    // Only reached without close when parsing already failed, so that error is the one worth reporting
+    try {
+        close();
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to write undo journal: " << e.what() << std::endl;
+    }
+}
+
+void UndoJournalWriter::close() {
+    addressState.recordHashIndexKeys(nullptr);
+    if (hasBlock) {
+        hasBlock = false;
+        writeBlock();
+    }
+}
+
+void UndoJournalWriter::writeBlock() {
+    current.write(undoFilePath(directory, currentHeight));
+    boost::system::error_code ec;
+    boost::filesystem::remove(undoFilePath(directory, currentHeight - journalDepth), ec);
+    current.spentOutputs.clear();
+    current.addressKeys.clear();
+}
+
+void UndoJournalWriter::addTx(const RawTransaction &tx) {
+    if (!hasBlock || tx.blockHeight != currentHeight) {
+        if (hasBlock) {
+            writeBlock();
+        }
+        hasBlock = true;
+        currentHeight = tx.blockHeight;
+        current.firstTxNum = tx.txNum;
+        auto &scriptCounts = addressState.getScriptCounts();
+        std::copy(scriptCounts.begin(), scriptCounts.end(), current.scriptCounts.begin());
+    }
+    for (auto &input : tx.inputs) {
+        current.spentOutputs.push_back(input.getOutputPointer());
+    }
+}
+
+bool loadUndoJournal(const ParserConfigurationBase &config, blocksci::BlockHeight firstBlock, blocksci::BlockHeight blockCount, std::vector<BlockUndo> &undos) {
+    undos.clear();
+    for (auto height = firstBlock; height < blockCount; height++) {
+        undos.emplace_back();
+        if (!undos.back().read(undoFilePath(config.undoJournalDirectory(), height))) {
+            undos.clear();
+            return false;
+        }
+    }
+    return !undos.empty();
+}
+
+void truncateUndoJournal(const ParserConfigurationBase &config, blocksci::BlockHeight firstBlock) {
+    auto directory = config.undoJournalDirectory();
+    if (!boost::filesystem::exists(directory)) {
+        return;
+    }
+    for (auto &entry : boost::filesystem::directory_iterator(directory)) {
+        auto &path = entry.path();
+        if (path.extension() == ".dat" && std::stoi(path.stem().native()) >= firstBlock) {
+            boost::filesystem::remove(path);
+        }
+    }
+}
@@ -0,0 +1,82 @@
+//
+//  undo_journal.hpp
+//  blocksci_parser
+//
+
+#ifndef undo_journal_hpp
+#define undo_journal_hpp
+
+#include "parser_fwd.hpp"
+
+#include <blocksci/address/address_info.hpp>
+#include <blocksci/address/dedup_address_type.hpp>
+#include <blocksci/chain/chain_fwd.hpp>
+#include <blocksci/chain/inout_pointer.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+// Key the address state added to the hash index for a new address
+struct HashIndexKey {
+    blocksci::AddressType::Enum column;
+    uint32_t size;
+    std::array<char, 32> data;
+};
+
+template <blocksci::AddressType::Enum type>
+HashIndexKey makeHashIndexKey(const typename blocksci::AddressInfo<type>::IDType &hash) {
+    static_assert(sizeof(hash) <= sizeof(HashIndexKey::data), "Hash index keys are at most 32 bytes");
+    HashIndexKey key{type, sizeof(hash), {}};
+    memcpy(key.data.data(), &hash, sizeof(hash));
+    return key;
+}
+
+// Everything needed to roll back a block that can't be recovered cheaply from the chain data itself
+struct BlockUndo {
+    uint32_t firstTxNum = 0;
+    // Address state script counts before the block was added
+    std::array<uint32_t, blocksci::DedupAddressType::size> scriptCounts;
+    // Outputs spent by the block's inputs in the order of the inputs
+    std::vector<blocksci::OutputPointer> spentOutputs;
+    std::vector<HashIndexKey> addressKeys;
+    
+    void write(const boost::filesystem::path &path) const;
+    bool read(const boost::filesystem::path &path);
+};
+
+// Records a BlockUndo for every block as it is parsed. Only the records for the last journalDepth blocks are
+// kept so reorgs deeper than that fall back to scanning the full state.
+class UndoJournalWriter {
+    boost::filesystem::path directory;
+    AddressState &addressState;
+    BlockUndo current;
+    blocksci::BlockHeight currentHeight = 0;
+    bool hasBlock = false;
+    
+    void writeBlock();
+
+public:
+    static constexpr blocksci::BlockHeight journalDepth = 100;
+    
+    UndoJournalWriter(const ParserConfigurationBase &config, AddressState &addressState);
+    UndoJournalWriter(const UndoJournalWriter &) = delete;
+    UndoJournalWriter &operator=(const UndoJournalWriter &) = delete;
+    ~UndoJournalWriter();
+    
+    // Must see every transaction in order right before its addresses are processed
+    void addTx(const RawTransaction &tx);
+    
+    // Writes the record of the last block and throws if it can't
+    void close();
+};
+
+// Loads the records for the blocks in [firstBlock, blockCount). Returns false unless every one of them was found
+bool loadUndoJournal(const ParserConfigurationBase &config, blocksci::BlockHeight firstBlock, blocksci::BlockHeight blockCount, std::vector<BlockUndo> &undos);
+
+// Drops the records for blocks at or above firstBlock
+void truncateUndoJournal(const ParserConfigurationBase &config, blocksci::BlockHeight firstBlock);
+
+#endif /* undo_journal_hpp */
@@ -7,3 +7,615 @@
 //
 
 #include "utxo_state.hpp"
+#include "parser_configuration.hpp"
+#include "parser_checkpoint.hpp"
+
+#include <blocksci/util/file_mapper.hpp>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+
+namespace {
+    // Layout of the parser state before UTXOState kept both values and script numbers, only read to
+    // migrate existing data directories
+    class LegacyUTXOState : public SerializableMap<RawOutputPointer, UTXO> {
+    public:
+        LegacyUTXOState() : SerializableMap<RawOutputPointer, UTXO>({blocksci::uint256{}, 0}, {blocksci::uint256{}, 1}) {}
+    };
+    
+    class LegacyUTXOScriptState : public SerializableMap<blocksci::OutputPointer, uint32_t> {
+    public:
+        LegacyUTXOScriptState() : SerializableMap<blocksci::OutputPointer, uint32_t>({std::numeric_limits<uint32_t>::max(), 0}, {std::numeric_limits<uint32_t>::max(), 1}) {}
+    };
+    
+    // Entry layout of the serialized utxoSet.dat file which preceded the mapped table
+    struct SerializedUTXO {
+        RawOutputPointer pointer;
+        UTXO utxo;
+        uint32_t scriptNum;
+    };
+    
+    struct SlotsHeader {
+        uint64_t magic;
+        uint32_t checkpoint;
+        uint32_t clean;
+        uint64_t slotCount;
+        uint64_t freeCount;
+    };
+    
+    constexpr uint32_t emptySlot = std::numeric_limits<uint32_t>::max();
+    constexpr uint32_t deletedSlot = emptySlot - 1;
+    constexpr uint64_t indexMagic = 0x5554584f494e4458; // UTXOINDX
+    constexpr uint64_t slotsMagic = 0x5554584f534c4f54; // UTXOSLOT
+    constexpr uint64_t initialCapacity = uint64_t{1} << 16;
+    
+    boost::iostreams::mapped_file mapFile(const boost::filesystem::path &path, size_t offset, size_t length) {
+        boost::iostreams::mapped_file_params params{path.native()};
+        params.flags = boost::iostreams::mapped_file::readwrite;
+        params.offset = static_cast<decltype(params.offset)>(offset);
+        params.length = length;
+        return boost::iostreams::mapped_file{params};
+    }
+    
+    void syncMapping(char *data, size_t length) {
+        if (::msync(data, length, MS_SYNC) != 0) {
+            throw std::runtime_error("Failed to flush UTXO state to disk");
+        }
+    }
+}
+
+struct UTXOState::IndexHeader {
+    uint64_t magic;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t deletedCount;
+    uint64_t dirty;
+};
+
+struct UTXOState::IndexEntry {
+    RawOutputPointer pointer;
+    uint32_t slot;
+};
+
+constexpr uint32_t UTXOState::duplicateSlot;
+constexpr uint32_t UTXOState::shardCount;
+constexpr uint32_t UTXOState::chunkSize;
+
+uint32_t UTXOState::shardOf(const RawOutputPointer &pointer) {
+    // Positions within a shard come from the low bits of the same hash
+    auto hash = std::hash<RawOutputPointer>{}(pointer);
+    return static_cast<uint32_t>(hash >> (sizeof(hash) * 8 - shardBits));
+}
+
+void UTXOState::IndexShard::map(boost::iostreams::mapped_file newFile) {
+    file = newFile;
+    header = reinterpret_cast<IndexHeader *>(file.data());
+    entries = reinterpret_cast<IndexEntry *>(file.data() + sizeof(IndexHeader));
+}
+
+// New tables are dirty until their entries are part of a recorded checkpoint
+void UTXOState::IndexShard::create(const boost::filesystem::path &filePath, uint64_t capacity) {
+    boost::iostreams::mapped_file_params params{filePath.native()};
+    params.flags = boost::iostreams::mapped_file::readwrite;
+    params.new_file_size = static_cast<decltype(params.new_file_size)>(sizeof(IndexHeader) + capacity * sizeof(IndexEntry));
+    map(boost::iostreams::mapped_file{params});
+    *header = IndexHeader{indexMagic, capacity, 0, 0, 1};
+    for (uint64_t i = 0; i < capacity; i++) {
+        entries[i].slot = emptySlot;
+    }
+    changed = true;
+}
+
+bool UTXOState::IndexShard::open(const boost::filesystem::path &filePath) {
+    path = filePath;
+    // A rebuild that was interrupted before it replaced the table
+    boost::filesystem::remove(boost::filesystem::path{path}.concat(".rebuild"));
+    if (!boost::filesystem::exists(path)) {
+        create(path, initialCapacity);
+        return false;
+    }
+    auto fileSize = static_cast<size_t>(boost::filesystem::file_size(path));
+    map(mapFile(path, 0, fileSize));
+    if (fileSize < sizeof(IndexHeader) || header->magic != indexMagic || fileSize != sizeof(IndexHeader) + header->capacity * sizeof(IndexEntry)) {
+        // Only the entries are lost, which are rebuilt from the records
+        unmap();
+        boost::filesystem::remove(path);
+        create(path, initialCapacity);
+        return false;
+    }
+    changed = header->dirty != 0;
+    return !changed;
+}
+
+void UTXOState::IndexShard::markChanged() {
+    changed = true;
+    header->dirty = 1;
+    syncMapping(file.data(), sizeof(IndexHeader));
+}
+
+void UTXOState::IndexShard::checkpointRecorded() {
+    if (changed) {
+        header->dirty = 0;
+        syncMapping(file.data(), sizeof(IndexHeader));
+        changed = false;
+    }
+}
+
+void UTXOState::IndexShard::unmap() {
+    header = nullptr;
+    entries = nullptr;
+    if (file.is_open()) {
+        file.close();
+    }
+}
+
+void UTXOState::IndexShard::clear() {
+    for (uint64_t i = 0; i < header->capacity; i++) {
+        entries[i].slot = emptySlot;
+    }
+    header->count = 0;
+    header->deletedCount = 0;
+}
+
+void UTXOState::IndexShard::sync() {
+    syncMapping(file.data(), file.size());
+}
+
+uint64_t UTXOState::IndexShard::size() const {
+    return header ? header->count : 0;
+}
+
+bool UTXOState::IndexShard::insert(const RawOutputPointer &pointer, uint32_t slot) {
+    if (!changed) {
+        markChanged();
+    }
+    if ((header->count + header->deletedCount + 1) * 10 > header->capacity * 7) {
+        // Tables that are mostly deleted entries are rebuilt at the same size
+        auto capacity = header->capacity;
+        if ((header->count + 1) * 10 > capacity * 3) {
+            capacity *= 2;
+        }
+        rebuild(capacity);
+    }
+    
+    auto mask = header->capacity - 1;
+    auto pos = std::hash<RawOutputPointer>{}(pointer) & mask;
+    IndexEntry *target = nullptr;
+    while (true) {
+        auto &entry = entries[pos];
+        if (entry.slot == emptySlot) {
+            break;
+        }
+        if (entry.slot == deletedSlot) {
+            if (!target) {
+                target = &entry;
+            }
+        } else if (entry.pointer == pointer) {
+            // Duplicate transactions (BIP 30) keep the original output like the previous hash map did
+            return false;
+        }
+        pos = (pos + 1) & mask;
+    }
+    if (target) {
+        header->deletedCount--;
+    } else {
+        target = &entries[pos];
+    }
+    target->pointer = pointer;
+    target->slot = slot;
+    header->count++;
+    return true;
+}
+
+uint32_t UTXOState::IndexShard::remove(const RawOutputPointer &pointer) {
+    if (!changed) {
+        markChanged();
+    }
+    auto mask = header->capacity - 1;
+    auto pos = std::hash<RawOutputPointer>{}(pointer) & mask;
+    while (true) {
+        auto &entry = entries[pos];
+        if (entry.slot == emptySlot) {
+            throw MissingOutputException();
+        }
+        if (entry.slot != deletedSlot && entry.pointer == pointer) {
+            auto slot = entry.slot;
+            entry.slot = deletedSlot;
+            header->count--;
+            header->deletedCount++;
+            return slot;
+        }
+        pos = (pos + 1) & mask;
+    }
+}
+
+void UTXOState::IndexShard::rebuild(uint64_t capacity) {
+    auto rebuildPath = boost::filesystem::path{path}.concat(".rebuild");
+    auto oldFile = file;
+    auto oldHeader = *header;
+    auto oldEntries = entries;
+    
+    create(rebuildPath, capacity);
+    for (uint64_t i = 0; i < oldHeader.capacity; i++) {
+        auto &entry = oldEntries[i];
+        if (entry.slot != emptySlot && entry.slot != deletedSlot) {
+            insert(entry.pointer, entry.slot);
+        }
+    }
+    oldFile.close();
+    boost::filesystem::rename(rebuildPath, path);
+}
+
+UTXOState::UTXOState() {
+    for (auto &chunk : chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+    chunkFiles.reserve(maxChunks);
+}
+
+UTXOState::~UTXOState() {
+    // A state that was not closed stays marked dirty
+    unmap();
+}
+
+size_t UTXOState::size() const {
+    size_t count = 0;
+    for (auto &shard : shards) {
+        count += shard.size();
+    }
+    return count;
+}
+
+void UTXOState::unmap() {
+    isOpen = false;
+    for (auto &shard : shards) {
+        shard.unmap();
+    }
+    for (auto &chunk : chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+    chunkFiles.clear();
+    slotCount = 0;
+    freeSlots.clear();
+    releasedSlots.clear();
+    returnedSlots.clear();
+}
+
+void UTXOState::mapChunk(uint32_t chunkNum) {
+    constexpr size_t chunkBytes = sizeof(UTXORecord) * chunkSize;
+    auto requiredSize = chunkBytes * (chunkNum + 1);
+    if (!boost::filesystem::exists(recordsPath)) {
+        std::ofstream{recordsPath.native(), std::ios::binary};
+    }
+    if (boost::filesystem::file_size(recordsPath) < requiredSize) {
+        boost::filesystem::resize_file(recordsPath, requiredSize);
+    }
+    chunkFiles.push_back(mapFile(recordsPath, chunkBytes * chunkNum, chunkBytes));
+    chunks[chunkNum].store(reinterpret_cast<UTXORecord *>(chunkFiles.back().data()), std::memory_order_release);
+}
+
+uint32_t UTXOState::allocateSlot() {
+    if (freeSlots.empty()) {
+        std::lock_guard<std::mutex> lock(returnedMutex);
+        freeSlots.swap(returnedSlots);
+    }
+    if (!freeSlots.empty()) {
+        auto slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+    auto slot = slotCount;
+    auto chunkNum = slot >> chunkBits;
+    if (chunkNum >= maxChunks) {
+        throw std::runtime_error("Too many unspent outputs");
+    }
+    if (chunks[chunkNum].load(std::memory_order_relaxed) == nullptr) {
+        mapChunk(chunkNum);
+    }
+    slotCount++;
+    return slot;
+}
+
+uint32_t UTXOState::allocate(const RawOutputPointer &pointer, const UTXO &utxo) {
+    auto slot = allocateSlot();
+    record(slot) = {utxo, 0, pointer.outputNum, currentCheckpoint, 0};
+    return slot;
+}
+
+bool UTXOState::insert(uint32_t shard, const RawOutputPointer &pointer, uint32_t slot) {
+    if (shards[shard].insert(pointer, slot)) {
+        return true;
+    }
+    // The slot never held an unspent output, so it can be reused right away. This may be called from any
+    // thread, which is why it goes back through the mutex
+    record(slot).createdIn = 0;
+    std::lock_guard<std::mutex> lock(returnedMutex);
+    returnedSlots.push_back(slot);
+    return false;
+}
+
+uint32_t UTXOState::add(const RawOutputPointer &pointer, const UTXO &utxo) {
+    auto slot = allocate(pointer, utxo);
+    if (!insert(shardOf(pointer), pointer, slot)) {
+        return duplicateSlot;
+    }
+    return slot;
+}
+
+uint32_t UTXOState::spend(const RawOutputPointer &pointer, UTXO &utxo) {
+    auto slot = remove(shardOf(pointer), pointer);
+    utxo = getUTXO(slot);
+    return slot;
+}
+
+uint32_t UTXOState::release(uint32_t slot) {
+    auto &item = record(slot);
+    item.spentIn = currentCheckpoint;
+    releasedSlots.push_back(slot);
+    return item.scriptNum;
+}
+
+void UTXOState::add(const RawOutputPointer &pointer, const UTXO &utxo, uint32_t scriptNum) {
+    auto slot = add(pointer, utxo);
+    if (slot != duplicateSlot) {
+        setScriptNum(slot, scriptNum);
+    }
+}
+
+void UTXOState::erase(const RawOutputPointer &pointer) {
+    UTXO utxo;
+    release(spend(pointer, utxo));
+}
+
+void UTXOState::importSerialized(const ParserConfigurationBase &config) {
+    std::ifstream file{config.utxoSetFilePath().native(), std::ios::binary};
+    uint64_t count = 0;
+    file.read(reinterpret_cast<char *>(&count), sizeof(count));
+    SerializedUTXO entry;
+    for (uint64_t i = 0; i < count; i++) {
+        if (!file.read(reinterpret_cast<char *>(&entry), sizeof(entry))) {
+            throw std::runtime_error("Unexpected end of UTXO state file");
+        }
+        add(entry.pointer, entry.utxo, entry.scriptNum);
+    }
+}
+
+void UTXOState::importLegacy(const ParserConfigurationBase &config) {
+    LegacyUTXOState legacyState;
+    LegacyUTXOScriptState legacyScriptState;
+    legacyState.unserialize(config.utxoCacheFile().native());
+    legacyScriptState.unserialize(config.utxoScriptStatePath().native());
+    for (auto &entry : legacyState) {
+        auto scriptIt = legacyScriptState.find({entry.second.txNum, entry.first.outputNum});
+        if (scriptIt == legacyScriptState.end()) {
+            throw std::runtime_error("Legacy UTXO state is missing a script number");
+        }
+        add(entry.first, entry.second, scriptIt->second);
+    }
+}
+
+void UTXOState::syncRecords() {
+    for (auto &chunkFile : chunkFiles) {
+        syncMapping(chunkFile.data(), chunkFile.size());
+    }
+}
+
+bool UTXOState::readSlots() {
+    std::ifstream slotsFile{slotsPath.native(), std::ios::binary};
+    SlotsHeader header;
+    if (!slotsFile.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        return false;
+    }
+    if (header.magic != slotsMagic || !header.clean || header.checkpoint != recordedCheckpoint) {
+        return false;
+    }
+    slotCount = static_cast<uint32_t>(header.slotCount);
+    freeSlots.resize(header.freeCount);
+    slotsFile.read(reinterpret_cast<char *>(freeSlots.data()), static_cast<std::streamsize>(header.freeCount * sizeof(uint32_t)));
+    if (!slotsFile) {
+        slotCount = 0;
+        freeSlots.clear();
+        return false;
+    }
+    return true;
+}
+
+void UTXOState::writeSlots() {
+    auto tmpPath = boost::filesystem::path{slotsPath}.concat(".tmp");
+    {
+        std::ofstream slotsFile{tmpPath.native(), std::ios::binary};
+        SlotsHeader header{slotsMagic, recordedCheckpoint, 1, slotCount, freeSlots.size()};
+        slotsFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        slotsFile.write(reinterpret_cast<const char *>(freeSlots.data()), static_cast<std::streamsize>(freeSlots.size() * sizeof(uint32_t)));
+        if (!slotsFile.flush()) {
+            throw std::runtime_error("Failed to write " + tmpPath.string());
+        }
+    }
+    syncFile(tmpPath);
+    boost::filesystem::rename(tmpPath, slotsPath);
+    syncFile(slotsPath.parent_path());
+}
+
+// The cleared flag has to be on disk before anything else changes
+void UTXOState::markSlotsDirty() {
+    int fd = ::open(slotsPath.c_str(), O_WRONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Could not open " + slotsPath.string());
+    }
+    uint32_t clean = 0;
+    auto written = ::pwrite(fd, &clean, sizeof(clean), offsetof(SlotsHeader, clean));
+    auto synced = ::fdatasync(fd);
+    ::close(fd);
+    if (written != static_cast<ssize_t>(sizeof(clean)) || synced != 0) {
+        throw std::runtime_error("Failed to mark " + slotsPath.string() + " as in use");
+    }
+}
+
+// Brings the arena back to the recorded checkpoint and rebuilds the free list and the dirty index shards from
+// it. Records added since then are freed and records spent since then are unspent again. The outpoint of each
+// record is rebuilt from the hash of its transaction, which is on disk for every output of the recorded
+// checkpoint. Shards that did not change since the checkpoint still hold it and are kept.
+void UTXOState::recover(const ParserConfigurationBase &config, const std::array<bool, shardCount> &dirtyShards) {
+    auto dirtyCount = std::count(dirtyShards.begin(), dirtyShards.end(), true);
+    std::cout << "UTXO state was not closed cleanly, restoring checkpoint " << recordedCheckpoint << " and rebuilding " << dirtyCount << " of " << shardCount << " index shards" << std::endl;
+    
+    constexpr size_t chunkBytes = sizeof(UTXORecord) * chunkSize;
+    auto recordsSize = boost::filesystem::exists(recordsPath) ? boost::filesystem::file_size(recordsPath) : 0;
+    auto chunkCount = static_cast<uint32_t>(std::min<uintmax_t>(recordsSize / chunkBytes, maxChunks));
+    for (uint32_t i = 0; i < chunkCount; i++) {
+        mapChunk(i);
+    }
+    for (uint32_t i = 0; i < shardCount; i++) {
+        if (dirtyShards[i]) {
+            shards[i].clear();
+        }
+    }
+    
+    const blocksci::FixedSizeFileMapper<blocksci::uint256> txHashesFile(config.txHashesFilePath());
+    auto isLive = [](const UTXORecord &item) {
+        return item.createdIn != 0 && item.spentIn == 0;
+    };
+    uint64_t totalSlots = uint64_t{chunkCount} * chunkSize;
+    slotCount = 0;
+    for (uint64_t slot = 0; slot < totalSlots; slot++) {
+        auto &item = record(static_cast<uint32_t>(slot));
+        if (item.createdIn > recordedCheckpoint) {
+            item.createdIn = 0;
+        } else if (item.spentIn > recordedCheckpoint) {
+            item.spentIn = 0;
+        }
+        if (isLive(item)) {
+            if (item.utxo.txNum >= txHashesFile.size()) {
+                throw std::runtime_error("UTXO record refers to a missing transaction");
+            }
+            RawOutputPointer pointer{*txHashesFile.getData(item.utxo.txNum), item.outputNum};
+            auto shard = shardOf(pointer);
+            if (dirtyShards[shard] && !shards[shard].insert(pointer, static_cast<uint32_t>(slot))) {
+                throw std::runtime_error("UTXO records contain an output twice");
+            }
+            slotCount = static_cast<uint32_t>(slot + 1);
+        }
+    }
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        if (!isLive(record(slot))) {
+            freeSlots.push_back(slot);
+        }
+    }
+    
+    // The restored state is the recorded checkpoint again
+    prepareCheckpoint();
+    for (auto &shard : shards) {
+        shard.checkpointRecorded();
+    }
+    std::cout << "Restored " << size() << " unspent outputs" << std::endl;
+}
+
+void UTXOState::open(const ParserConfigurationBase &config) {
+    unmap();
+    auto indexDirectory = config.utxoIndexDirectory();
+    recordsPath = config.utxoRecordsFilePath();
+    slotsPath = config.utxoSlotsFilePath();
+    
+    ParserCheckpoint checkpoint;
+    recordedCheckpoint = ParserCheckpoint::load(config, checkpoint) ? checkpoint.utxoCheckpoint : 0;
+    currentCheckpoint = recordedCheckpoint + 1;
+    
+    // Nothing of a state without a recorded checkpoint can be trusted, so it is created again
+    bool newState = recordedCheckpoint == 0;
+    if (newState) {
+        boost::filesystem::remove_all(indexDirectory);
+        boost::filesystem::remove(recordsPath);
+        boost::filesystem::remove(slotsPath);
+    }
+    boost::filesystem::create_directories(indexDirectory);
+    
+    bool clean = !newState && readSlots();
+    std::array<bool, shardCount> dirtyShards;
+    for (uint32_t i = 0; i < shardCount; i++) {
+        dirtyShards[i] = !shards[i].open(indexDirectory/(std::to_string(i) + ".dat"));
+        clean = clean && !dirtyShards[i];
+    }
+    isOpen = true;
+    
+    if (newState) {
+        if (boost::filesystem::exists(config.utxoSetFilePath())) {
+            importSerialized(config);
+            importedPaths = {config.utxoSetFilePath()};
+        } else if (boost::filesystem::exists(config.utxoCacheFile())) {
+            importLegacy(config);
+            importedPaths = {config.utxoCacheFile(), config.utxoScriptStatePath()};
+        }
+        return;
+    }
+    
+    if (clean) {
+        uint32_t chunkCount = (slotCount + chunkSize - 1) >> chunkBits;
+        for (uint32_t i = 0; i < chunkCount; i++) {
+            mapChunk(i);
+        }
+        markSlotsDirty();
+    } else {
+        // A missing slots file marks the state dirty until it is closed again
+        boost::filesystem::remove(slotsPath);
+        slotCount = 0;
+        freeSlots.clear();
+        recover(config, dirtyShards);
+    }
+}
+
+uint32_t UTXOState::prepareCheckpoint() {
+    syncRecords();
+    for (auto &shard : shards) {
+        shard.sync();
+    }
+    return currentCheckpoint;
+}
+
+void UTXOState::checkpointRecorded() {
+    recordedCheckpoint = currentCheckpoint;
+    currentCheckpoint++;
+    // Records spent before the recorded checkpoint are no longer needed to restore it
+    freeSlots.insert(freeSlots.end(), releasedSlots.begin(), releasedSlots.end());
+    releasedSlots.clear();
+    for (auto &shard : shards) {
+        shard.checkpointRecorded();
+    }
+    
+    // Imported files are only removed once their outputs are part of a recorded checkpoint
+    for (auto &path : importedPaths) {
+        boost::filesystem::remove(path);
+    }
+    importedPaths.clear();
+}
+
+void UTXOState::close() {
+    if (!isOpen) {
+        return;
+    }
+    bool changed = !releasedSlots.empty();
+    for (auto &shard : shards) {
+        changed = changed || shard.isChanged();
+    }
+    if (changed) {
+        // Changes that were never recorded are rolled back by the next open
+        unmap();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(returnedMutex);
+        freeSlots.insert(freeSlots.end(), returnedSlots.begin(), returnedSlots.end());
+        returnedSlots.clear();
+    }
+    // Unchanged shards are already marked clean, so only the records have to be flushed before the slots file
+    syncRecords();
+    writeSlots();
+    unmap();
+}
@@ -9,21 +9,193 @@
 #ifndef utxo_state_hpp
 #define utxo_state_hpp
 
+#include "parser_fwd.hpp"
 #include "serializable_map.hpp"
 #include "basic_types.hpp"
 #include "utxo.hpp"
 
 #include <blocksci/chain/inout_pointer.hpp>
 
-class UTXOState : public SerializableMap<RawOutputPointer, UTXO> {
-public:
-    UTXOState() : SerializableMap<RawOutputPointer, UTXO>({blocksci::uint256{}, 0}, {blocksci::uint256{}, 1}) {}
+#include <boost/filesystem/path.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <array>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+struct UTXORecord {
+    UTXO utxo;
+    uint32_t scriptNum;
+    uint16_t outputNum;
+    // Checkpoints in which the output was added and spent. createdIn is 0 for a free slot and spentIn is 0
+    // while the output is unspent
+    uint32_t createdIn;
+    uint32_t spentIn;
 };
 
-class UTXOScriptState : public SerializableMap<blocksci::OutputPointer, uint32_t> {
+// Every unspent output is stored once as a UTXORecord in a slot of a chunked arena whose addresses never
+// change, and the hash index only maps an outpoint to its slot.
+//
+// connectUTXOs resolves each input to the slot of the output it spends and removes the outpoint from the
+// index. recordAddresses runs later on another thread. It reads the spent output's script number straight
+// from that slot and then releases it. Outputs are given a slot by connectUTXOs and receive their script
+// number in recordAddresses. Slots are only allocated by the connecting thread and only released by the
+// recording thread.
+//
+// The index is split into shardCount shards by outpoint hash so the lookups of one batch can be spread
+// over several threads. Shards are independent, and each one may be used by a single thread at a time.
+//
+// Both the arena and the index shards live in memory mapped files in the parser directory and are updated
+// in place. Opening the state only maps the files, and the page cache decides how much of it stays
+// resident. Each shard is an open addressing table with linear probing which is rebuilt into a new file
+// when it fills up.
+//
+// Changes are grouped into numbered checkpoints. prepareCheckpoint flushes the mapped files and, once the
+// parser has recorded the number in its ParserCheckpoint, checkpointRecorded starts the next one. Records
+// carry the checkpoint that added and spent them, and a released slot is only reused after the checkpoint
+// that spent it was recorded, so the arena always still holds the state of the last recorded checkpoint.
+// The slots file is marked clean by close and dirty again by open, and each shard marks itself dirty before
+// its first change after a checkpoint. Opening a state that was not closed cleanly restores the recorded
+// checkpoint by scanning the arena and rebuilding only the dirty shards from it.
+class UTXOState {
 public:
-    UTXOScriptState() : SerializableMap<blocksci::OutputPointer, uint32_t>({std::numeric_limits<uint32_t>::max(), 0}, {std::numeric_limits<uint32_t>::max(), 1}) {}
-};
+    struct MissingOutputException : public std::runtime_error {
+        MissingOutputException() : std::runtime_error("Tried to spend missing output") {}
+    };
+    
+    // Slot of an output whose outpoint is already unspent, as for the duplicate transactions of BIP 30
+    static constexpr uint32_t duplicateSlot = std::numeric_limits<uint32_t>::max();
+    
+    static constexpr uint32_t shardBits = 4;
+    static constexpr uint32_t shardCount = uint32_t{1} << shardBits;
+    
+    static uint32_t shardOf(const RawOutputPointer &pointer);
+    
+    UTXOState();
+    UTXOState(const UTXOState &) = delete;
+    UTXOState &operator=(const UTXOState &) = delete;
+    ~UTXOState();
+    
+    // Connecting thread. Returns duplicateSlot if the outpoint is already unspent
+    uint32_t add(const RawOutputPointer &pointer, const UTXO &utxo);
+    uint32_t spend(const RawOutputPointer &pointer, UTXO &utxo);
+    
+    // Connecting thread, split into the slot allocation and the index update so that the index of each
+    // shard can be updated from a different thread
+    uint32_t allocate(const RawOutputPointer &pointer, const UTXO &utxo);
+    // Gives the slot back and returns false if the outpoint is already unspent
+    bool insert(uint32_t shard, const RawOutputPointer &pointer, uint32_t slot);
+    uint32_t remove(uint32_t shard, const RawOutputPointer &pointer) {
+        return shards[shard].remove(pointer);
+    }
+    const UTXO &getUTXO(uint32_t slot) {
+        return record(slot).utxo;
+    }
+    
+    // Recording thread
+    void setScriptNum(uint32_t slot, uint32_t scriptNum) {
+        record(slot).scriptNum = scriptNum;
+    }
+    
+    // Marks the output spent and returns its script number
+    uint32_t release(uint32_t slot);
+    
+    // Only while no other thread uses the state
+    void add(const RawOutputPointer &pointer, const UTXO &utxo, uint32_t scriptNum);
+    void erase(const RawOutputPointer &pointer);
+    
+    size_t size() const;
+    
+    void open(const ParserConfigurationBase &config);
+    void close();
+    
+    // Only while no other thread uses the state. Flushes every change to disk and returns the number the
+    // parser must record before calling checkpointRecorded
+    uint32_t prepareCheckpoint();
+    void checkpointRecorded();
 
+private:
+    struct IndexHeader;
+    struct IndexEntry;
+    
+    class IndexShard {
+        boost::filesystem::path path;
+        boost::iostreams::mapped_file file;
+        IndexHeader *header = nullptr;
+        IndexEntry *entries = nullptr;
+        bool changed = false;
+        
+        void map(boost::iostreams::mapped_file newFile);
+        void create(const boost::filesystem::path &filePath, uint64_t capacity);
+        void rebuild(uint64_t capacity);
+        void markChanged();
+    
+    public:
+        // Returns false if the shard changed after the last recorded checkpoint and must be rebuilt
+        bool open(const boost::filesystem::path &filePath);
+        void unmap();
+        // Removes every entry but keeps the capacity
+        void clear();
+        void sync();
+        
+        // Whether the shard changed since the last checkpoint
+        bool isChanged() const {
+            return changed;
+        }
+        // Marks the shard clean again once its flushed entries are part of a recorded checkpoint
+        void checkpointRecorded();
+        
+        bool insert(const RawOutputPointer &pointer, uint32_t slot);
+        uint32_t remove(const RawOutputPointer &pointer);
+        uint64_t size() const;
+    };
+    
+    static constexpr uint32_t chunkBits = 20;
+    static constexpr uint32_t chunkSize = uint32_t{1} << chunkBits;
+    static constexpr uint32_t maxChunks = 4096;
+    static constexpr size_t releaseBatchSize = 4096;
+    
+    boost::filesystem::path recordsPath;
+    boost::filesystem::path slotsPath;
+    std::vector<boost::filesystem::path> importedPaths;
+    
+    std::array<IndexShard, shardCount> shards;
+    
+    std::vector<boost::iostreams::mapped_file> chunkFiles;
+    std::array<std::atomic<UTXORecord *>, maxChunks> chunks;
+    
+    // Owned by the connecting thread
+    uint32_t slotCount = 0;
+    std::vector<uint32_t> freeSlots;
+    
+    // Owned by the recording thread, free once the checkpoint that spent them is recorded
+    std::vector<uint32_t> releasedSlots;
+    
+    // Slots of duplicate outputs, which never held an unspent output and can be reused right away
+    std::mutex returnedMutex;
+    std::vector<uint32_t> returnedSlots;
+    
+    uint32_t recordedCheckpoint = 0;
+    uint32_t currentCheckpoint = 1;
+    
+    bool isOpen = false;
+    
+    UTXORecord &record(uint32_t slot) {
+        return chunks[slot >> chunkBits].load(std::memory_order_acquire)[slot & (chunkSize - 1)];
+    }
+    
+    void mapChunk(uint32_t chunkNum);
+    uint32_t allocateSlot();
+    void unmap();
+    void syncRecords();
+    bool readSlots();
+    void writeSlots();
+    void markSlotsDirty();
+    void recover(const ParserConfigurationBase &config, const std::array<bool, shardCount> &dirtyShards);
+    void importSerialized(const ParserConfigurationBase &config);
+    void importLegacy(const ParserConfigurationBase &config);
+};
 
 #endif /* utxo_state_hpp */
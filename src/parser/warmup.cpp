@@ -0,0 +1,355 @@
+//
+//  warmup.cpp
+//  blocksci_parser
+//
+
+#include "warmup.hpp"
+
+#include <blocksci/util/data_configuration.hpp>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    // Direct reads need buffers, offsets and lengths aligned to the logical block size of the device
+    constexpr size_t readAlignment = 4096;
+    
+    [[noreturn]] void throwFileError(const char *action, const boost::filesystem::path &path) {
+        std::stringstream ss;
+        ss << "Failed to " << action << " " << path << ": " << strerror(errno);
+        throw std::runtime_error(ss.str());
+    }
+    
+    // Changes on every boot, and with it the content of the page cache
+    std::string readBootId() {
+        std::ifstream file("/proc/sys/kernel/random/boot_id");
+        std::string bootId;
+        std::getline(file, bootId);
+        return bootId;
+    }
+    
+    struct WarmupTier {
+        std::string name;
+        std::vector<boost::filesystem::path> files;
+    };
+    
+    class WarmupTierBuilder {
+        std::set<boost::filesystem::path> claimed;
+    
+    public:
+        std::vector<WarmupTier> tiers;
+        
+        void addTier(const std::string &name) {
+            tiers.push_back({name, {}});
+        }
+        
+        void addFile(const boost::filesystem::path &path) {
+            if (boost::filesystem::is_regular_file(path) && claimed.insert(path).second) {
+                tiers.back().files.push_back(path);
+            }
+        }
+        
+        void addDirectory(const boost::filesystem::path &directory) {
+            if (!boost::filesystem::is_directory(directory)) {
+                return;
+            }
+            std::vector<boost::filesystem::path> paths;
+            for (auto &entry : boost::filesystem::recursive_directory_iterator(directory)) {
+                paths.push_back(entry.path());
+            }
+            std::sort(paths.begin(), paths.end());
+            for (auto &path : paths) {
+                addFile(path);
+            }
+        }
+    };
+    
+    std::vector<WarmupTier> findDataFiles(const blocksci::DataConfiguration &config) {
+        WarmupTierBuilder builder;
+        builder.addTier("tx");
+        builder.addFile(boost::filesystem::path{config.txFilePath()}.concat("_index.dat"));
+        builder.addFile(boost::filesystem::path{config.txFilePath()}.concat("_data.dat"));
+        builder.addFile(boost::filesystem::path{config.blockFilePath()}.concat(".dat"));
+        builder.addTier("scripts");
+        builder.addDirectory(config.scriptsDirectory());
+        builder.addTier("indexes");
+        builder.addDirectory(config.addressDBFilePath());
+        builder.addDirectory(config.hashIndexFilePath());
+        builder.addTier("chain");
+        builder.addDirectory(config.chainDirectory());
+        return builder.tiers;
+    }
+    
+    struct WarmupFile {
+        boost::filesystem::path path;
+        uint64_t size;
+        size_t tier;
+    };
+    
+    // Reads are handed out as fixed size chunks numbered across all files in tier order, so every thread
+    // works near the front of the same tier and tiers finish one after another
+    class WarmupReader {
+        std::vector<WarmupFile> files;
+        std::vector<uint64_t> firstChunks;
+        uint64_t chunkSize;
+        uint64_t totalChunks;
+        int openFlags;
+        boost::filesystem::path markerDirectory;
+        std::string bootId;
+        
+        std::atomic<uint64_t> nextChunk{0};
+        std::unique_ptr<std::atomic<uint64_t>[]> tierChunksLeft;
+        
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        std::atomic<bool> failed{false};
+        
+        std::mutex finishMutex;
+        std::condition_variable threadFinished;
+        size_t runningThreads = 0;
+        
+        void finishTier(size_t tier) {
+            // Direct reads bypass the page cache so the tier is no warmer than before
+            if (!(openFlags & O_DIRECT)) {
+                boost::filesystem::ofstream marker{markerDirectory/tierNames[tier]};
+                marker << bootId << "\n";
+            }
+            tiersFinished[tier] = true;
+        }
+        
+        uint64_t readChunk(int fd, const WarmupFile &file, uint64_t offset, char *buffer) {
+            auto length = std::min(chunkSize, file.size - offset);
+            auto requested = (openFlags & O_DIRECT) ? chunkSize : length;
+            uint64_t done = 0;
+            while (done < length) {
+                auto count = pread(fd, buffer + done, requested - done, static_cast<off_t>(offset + done));
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throwFileError("read", file.path);
+                }
+                if (count == 0) {
+                    // The file shrank since it was listed
+                    break;
+                }
+                done += static_cast<uint64_t>(count);
+            }
+            // A direct read of the last chunk may return more than the file had when it was listed
+            return std::min(done, length);
+        }
+        
+        void run() {
+            size_t openIndex = files.size();
+            int fd = -1;
+            try {
+                void *allocation = nullptr;
+                if (posix_memalign(&allocation, readAlignment, chunkSize) != 0) {
+                    throw std::bad_alloc();
+                }
+                std::unique_ptr<char, decltype(&free)> buffer(static_cast<char *>(allocation), &free);
+                
+                while (!failed) {
+                    auto chunk = nextChunk++;
+                    if (chunk >= totalChunks) {
+                        break;
+                    }
+                    auto fileIndex = static_cast<size_t>(std::upper_bound(firstChunks.begin(), firstChunks.end(), chunk) - firstChunks.begin()) - 1;
+                    auto &file = files[fileIndex];
+                    if (fileIndex != openIndex) {
+                        if (fd >= 0) {
+                            close(fd);
+                        }
+                        fd = open(file.path.c_str(), openFlags);
+                        if (fd < 0) {
+                            throwFileError("open", file.path);
+                        }
+                        openIndex = fileIndex;
+                    }
+                    bytesRead += readChunk(fd, file, (chunk - firstChunks[fileIndex]) * chunkSize, buffer.get());
+                    if (--tierChunksLeft[file.tier] == 0) {
+                        finishTier(file.tier);
+                    }
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+            
+            std::lock_guard<std::mutex> lock(finishMutex);
+            runningThreads--;
+            threadFinished.notify_all();
+        }
+    
+    public:
+        std::vector<std::string> tierNames;
+        std::unique_ptr<std::atomic<bool>[]> tiersFinished;
+        std::atomic<uint64_t> bytesRead{0};
+        uint64_t totalBytes = 0;
+        
+        WarmupReader(const std::vector<WarmupTier> &tiers, const boost::filesystem::path &markerDirectory_, const WarmupSettings &settings) : markerDirectory(markerDirectory_), bootId(readBootId()) {
+            chunkSize = std::max<uint64_t>(readAlignment, (uint64_t{settings.blockSizeKB} * 1024 + readAlignment - 1) / readAlignment * readAlignment);
+            openFlags = O_RDONLY | O_CLOEXEC | (settings.direct ? O_DIRECT : 0);
+            tierChunksLeft = std::make_unique<std::atomic<uint64_t>[]>(tiers.size());
+            tiersFinished = std::make_unique<std::atomic<bool>[]>(tiers.size());
+            totalChunks = 0;
+            for (size_t tier = 0; tier < tiers.size(); tier++) {
+                tierNames.push_back(tiers[tier].name);
+                uint64_t tierChunks = 0;
+                for (auto &path : tiers[tier].files) {
+                    auto size = boost::filesystem::file_size(path);
+                    if (size == 0) {
+                        continue;
+                    }
+                    files.push_back({path, size, tier});
+                    firstChunks.push_back(totalChunks);
+                    auto chunks = (size + chunkSize - 1) / chunkSize;
+                    totalChunks += chunks;
+                    tierChunks += chunks;
+                    totalBytes += size;
+                }
+                tierChunksLeft[tier] = tierChunks;
+                tiersFinished[tier] = false;
+            }
+        }
+        
+        void start(std::vector<std::thread> &threads, uint32_t threadCount) {
+            for (size_t tier = 0; tier < tierNames.size(); tier++) {
+                if (tierChunksLeft[tier] == 0) {
+                    finishTier(tier);
+                }
+            }
+            runningThreads = threadCount;
+            for (uint32_t i = 0; i < threadCount; i++) {
+                threads.emplace_back([this] { run(); });
+            }
+        }
+        
+        // Returns true once every thread has run out of chunks
+        bool waitForThreads(std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(finishMutex);
+            return threadFinished.wait_for(lock, timeout, [&] { return runningThreads == 0; });
+        }
+        
+        void rethrowError() {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    };
+    
+    double toGB(uint64_t bytes) {
+        return static_cast<double>(bytes) / (1ull << 30);
+    }
+    
+    // Maps the files and locks them in memory. Locked pages stay in the page cache, so queries from other
+    // processes find them resident for as long as this process holds them
+    uint64_t lockFiles(const std::vector<boost::filesystem::path> &paths) {
+        uint64_t lockedBytes = 0;
+        for (auto &path : paths) {
+            auto size = boost::filesystem::file_size(path);
+            if (size == 0) {
+                continue;
+            }
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                throwFileError("open", path);
+            }
+            auto data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (data == MAP_FAILED) {
+                throwFileError("map", path);
+            }
+            if (mlock(data, size) != 0) {
+                std::stringstream ss;
+                ss << "Failed to lock " << path << " in memory: " << strerror(errno) << ". The memlock limit (ulimit -l) must cover the transaction and block files";
+                throw std::runtime_error(ss.str());
+            }
+            lockedBytes += size;
+        }
+        return lockedBytes;
+    }
+}
+
+void warmupData(const blocksci::DataConfiguration &config, const WarmupSettings &settings) {
+    auto tiers = findDataFiles(config);
+    
+    auto markerDirectory = config.warmupDirectory();
+    boost::filesystem::remove_all(markerDirectory);
+    boost::filesystem::create_directories(markerDirectory);
+    
+    std::cout.setf(std::ios::fixed, std::ios::floatfield);
+    std::cout.precision(2);
+    
+    WarmupReader reader{tiers, markerDirectory, settings};
+    std::cout << "Reading " << toGB(reader.totalBytes) << " GB of data with " << settings.ioDepth << " reads in flight\n";
+    
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    reader.start(threads, std::max(settings.ioDepth, 1u));
+    
+    std::vector<bool> tiersReported(reader.tierNames.size(), false);
+    auto report = [&]() {
+        auto bytesRead = reader.bytesRead.load();
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        for (size_t tier = 0; tier < tiersReported.size(); tier++) {
+            if (!tiersReported[tier] && reader.tiersFinished[tier]) {
+                tiersReported[tier] = true;
+                std::cout << "\rFinished " << reader.tierNames[tier] << " files after " << seconds << " seconds" << std::string(40, ' ') << "\n";
+            }
+        }
+        auto percentDone = reader.totalBytes > 0 ? static_cast<double>(bytesRead) / static_cast<double>(reader.totalBytes) * 100 : 100.0;
+        std::cout << "\r" << percentDone << "% done, " << toGB(bytesRead) << "/" << toGB(reader.totalBytes) << " GB at " << (seconds > 0 ? toGB(bytesRead) / seconds : 0.0) << " GB/s" << std::flush;
+    };
+    
+    do {
+        report();
+    } while (!reader.waitForThreads(std::chrono::milliseconds(1000)));
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    report();
+    std::cout << "\n";
+    reader.rethrowError();
+    
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Read " << toGB(reader.bytesRead) << " GB in " << seconds << " seconds\n";
+    
+    if (settings.lockHotSet) {
+        auto lockedBytes = lockFiles(tiers.front().files);
+        std::cout << "Locked " << toGB(lockedBytes) << " GB of transaction and block data in memory until interrupted" << std::endl;
+        while (true) {
+            pause();
+        }
+    }
+}
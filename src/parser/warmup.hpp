@@ -0,0 +1,34 @@
+//
+//  warmup.hpp
+//  blocksci_parser
+//
+
+#ifndef warmup_hpp
+#define warmup_hpp
+
+#include <cstdint>
+
+namespace blocksci {
+    struct DataConfiguration;
+}
+
+struct WarmupSettings {
+    // Number of reads kept in flight at once, each issued by its own thread
+    uint32_t ioDepth = 32;
+    // Size of each read in KiB
+    uint32_t blockSizeKB = 128;
+    // Read around the page cache. Initializes a volume restored from a snapshot without filling memory
+    bool direct = false;
+    // Once everything has been read, keep the transaction and block files locked in memory until interrupted
+    bool lockHotSet = false;
+};
+
+// Reads every file of the parsed data once so later queries don't wait on a cold disk. Files are read in
+// tiers, most heavily queried first: transactions and blocks, script data, the address and hash indexes,
+// then the remaining chain files. A marker named after each tier is written to the warmup directory of the
+// data as soon as it has been read, which the Python module checks to tell users what is still cold. The page
+// cache doesn't survive a reboot, so each marker holds the boot ID it was written under. Direct reads leave
+// nothing in the cache and write no markers.
+void warmupData(const blocksci::DataConfiguration &config, const WarmupSettings &settings);
+
+#endif /* warmup_hpp */
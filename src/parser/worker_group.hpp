@@ -0,0 +1,122 @@
+//
+//  worker_group.hpp
+//  blocksci_parser
+//
+
+#ifndef worker_group_hpp
+#define worker_group_hpp
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads which repeatedly run the same kind of short job together. Unlike runOnThreads no
+// threads are started per job, which matters for stages that fan out once for every pipeline batch.
+// The calling thread takes part as worker 0 and the first exception thrown by any worker is rethrown
+// from run once every worker has finished.
+class WorkerGroup {
+    std::mutex m;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    std::function<void(size_t)> job;
+    std::exception_ptr error;
+    uint64_t generation = 0;
+    size_t runningCount = 0;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+    
+    void finishJob(std::exception_ptr jobError) {
+        std::lock_guard<std::mutex> lock(m);
+        if (jobError && !error) {
+            error = jobError;
+        }
+        runningCount--;
+        if (runningCount == 0) {
+            jobDone.notify_one();
+        }
+    }
+    
+    void workerLoop(size_t worker) {
+        uint64_t seenGeneration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                jobReady.wait(lock, [&]() {
+                    return stopping || generation != seenGeneration;
+                });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = generation;
+            }
+            std::exception_ptr jobError;
+            try {
+                job(worker);
+            } catch (...) {
+                jobError = std::current_exception();
+            }
+            finishJob(jobError);
+        }
+    }
+    
+public:
+    explicit WorkerGroup(size_t workerCount) {
+        for (size_t i = 1; i < std::max(workerCount, size_t{1}); i++) {
+            threads.emplace_back(&WorkerGroup::workerLoop, this, i);
+        }
+    }
+    
+    WorkerGroup(const WorkerGroup &) = delete;
+    WorkerGroup &operator=(const WorkerGroup &) = delete;
+    
+    ~WorkerGroup() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+    
+    size_t size() const {
+        return threads.size() + 1;
+    }
+    
+    // Calls func(worker) once for every worker in [0, size()) and waits for all of them
+    template <typename Func>
+    void run(Func func) {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            job = func;
+            error = nullptr;
+            runningCount = size();
+            generation++;
+        }
+        jobReady.notify_all();
+        
+        std::exception_ptr jobError;
+        try {
+            func(size_t{0});
+        } catch (...) {
+            jobError = std::current_exception();
+        }
+        finishJob(jobError);
+        
+        std::unique_lock<std::mutex> lock(m);
+        jobDone.wait(lock, [&]() {
+            return runningCount == 0;
+        });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+#endif /* worker_group_hpp */
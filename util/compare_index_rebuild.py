@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Times rebuilding the address and hash indexes of a parsed chain with and without --bulk-index and checks that both
+modes build the same indexes.
+
+The data directory is copied once per mode so both start from the same state. In each copy the address index is
+deleted and both index states are reset to the start of the chain, so the address index is built from scratch and
+every transaction hash is written again. Both copies are then read back with RocksDB's ldb tool, and every key and
+value of every column family of the bulk built indexes is compared with the incremental ones. The copies need
+twice as much free space as the data directory itself.
+
+The timings, the differences found and the machine they were measured on are written to the report.
+
+    python3 util/compare_index_rebuild.py build/src/parser/blocksci_parser ~/blocksci-data /scratch --report rebuild.txt
+
+The process exits with a non-zero status if the indexes differ.
+"""
+
+import argparse
+import datetime
+import itertools
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import time
+
+INDEXES = ('addressesDb', 'hashIndex')
+COMMANDS = ('address-index-update', 'hash-index-update')
+
+
+def prepare_copy(data_dir, work_dir, name):
+    copy = os.path.join(work_dir, name)
+    if os.path.exists(copy):
+        shutil.rmtree(copy)
+    shutil.copytree(data_dir, copy, symlinks=True)
+    shutil.rmtree(os.path.join(copy, 'addressesDb'), ignore_errors=True)
+    for state_file in ('addressDB.txt', 'hashIndex.txt'):
+        path = os.path.join(copy, 'parser', state_file)
+        if os.path.exists(path):
+            os.remove(path)
+    return copy
+
+
+def run_rebuild(parser, data_dir, extra_args):
+    timings = {}
+    for command in COMMANDS:
+        start = time.monotonic()
+        subprocess.run([parser, '-o', data_dir, command] + extra_args, check=True)
+        timings[command] = time.monotonic() - start
+    return timings
+
+
+def column_families(ldb, db):
+    output = subprocess.run([ldb, '--db=' + db, 'list_column_families'], stdout=subprocess.PIPE, check=True, universal_newlines=True).stdout
+    # Printed as "Column families in <db>:" followed by "{default, name, ...}"
+    return [name.strip() for name in output[output.index('{') + 1:output.rindex('}')].split(',')]
+
+
+def compare_column_family(ldb, expected_db, actual_db, family, max_differences):
+    """Streams both copies of a column family in key order and returns the number of entries compared and the
+    first differences found"""
+    commands = [[ldb, '--db=' + db, '--column_family=' + family, 'scan', '--hex'] for db in (expected_db, actual_db)]
+    expected = subprocess.Popen(commands[0], stdout=subprocess.PIPE, universal_newlines=True)
+    actual = subprocess.Popen(commands[1], stdout=subprocess.PIPE, universal_newlines=True)
+    count = 0
+    differences = []
+    with expected, actual:
+        for expected_line, actual_line in itertools.zip_longest(expected.stdout, actual.stdout):
+            if expected_line != actual_line:
+                differences.append((expected_line, actual_line))
+                if len(differences) >= max_differences:
+                    expected.kill()
+                    actual.kill()
+                    break
+            count += 1
+    if len(differences) < max_differences:
+        for process, command in ((expected, commands[0]), (actual, commands[1])):
+            if process.returncode != 0:
+                raise subprocess.CalledProcessError(process.returncode, command)
+    return count, differences
+
+
+def compare_indexes(ldb, expected_dir, actual_dir, max_differences):
+    """Returns the entry count and differences of every column family of both indexes"""
+    results = []
+    for index in INDEXES:
+        expected_db = os.path.join(expected_dir, index)
+        actual_db = os.path.join(actual_dir, index)
+        expected_families = column_families(ldb, expected_db)
+        actual_families = column_families(ldb, actual_db)
+        if sorted(expected_families) != sorted(actual_families):
+            results.append((index, '*', 0, [('column families {}\n'.format(expected_families), 'column families {}\n'.format(actual_families))]))
+            continue
+        for family in expected_families:
+            count, differences = compare_column_family(ldb, expected_db, actual_db, family, max_differences)
+            results.append((index, family, count, differences))
+    return results
+
+
+def describe_machine():
+    lines = ['{} {}, {} cores'.format(platform.system(), platform.release(), os.cpu_count())]
+    for path, key in (('/proc/cpuinfo', 'model name'), ('/proc/meminfo', 'MemTotal')):
+        try:
+            with open(path) as f:
+                for line in f:
+                    if line.startswith(key):
+                        lines.append(' '.join(line.split()))
+                        break
+        except IOError:
+            pass
+    return lines
+
+
+def source_commit():
+    try:
+        return subprocess.run(['git', '-C', os.path.dirname(os.path.abspath(__file__)), 'rev-parse', 'HEAD'], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, check=True, universal_newlines=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return 'unknown'
+
+
+def write_report(path, results, comparison):
+    lines = [
+        'Index rebuild comparison, {}'.format(datetime.datetime.now().isoformat(timespec='seconds')),
+        'Command: {}'.format(' '.join(sys.argv)),
+        'Source commit of this script: {}'.format(source_commit()),
+        'Machine: {}'.format('; '.join(describe_machine())),
+        '',
+        '{:<22} {:>12} {:>12} {:>8}'.format('index', 'incremental', 'bulk', 'speedup'),
+    ]
+    for command in COMMANDS:
+        incremental = results['incremental'][command]
+        bulk = results['bulk'][command]
+        lines.append('{:<22} {:>11.1f}s {:>11.1f}s {:>7.2f}x'.format(command, incremental, bulk, incremental / bulk))
+    lines.append('')
+    lines.append('{:<12} {:<24} {:>14} {:>12}'.format('index', 'column family', 'entries', 'differences'))
+    for index, family, count, differences in comparison:
+        lines.append('{:<12} {:<24} {:>14} {:>12}'.format(index, family, count, len(differences)))
+    for index, family, _, differences in comparison:
+        for expected, actual in differences:
+            lines.append('{}/{}: incremental {} bulk {}'.format(index, family, (expected or 'missing').strip(), (actual or 'missing').strip()))
+    report = '\n'.join(lines) + '\n'
+    with open(path, 'w') as f:
+        f.write(report)
+    print(report, end='')
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    arg_parser.add_argument('parser', help='blocksci_parser binary')
+    arg_parser.add_argument('data_dir', help='BlockSci data directory of a parsed chain, left untouched')
+    arg_parser.add_argument('work_dir', help='directory the copies are made in')
+    arg_parser.add_argument('--report', default='index_rebuild_report.txt', help='file the report is written to (default index_rebuild_report.txt)')
+    arg_parser.add_argument('--ldb', default='ldb', help='RocksDB ldb tool built against the same RocksDB version (default ldb)')
+    arg_parser.add_argument('--max-differences', type=int, default=20, help='differences reported per column family before it is skipped (default 20)')
+    arg_parser.add_argument('--keep', action='store_true', help='keep the copies afterwards')
+    args = arg_parser.parse_args()
+
+    results = {}
+    copies = {}
+    try:
+        for name, extra_args in (('incremental', []), ('bulk', ['--bulk-index'])):
+            copies[name] = prepare_copy(args.data_dir, args.work_dir, name)
+            results[name] = run_rebuild(args.parser, copies[name], extra_args)
+        comparison = compare_indexes(args.ldb, copies['incremental'], copies['bulk'], args.max_differences)
+    finally:
+        if not args.keep:
+            for copy in copies.values():
+                shutil.rmtree(copy, ignore_errors=True)
+
+    write_report(args.report, results, comparison)
+    if any(differences for _, _, _, differences in comparison):
+        print('FAILED: the bulk built indexes differ from the incremental ones')
+        sys.exit(1)
+    print('The bulk built indexes match the incremental ones')
+
+
+if __name__ == '__main__':
+    main()
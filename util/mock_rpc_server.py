@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+"""Minimal bitcoind JSON-RPC stand-in for testing the RPC parser without a node.
+
+Blocks are read from a directory holding one file per block named <height>.hex, containing the output of
+`bitcoin-cli getblock <hash> 0`. Only the calls the parser makes are implemented, answering them the way bitcoind
+does: getblockcount, getblockhash, getbestblockhash, getblockheader and getblock, as well as getrawtransaction,
+which older parsers called for every transaction. Credentials are accepted but not checked. --delay-ms adds a fixed latency to every request to stand in for a remote node.
+
+    python3 util/mock_rpc_server.py blocks/ --port 9998
+    blocksci_parser -o data update rpc --username user --password pass --port 9998
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import struct
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def double_sha256(data):
+    return hashlib.sha256(hashlib.sha256(data).digest()).digest()
+
+
+def read_varint(data, pos):
+    first = data[pos]
+    if first < 0xfd:
+        return first, pos + 1
+    size = {0xfd: 2, 0xfe: 4, 0xff: 8}[first]
+    return int.from_bytes(data[pos + 1:pos + 1 + size], 'little'), pos + 1 + size
+
+
+def decode_transaction(data, pos):
+    """Decodes the transaction at pos into the fields of a verbose getrawtransaction and returns them together with
+    the position after it. Scripts are only given in hex."""
+    start = pos
+    version, = struct.unpack_from('<i', data, pos)
+    pos += 4
+    segwit = data[pos] == 0 and data[pos + 1] != 0
+    if segwit:
+        pos += 2
+    inputs_start = pos
+    input_count, pos = read_varint(data, pos)
+    vin = []
+    for _ in range(input_count):
+        prev_hash = data[pos:pos + 32]
+        prev_index, = struct.unpack_from('<I', data, pos + 32)
+        script_length, pos = read_varint(data, pos + 36)
+        script = data[pos:pos + script_length].hex()
+        pos += script_length
+        sequence, = struct.unpack_from('<I', data, pos)
+        pos += 4
+        if prev_hash == b'\x00' * 32 and prev_index == 0xffffffff:
+            vin.append({'coinbase': script, 'sequence': sequence})
+        else:
+            vin.append({'txid': prev_hash[::-1].hex(), 'vout': prev_index, 'scriptSig': {'asm': '', 'hex': script}, 'sequence': sequence})
+    output_count, pos = read_varint(data, pos)
+    vout = []
+    for n in range(output_count):
+        value, = struct.unpack_from('<q', data, pos)
+        script_length, pos = read_varint(data, pos + 8)
+        vout.append({'value': value / 10 ** 8, 'n': n, 'scriptPubKey': {'asm': '', 'hex': data[pos:pos + script_length].hex()}})
+        pos += script_length
+    outputs_end = pos
+    if segwit:
+        for tx_input in vin:
+            item_count, pos = read_varint(data, pos)
+            witness = []
+            for _ in range(item_count):
+                item_length, pos = read_varint(data, pos)
+                witness.append(data[pos:pos + item_length].hex())
+                pos += item_length
+            tx_input['txinwitness'] = witness
+    locktime, = struct.unpack_from('<I', data, pos)
+    pos += 4
+    # The txid leaves out the witness data, the hash doesn't
+    stripped = data[start:start + 4] + data[inputs_start:outputs_end] + data[pos - 4:pos]
+    return {
+        'txid': double_sha256(stripped)[::-1].hex(),
+        'hash': double_sha256(data[start:pos])[::-1].hex(),
+        'version': version,
+        'size': pos - start,
+        'locktime': locktime,
+        'vin': vin,
+        'vout': vout,
+        'hex': data[start:pos].hex(),
+    }, pos
+
+
+def transaction_offsets(block):
+    """Returns the txid and offset of every transaction in a serialized block"""
+    count, pos = read_varint(block, 80)
+    transactions = []
+    for _ in range(count):
+        tx, end = decode_transaction(block, pos)
+        transactions.append((tx['txid'], pos))
+        pos = end
+    return transactions
+
+
+def parse_txids(block):
+    return [txid for txid, _ in transaction_offsets(block)]
+
+
+class BlockStore:
+    def __init__(self, blocks=()):
+        self.blocks = []
+        self.hashes = []
+        self.heights = {}
+        # Height and offset of every transaction, for getrawtransaction
+        self.transactions = {}
+        # Blocks may be appended while requests are served
+        self.lock = threading.Lock()
+        for block in blocks:
+            self.append(block)
+
+    @classmethod
+    def from_directory(cls, directory):
+        heights = sorted(int(name[:-4]) for name in os.listdir(directory) if name.endswith('.hex'))
+        if heights != list(range(len(heights))):
+            raise ValueError('Block files must be numbered from 0 without gaps')
+        blocks = []
+        for height in heights:
+            with open(os.path.join(directory, '{}.hex'.format(height))) as f:
+                blocks.append(f.read().strip())
+        return cls(blocks)
+
+    def append(self, block):
+        """Adds a raw block in hex on top of the chain"""
+        block_hash = double_sha256(bytes.fromhex(block[:160]))[::-1].hex()
+        offsets = transaction_offsets(bytes.fromhex(block))
+        with self.lock:
+            for txid, offset in offsets:
+                self.transactions[txid] = (len(self.blocks), offset)
+            self.heights[block_hash] = len(self.blocks)
+            self.hashes.append(block_hash)
+            self.blocks.append(block)
+
+    def verbose_header(self, height):
+        raw = bytes.fromhex(self.blocks[height])
+        version, = struct.unpack('<i', raw[0:4])
+        timestamp, bits, nonce = struct.unpack('<III', raw[68:80])
+        info = {
+            'hash': self.hashes[height],
+            'confirmations': len(self.blocks) - height,
+            'height': height,
+            'version': version,
+            'merkleroot': raw[36:68][::-1].hex(),
+            'time': timestamp,
+            'nonce': nonce,
+            'bits': '{:08x}'.format(bits),
+            'difficulty': 0,
+            'chainwork': '',
+            'nTx': read_varint(raw, 80)[0],
+        }
+        # Like bitcoind, the genesis block has no previousblockhash and the tip no nextblockhash
+        if height > 0:
+            info['previousblockhash'] = self.hashes[height - 1]
+        if height + 1 < len(self.blocks):
+            info['nextblockhash'] = self.hashes[height + 1]
+        return info
+
+    def verbose_block(self, height):
+        raw = bytes.fromhex(self.blocks[height])
+        info = self.verbose_header(height)
+        info['size'] = len(raw)
+        info['tx'] = parse_txids(raw)
+        return info
+
+    def verbose_transaction(self, txid):
+        height, offset = self.transactions[txid]
+        raw = bytes.fromhex(self.blocks[height])
+        info, _ = decode_transaction(raw, offset)
+        timestamp, = struct.unpack('<I', raw[68:72])
+        info.update({'blockhash': self.hashes[height], 'confirmations': len(self.blocks) - height, 'time': timestamp, 'blocktime': timestamp})
+        return info
+
+    def call(self, method, params):
+        with self.lock:
+            return self.answer(method, params)
+
+    def answer(self, method, params):
+        if method == 'getblockcount':
+            # Height of the tip, not the number of blocks
+            return len(self.blocks) - 1
+        if method == 'getbestblockhash':
+            return self.hashes[-1]
+        if method == 'getblockhash':
+            return self.hashes[params[0]]
+        if method == 'getblockheader':
+            height = self.heights[params[0]]
+            verbose = params[1] if len(params) > 1 else True
+            if verbose:
+                return self.verbose_header(height)
+            return self.blocks[height][:160]
+        if method == 'getblock':
+            height = self.heights[params[0]]
+            verbose = params[1] if len(params) > 1 else True
+            if verbose:
+                return self.verbose_block(height)
+            return self.blocks[height]
+        if method == 'getrawtransaction':
+            info = self.verbose_transaction(params[0])
+            return info if len(params) > 1 and params[1] else info['hex']
+        raise KeyError(method)
+
+
+def make_handler(store, delay=0):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = 'HTTP/1.1'
+
+        def respond(self, request):
+            try:
+                return {'result': store.call(request['method'], request.get('params', [])), 'error': None, 'id': request.get('id')}
+            except (KeyError, IndexError) as e:
+                return {'result': None, 'error': {'code': -5, 'message': 'Not found: {}'.format(e)}, 'id': request.get('id')}
+
+        def do_POST(self):
+            request = json.loads(self.rfile.read(int(self.headers['Content-Length'])))
+            if delay:
+                time.sleep(delay)
+            if isinstance(request, list):
+                response = [self.respond(item) for item in request]
+            else:
+                response = self.respond(request)
+            body = json.dumps(response).encode()
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def log_message(self, format, *args):
+            pass
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('directory', help='Directory of <height>.hex raw blocks')
+    parser.add_argument('--address', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=9998)
+    parser.add_argument('--delay-ms', type=float, default=0, help='latency added to every request')
+    args = parser.parse_args()
+
+    store = BlockStore.from_directory(args.directory)
+    server = ThreadingHTTPServer((args.address, args.port), make_handler(store, args.delay_ms / 1000))
+    print('Serving {} blocks on {}:{}'.format(len(store.blocks), args.address, args.port))
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""Measures how long blocksci_parser tail takes to make new blocks queryable.
+
+Given a log, reads the output of tail and reports how long adding each batch of blocks took, split into parsing,
+updating the indexes and committing the parser checkpoint, how long the checkpoints took and how many batches
+finished within the target.
+
+    blocksci_parser -o ~/blocksci-data tail disk -c ~/.bitcoin | tee tail.log
+    python3 util/tail_latency.py tail.log --target-ms 1000
+
+Given --parser, it instead runs tail against util/mock_rpc_server.py on a synthetic chain. Once tail has caught
+up, a block is added to the node every --interval-ms. The time from adding a block until tail reports it indexed
+is its latency, which includes waiting for the next poll. The batch timings of that run are reported as well.
+
+    python3 util/tail_latency.py --parser build/src/parser/blocksci_parser --new-blocks 100 --checkpoint-seconds 60
+"""
+
+import argparse
+import os
+import queue
+import re
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from mock_rpc_server import BlockStore  # noqa: E402
+from test_rpc_parser import ChainGenerator, start_node  # noqa: E402
+
+BATCH_LINE = re.compile(r'Added (\d+) blocks in ([\d.e+-]+)ms \(parse ([\d.e+-]+)ms, commit ([\d.e+-]+)ms, index ([\d.e+-]+)ms\)')
+CHECKPOINT_LINE = re.compile(r'Saved checkpoint in ([\d.e+-]+)ms')
+READY_LINE = 'Following the chain from'
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def print_percentiles(name, values):
+    print('{:<12} {:>10.1f} {:>10.1f} {:>10.1f}'.format(name, percentile(values, 0.5), percentile(values, 0.95), max(values)))
+
+
+def summarize(lines, target_ms):
+    timings = {'total': [], 'parse': [], 'index': [], 'commit': []}
+    checkpoints = []
+    for line in lines:
+        match = BATCH_LINE.search(line)
+        # Polls which found headers but no new blocks to add aren't batches
+        if match and int(match.group(1)) > 0:
+            total, parse, commit, index = (float(value) for value in match.groups()[1:])
+            for name, value in (('total', total), ('parse', parse), ('index', index), ('commit', commit)):
+                timings[name].append(value)
+        if match and float(match.group(4)) > 0:
+            checkpoints.append(float(match.group(4)))
+        match = CHECKPOINT_LINE.search(line)
+        if match:
+            checkpoints.append(float(match.group(1)))
+
+    batches = len(timings['total'])
+    if batches == 0:
+        print('No batches of blocks found')
+        return
+
+    print('{} batches, {} checkpoints'.format(batches, len(checkpoints)))
+    print('{:<12} {:>10} {:>10} {:>10}'.format('step', 'p50 ms', 'p95 ms', 'max ms'))
+    for name, values in timings.items():
+        print_percentiles(name, values)
+    if checkpoints:
+        print_percentiles('checkpoint', checkpoints)
+    within_target = sum(1 for value in timings['total'] if value <= target_ms)
+    print('{} of {} batches within {:.0f}ms'.format(within_target, batches, target_ms))
+
+
+def follow_output(process, lines, events):
+    for line in process.stdout:
+        now = time.monotonic()
+        lines.append(line)
+        match = BATCH_LINE.search(line)
+        if match and int(match.group(1)) > 0:
+            events.put(('batch', now, int(match.group(1))))
+        elif line.startswith(READY_LINE):
+            events.put(('ready', now, 0))
+    events.put(None)
+
+
+def next_event(events, timeout, lines):
+    try:
+        event = events.get(timeout=timeout)
+    except queue.Empty:
+        raise AssertionError('tail reported nothing for {}s'.format(timeout))
+    if event is None:
+        raise AssertionError('tail exited:\n{}'.format(''.join(lines[-20:])))
+    return event
+
+
+def measure(args):
+    """Returns the latency of every new block in ms and the output of tail"""
+    generator = ChainGenerator(args.txes_per_block)
+    store = BlockStore(generator.next_block()[0] for _ in range(args.blocks))
+    server = start_node(store, args.delay_ms / 1000)
+    data_dir = tempfile.mkdtemp(prefix='blocksci_tail_latency_')
+    command = [args.parser, '-o', data_dir, 'tail', '--poll-ms', str(args.poll_ms), '--checkpoint-seconds', str(args.checkpoint_seconds),
+               'rpc', '--username', 'user', '--password', 'pass', '--port', str(server.server_address[1])]
+    process = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    lines = []
+    events = queue.Queue()
+    threading.Thread(target=follow_output, args=(process, lines, events), daemon=True).start()
+    latencies = []
+    try:
+        while next_event(events, args.timeout, lines)[0] != 'ready':
+            pass
+        for _ in range(args.new_blocks):
+            appended = time.monotonic()
+            store.append(generator.next_block()[0])
+            _, indexed, _ = next_event(events, args.timeout, lines)
+            latencies.append((indexed - appended) * 1000)
+            time.sleep(max(0, args.interval_ms / 1000 - (time.monotonic() - appended)))
+    finally:
+        process.send_signal(signal.SIGINT)
+        try:
+            process.wait(timeout=args.timeout)
+        except subprocess.TimeoutExpired:
+            process.kill()
+        server.shutdown()
+        server.server_close()
+        shutil.rmtree(data_dir, ignore_errors=True)
+    return latencies, lines
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    arg_parser.add_argument('log', nargs='?', help='output of tail, read from stdin if neither this nor --parser is given')
+    arg_parser.add_argument('--target-ms', type=float, default=1000, help='latency target per batch (default 1000)')
+    arg_parser.add_argument('--parser', help='blocksci_parser binary to run tail with against the mock node')
+    arg_parser.add_argument('--blocks', type=int, default=200, help='blocks in the chain before tail starts (default 200)')
+    arg_parser.add_argument('--new-blocks', type=int, default=50, help='blocks added once tail is following (default 50)')
+    arg_parser.add_argument('--txes-per-block', type=int, default=20, help='transactions per block (default 20)')
+    arg_parser.add_argument('--interval-ms', type=float, default=1000, help='time between new blocks (default 1000)')
+    arg_parser.add_argument('--delay-ms', type=float, default=1, help='latency the mock node adds to every request (default 1)')
+    arg_parser.add_argument('--poll-ms', type=int, default=200, help='poll interval passed to tail (default 200)')
+    arg_parser.add_argument('--checkpoint-seconds', type=int, default=60, help='checkpoint interval passed to tail (default 60)')
+    arg_parser.add_argument('--timeout', type=float, default=600, help='seconds to wait for tail to catch up or add a block (default 600)')
+    args = arg_parser.parse_args()
+
+    if args.parser:
+        try:
+            latencies, lines = measure(args)
+        except AssertionError as e:
+            print('FAILED: {}'.format(e))
+            sys.exit(1)
+        print('{} new blocks'.format(len(latencies)))
+        print('{:<12} {:>10} {:>10} {:>10}'.format('', 'p50 ms', 'p95 ms', 'max ms'))
+        print_percentiles('queryable', latencies)
+        within_target = sum(1 for value in latencies if value <= args.target_ms)
+        print('{} of {} blocks queryable within {:.0f}ms'.format(within_target, len(latencies), args.target_ms))
+        print()
+        summarize(lines, args.target_ms)
+        return
+
+    log = open(args.log) if args.log else sys.stdin
+    with log:
+        summarize(log, args.target_ms)
+
+
+if __name__ == '__main__':
+    main()
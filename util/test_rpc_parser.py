@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+"""Checks the RPC parser against util/mock_rpc_server.py and measures how fast it ingests blocks.
+
+A synthetic chain is generated in which every block has a coinbase and spends the outputs of earlier blocks. It
+is served by the mock node, and blocksci_parser core-update rpc parses it into a fresh data directory once for
+every connection count given. Each run checks that every block up to the tip was parsed with the node's hash and
+height. It then checks that an update with no new blocks changes nothing and that blocks added to the node's
+tip are picked up. The time of the first update is reported as the throughput.
+
+--baseline-parser times the first update of another build on the same chain, such as one from before blocks
+were fetched whole, which asks the node for every transaction on its own. Its output is not checked, and since
+older parsers stopped one block short of the tip, its throughput counts the blocks it actually parsed.
+
+    python3 util/test_rpc_parser.py build/src/parser/blocksci_parser --blocks 2000 --connections 1 4 8 --delay-ms 2
+    python3 util/test_rpc_parser.py build/src/parser/blocksci_parser --baseline-parser old/src/parser/blocksci_parser
+
+The process exits with a non-zero status if any check fails.
+"""
+
+import argparse
+import hashlib
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from http.server import ThreadingHTTPServer
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from mock_rpc_server import BlockStore, double_sha256, make_handler  # noqa: E402
+
+RAW_BLOCK_SIZE = 80
+RAW_BLOCK_HEIGHT_OFFSET = 8
+RAW_BLOCK_HASH_OFFSET = 12
+
+
+def varint(value):
+    if value < 0xfd:
+        return bytes([value])
+    if value <= 0xffff:
+        return b'\xfd' + struct.pack('<H', value)
+    return b'\xfe' + struct.pack('<I', value)
+
+
+def p2pkh_script(key_num):
+    return b'\x76\xa9\x14' + hashlib.new('ripemd160', hashlib.sha256(struct.pack('<I', key_num)).digest()).digest() + b'\x88\xac'
+
+
+def serialize_tx(inputs, outputs):
+    tx = struct.pack('<i', 1) + varint(len(inputs))
+    for prev_hash, prev_index, script_sig in inputs:
+        tx += prev_hash + struct.pack('<I', prev_index) + varint(len(script_sig)) + script_sig + struct.pack('<I', 0xffffffff)
+    tx += varint(len(outputs))
+    for value, script in outputs:
+        tx += struct.pack('<q', value) + varint(len(script)) + script
+    return tx + struct.pack('<I', 0)
+
+
+def merkle_root(txids):
+    level = list(txids)
+    while len(level) > 1:
+        if len(level) % 2:
+            level.append(level[-1])
+        level = [double_sha256(level[i] + level[i + 1]) for i in range(0, len(level), 2)]
+    return level[0]
+
+
+class ChainGenerator:
+    """Builds blocks whose transactions spend the outputs of earlier blocks"""
+
+    def __init__(self, txes_per_block):
+        self.txes_per_block = txes_per_block
+        self.prev_hash = b'\x00' * 32
+        self.height = 0
+        self.unspent = []
+        self.key_num = 0
+
+    def next_output(self, value):
+        self.key_num += 1
+        return value, p2pkh_script(self.key_num)
+
+    def next_block(self):
+        """Returns the next block in hex and the number of transactions in it"""
+        coinbase_script_sig = b'\x03' + struct.pack('<I', self.height)[:3]
+        txes = [([(b'\x00' * 32, 0xffffffff, coinbase_script_sig)], [self.next_output(50 * 10 ** 8)])]
+        for _ in range(self.txes_per_block - 1):
+            if not self.unspent:
+                break
+            prev_hash, prev_index, value = self.unspent.pop(0)
+            txes.append(([(prev_hash, prev_index, b'\x51')], [self.next_output(value // 2), self.next_output(value - value // 2)]))
+
+        serialized = [serialize_tx(inputs, outputs) for inputs, outputs in txes]
+        txids = [double_sha256(tx) for tx in serialized]
+        for txid, (_, outputs) in zip(txids, txes):
+            self.unspent.extend((txid, index, value) for index, (value, _) in enumerate(outputs))
+
+        header = struct.pack('<i', 1) + self.prev_hash + merkle_root(txids) + struct.pack('<III', 1231006505 + self.height * 600, 0x207fffff, self.height)
+        self.prev_hash = double_sha256(header)
+        self.height += 1
+        return (header + varint(len(serialized)) + b''.join(serialized)).hex(), len(serialized)
+
+
+def start_node(store, delay):
+    server = ThreadingHTTPServer(('127.0.0.1', 0), make_handler(store, delay))
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def run_update(parser, data_dir, port, connections=None):
+    command = [parser, '-o', data_dir, 'core-update']
+    if connections is not None:
+        command += ['--rpc-connections', str(connections)]
+    command += ['rpc', '--username', 'user', '--password', 'pass', '--port', str(port)]
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    if result.returncode != 0:
+        raise AssertionError('{} failed:\n{}'.format(' '.join(command), result.stdout))
+    return result.stdout
+
+
+def check_blocks(data_dir, store):
+    with open(os.path.join(data_dir, 'chain', 'block.dat'), 'rb') as f:
+        data = f.read()
+    if len(data) != RAW_BLOCK_SIZE * len(store.blocks):
+        raise AssertionError('Parsed {} blocks but the node has {}'.format(len(data) // RAW_BLOCK_SIZE, len(store.blocks)))
+    for height, block_hash in enumerate(store.hashes):
+        record = data[height * RAW_BLOCK_SIZE:(height + 1) * RAW_BLOCK_SIZE]
+        parsed_height, = struct.unpack('<I', record[RAW_BLOCK_HEIGHT_OFFSET:RAW_BLOCK_HEIGHT_OFFSET + 4])
+        parsed_hash = record[RAW_BLOCK_HASH_OFFSET:RAW_BLOCK_HASH_OFFSET + 32][::-1].hex()
+        if parsed_height != height or parsed_hash != block_hash:
+            raise AssertionError('Block {} was parsed as {} at height {}'.format(block_hash, parsed_hash, parsed_height))
+
+
+def parsed_block_count(data_dir):
+    path = os.path.join(data_dir, 'chain', 'block.dat')
+    return os.path.getsize(path) // RAW_BLOCK_SIZE if os.path.exists(path) else 0
+
+
+def time_baseline(parser, work_dir, blocks, delay):
+    """Returns how long the first update of parser took and how many blocks it parsed"""
+    store = BlockStore(blocks)
+    server = start_node(store, delay)
+    data_dir = os.path.join(work_dir, 'data_baseline')
+    try:
+        start = time.monotonic()
+        run_update(parser, data_dir, server.server_address[1])
+        elapsed = time.monotonic() - start
+        parsed = parsed_block_count(data_dir)
+        if parsed == 0:
+            raise AssertionError('The baseline parser parsed no blocks')
+        return elapsed, parsed
+    finally:
+        server.shutdown()
+        server.server_close()
+        shutil.rmtree(data_dir, ignore_errors=True)
+
+
+def test_connections(parser, work_dir, blocks, extra_blocks, delay, connections):
+    store = BlockStore(blocks)
+    server = start_node(store, delay)
+    port = server.server_address[1]
+    data_dir = os.path.join(work_dir, 'data_{}'.format(connections))
+    try:
+        start = time.monotonic()
+        run_update(parser, data_dir, port, connections)
+        elapsed = time.monotonic() - start
+        check_blocks(data_dir, store)
+
+        with open(os.path.join(data_dir, 'chain', 'block.dat'), 'rb') as f:
+            before = f.read()
+        run_update(parser, data_dir, port, connections)
+        with open(os.path.join(data_dir, 'chain', 'block.dat'), 'rb') as f:
+            if f.read() != before:
+                raise AssertionError('An update without new blocks changed the parsed chain')
+
+        for block in extra_blocks:
+            store.append(block)
+        run_update(parser, data_dir, port, connections)
+        check_blocks(data_dir, store)
+        return elapsed
+    finally:
+        server.shutdown()
+        server.server_close()
+        shutil.rmtree(data_dir, ignore_errors=True)
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    arg_parser.add_argument('parser', help='blocksci_parser binary built with the RPC parser')
+    arg_parser.add_argument('--blocks', type=int, default=500, help='blocks in the generated chain (default 500)')
+    arg_parser.add_argument('--txes-per-block', type=int, default=20, help='transactions per block (default 20)')
+    arg_parser.add_argument('--connections', type=int, nargs='+', default=[1, 4], help='RPC connection counts to run with (default 1 4)')
+    arg_parser.add_argument('--delay-ms', type=float, default=1, help='latency the mock node adds to every request (default 1)')
+    arg_parser.add_argument('--baseline-parser', help='another blocksci_parser build to time on the same chain')
+    args = arg_parser.parse_args()
+
+    generator = ChainGenerator(args.txes_per_block)
+    blocks, tx_counts = zip(*(generator.next_block() for _ in range(args.blocks)))
+    extra_blocks = [generator.next_block()[0] for _ in range(3)]
+    tx_count = sum(tx_counts)
+
+    work_dir = tempfile.mkdtemp(prefix='blocksci_rpc_test_')
+    try:
+        print('{:>12} {:>10} {:>10} {:>10}'.format('connections', 'seconds', 'blocks/s', 'txes/s'))
+        if args.baseline_parser:
+            elapsed, parsed = time_baseline(args.baseline_parser, work_dir, blocks, args.delay_ms / 1000)
+            parsed_txes = sum(tx_counts[:parsed])
+            print('{:>12} {:>10.2f} {:>10.0f} {:>10.0f}'.format('baseline', elapsed, parsed / elapsed, parsed_txes / elapsed))
+        for connections in args.connections:
+            elapsed = test_connections(args.parser, work_dir, blocks, extra_blocks, args.delay_ms / 1000, connections)
+            print('{:>12} {:>10.2f} {:>10.0f} {:>10.0f}'.format(connections, elapsed, len(blocks) / elapsed, tx_count / elapsed))
+    except AssertionError as e:
+        print('FAILED: {}'.format(e))
+        sys.exit(1)
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+    print('All checks passed')
+
+
+if __name__ == '__main__':
+    main()